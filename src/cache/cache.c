@@ -45,6 +45,7 @@ struct cache_config {
 
 struct tb {
     uint16_t size;
+    uint16_t code_size;
     uint64_t guest_pc;
     struct tb *next_in_hash_list;
 } __attribute__ ((packed));
@@ -66,7 +67,7 @@ struct entry_header {
 } __attribute__ ((packed));
 
 static void *lookup(struct cache *cache, uint64_t pc, int *cache_clean_event);
-static void *append(struct cache *cache, uint64_t pc, void *data, int size, int *cache_clean_event);
+static void *append(struct cache *cache, uint64_t pc, void *data, int size, void *map, int map_size, int *cache_clean_event);
 
 struct internal_cache *root = NULL;
 static pthread_mutex_t ll_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -178,22 +179,26 @@ static void *lookup(struct cache *cache, uint64_t pc, int *cache_clean_event)
     return NULL;
 }
 
-static void *append(struct cache *cache, uint64_t pc, void *data, int size, int *cache_clean_event)
+static void *append(struct cache *cache, uint64_t pc, void *data, int size, void *map, int map_size, int *cache_clean_event)
 {
     struct internal_cache *acache = container_of(cache, struct internal_cache, cache);
     int hash = hash_pc(pc);
     struct tb *new_tb;
     void *res;
 
+    /* tb size is rounded so next jitted code is also JIT_CODE_ALIGN aligned */
+    int tb_size = (size + map_size + sizeof(struct tb) + JIT_CODE_ALIGN - 1) & ~(JIT_CODE_ALIGN - 1);
+
     /* handle jitter area full */
-    if (acache->info.write_pos + size + sizeof(struct tb) > acache->config.jitter_area_size) {
+    if (acache->info.write_pos + tb_size > acache->config.jitter_area_size) {
         reset(acache);
         *cache_clean_event = 1;
     }
 
     /* setup new translation buffer */
     new_tb = (struct tb *) &acache->area[acache->info.write_pos];
-    new_tb->size = size + sizeof(struct tb);
+    new_tb->size = tb_size;
+    new_tb->code_size = size;
     new_tb->guest_pc = pc;
      /* insert at head */
     new_tb->next_in_hash_list = acache->list[hash];
@@ -202,12 +207,13 @@ static void *append(struct cache *cache, uint64_t pc, void *data, int size, int
     /* copy jit data */
     res = tb_to_jit_area(new_tb);
     memcpy(res, data, size);
-    acache->info.write_pos += size + sizeof(struct tb);
+    memcpy(res + size, map, map_size);
+    acache->info.write_pos += new_tb->size;
 
     return res;
 }
 
-static uint64_t lookup_pc(struct cache *cache, void *host_pc, void **host_pc_start)
+static uint64_t lookup_pc(struct cache *cache, void *host_pc, void **host_pc_start, void **map)
 {
     struct internal_cache *acache = container_of(cache, struct internal_cache, cache);
     void *start_size_ptr = acache->area;
@@ -219,6 +225,7 @@ static uint64_t lookup_pc(struct cache *cache, void *host_pc, void **host_pc_sta
         if (host_pc >= start_size_ptr && host_pc < start_size_ptr + tb->size) {
             res = tb->guest_pc;
             *host_pc_start = start_size_ptr + sizeof(struct tb);
+            *map = *host_pc_start + tb->code_size;
             break;
         }
         start_size_ptr += tb->size;
@@ -240,8 +247,10 @@ struct cache *createCache(void *memory, int size, int nb_of_pc_bit_to_drop)
     acache->cache.lookup = lookup;
     acache->cache.append = append;
     acache->cache.lookup_pc = lookup_pc;
-    acache->config.jitter_area_size = size - sizeof(struct internal_cache);
-    acache->area = (char *) (memory + sizeof(struct internal_cache));
+    /* area start is chosen so first jitted code is JIT_CODE_ALIGN aligned */
+    acache->area = (char *) ((((uintptr_t) (memory + sizeof(struct internal_cache) + sizeof(struct tb)) + JIT_CODE_ALIGN - 1) &
+                              ~(uintptr_t) (JIT_CODE_ALIGN - 1)) - sizeof(struct tb));
+    acache->config.jitter_area_size = (memory + size) - (void *) acache->area;
     acache->area_end = memory + size;
     reset(acache);
 
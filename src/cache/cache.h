@@ -33,8 +33,9 @@ extern "C" {
 
 struct cache {
     void *(*lookup)(struct cache *cache, uint64_t pc, int *cache_clean_event);
-    void *(*append)(struct cache *cache, uint64_t pc, void *data, int size, int *cache_clean_event);
-    uint64_t (*lookup_pc)(struct cache *cache, void *host_pc, void **host_pc_start);
+    /* insn map is stored right after jitted code */
+    void *(*append)(struct cache *cache, uint64_t pc, void *data, int size, void *map, int map_size, int *cache_clean_event);
+    uint64_t (*lookup_pc)(struct cache *cache, void *host_pc, void **host_pc_start, void **map);
 };
 
 struct cache *createCache(void *memory, int size, int nb_of_pc_bit_to_drop);
@@ -33,6 +33,7 @@
 struct internal_cache {
     struct cache cache;
     void *data;
+    void *map;
     uint64_t pc;
 };
 
@@ -43,21 +44,23 @@ static void *lookup_none(struct cache *cache, uint64_t pc, int *cache_clean_even
     return NULL;
 }
 
-static void *append_none(struct cache *cache, uint64_t pc, void *data, int size, int *cache_clean_event)
+static void *append_none(struct cache *cache, uint64_t pc, void *data, int size, void *map, int map_size, int *cache_clean_event)
 {
     struct internal_cache *acache = container_of(cache, struct internal_cache, cache);
 
     acache->data = data;
+    acache->map = map;
     acache->pc = pc;
 
     return data;
 }
 
-static uint64_t lookup_pc_none(struct cache *cache, void *host_pc, void **host_pc_start)
+static uint64_t lookup_pc_none(struct cache *cache, void *host_pc, void **host_pc_start, void **map)
 {
     struct internal_cache *acache = container_of(cache, struct internal_cache, cache);
 
     *host_pc_start = acache->data;
+    *map = acache->map;
 
     return acache->pc;
 }
@@ -75,6 +78,7 @@ struct cache *createCacheNone(void *memory, int size)
     acache->cache.append = append_none;
     acache->cache.lookup_pc = lookup_pc_none;
     acache->data = NULL;
+    acache->map = NULL;
     acache->pc = 0;
 
     return &acache->cache;
@@ -32,6 +32,11 @@ extern "C" {
 struct backend *createBackend(void *memory, int size);
 void deleteBackend(struct backend *backend);
 
+/* backends use these to time their passes when backend stats is set. jitStatsStart also
+   clears previous statistics */
+uint64_t jitStatsStart(struct backend *backend);
+void jitStatsPassEnd(struct backend *backend, enum jitPass pass, uint64_t *time);
+
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,137 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2016 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include "host_features.h"
+
+static int isInit;
+static uint32_t features;
+
+static const char *featureNames[HOST_FEATURE_NB] = {
+    "sse2", "ssse3", "sse4.1", "sse4.2", "popcnt", "lzcnt", "bmi1", "bmi2",
+    "avx", "avx2", "aes", "pclmul", "sha", "f16c", "fma", "erms"
+};
+
+#if defined(__i386__) || defined(__x86_64__)
+/* avx state must be enabled by os for avx encoded instructions to be usable */
+static int isAvxStateEnabled(uint32_t ecx1)
+{
+    uint32_t xcr0_lo, xcr0_hi;
+
+    if (!(ecx1 & bit_OSXSAVE))
+        return 0;
+    asm volatile("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+
+    return (xcr0_lo & 6) == 6;
+}
+
+static uint32_t probeFeatures()
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t res = 0;
+    int isAvx = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return res;
+    if (edx & bit_SSE2)
+        res |= 1 << HOST_FEATURE_SSE2;
+    if (ecx & bit_SSSE3)
+        res |= 1 << HOST_FEATURE_SSSE3;
+    if (ecx & bit_SSE4_1)
+        res |= 1 << HOST_FEATURE_SSE4_1;
+    if (ecx & bit_SSE4_2)
+        res |= 1 << HOST_FEATURE_SSE4_2;
+    if (ecx & bit_POPCNT)
+        res |= 1 << HOST_FEATURE_POPCNT;
+    if (ecx & bit_AES)
+        res |= 1 << HOST_FEATURE_AES;
+    if (ecx & bit_PCLMUL)
+        res |= 1 << HOST_FEATURE_PCLMUL;
+    if ((ecx & bit_AVX) && isAvxStateEnabled(ecx)) {
+        isAvx = 1;
+        res |= 1 << HOST_FEATURE_AVX;
+        if (ecx & bit_F16C)
+            res |= 1 << HOST_FEATURE_F16C;
+        if (ecx & bit_FMA)
+            res |= 1 << HOST_FEATURE_FMA;
+    }
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & bit_BMI)
+            res |= 1 << HOST_FEATURE_BMI1;
+        if (ebx & bit_BMI2)
+            res |= 1 << HOST_FEATURE_BMI2;
+        if ((ebx & bit_AVX2) && isAvx)
+            res |= 1 << HOST_FEATURE_AVX2;
+        if (ebx & bit_SHA)
+            res |= 1 << HOST_FEATURE_SHA;
+        /* erms bit */
+        if (ebx & (1 << 9))
+            res |= 1 << HOST_FEATURE_ERMS;
+    }
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+        if (ecx & bit_LZCNT)
+            res |= 1 << HOST_FEATURE_LZCNT;
+    }
+
+    return res;
+}
+#else
+static uint32_t probeFeatures()
+{
+    return 0;
+}
+#endif
+
+/* api */
+void initHostFeatures(int isBaseline)
+{
+    if (isBaseline) {
+#if defined(__x86_64__)
+        /* sse2 is part of x86_64 baseline */
+        features = 1 << HOST_FEATURE_SSE2;
+#else
+        features = 0;
+#endif
+    } else
+        features = probeFeatures();
+    isInit = 1;
+}
+
+int hasHostFeature(enum hostFeature feature)
+{
+    assert(feature < HOST_FEATURE_NB);
+    if (!isInit)
+        initHostFeatures(0);
+
+    return (features >> feature) & 1;
+}
+
+const char *getHostFeatureName(enum hostFeature feature)
+{
+    assert(feature < HOST_FEATURE_NB);
+
+    return featureNames[feature];
+}
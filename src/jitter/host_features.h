@@ -0,0 +1,60 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2016 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __HOST_FEATURES__
+#define __HOST_FEATURES__ 1
+
+/* x86 host instruction set extensions that backends and helpers may use */
+enum hostFeature {
+    HOST_FEATURE_SSE2,
+    HOST_FEATURE_SSSE3,
+    HOST_FEATURE_SSE4_1,
+    HOST_FEATURE_SSE4_2,
+    HOST_FEATURE_POPCNT,
+    HOST_FEATURE_LZCNT,
+    HOST_FEATURE_BMI1,
+    HOST_FEATURE_BMI2,
+    HOST_FEATURE_AVX,
+    HOST_FEATURE_AVX2,
+    HOST_FEATURE_AES,
+    HOST_FEATURE_PCLMUL,
+    HOST_FEATURE_SHA,
+    HOST_FEATURE_F16C,
+    HOST_FEATURE_FMA,
+    HOST_FEATURE_ERMS,
+    HOST_FEATURE_NB
+};
+
+/* probe host using cpuid. When isBaseline is set only features guaranteed by the host
+   architecture are reported, so generated code doesn't depend on host cpu. */
+void initHostFeatures(int isBaseline);
+/* features are probed on first call if initHostFeatures has not been called */
+int hasHostFeature(enum hostFeature feature);
+const char *getHostFeatureName(enum hostFeature feature);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -27,6 +27,7 @@
 #include <ucontext.h>
 #include "be.h"
 #include "be_i386_private.h"
+#include "host_features.h"
 
 //#define DEBUG_REG_ALLOC     1
 
@@ -34,12 +35,17 @@
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
     (type *)( (char *)__mptr - offsetof(type,member) );})
 
-#define REG_NUMBER  16
+/* virtual registers are 32 bits stack slots. REG_NUMBER slots are close to ebp and
+   reachable with a disp8, SPILL_NUMBER more slots are allocated below them when the
+   block runs out of those. */
+#define REG_NUMBER      16
+#define SPILL_NUMBER    48
+#define SLOT_NUMBER     (REG_NUMBER + SPILL_NUMBER)
 
 /* can be a 32 or 64 bits register. If it's a 64 bits register
-  then it will use two i386 registers to hold this 64 bit value.
-  In that case index2 will hold register index else it will hold
-  -1 if not use */
+  then it will use a pair of adjacent slots to hold this 64 bit value,
+  index for lower part and index2 for upper part, so value can be
+  accessed as a whole in memory. index2 will hold -1 if not use */
 struct x86Register {
     int isConstant;
     int index;
@@ -59,7 +65,10 @@ enum x86BinopType {
     X86_BINOP_ASR,
     X86_BINOP_ROR,
     X86_BINOP_CMPEQ,
-    X86_BINOP_CMPNE
+    X86_BINOP_CMPNE,
+    X86_BINOP_CRC32C,
+    X86_BINOP_FCMP,
+    X86_BINOP_FCMPE
 };
 
 enum x86InstructionType {
@@ -73,6 +82,9 @@ enum x86InstructionType {
     X86_CALL,
     X86_READ_8, X86_READ_16, X86_READ_32, X86_READ_64,
     X86_WRITE_8, X86_WRITE_16, X86_WRITE_32, X86_WRITE_64,
+    X86_CMPXCHG_8, X86_CMPXCHG_16, X86_CMPXCHG_32, X86_CMPXCHG_64,
+    X86_XCHG_8, X86_XCHG_16, X86_XCHG_32, X86_XCHG_64,
+    X86_FETCH_ADD_8, X86_FETCH_ADD_16, X86_FETCH_ADD_32, X86_FETCH_ADD_64,
     X86_INSN_MARKER
 };
 
@@ -128,7 +140,14 @@ struct x86Instruction {
         } write_context;
         struct {
             uint32_t value;
+            uint32_t host_offset;
         } marker;
+        struct {
+            struct x86Register *dst;
+            struct x86Register *address;
+            struct x86Register *op1;
+            struct x86Register *op2;
+        } atomic;
     } u;
 };
 
@@ -148,6 +167,9 @@ struct inter {
     struct memoryPool instructionPoolAllocator;
     int regIndex;
     int instructionIndex;
+    /* ir registers of the sequence being jitted and their x86 counterparts */
+    struct irRegister *irRegs;
+    struct x86Register *irRegisters;
 };
 
 /* pool */
@@ -178,22 +200,22 @@ static void memoryPoolInit(struct memoryPool *pool, char *buffer, int size)
 }
 
 /* register allocation */
-static struct x86Register *allocateRegister(struct inter *inter, struct irRegister *irReg)
+static struct x86Register *allocateRegister(struct inter *inter, int32_t irRegIndex)
 {
     struct x86Register *res;
     struct memoryPool *pool = (struct memoryPool *) &inter->registerPoolAllocator;
 
-    if (irReg && irReg->backend) {
-        res = irReg->backend;
-    } else {
+    if (irRegIndex == IR_NO_REG)
         res = (struct x86Register *) pool->alloc(pool, sizeof(struct x86Register));
+    else
+        res = &inter->irRegisters[irRegIndex];
+    /* ir registers entries are created on first use */
+    if (irRegIndex == IR_NO_REG || res->firstWriteIndex == -1) {
         res->isConstant = 0;
         res->index = inter->regIndex++;
-        res->index2 = (irReg && irReg->type == IR_REG_64)?inter->regIndex++:-1;
+        res->index2 = (irRegIndex != IR_NO_REG && inter->irRegs[irRegIndex].type == IR_REG_64)?inter->regIndex++:-1;
         res->firstWriteIndex = inter->instructionIndex;
         res->lastReadIndex = -1;
-        if (irReg)
-            irReg->backend = res;
     }
 
     return res;
@@ -355,6 +377,25 @@ static void add_call(struct inter *inter, struct x86Register *address, struct x8
     inter->instructionIndex++;
 }
 
+static void add_atomic(struct inter *inter, enum x86InstructionType type, struct x86Register *dst, struct x86Register *address, struct x86Register *op1, struct x86Register *op2)
+{
+    struct memoryPool *pool = &inter->instructionPoolAllocator;
+    struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
+
+    address->lastReadIndex = inter->instructionIndex;
+    op1->lastReadIndex = inter->instructionIndex;
+    if (op2)
+        op2->lastReadIndex = inter->instructionIndex;
+
+    insn->type = type;
+    insn->u.atomic.dst = dst;
+    insn->u.atomic.address = address;
+    insn->u.atomic.op1 = op1;
+    insn->u.atomic.op2 = op2;
+
+    inter->instructionIndex++;
+}
+
 static void add_insn_start_marker(struct inter *inter, uint32_t value)
 {
     struct memoryPool *pool = &inter->instructionPoolAllocator;
@@ -393,9 +434,9 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
             case IR_STORE_32:
             case IR_STORE_64:
                 {
-                    struct x86Register *address32 = allocateRegister(inter, (insn->u.store.address->type == IR_REG_64)?NULL:insn->u.store.address);
+                    struct x86Register *address32 = allocateRegister(inter, (inter->irRegs[insn->u.store.address].type == IR_REG_64)?IR_NO_REG:insn->u.store.address);
 
-                    if (insn->u.store.address->type == IR_REG_64)
+                    if (inter->irRegs[insn->u.store.address].type == IR_REG_64)
                         add_cast(inter, IR_CAST_64_TO_32, address32, allocateRegister(inter, insn->u.store.address));
                     add_store(inter, X86_STORE_8 + insn->type - IR_STORE_8, allocateRegister(inter, insn->u.store.src), address32);
                 }
@@ -437,11 +478,11 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                                 struct x86Register *shiftRightResult;
 
                                 if (goto_p0) {
-                                    shiftValue = allocateRegister(inter, NULL);
+                                    shiftValue = allocateRegister(inter, IR_NO_REG);
                                     add_mov_const(inter, shiftValue, goto_p0);
-                                    shiftLeftResult = allocateRegister(inter, NULL);
+                                    shiftLeftResult = allocateRegister(inter, IR_NO_REG);
                                     add_binop(inter, X86_BINOP_32, X86_BINOP_SHL, shiftLeftResult, op1, shiftValue);
-                                    shiftRightResult = allocateRegister(inter, NULL);
+                                    shiftRightResult = allocateRegister(inter, IR_NO_REG);
                                     add_binop(inter, X86_BINOP_32, X86_BINOP_ASR, shiftRightResult, shiftLeftResult, shiftValue);
                                 } else {
                                     shiftRightResult = allocateRegister(inter, insn->u.binop.op1);
@@ -458,6 +499,15 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                         case IR_BINOP_CMPNE_8: case IR_BINOP_CMPNE_16: case IR_BINOP_CMPNE_32: case IR_BINOP_CMPNE_64:
                             add_binop(inter, X86_BINOP_8 + insn->u.binop.type - IR_BINOP_CMPNE_8, X86_BINOP_CMPNE, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
                             break;
+                        case IR_BINOP_CRC32C_8: case IR_BINOP_CRC32C_16: case IR_BINOP_CRC32C_32: case IR_BINOP_CRC32C_64:
+                            add_binop(inter, X86_BINOP_8 + insn->u.binop.type - IR_BINOP_CRC32C_8, X86_BINOP_CRC32C, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
+                            break;
+                        case IR_BINOP_FCMP_32: case IR_BINOP_FCMP_64:
+                            add_binop(inter, X86_BINOP_32 + insn->u.binop.type - IR_BINOP_FCMP_32, X86_BINOP_FCMP, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
+                            break;
+                        case IR_BINOP_FCMPE_32: case IR_BINOP_FCMPE_64:
+                            add_binop(inter, X86_BINOP_32 + insn->u.binop.type - IR_BINOP_FCMPE_32, X86_BINOP_FCMPE, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
+                            break;
                         default:
                             assert(0);
                     }
@@ -470,7 +520,7 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                 add_cast(inter, insn->u.cast.type, allocateRegister(inter, insn->u.cast.dst), allocateRegister(inter, insn->u.cast.op));
                 break;
             case IR_EXIT:
-                if (insn->u.exit.pred)
+                if (insn->u.exit.pred != IR_NO_REG)
                     add_exit(inter, allocateRegister(inter, insn->u.exit.value), allocateRegister(inter, insn->u.exit.pred));
                 else
                     add_exit(inter, allocateRegister(inter, insn->u.exit.value), NULL);
@@ -482,12 +532,12 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                     int i;
 
                     for(i = 0; i < 4; i++) {
-                        if (insn->u.call.param[i])
+                        if (insn->u.call.param[i] != IR_NO_REG)
                             params[i] = allocateRegister(inter, insn->u.call.param[i]);
                         else
                             params[i] = NULL;
                     }
-                    if (insn->u.call.result)
+                    if (insn->u.call.result != IR_NO_REG)
                         result = allocateRegister(inter, insn->u.call.result);
                     else
                         result = NULL;
@@ -497,12 +547,24 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                 break;
             case IR_READ_8: case IR_READ_16: case IR_READ_32: case IR_READ_64:
                 /* if register is never use then drop the read */
-                if (insn->u.read_context.dst->lastReadIndex != -1)
+                if (inter->irRegs[insn->u.read_context.dst].lastReadIndex != -1)
                     add_read(inter, X86_READ_8 + insn->type - IR_READ_8, allocateRegister(inter, insn->u.read_context.dst), insn->u.read_context.offset);
                 break;
             case IR_WRITE_8: case IR_WRITE_16: case IR_WRITE_32: case IR_WRITE_64:
                 add_write(inter, X86_WRITE_8 + insn->type - IR_WRITE_8, allocateRegister(inter, insn->u.write_context.src), insn->u.write_context.offset);
                 break;
+            case IR_CMPXCHG_8: case IR_CMPXCHG_16: case IR_CMPXCHG_32: case IR_CMPXCHG_64:
+            case IR_XCHG_8: case IR_XCHG_16: case IR_XCHG_32: case IR_XCHG_64:
+            case IR_FETCH_ADD_8: case IR_FETCH_ADD_16: case IR_FETCH_ADD_32: case IR_FETCH_ADD_64:
+                {
+                    struct x86Register *address32 = allocateRegister(inter, (inter->irRegs[insn->u.atomic.address].type == IR_REG_64)?IR_NO_REG:insn->u.atomic.address);
+
+                    if (inter->irRegs[insn->u.atomic.address].type == IR_REG_64)
+                        add_cast(inter, IR_CAST_64_TO_32, address32, allocateRegister(inter, insn->u.atomic.address));
+                    add_atomic(inter, X86_CMPXCHG_8 + insn->type - IR_CMPXCHG_8, allocateRegister(inter, insn->u.atomic.dst), address32,
+                               allocateRegister(inter, insn->u.atomic.op1), insn->u.atomic.op2 != IR_NO_REG?allocateRegister(inter, insn->u.atomic.op2):NULL);
+                }
+                break;
             case IR_INSN_MARKER:
                 add_insn_start_marker(inter, insn->u.marker.value);
                 break;
@@ -514,10 +576,26 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
 }
 
 /* register allocation */
-static int getFreeRegRaw(int *freeRegList)
+static void setRegFree(int *freeRegList, struct x86Register *reg)
+{
+    freeRegList[reg->index] = 1;
+    if (reg->index2 != -1)
+        freeRegList[reg->index2] = 1;
+}
+
+/* slot 2n+1 is just below slot 2n, so pair (2n + 1, 2n) holds a little endian 64 bits value */
+static int getFreeSlot(int *freeRegList)
 {
     int i;
-    for(i = 0; i < REG_NUMBER; i++) {
+
+    /* prefer slots whose pair buddy is already in use so pairs stay available */
+    for(i = 0; i < SLOT_NUMBER; i++) {
+        if (freeRegList[i] && !freeRegList[i ^ 1]) {
+            freeRegList[i] = 0;
+            return i;
+        }
+    }
+    for(i = 0; i < SLOT_NUMBER; i++) {
         if (freeRegList[i]) {
             freeRegList[i] = 0;
             return i;
@@ -527,23 +605,30 @@ static int getFreeRegRaw(int *freeRegList)
     assert(0);
 }
 
-static void getFreeReg(int *freeRegList, struct x86Register *reg)
+static int getFreeSlotPair(int *freeRegList)
 {
-    reg->index = getFreeRegRaw(freeRegList);
-    if (reg->lastReadIndex == -1)
-        freeRegList[reg->index] = 1;
-    if (reg->index2 != -1) {
-        reg->index2 = getFreeRegRaw(freeRegList);
-        if (reg->lastReadIndex == -1)
-            freeRegList[reg->index2] = 1;
+    int i;
+
+    for(i = 0; i < SLOT_NUMBER; i += 2) {
+        if (freeRegList[i] && freeRegList[i + 1]) {
+            freeRegList[i] = 0;
+            freeRegList[i + 1] = 0;
+            return i;
+        }
     }
+
+    assert(0);
 }
 
-static void setRegFree(int *freeRegList, struct x86Register *reg)
+static void getFreeReg(int *freeRegList, struct x86Register *reg)
 {
-    freeRegList[reg->index] = 1;
-    if (reg->index2 != -1)
-        freeRegList[reg->index2] = 1;
+    if (reg->index2 != -1) {
+        reg->index2 = getFreeSlotPair(freeRegList);
+        reg->index = reg->index2 + 1;
+    } else
+        reg->index = getFreeSlot(freeRegList);
+    if (reg->lastReadIndex == -1)
+        setRegFree(freeRegList, reg);
 }
 
 static void setRegFreeIfNoMoreUse(int *freeRegList, struct x86Register *reg, int index)
@@ -552,6 +637,32 @@ static void setRegFreeIfNoMoreUse(int *freeRegList, struct x86Register *reg, int
         setRegFree(freeRegList, reg);
 }
 
+static void updateMaxLive(struct jit_stats *stats, int *freeRegList)
+{
+    int liveNb = 0;
+    int i;
+
+    for(i = 0; i < SLOT_NUMBER; i++)
+        liveNb += !freeRegList[i];
+    if (liveNb > stats->max_live)
+        stats->max_live = liveNb;
+}
+
+/* values allocated past REG_NUMBER live in spill slots */
+static int getSpillNb(struct inter *inter)
+{
+    struct x86Register *reg = (struct x86Register *) inter->registerPoolAllocator.buffer;
+    int regNb = inter->registerPoolAllocator.index / sizeof(struct x86Register);
+    int res = 0;
+    int i;
+
+    /* skip entries of ir registers dropped by instruction allocation */
+    for(i = 0; i < regNb; i++, reg++)
+        res += reg->firstWriteIndex != -1 && reg->index >= REG_NUMBER;
+
+    return res;
+}
+
 #ifdef DEBUG_REG_ALLOC
 static void displayReg(struct x86Register *reg)
 {
@@ -570,8 +681,10 @@ static void allocateRegisters(struct inter *inter)
 {
     int i;
     struct x86Instruction *insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
-    int freeRegList[REG_NUMBER] = {1, 1, 1, 1, 1, 1, 1, 1,
-                                   1, 1, 1, 1, 1, 1, 1, 1};
+    int freeRegList[SLOT_NUMBER];
+
+    for (i = 0; i < SLOT_NUMBER; ++i)
+        freeRegList[i] = 1;
 
     for (i = 0; i < inter->instructionIndex; ++i, insn++)
     {
@@ -720,6 +833,24 @@ static void allocateRegisters(struct inter *inter)
 #endif
                 }
                 break;
+            case X86_CMPXCHG_8: case X86_CMPXCHG_16: case X86_CMPXCHG_32: case X86_CMPXCHG_64:
+            case X86_XCHG_8: case X86_XCHG_16: case X86_XCHG_32: case X86_XCHG_64:
+            case X86_FETCH_ADD_8: case X86_FETCH_ADD_16: case X86_FETCH_ADD_32: case X86_FETCH_ADD_64:
+                getFreeReg(freeRegList, insn->u.atomic.dst);
+                setRegFreeIfNoMoreUse(freeRegList, insn->u.atomic.address, i);
+                setRegFreeIfNoMoreUse(freeRegList, insn->u.atomic.op1, i);
+                setRegFreeIfNoMoreUse(freeRegList, insn->u.atomic.op2, i);
+#ifdef DEBUG_REG_ALLOC
+                printf("atomic ");
+                displayReg(insn->u.atomic.dst);
+                printf(", [");
+                displayReg(insn->u.atomic.address);
+                printf("], ");
+                displayReg(insn->u.atomic.op1);
+                printf(", ");
+                displayReg(insn->u.atomic.op2);
+#endif
+                break;
             case X86_INSN_MARKER:
 #ifdef DEBUG_REG_ALLOC
                 printf("start_of_new_instruction\n");
@@ -734,16 +865,22 @@ static void allocateRegisters(struct inter *inter)
     {
         int j;
         printf("    ");
-        for(j=0;j<REG_NUMBER;j++)
+        for(j=0;j<SLOT_NUMBER;j++)
             printf("%d", freeRegList[j]);
         printf("\n");
     }
 #endif
+        if (inter->backend.stats)
+            updateMaxLive(inter->backend.stats, freeRegList);
     }
+    if (inter->backend.stats)
+        inter->backend.stats->spill_nb = getSpillNb(inter);
 }
 
 /* code generation */
-#define VREG_OFFSET(idx)    (-(idx) * 4 - 4)
+/* sp value when calling an helper is saved below virtual registers, spill slots follow */
+#define CALL_SP_OFFSET      (-68)
+#define VREG_OFFSET(idx)    ((idx) < REG_NUMBER?(-(idx) * 4 - 4):(CALL_SP_OFFSET - ((idx) - REG_NUMBER) * 4 - 4))
 
 #define MODRM_MODE_0        0x00
 #define MODRM_MODE_1        0x40
@@ -761,6 +898,9 @@ static void allocateRegisters(struct inter *inter)
 #define ESI                 6
 #define EDI                 7
 
+#define XMM0                0
+#define XMM1                1
+
 static char *gen_and_between_physicals(char *pos, int dst, int op)
 {
     *pos++ = 0x21;
@@ -812,11 +952,29 @@ static char *gen_mov_const_in_physical_reg(char *pos, int index, uint32_t value)
     return pos;
 }
 
+/* modrm for [ebp + VREG_OFFSET(index)], spill slots may need a disp32 */
+static char *gen_modrm_virtual(char *pos, int index, int reg)
+{
+    int32_t offset = VREG_OFFSET(index);
+
+    if (offset >= -128) {
+        *pos++ = MODRM_MODE_1 | (EBP << MODRM_RM_SHIFT) | (reg << MODRM_REG_SHIFT);
+        *pos++ = offset;
+    } else {
+        *pos++ = MODRM_MODE_2 | (EBP << MODRM_RM_SHIFT) | (reg << MODRM_REG_SHIFT);
+        *pos++ = (offset >> 0) & 0xff;
+        *pos++ = (offset >> 8) & 0xff;
+        *pos++ = (offset >> 16) & 0xff;
+        *pos++ = (offset >> 24) & 0xff;
+    }
+
+    return pos;
+}
+
 static char *gen_mov_const_in_virtual_reg(char *pos, int index, uint32_t value)
 {
     *pos++ = 0xc7;
-    *pos++ = MODRM_MODE_1 | (EBP << MODRM_RM_SHIFT);
-    *pos++ = VREG_OFFSET(index);
+    pos = gen_modrm_virtual(pos, index, 0);
     *pos++ = (value >> 0) & 0xff;
     *pos++ = (value >> 8) & 0xff;
     *pos++ = (value >> 16) & 0xff;
@@ -828,8 +986,7 @@ static char *gen_mov_const_in_virtual_reg(char *pos, int index, uint32_t value)
 static char *gen_mov_from_virtual_to_physical(char *pos, int from, int to)
 {
     *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_1 | (EBP << MODRM_RM_SHIFT) | (to << MODRM_REG_SHIFT);
-    *pos++ = VREG_OFFSET(from);
+    pos = gen_modrm_virtual(pos, from, to);
 
     return pos;
 }
@@ -845,8 +1002,7 @@ static char *gen_mov_from_virtual_to_physical(char *pos, int from, int to)
 static char *gen_mov_from_physical_to_virtual(char *pos, int from, int to)
 {
     *pos++ = 0x89;
-    *pos++ = MODRM_MODE_1 | (EBP << MODRM_RM_SHIFT) | (from << MODRM_REG_SHIFT);
-    *pos++ = VREG_OFFSET(to);
+    pos = gen_modrm_virtual(pos, to, from);
 
     return pos;
 }
@@ -876,6 +1032,16 @@ static char *gen_push_physical_on_stack(char *pos, int index, int *sp_offset)
     return pos;
 }
 
+/* record sp so get_helper_return_address can find call return address */
+static char *gen_record_call_sp(char *pos)
+{
+    *pos++ = 0x89;
+    *pos++ = MODRM_MODE_1 | (EBP << MODRM_RM_SHIFT) | (ESP << MODRM_REG_SHIFT);
+    *pos++ = CALL_SP_OFFSET;
+
+    return pos;
+}
+
 static char *gen_add_sp(char *pos, int offset)
 {
     *pos++ = 0x81;
@@ -1229,21 +1395,6 @@ static char *gen_ror32(char *pos, enum x86InstructionType type, struct x86Regist
     return pos;
 }
 
-static uint64_t shl64_helper(uint64_t op, uint32_t shift_value)
-{
-    return op << shift_value;
-}
-
-static uint64_t shr64_helper(uint64_t op, uint32_t shift_value)
-{
-    return op >> shift_value;
-}
-
-static int64_t asr64_helper(int64_t op, uint32_t shift_value)
-{
-    return op >> shift_value;
-}
-
 static int64_t ror64_helper(uint64_t op, uint32_t shift_value)
 {
     if (shift_value == 0)
@@ -1266,6 +1417,7 @@ static char *gen_shift64(char *pos, struct x86Register *dst, struct x86Register
 
     /* call helper */
     pos = gen_mov_const_in_physical_reg(pos, EAX, helper_addr);
+    pos = gen_record_call_sp(pos);
     *pos++ = 0xff;
     *pos++ = MODRM_MODE_3 | (2/*subcode*/ << MODRM_REG_SHIFT) | EAX;
 
@@ -1279,6 +1431,20 @@ static char *gen_shift64(char *pos, struct x86Register *dst, struct x86Register
     return pos;
 }
 
+/* crc32 eax, ecx / cx / cl */
+static char *gen_crc32c(char *pos, enum x86InstructionType type)
+{
+    if (type == X86_BINOP_16)
+        *pos++ = 0x66;
+    *pos++ = 0xf2;
+    *pos++ = 0x0f;
+    *pos++ = 0x38;
+    *pos++ = (type == X86_BINOP_8)?0xf0:0xf1;
+    *pos++ = MODRM_MODE_3 | (EAX << MODRM_REG_SHIFT) | ECX;
+
+    return pos;
+}
+
 static char *gen_binop(char *pos, struct x86Instruction *insn, uint32_t mask)
 {
     static const char binopToOpcode[] = {0x01/*add*/, 0x29/*sub*/, 0x31/*xor*/, 0x21/*and*/,
@@ -1317,6 +1483,17 @@ static char *gen_binop(char *pos, struct x86Instruction *insn, uint32_t mask)
         case X86_BINOP_CMPNE:
             pos = gen_cmp32(pos, 0, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
             break;
+        case X86_BINOP_CRC32C:
+            /* crc is 32 bits whatever value size is. 64 bits value is done in two steps */
+            pos = gen_mov_from_virtual_to_physical(pos, insn->u.binop.op1->index, EAX);
+            pos = gen_mov_from_virtual_to_physical(pos, insn->u.binop.op2->index, ECX);
+            pos = gen_crc32c(pos, insn->type == X86_BINOP_64?X86_BINOP_32:insn->type);
+            if (insn->type == X86_BINOP_64) {
+                pos = gen_mov_from_virtual_to_physical(pos, insn->u.binop.op2->index2, ECX);
+                pos = gen_crc32c(pos, X86_BINOP_32);
+            }
+            mask = 0;
+            break;
         default:
             fprintf(stderr, "Implement binop type %d\n", insn->u.binop.type);
             assert(0);
@@ -1335,6 +1512,176 @@ static char *gen_binop(char *pos, struct x86Instruction *insn, uint32_t mask)
     return pos;
 }
 
+/* [prefix] 0f opcode xmm, [virtual] */
+static char *gen_sse2_virtual(char *pos, int prefix, int opcode, int xmm, int index)
+{
+    *pos++ = prefix;
+    *pos++ = 0x0f;
+    *pos++ = opcode;
+    pos = gen_modrm_virtual(pos, index, xmm);
+
+    return pos;
+}
+
+/* [prefix] 0f opcode xmm, reg */
+static char *gen_sse2_physical(char *pos, int prefix, int opcode, int xmm, int reg)
+{
+    *pos++ = prefix;
+    *pos++ = 0x0f;
+    *pos++ = opcode;
+    *pos++ = MODRM_MODE_3 | (reg << MODRM_RM_SHIFT) | (xmm << MODRM_REG_SHIFT);
+
+    return pos;
+}
+
+/* 64 bits value is in memory as a whole so a movq can load or store it */
+static char *gen_load_xmm_from_virtual(char *pos, int xmm, struct x86Register *reg)
+{
+    assert(reg->index == reg->index2 + 1);
+    /* movq xmm, [virtual] */
+    return gen_sse2_virtual(pos, 0xf3, 0x7e, xmm, reg->index);
+}
+
+static char *gen_store_xmm_to_virtual(char *pos, int xmm, struct x86Register *reg)
+{
+    assert(reg->index == reg->index2 + 1);
+    /* movq [virtual], xmm */
+    return gen_sse2_virtual(pos, 0x66, 0xd6, xmm, reg->index);
+}
+
+/* cmovcc eax, ecx */
+static char *gen_cmov_eax_ecx(char *pos, int cc)
+{
+    *pos++ = 0x0f;
+    *pos++ = 0x40 + cc;
+    *pos++ = MODRM_MODE_3 | (ECX << MODRM_RM_SHIFT) | (EAX << MODRM_REG_SHIFT);
+
+    return pos;
+}
+
+/* ucomis / comis of op1 and op2 then turn zf, pf and cf into arm nzcv. Moves don't change
+   flags. Unordered sets all three flags so it's tested last */
+static char *gen_fcmp(char *pos, struct x86Instruction *insn)
+{
+    int is64 = (insn->type == X86_BINOP_64);
+
+    if (is64) {
+        pos = gen_load_xmm_from_virtual(pos, 0, insn->u.binop.op1);
+        pos = gen_load_xmm_from_virtual(pos, 1, insn->u.binop.op2);
+    } else {
+        /* movd xmm, [virtual] */
+        pos = gen_sse2_virtual(pos, 0x66, 0x6e, 0, insn->u.binop.op1->index);
+        pos = gen_sse2_virtual(pos, 0x66, 0x6e, 1, insn->u.binop.op2->index);
+    }
+    if (is64)
+        *pos++ = 0x66;
+    *pos++ = 0x0f;
+    *pos++ = (insn->u.binop.type == X86_BINOP_FCMPE)?0x2f:0x2e;
+    *pos++ = MODRM_MODE_3 | (1 << MODRM_RM_SHIFT) | (0 << MODRM_REG_SHIFT);
+    //greater
+    pos = gen_mov_const_in_physical_reg(pos, EAX, 0x20000000);
+    //less
+    pos = gen_mov_const_in_physical_reg(pos, ECX, 0x80000000);
+    pos = gen_cmov_eax_ecx(pos, 0x2/*b*/);
+    //equal
+    pos = gen_mov_const_in_physical_reg(pos, ECX, 0x60000000);
+    pos = gen_cmov_eax_ecx(pos, 0x4/*e*/);
+    //unordered
+    pos = gen_mov_const_in_physical_reg(pos, ECX, 0x30000000);
+    pos = gen_cmov_eax_ecx(pos, 0xa/*p*/);
+    pos = gen_mov_from_physical_to_virtual(pos, EAX, insn->u.binop.dst->index);
+    if (is64) {
+        pos = gen_mov_const_in_physical_reg(pos, EAX, 0);
+        pos = gen_mov_from_physical_to_virtual(pos, EAX, insn->u.binop.dst->index2);
+    }
+
+    return pos;
+}
+
+static char *gen_logic64_sse2(char *pos, enum x86BinopType type, struct x86Register *dst, struct x86Register *op1, struct x86Register *op2)
+{
+    int opcode = (type == X86_BINOP_XOR)?0xef/*pxor*/:(type == X86_BINOP_AND)?0xdb/*pand*/:0xeb/*por*/;
+
+    pos = gen_load_xmm_from_virtual(pos, XMM0, op1);
+    pos = gen_load_xmm_from_virtual(pos, XMM1, op2);
+    pos = gen_sse2_physical(pos, 0x66, opcode, XMM0, XMM1);
+    pos = gen_store_xmm_to_virtual(pos, XMM0, dst);
+
+    return pos;
+}
+
+/* shift count is taken modulo 64 like x86_64 hardware does */
+static char *gen_shift64_sse2(char *pos, enum x86BinopType type, struct x86Register *dst, struct x86Register *op1, struct x86Register *op2)
+{
+    pos = gen_load_xmm_from_virtual(pos, XMM0, op1);
+    pos = gen_mov_from_virtual_to_physical(pos, op2->index, ECX);
+    /* and ecx, 63 */
+    *pos++ = 0x83;
+    *pos++ = MODRM_MODE_3 | (4/*subcode*/ << MODRM_REG_SHIFT) | ECX;
+    *pos++ = 63;
+    /* movd xmm1, ecx */
+    pos = gen_sse2_physical(pos, 0x66, 0x6e, XMM1, ECX);
+    /* psllq / psrlq xmm0, xmm1 */
+    pos = gen_sse2_physical(pos, 0x66, (type == X86_BINOP_SHL)?0xf3:0xd3, XMM0, XMM1);
+    pos = gen_store_xmm_to_virtual(pos, XMM0, dst);
+
+    return pos;
+}
+
+/* edx:eax shift using shld/shrd, fix up when count is 32 or more */
+static char *gen_shift64_gpr(char *pos, enum x86BinopType type, struct x86Register *dst, struct x86Register *op1, struct x86Register *op2)
+{
+    char *patch;
+
+    pos = gen_mov_from_virtual_to_physical(pos, op1->index, EAX);
+    pos = gen_mov_from_virtual_to_physical(pos, op1->index2, EDX);
+    pos = gen_mov_from_virtual_to_physical(pos, op2->index, ECX);
+    if (type == X86_BINOP_SHL) {
+        /* shld edx, eax, cl / shl eax, cl */
+        *pos++ = 0x0f;
+        *pos++ = 0xa5;
+        *pos++ = MODRM_MODE_3 | (EDX << MODRM_RM_SHIFT) | (EAX << MODRM_REG_SHIFT);
+        *pos++ = 0xd3;
+        *pos++ = MODRM_MODE_3 | (4/*shl*/ << MODRM_REG_SHIFT) | EAX;
+    } else {
+        /* shrd eax, edx, cl / shr or sar edx, cl */
+        *pos++ = 0x0f;
+        *pos++ = 0xad;
+        *pos++ = MODRM_MODE_3 | (EAX << MODRM_RM_SHIFT) | (EDX << MODRM_REG_SHIFT);
+        *pos++ = 0xd3;
+        *pos++ = MODRM_MODE_3 | (((type == X86_BINOP_ASR)?7/*sar*/:5/*shr*/) << MODRM_REG_SHIFT) | EDX;
+    }
+    /* test cl, 32 */
+    *pos++ = 0xf6;
+    *pos++ = MODRM_MODE_3 | (0/*subcode*/ << MODRM_REG_SHIFT) | ECX;
+    *pos++ = 32;
+    /* skip fix up if bit 5 is clear */
+    *pos++ = 0x74;
+    patch = pos++;
+    if (type == X86_BINOP_SHL) {
+        /* mov edx, eax / xor eax, eax */
+        *pos++ = 0x89;
+        *pos++ = MODRM_MODE_3 | (EDX << MODRM_RM_SHIFT) | (EAX << MODRM_REG_SHIFT);
+        pos = gen_xor_between_physicals(pos, EAX, EAX);
+    } else {
+        /* mov eax, edx */
+        *pos++ = 0x89;
+        *pos++ = MODRM_MODE_3 | (EAX << MODRM_RM_SHIFT) | (EDX << MODRM_REG_SHIFT);
+        if (type == X86_BINOP_ASR) {
+            /* sar edx, 31 */
+            *pos++ = 0xc1;
+            *pos++ = MODRM_MODE_3 | (7/*sar*/ << MODRM_REG_SHIFT) | EDX;
+            *pos++ = 31;
+        } else
+            pos = gen_xor_between_physicals(pos, EDX, EDX);
+    }
+    *patch = pos - patch - 1;
+    pos = gen_mov_from_physical_to_virtual(pos, EAX, dst->index);
+    pos = gen_mov_from_physical_to_virtual(pos, EDX, dst->index2);
+
+    return pos;
+}
+
 static char *gen_binop64(char *pos, struct x86Instruction *insn)
 {
     static const char binopToOpcode1[] = {0x01/*add*/, 0x29/*sub*/, 0x31/*xor*/, 0x21/*and*/,
@@ -1346,11 +1693,16 @@ static char *gen_binop64(char *pos, struct x86Instruction *insn)
 
     /* do ops with result in eax */
     switch(insn->u.binop.type) {
-        case X86_BINOP_ADD:
-        case X86_BINOP_SUB:
         case X86_BINOP_XOR:
         case X86_BINOP_AND:
         case X86_BINOP_OR:
+            if (hasHostFeature(HOST_FEATURE_SSE2)) {
+                pos = gen_logic64_sse2(pos, insn->u.binop.type, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
+                break;
+            }
+            /* fallthrough */
+        case X86_BINOP_ADD:
+        case X86_BINOP_SUB:
             /* lower part */
             pos = gen_mov_from_virtual_to_physical(pos, insn->u.binop.op1->index, EAX);
             pos = gen_mov_from_virtual_to_physical(pos, insn->u.binop.op2->index, ECX);
@@ -1365,13 +1717,14 @@ static char *gen_binop64(char *pos, struct x86Instruction *insn)
             pos = gen_mov_from_physical_to_virtual(pos, EAX, insn->u.binop.dst->index2);
             break;
         case X86_BINOP_SHL:
-            pos = gen_shift64(pos, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2, (uint32_t)&shl64_helper);
-            break;
         case X86_BINOP_SHR:
-            pos = gen_shift64(pos, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2, (uint32_t)&shr64_helper);
+            if (hasHostFeature(HOST_FEATURE_SSE2))
+                pos = gen_shift64_sse2(pos, insn->u.binop.type, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
+            else
+                pos = gen_shift64_gpr(pos, insn->u.binop.type, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
             break;
         case X86_BINOP_ASR:
-            pos = gen_shift64(pos, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2, (uint32_t)&asr64_helper);
+            pos = gen_shift64_gpr(pos, insn->u.binop.type, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
             break;
         case X86_BINOP_ROR:
             pos = gen_shift64(pos, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2, (uint32_t)&ror64_helper);
@@ -1537,6 +1890,7 @@ static char *gen_call(char *pos, struct x86Instruction *insn)
     pos = gen_mov_from_virtual_to_physical(pos, insn->u.call.address->index, EAX);
 
     /* jump to helper */
+    pos = gen_record_call_sp(pos);
     *pos++ = 0xff;
     *pos++ = MODRM_MODE_3 | (2/*subcode*/ << MODRM_REG_SHIFT) | EAX;
 
@@ -1553,6 +1907,79 @@ static char *gen_call(char *pos, struct x86Instruction *insn)
     return pos;
 }
 
+/* eax hold result of atomic instruction, zero extend it and save it into dst */
+static char *gen_atomic_result(char *pos, int size, struct x86Register *dst)
+{
+    if (size < 2) {
+        /* movzx eax, al / movzx eax, ax */
+        *pos++ = 0x0f;
+        *pos++ = size?0xb7:0xb6;
+        *pos++ = MODRM_MODE_3 | (EAX << MODRM_RM_SHIFT) | (EAX << MODRM_REG_SHIFT);
+    }
+    pos = gen_mov_from_physical_to_virtual(pos, EAX, dst->index);
+
+    return pos;
+}
+
+/* generate [lock] opcode [ecx], reg with correct operand size prefix */
+static char *gen_atomic_hlp(char *pos, int size, int isLock, int opcode, int reg)
+{
+    if (isLock)
+        *pos++ = 0xf0;
+    if (size == 1)
+        *pos++ = 0x66;
+    if (opcode > 0xff)
+        *pos++ = opcode >> 8;
+    *pos++ = opcode & 0xff;
+    *pos++ = MODRM_MODE_0 | (ECX << MODRM_RM_SHIFT) | (reg << MODRM_REG_SHIFT);
+
+    return pos;
+}
+
+static char *gen_cmpxchg(char *pos, struct x86Instruction *insn)
+{
+    int size = insn->type - X86_CMPXCHG_8;
+
+    /* 64 bits atomics are not use by arm guest on i386 host */
+    assert(size != 3);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.op1->index, EAX);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.address->index, ECX);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.op2->index, EDX);
+    /* lock cmpxchg [ecx], edx */
+    pos = gen_atomic_hlp(pos, size, 1, size?0x0fb1:0x0fb0, EDX);
+    pos = gen_atomic_result(pos, size, insn->u.atomic.dst);
+
+    return pos;
+}
+
+static char *gen_xchg(char *pos, struct x86Instruction *insn)
+{
+    int size = insn->type - X86_XCHG_8;
+
+    assert(size != 3);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.op1->index, EAX);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.address->index, ECX);
+    /* xchg [ecx], eax. lock is implicit */
+    pos = gen_atomic_hlp(pos, size, 0, size?0x87:0x86, EAX);
+    pos = gen_atomic_result(pos, size, insn->u.atomic.dst);
+
+    return pos;
+}
+
+static char *gen_fetch_add(char *pos, struct x86Instruction *insn)
+{
+    int size = insn->type - X86_FETCH_ADD_8;
+
+    assert(size != 3);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.op1->index, EAX);
+    pos = gen_mov_from_virtual_to_physical(pos, insn->u.atomic.address->index, ECX);
+    /* lock xadd [ecx], eax */
+    pos = gen_atomic_hlp(pos, size, 1, size?0x0fc1:0x0fc0, EAX);
+    pos = gen_atomic_result(pos, size, insn->u.atomic.dst);
+
+    return pos;
+}
+
 static int generateCode(struct inter *inter, char *buffer)
 {
     int i;
@@ -1563,6 +1990,9 @@ static int generateCode(struct inter *inter, char *buffer)
     for (i = 0; i < inter->instructionIndex; ++i, insn++)
     {
         switch(insn->type) {
+            case X86_INSN_MARKER:
+                insn->u.marker.host_offset = pos - buffer;
+                break;
             case X86_MOV_CONST:
                 pos = gen_mov_const(pos, insn);
                 break;
@@ -1594,10 +2024,18 @@ static int generateCode(struct inter *inter, char *buffer)
             case X86_BINOP_16: mask = 0xffff; goto binop;
             case X86_BINOP_32: mask = 0; goto binop;
                 binop:
-                    pos = gen_binop(pos, insn, mask);
+                    if (insn->u.binop.type == X86_BINOP_FCMP || insn->u.binop.type == X86_BINOP_FCMPE)
+                        pos = gen_fcmp(pos, insn);
+                    else
+                        pos = gen_binop(pos, insn, mask);
                 break;
             case X86_BINOP_64:
-                pos = gen_binop64(pos, insn);
+                if (insn->u.binop.type == X86_BINOP_CRC32C)
+                    pos = gen_binop(pos, insn, 0);
+                else if (insn->u.binop.type == X86_BINOP_FCMP || insn->u.binop.type == X86_BINOP_FCMPE)
+                    pos = gen_fcmp(pos, insn);
+                else
+                    pos = gen_binop64(pos, insn);
                 break;
             case X86_CAST:
                 pos = gen_cast(pos, insn);
@@ -1635,6 +2073,15 @@ static int generateCode(struct inter *inter, char *buffer)
             case X86_WRITE_64:
                 pos = gen_write_64(pos, insn);
                 break;
+            case X86_CMPXCHG_8: case X86_CMPXCHG_16: case X86_CMPXCHG_32: case X86_CMPXCHG_64:
+                pos = gen_cmpxchg(pos, insn);
+                break;
+            case X86_XCHG_8: case X86_XCHG_16: case X86_XCHG_32: case X86_XCHG_64:
+                pos = gen_xchg(pos, insn);
+                break;
+            case X86_FETCH_ADD_8: case X86_FETCH_ADD_16: case X86_FETCH_ADD_32: case X86_FETCH_ADD_64:
+                pos = gen_fetch_add(pos, insn);
+                break;
             default:
                 fprintf(stderr, "unknown insn type for generatecode %d\n", insn->type);
                 assert(0);
@@ -1644,98 +2091,20 @@ static int generateCode(struct inter *inter, char *buffer)
     return pos - buffer;
 }
 
-static uint32_t findInsnInCode(struct inter *inter, char *buffer, int offset)
+static int get_markers(struct backend *backend, struct insn_marker *markers, int markerNb)
 {
-    int i;
+    struct inter *inter = container_of(backend, struct inter, backend);
     struct x86Instruction *insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
-    char *pos = buffer;
-    uint32_t mask;
-    uint32_t res = ~0;
+    int res = 0;
+    int i;
 
-    for (i = 0; i < inter->instructionIndex; ++i, insn++)
-    {
-        switch(insn->type) {
-            case X86_INSN_MARKER:
-                res = insn->u.marker.value;
-                break;
-            case X86_MOV_CONST:
-                pos = gen_mov_const(pos, insn);
-                break;
-            case X86_LOAD_8:
-                pos = gen_load_8(pos, insn);
-                break;
-            case X86_LOAD_16:
-                pos = gen_load_16(pos, insn);
-                break;
-            case X86_LOAD_32:
-                pos = gen_load_32(pos, insn);
-                break;
-            case X86_LOAD_64:
-                pos = gen_load_64(pos, insn);
-                break;
-            case X86_STORE_8:
-                pos = gen_store_8(pos, insn);
-                break;
-            case X86_STORE_16:
-                pos = gen_store_16(pos, insn);
-                break;
-            case X86_STORE_32:
-                pos = gen_store_32(pos, insn);
-                break;
-            case X86_STORE_64:
-                pos = gen_store_64(pos, insn);
-                break;
-            case X86_BINOP_8: mask = 0xff; goto binop;
-            case X86_BINOP_16: mask = 0xffff; goto binop;
-            case X86_BINOP_32: mask = 0; goto binop;
-                binop:
-                    pos = gen_binop(pos, insn, mask);
-                break;
-            case X86_BINOP_64:
-                pos = gen_binop64(pos, insn);
-                break;
-            case X86_CAST:
-                pos = gen_cast(pos, insn);
-                break;
-            case X86_EXIT:
-                pos = gen_exit(pos, insn);
-                break;
-            case X86_ITE:
-                pos = gen_ite(pos, insn);
-                break;
-            case X86_CALL:
-                pos = gen_call(pos, insn);
-                break;
-            case X86_READ_8:
-                pos = gen_read_8(pos, insn);
-                break;
-            case X86_READ_16:
-                pos = gen_read_16(pos, insn);
-                break;
-            case X86_READ_32:
-                pos = gen_read_32(pos, insn);
-                break;
-            case X86_READ_64:
-                pos = gen_read_64(pos, insn);
-                break;
-            case X86_WRITE_8:
-                pos = gen_write_8(pos, insn);
-                break;
-            case X86_WRITE_16:
-                pos = gen_write_16(pos, insn);
-                break;
-            case X86_WRITE_32:
-                pos = gen_write_32(pos, insn);
-                break;
-            case X86_WRITE_64:
-                pos = gen_write_64(pos, insn);
-                break;
-            default:
-                fprintf(stderr, "unknown insn type for generatecode %d\n", insn->type);
-                assert(0);
+    for (i = 0; i < inter->instructionIndex; ++i, insn++) {
+        if (insn->type == X86_INSN_MARKER) {
+            assert(res < markerNb);
+            markers[res].host_offset = insn->u.marker.host_offset;
+            markers[res].value = insn->u.marker.value;
+            res++;
         }
-        if (pos >= buffer + offset)
-            break;
     }
 
     return res;
@@ -1757,37 +2126,47 @@ static void patch(struct backend *backend, void *link_patch_area, void *cache_ar
     assert(0 && "Implement me\n");
 }
 
-static int jit(struct backend *backend, struct irInstruction *irArray, int irInsnNb, char *buffer, int bufferSize)
+static void *get_helper_return_address(struct backend *backend, void *_ucp)
 {
     struct inter *inter = container_of(backend, struct inter, backend);
-    int res;
-
-    // allocate x86 instructions
-    allocateInstructions(inter, irArray, irInsnNb);
-
-    // allocate registers
-    allocateRegisters(inter);
+    ucontext_t *ucp = (ucontext_t *) _ucp;
+    uint32_t call_sp;
 
-    // generate code
-    res = generateCode(inter, buffer);
-    assert(res <= bufferSize);
+    /* jit code is not running */
+    if (!inter->restore_sp)
+        return NULL;
+    /* being below last recorded call sp means we are inside this helper */
+    call_sp = *(uint32_t *) (inter->restore_sp + CALL_SP_OFFSET);
+    if (!call_sp || ucp->uc_mcontext.gregs[REG_ESP] >= call_sp)
+        return NULL;
 
-    return res;
+    return *(void **) (call_sp - 4);
 }
 
-static uint32_t get_marker(struct backend *backend, struct irInstruction *irArray, int irInsnNb, char *buffer, int bufferSize, int offset)
+static int jit(struct backend *backend, struct irInstruction *irArray, int irInsnNb, struct irRegister *irRegArray, int irRegNb, char *buffer, int bufferSize)
 {
     struct inter *inter = container_of(backend, struct inter, backend);
+    struct memoryPool *pool = &inter->registerPoolAllocator;
+    uint64_t time = jitStatsStart(backend);
     int res;
+    int i;
 
     // allocate x86 instructions
+    inter->irRegs = irRegArray;
+    inter->irRegisters = (struct x86Register *) pool->alloc(pool, irRegNb * sizeof(struct x86Register));
+    for(i = 0; i < irRegNb; i++)
+        inter->irRegisters[i].firstWriteIndex = -1;
     allocateInstructions(inter, irArray, irInsnNb);
+    jitStatsPassEnd(backend, JIT_PASS_LOWER, &time);
 
     // allocate registers
     allocateRegisters(inter);
+    jitStatsPassEnd(backend, JIT_PASS_REGALLOC, &time);
 
-    // find insn
-    res = findInsnInCode(inter, buffer, offset);
+    // generate code
+    res = generateCode(inter, buffer);
+    assert(res <= bufferSize);
+    jitStatsPassEnd(backend, JIT_PASS_CODEGEN, &time);
 
     return res;
 }
@@ -1818,8 +2197,10 @@ struct backend *createBackend(void *memory, int size)
         inter->backend.jit = jit;
         inter->backend.execute = execute_be_i386;
         inter->backend.request_signal_alternate_exit = request_signal_alternate_exit;
-        inter->backend.get_marker = get_marker;
+        inter->backend.get_markers = get_markers;
         inter->backend.patch = patch;
+        inter->backend.get_helper_return_address = get_helper_return_address;
+        inter->backend.stats = NULL;
         inter->backend.reset = reset;
         inter->registerPoolAllocator.alloc = memoryPoolAlloc;
         inter->instructionPoolAllocator.alloc = memoryPoolAlloc;
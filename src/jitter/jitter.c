@@ -22,7 +22,13 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <assert.h>
+#include <alloca.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
 #include "jitter.h"
+#include "be.h"
 
 #define container_of(ptr, type, member) ({			\
     const typeof( ((type *)0)->member ) *__mptr = (ptr);	\
@@ -83,11 +89,15 @@ struct irRegister *allocateRegister(struct irInstructionAllocator *irAlloc, enum
     reg->index = jitter->regIndex++;
     reg->firstWriteIndex = jitter->instructionIndex;
     reg->lastReadIndex = -1;
-    reg->backend = NULL;
 
     return reg;
 }
 
+static int32_t regIndex(struct irRegister *reg)
+{
+    return reg?reg->index:IR_NO_REG;
+}
+
 /* instruction creation */
 static struct irRegister *add_mov_const(struct irInstructionAllocator *irAlloc, uint64_t value, enum irInstructionType insnType, enum irRegisterType regType)
 {
@@ -97,7 +107,7 @@ static struct irRegister *add_mov_const(struct irInstructionAllocator *irAlloc,
     struct irInstruction *insn = (struct irInstruction *) pool->alloc(pool, sizeof(struct irInstruction));
 
     insn->type = insnType;
-    insn->u.mov.dst = dst;
+    insn->u.mov.dst = regIndex(dst);
     insn->u.mov.value = value;
     
     jitter->instructionIndex++;
@@ -131,8 +141,8 @@ static struct irRegister *add_load(struct irInstructionAllocator *irAlloc, struc
     address->lastReadIndex = jitter->instructionIndex;
 
     insn->type = insnType;
-    insn->u.load.dst = dst;
-    insn->u.load.address = address;
+    insn->u.load.dst = regIndex(dst);
+    insn->u.load.address = regIndex(address);
 
     jitter->instructionIndex++;
 
@@ -165,8 +175,8 @@ static void add_store(struct irInstructionAllocator *irAlloc, struct irRegister
     src->lastReadIndex = jitter->instructionIndex;
 
     insn->type = insnType;
-    insn->u.store.src = src;
-    insn->u.store.address = address;
+    insn->u.store.src = regIndex(src);
+    insn->u.store.address = regIndex(address);
 
     jitter->instructionIndex++;
 }
@@ -203,9 +213,9 @@ static struct irRegister *add_binop(struct irInstructionAllocator *irAlloc, stru
 
     insn->type = IR_BINOP;
     insn->u.binop.type = binopType;
-    insn->u.binop.dst = dst;
-    insn->u.binop.op1 = op1;
-    insn->u.binop.op2 = op2;
+    insn->u.binop.dst = regIndex(dst);
+    insn->u.binop.op1 = regIndex(op1);
+    insn->u.binop.op2 = regIndex(op2);
 
     jitter->instructionIndex++;
 
@@ -443,11 +453,55 @@ static struct irRegister *add_cmpne_64(struct irInstructionAllocator *irAlloc, s
     return add_binop(irAlloc, op1, op2, IR_BINOP_CMPNE_64);
 }
 
+static struct irRegister *add_crc32c_8(struct irInstructionAllocator *irAlloc, struct irRegister *crc, struct irRegister *value)
+{
+    assert(crc->type == IR_REG_32 && value->type == IR_REG_8);
+    return add_binop(irAlloc, crc, value, IR_BINOP_CRC32C_8);
+}
+static struct irRegister *add_crc32c_16(struct irInstructionAllocator *irAlloc, struct irRegister *crc, struct irRegister *value)
+{
+    assert(crc->type == IR_REG_32 && value->type == IR_REG_16);
+    return add_binop(irAlloc, crc, value, IR_BINOP_CRC32C_16);
+}
+static struct irRegister *add_crc32c_32(struct irInstructionAllocator *irAlloc, struct irRegister *crc, struct irRegister *value)
+{
+    assert(crc->type == IR_REG_32 && value->type == IR_REG_32);
+    return add_binop(irAlloc, crc, value, IR_BINOP_CRC32C_32);
+}
+static struct irRegister *add_crc32c_64(struct irInstructionAllocator *irAlloc, struct irRegister *crc, struct irRegister *value)
+{
+    assert(crc->type == IR_REG_32 && value->type == IR_REG_64);
+    return add_binop(irAlloc, crc, value, IR_BINOP_CRC32C_64);
+}
+
+static struct irRegister *add_fcmp_32(struct irInstructionAllocator *irAlloc, struct irRegister *op1, struct irRegister *op2)
+{
+    assert(op1->type == IR_REG_32 && op2->type == IR_REG_32);
+    return add_binop(irAlloc, op1, op2, IR_BINOP_FCMP_32);
+}
+static struct irRegister *add_fcmp_64(struct irInstructionAllocator *irAlloc, struct irRegister *op1, struct irRegister *op2)
+{
+    assert(op1->type == IR_REG_64 && op2->type == IR_REG_64);
+    return add_binop(irAlloc, op1, op2, IR_BINOP_FCMP_64);
+}
+
+static struct irRegister *add_fcmpe_32(struct irInstructionAllocator *irAlloc, struct irRegister *op1, struct irRegister *op2)
+{
+    assert(op1->type == IR_REG_32 && op2->type == IR_REG_32);
+    return add_binop(irAlloc, op1, op2, IR_BINOP_FCMPE_32);
+}
+static struct irRegister *add_fcmpe_64(struct irInstructionAllocator *irAlloc, struct irRegister *op1, struct irRegister *op2)
+{
+    assert(op1->type == IR_REG_64 && op2->type == IR_REG_64);
+    return add_binop(irAlloc, op1, op2, IR_BINOP_FCMPE_64);
+}
+
 struct irRegister *add_call(struct irInstructionAllocator *irAlloc, char *name, struct irRegister *address, struct irRegister *param[4], enum irInstructionType type)
 {
     struct jitter *jitter = container_of(irAlloc, struct jitter, irInstructionAllocator);
     struct memoryPool *pool = &jitter->instructionPoolAllocator;
     struct irInstruction *insn = (struct irInstruction *) pool->alloc(pool, sizeof(struct irInstruction));
+    struct irRegister *result = NULL;
     int i;
 
     address->lastReadIndex = jitter->instructionIndex;
@@ -455,19 +509,17 @@ struct irRegister *add_call(struct irInstructionAllocator *irAlloc, char *name,
         if (param[i])
             param[i]->lastReadIndex = jitter->instructionIndex;
 
-    insn->u.call.address = address;
+    insn->u.call.address = regIndex(address);
     insn->type = type;
-    insn->u.call.name = "Unknown";
     for(i=0;i<4;i++)
-        insn->u.call.param[i] = param[i];
-    if (type == IR_CALL_VOID)
-        insn->u.call.result = NULL;
-    else
-        insn->u.call.result = allocateRegister(irAlloc, IR_REG_8 + type - IR_CALL_8);
+        insn->u.call.param[i] = regIndex(param[i]);
+    if (type != IR_CALL_VOID)
+        result = allocateRegister(irAlloc, IR_REG_8 + type - IR_CALL_8);
+    insn->u.call.result = regIndex(result);
 
     jitter->instructionIndex++;
 
-    return insn->u.call.result;
+    return result;
 }
 
 static void add_call_void(struct irInstructionAllocator *irAlloc, char *name, struct irRegister *address, struct irRegister *param[4])
@@ -509,10 +561,10 @@ static struct irRegister *add_ite(struct irInstructionAllocator *irAlloc, struct
     falseOp->lastReadIndex = jitter->instructionIndex;
 
     insn->type = type;
-    insn->u.ite.dst = dst;
-    insn->u.ite.pred = pred;
-    insn->u.ite.trueOp = trueOp;
-    insn->u.ite.falseOp = falseOp;
+    insn->u.ite.dst = regIndex(dst);
+    insn->u.ite.pred = regIndex(pred);
+    insn->u.ite.trueOp = regIndex(trueOp);
+    insn->u.ite.falseOp = regIndex(falseOp);
 
     jitter->instructionIndex++;
 
@@ -547,8 +599,8 @@ static struct irRegister *add_cast(struct irInstructionAllocator *irAlloc, struc
 
     insn->type = IR_CAST;
     insn->u.cast.type = type;
-    insn->u.cast.dst = dst;
-    insn->u.cast.op = op;
+    insn->u.cast.dst = regIndex(dst);
+    insn->u.cast.op = regIndex(op);
 
     jitter->instructionIndex++;
 
@@ -640,8 +692,8 @@ static void add_exit_cond(struct irInstructionAllocator *irAlloc, struct irRegis
 
     assert(exitValue->type == IR_REG_64);
     insn->type = IR_EXIT;
-    insn->u.exit.value = exitValue;
-    insn->u.exit.pred = pred;
+    insn->u.exit.value = regIndex(exitValue);
+    insn->u.exit.pred = regIndex(pred);
 
     jitter->instructionIndex++;
 }
@@ -659,7 +711,7 @@ static struct irRegister *add_read_context(struct irInstructionAllocator *irAllo
     struct irInstruction *insn = (struct irInstruction *) pool->alloc(pool, sizeof(struct irInstruction));
 
     insn->type = insnType;
-    insn->u.read_context.dst = dst;
+    insn->u.read_context.dst = regIndex(dst);
     insn->u.read_context.offset = offset;
 
     jitter->instructionIndex++;
@@ -693,7 +745,7 @@ static void add_write_context(struct irInstructionAllocator *irAlloc, struct irR
     src->lastReadIndex = jitter->instructionIndex;
 
     insn->type = insnType;
-    insn->u.write_context.src = src;
+    insn->u.write_context.src = regIndex(src);
     insn->u.write_context.offset = offset;
 
     jitter->instructionIndex++;
@@ -728,15 +780,92 @@ static void add_insn_marker(struct irInstructionAllocator *irAlloc, uint32_t val
     jitter->instructionIndex++;
 }
 
-static void displayReg(struct irRegister *reg)
+static struct irRegister *add_atomic(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *op1, struct irRegister *op2, enum irInstructionType insnType, enum irRegisterType regType)
+{
+    struct jitter *jitter = container_of(irAlloc, struct jitter, irInstructionAllocator);
+    struct memoryPool *pool = &jitter->instructionPoolAllocator;
+    struct irRegister *dst = allocateRegister(irAlloc, regType);
+    struct irInstruction *insn = (struct irInstruction *) pool->alloc(pool, sizeof(struct irInstruction));
+
+    assert(op1->type == regType);
+    assert(op2 == NULL || op2->type == regType);
+
+    address->lastReadIndex = jitter->instructionIndex;
+    op1->lastReadIndex = jitter->instructionIndex;
+    if (op2)
+        op2->lastReadIndex = jitter->instructionIndex;
+
+    insn->type = insnType;
+    insn->u.atomic.dst = regIndex(dst);
+    insn->u.atomic.address = regIndex(address);
+    insn->u.atomic.op1 = regIndex(op1);
+    insn->u.atomic.op2 = regIndex(op2);
+
+    jitter->instructionIndex++;
+
+    return dst;
+}
+
+static struct irRegister *add_cmpxchg_8(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *expected, struct irRegister *value)
 {
-    if (reg)
-        printf("R%d_%d[%d->%d[", reg->index, 1 << (reg->type + 3), reg->firstWriteIndex, reg->lastReadIndex);
+    return add_atomic(irAlloc, address, expected, value, IR_CMPXCHG_8, IR_REG_8);
+}
+static struct irRegister *add_cmpxchg_16(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *expected, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, expected, value, IR_CMPXCHG_16, IR_REG_16);
+}
+static struct irRegister *add_cmpxchg_32(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *expected, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, expected, value, IR_CMPXCHG_32, IR_REG_32);
+}
+static struct irRegister *add_cmpxchg_64(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *expected, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, expected, value, IR_CMPXCHG_64, IR_REG_64);
+}
+
+static struct irRegister *add_xchg_8(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_XCHG_8, IR_REG_8);
+}
+static struct irRegister *add_xchg_16(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_XCHG_16, IR_REG_16);
+}
+static struct irRegister *add_xchg_32(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_XCHG_32, IR_REG_32);
+}
+static struct irRegister *add_xchg_64(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_XCHG_64, IR_REG_64);
+}
+
+static struct irRegister *add_fetch_add_8(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_FETCH_ADD_8, IR_REG_8);
+}
+static struct irRegister *add_fetch_add_16(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_FETCH_ADD_16, IR_REG_16);
+}
+static struct irRegister *add_fetch_add_32(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_FETCH_ADD_32, IR_REG_32);
+}
+static struct irRegister *add_fetch_add_64(struct irInstructionAllocator *irAlloc, struct irRegister *address, struct irRegister *value)
+{
+    return add_atomic(irAlloc, address, value, NULL, IR_FETCH_ADD_64, IR_REG_64);
+}
+
+static void displayReg(struct irRegister *regs, int32_t index)
+{
+    if (index != IR_NO_REG)
+        printf("R%d_%d[%d->%d[", index, 1 << (regs[index].type + 3), regs[index].firstWriteIndex, regs[index].lastReadIndex);
     else
         printf("NULL");
 }
 
-static void displayInsn(struct irInstruction *insn)
+static void displayInsn(struct irRegister *regs, struct irInstruction *insn)
 {
     switch(insn->type) {
         case IR_MOV_CONST_8:
@@ -745,7 +874,7 @@ static void displayInsn(struct irInstruction *insn)
         case IR_MOV_CONST_64:
             {
                 printf("mov_const_%d ", 1 << (insn->type - IR_MOV_CONST_8 + 3));
-                displayReg(insn->u.mov.dst);
+                displayReg(regs, insn->u.mov.dst);
                 printf(", 0x%08lx\n", insn->u.mov.value);
             }
             break;
@@ -755,9 +884,9 @@ static void displayInsn(struct irInstruction *insn)
         case IR_LOAD_64:
             {
                 printf("load_%d ", 1 << (insn->type - IR_LOAD_8 + 3));
-                displayReg(insn->u.load.dst);
+                displayReg(regs, insn->u.load.dst);
                 printf(", [");
-                displayReg(insn->u.load.address);
+                displayReg(regs, insn->u.load.address);
                 printf("]\n");
             }
             break;
@@ -768,24 +897,34 @@ static void displayInsn(struct irInstruction *insn)
             {
                 printf("store_%d ", 1 << (insn->type - IR_STORE_8 + 3));
                 printf("[");
-                displayReg(insn->u.store.address);
+                displayReg(regs, insn->u.store.address);
                 printf("], ");
-                displayReg(insn->u.store.src);
+                displayReg(regs, insn->u.store.src);
                 printf("\n");
             }
             break;
         case IR_BINOP:
             {
-                const char *binopTypeToName[] = {"add", "sub", "xor", "and", "or", "shl", "shr", "asr", "ror", "cmpeq", "cmpne"};
-                const char *name = binopTypeToName[insn->u.binop.type / 4];
-                int bitNb = 1 << ((insn->u.binop.type % 4) + 3);
-                
+                const char *binopTypeToName[] = {"add", "sub", "xor", "and", "or", "shl", "shr", "asr", "ror", "cmpeq", "cmpne", "crc32c"};
+                const char *name;
+                int bitNb;
+
+                switch(insn->u.binop.type) {
+                    case IR_BINOP_FCMP_32: case IR_BINOP_FCMP_64:
+                    case IR_BINOP_FCMPE_32: case IR_BINOP_FCMPE_64:
+                        name = insn->u.binop.type < IR_BINOP_FCMPE_32 ? "fcmp" : "fcmpe";
+                        bitNb = 32 << ((insn->u.binop.type - IR_BINOP_FCMP_32) % 2);
+                        break;
+                    default:
+                        name = binopTypeToName[insn->u.binop.type / 4];
+                        bitNb = 1 << ((insn->u.binop.type % 4) + 3);
+                }
                 printf("%s_%d ", name, bitNb);
-                displayReg(insn->u.binop.dst);
+                displayReg(regs, insn->u.binop.dst);
                 printf(", ");
-                displayReg(insn->u.binop.op1);
+                displayReg(regs, insn->u.binop.op1);
                 printf(", ");
-                displayReg(insn->u.binop.op2);
+                displayReg(regs, insn->u.binop.op2);
                 printf("\n");
             }
             break;
@@ -795,18 +934,18 @@ static void displayInsn(struct irInstruction *insn)
         case IR_CALL_32:
         case IR_CALL_64:
             {
-                printf("call %s(", insn->u.call.name);
-                displayReg(insn->u.call.address);
+                printf("call (");
+                displayReg(regs, insn->u.call.address);
                 printf("), [");
-                displayReg(insn->u.call.param[0]);
+                displayReg(regs, insn->u.call.param[0]);
                 printf(",");
-                displayReg(insn->u.call.param[1]);
+                displayReg(regs, insn->u.call.param[1]);
                 printf(",");
-                displayReg(insn->u.call.param[2]);
+                displayReg(regs, insn->u.call.param[2]);
                 printf(",");
-                displayReg(insn->u.call.param[3]);
+                displayReg(regs, insn->u.call.param[3]);
                 printf("] => ");
-                displayReg(insn->u.call.result);
+                displayReg(regs, insn->u.call.result);
                 printf("\n");
             }
             break;
@@ -815,13 +954,13 @@ static void displayInsn(struct irInstruction *insn)
         case IR_ITE_32:
         case IR_ITE_64:
             {
-                displayReg(insn->u.ite.dst);
+                displayReg(regs, insn->u.ite.dst);
                 printf(" = ");
-                displayReg(insn->u.ite.pred);
+                displayReg(regs, insn->u.ite.pred);
                 printf("?");
-                displayReg(insn->u.ite.trueOp);
+                displayReg(regs, insn->u.ite.trueOp);
                 printf(":");
-                displayReg(insn->u.ite.falseOp);
+                displayReg(regs, insn->u.ite.falseOp);
                 printf("\n");
             }
             break;
@@ -835,18 +974,18 @@ static void displayInsn(struct irInstruction *insn)
                                               "(64_to_8)", "(32_to_8)", "(16_to_8)",
                                               "(64_to_16)", "(32_to_16)", "(64_to_32)"};
 
-                displayReg(insn->u.cast.dst);
+                displayReg(regs, insn->u.cast.dst);
                 printf(" = %s ", typeToString[insn->u.cast.type]);
-                displayReg(insn->u.cast.op);
+                displayReg(regs, insn->u.cast.op);
                 printf("\n");
             }
             break;
         case IR_EXIT:
             {
                 printf("exit ");
-                displayReg(insn->u.exit.value);
+                displayReg(regs, insn->u.exit.value);
                 printf(" if ");
-                displayReg(insn->u.exit.pred);
+                displayReg(regs, insn->u.exit.pred);
                 printf("\n");
             }
             break;
@@ -856,7 +995,7 @@ static void displayInsn(struct irInstruction *insn)
         case IR_READ_64:
             {
                 printf("read_context_%d ", 1 << (insn->type - IR_READ_8 + 3));
-                displayReg(insn->u.read_context.dst);
+                displayReg(regs, insn->u.read_context.dst);
                 printf(", context[%d]\n",insn->u.read_context.offset);
             }
             break;
@@ -867,7 +1006,44 @@ static void displayInsn(struct irInstruction *insn)
             {
                 printf("write_context_%d ", 1 << (insn->type - IR_WRITE_8 + 3));
                 printf("context[%d], ",insn->u.write_context.offset);
-                displayReg(insn->u.write_context.src);
+                displayReg(regs, insn->u.write_context.src);
+                printf("\n");
+            }
+            break;
+        case IR_CMPXCHG_8:
+        case IR_CMPXCHG_16:
+        case IR_CMPXCHG_32:
+        case IR_CMPXCHG_64:
+            {
+                printf("cmpxchg_%d ", 1 << (insn->type - IR_CMPXCHG_8 + 3));
+                displayReg(regs, insn->u.atomic.dst);
+                printf(", [");
+                displayReg(regs, insn->u.atomic.address);
+                printf("], ");
+                displayReg(regs, insn->u.atomic.op1);
+                printf(", ");
+                displayReg(regs, insn->u.atomic.op2);
+                printf("\n");
+            }
+            break;
+        case IR_XCHG_8:
+        case IR_XCHG_16:
+        case IR_XCHG_32:
+        case IR_XCHG_64:
+        case IR_FETCH_ADD_8:
+        case IR_FETCH_ADD_16:
+        case IR_FETCH_ADD_32:
+        case IR_FETCH_ADD_64:
+            {
+                if (insn->type >= IR_FETCH_ADD_8)
+                    printf("fetch_add_%d ", 1 << (insn->type - IR_FETCH_ADD_8 + 3));
+                else
+                    printf("xchg_%d ", 1 << (insn->type - IR_XCHG_8 + 3));
+                displayReg(regs, insn->u.atomic.dst);
+                printf(", [");
+                displayReg(regs, insn->u.atomic.address);
+                printf("], ");
+                displayReg(regs, insn->u.atomic.op1);
                 printf("\n");
             }
             break;
@@ -888,7 +1064,7 @@ jitContext createJitter(void *memory, struct backend *backend, int size)
     assert(size >= JITTER_MIN_CONTEXT_SIZE);
     jitter = (struct jitter *) memory;
     if (jitter) {
-        int pool_mem_size;
+        int entryNb;
         int struct_jitter_size_aligned_16 = ((sizeof(*jitter) + 15) & ~0xf);
 
         jitter->backend = backend;
@@ -961,6 +1137,14 @@ jitContext createJitter(void *memory, struct backend *backend, int size)
         jitter->irInstructionAllocator.add_cmpne_16 = add_cmpne_16;
         jitter->irInstructionAllocator.add_cmpne_32 = add_cmpne_32;
         jitter->irInstructionAllocator.add_cmpne_64 = add_cmpne_64;
+        jitter->irInstructionAllocator.add_crc32c_8 = add_crc32c_8;
+        jitter->irInstructionAllocator.add_crc32c_16 = add_crc32c_16;
+        jitter->irInstructionAllocator.add_crc32c_32 = add_crc32c_32;
+        jitter->irInstructionAllocator.add_crc32c_64 = add_crc32c_64;
+        jitter->irInstructionAllocator.add_fcmp_32 = add_fcmp_32;
+        jitter->irInstructionAllocator.add_fcmp_64 = add_fcmp_64;
+        jitter->irInstructionAllocator.add_fcmpe_32 = add_fcmpe_32;
+        jitter->irInstructionAllocator.add_fcmpe_64 = add_fcmpe_64;
         jitter->irInstructionAllocator.add_8U_to_16 = add_8U_to_16;
         jitter->irInstructionAllocator.add_8U_to_32 = add_8U_to_32;
         jitter->irInstructionAllocator.add_8U_to_64 = add_8U_to_64;
@@ -990,11 +1174,24 @@ jitContext createJitter(void *memory, struct backend *backend, int size)
         jitter->irInstructionAllocator.add_write_context_32 = add_write_context_32;
         jitter->irInstructionAllocator.add_write_context_64 = add_write_context_64;
         jitter->irInstructionAllocator.add_insn_marker = add_insn_marker;
-
-        /* setup pool memory */
-        pool_mem_size = (size - struct_jitter_size_aligned_16) / 2;
-        memoryPoolInit(&jitter->registerPoolAllocator, memory + struct_jitter_size_aligned_16, pool_mem_size);
-        memoryPoolInit(&jitter->instructionPoolAllocator, memory + struct_jitter_size_aligned_16 + pool_mem_size, pool_mem_size);
+        jitter->irInstructionAllocator.add_cmpxchg_8 = add_cmpxchg_8;
+        jitter->irInstructionAllocator.add_cmpxchg_16 = add_cmpxchg_16;
+        jitter->irInstructionAllocator.add_cmpxchg_32 = add_cmpxchg_32;
+        jitter->irInstructionAllocator.add_cmpxchg_64 = add_cmpxchg_64;
+        jitter->irInstructionAllocator.add_xchg_8 = add_xchg_8;
+        jitter->irInstructionAllocator.add_xchg_16 = add_xchg_16;
+        jitter->irInstructionAllocator.add_xchg_32 = add_xchg_32;
+        jitter->irInstructionAllocator.add_xchg_64 = add_xchg_64;
+        jitter->irInstructionAllocator.add_fetch_add_8 = add_fetch_add_8;
+        jitter->irInstructionAllocator.add_fetch_add_16 = add_fetch_add_16;
+        jitter->irInstructionAllocator.add_fetch_add_32 = add_fetch_add_32;
+        jitter->irInstructionAllocator.add_fetch_add_64 = add_fetch_add_64;
+
+        /* setup pool memory. Each instruction defines at most one register so split memory
+           so both pools hold the same number of entries */
+        entryNb = (size - struct_jitter_size_aligned_16) / (sizeof(struct irRegister) + sizeof(struct irInstruction));
+        memoryPoolInit(&jitter->registerPoolAllocator, memory + struct_jitter_size_aligned_16, entryNb * sizeof(struct irRegister));
+        memoryPoolInit(&jitter->instructionPoolAllocator, memory + struct_jitter_size_aligned_16 + entryNb * sizeof(struct irRegister), entryNb * sizeof(struct irInstruction));
 
         resetJitter((jitContext) jitter);
     }
@@ -1029,11 +1226,12 @@ void displayIr(jitContext handle)
     struct jitter *jitter = (struct jitter *) handle;
     int insnNb = jitter->instructionPoolAllocator.index / sizeof(struct irInstruction);
     struct irInstruction *insn = (struct irInstruction *) jitter->instructionPoolAllocator.buffer;
+    struct irRegister *regs = (struct irRegister *) jitter->registerPoolAllocator.buffer;
     int i;
 
     for(i=0;i<insnNb;i++) {
         printf("%2d : ", i);
-        displayInsn(insn++);
+        displayInsn(regs, insn++);
     }
 }
 
@@ -1042,15 +1240,357 @@ int jitCode(jitContext handle, char *buffer, int bufferSize)
     struct jitter *jitter = (struct jitter *) handle;
     int insnNb = jitter->instructionPoolAllocator.index / sizeof(struct irInstruction);
     struct irInstruction *irArray = (struct irInstruction *) jitter->instructionPoolAllocator.buffer;
+    int regNb = jitter->registerPoolAllocator.index / sizeof(struct irRegister);
+    struct irRegister *regArray = (struct irRegister *) jitter->registerPoolAllocator.buffer;
 
-    return jitter->backend->jit(jitter->backend, irArray, insnNb, buffer, bufferSize);
+    return jitter->backend->jit(jitter->backend, irArray, insnNb, regArray, regNb, buffer, bufferSize);
 }
 
-int findInsn(jitContext handle, char *buffer, int bufferSize, int offset)
+/* insn map is marker number followed by host offset delta and value delta of each marker.
+   All of them are encoded as uleb128 */
+static unsigned char *encode_uleb128(unsigned char *pos, uint64_t value)
+{
+    do {
+        *pos = value & 0x7f;
+        value >>= 7;
+        if (value)
+            *pos |= 0x80;
+        pos++;
+    } while(value);
+
+    return pos;
+}
+
+static unsigned char *decode_uleb128(unsigned char *pos, uint32_t *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    do {
+        *value |= (*pos & 0x7f) << shift;
+        shift += 7;
+    } while(*pos++ & 0x80);
+
+    return pos;
+}
+
+static unsigned char *decode_uleb128_64(unsigned char *pos, uint64_t *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    do {
+        *value |= (uint64_t) (*pos & 0x7f) << shift;
+        shift += 7;
+    } while(*pos++ & 0x80);
+
+    return pos;
+}
+
+int jitInsnMap(jitContext handle, char *buffer, int bufferSize)
 {
     struct jitter *jitter = (struct jitter *) handle;
     int insnNb = jitter->instructionPoolAllocator.index / sizeof(struct irInstruction);
     struct irInstruction *irArray = (struct irInstruction *) jitter->instructionPoolAllocator.buffer;
+    unsigned char *pos = (unsigned char *) buffer;
+    struct insn_marker prev = {0, 0};
+    struct insn_marker *markers;
+    int markerNb = 0;
+    int i;
+
+    /* backend may add one marker per exit for out of line code */
+    for(i = 0; i < insnNb; i++)
+        if (irArray[i].type == IR_INSN_MARKER || irArray[i].type == IR_EXIT)
+            markerNb++;
+    markers = alloca((markerNb + 1) * sizeof(struct insn_marker));
+    markerNb = jitter->backend->get_markers(jitter->backend, markers, markerNb);
+
+    /* worst case is 5 bytes for each uleb128. Value may go backward for out of line code so
+       its delta is zigzag encoded */
+    assert((1 + 2 * markerNb) * 5 <= bufferSize);
+    pos = encode_uleb128(pos, markerNb);
+    for(i = 0; i < markerNb; i++) {
+        int32_t delta = markers[i].value - prev.value;
+
+        assert(markers[i].host_offset >= prev.host_offset);
+        pos = encode_uleb128(pos, markers[i].host_offset - prev.host_offset);
+        pos = encode_uleb128(pos, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+        prev = markers[i];
+    }
+
+    return pos - (unsigned char *) buffer;
+}
+
+uint32_t lookupInsnMap(void *map, int offset)
+{
+    unsigned char *pos = (unsigned char *) map;
+    struct insn_marker current = {0, 0};
+    uint32_t res = ~0;
+    uint32_t markerNb;
+    uint32_t delta;
+    int i;
+
+    pos = decode_uleb128(pos, &markerNb);
+    for(i = 0; i < markerNb; i++) {
+        pos = decode_uleb128(pos, &delta);
+        current.host_offset += delta;
+        pos = decode_uleb128(pos, &delta);
+        current.value += (delta >> 1) ^ -(delta & 1);
+        /* marker applies to code up to next marker. When several markers share the same
+           offset, previous ones have no code and so last one wins */
+        if (current.host_offset > offset)
+            break;
+        res = current.value;
+    }
+
+    return res;
+}
+
+/* serialized ir is instruction number followed by each instruction type and operands, all
+   encoded as uleb128. Registers are referenced by their definition order plus one, zero
+   is used for a NULL register. Destination registers are implicit since each instruction
+   defines at most one register */
+#define SERIALIZED_INSN_MAX_SIZE    64
+
+static unsigned char *encode_reg(unsigned char *pos, int32_t index)
+{
+    return encode_uleb128(pos, (uint32_t) (index + 1));
+}
+
+static unsigned char *decode_reg(unsigned char *pos, struct irRegister **regs, int regNb, struct irRegister **reg)
+{
+    uint32_t value;
+
+    pos = decode_uleb128(pos, &value);
+    assert(value <= regNb);
+    *reg = value?regs[value - 1]:NULL;
+    assert(value == 0 || *reg != NULL);
+
+    return pos;
+}
+
+static int serializeInsn(struct irInstruction *insn, unsigned char *buffer)
+{
+    unsigned char *pos = buffer;
+    int i;
+
+    pos = encode_uleb128(pos, insn->type);
+    switch(insn->type) {
+        case IR_MOV_CONST_8: case IR_MOV_CONST_16: case IR_MOV_CONST_32: case IR_MOV_CONST_64:
+            pos = encode_uleb128(pos, insn->u.mov.value);
+            break;
+        case IR_LOAD_8: case IR_LOAD_16: case IR_LOAD_32: case IR_LOAD_64:
+            pos = encode_reg(pos, insn->u.load.address);
+            break;
+        case IR_STORE_8: case IR_STORE_16: case IR_STORE_32: case IR_STORE_64:
+            pos = encode_reg(pos, insn->u.store.src);
+            pos = encode_reg(pos, insn->u.store.address);
+            break;
+        case IR_ITE_8: case IR_ITE_16: case IR_ITE_32: case IR_ITE_64:
+            pos = encode_reg(pos, insn->u.ite.pred);
+            pos = encode_reg(pos, insn->u.ite.trueOp);
+            pos = encode_reg(pos, insn->u.ite.falseOp);
+            break;
+        case IR_READ_8: case IR_READ_16: case IR_READ_32: case IR_READ_64:
+            pos = encode_uleb128(pos, (uint32_t) insn->u.read_context.offset);
+            break;
+        case IR_WRITE_8: case IR_WRITE_16: case IR_WRITE_32: case IR_WRITE_64:
+            pos = encode_reg(pos, insn->u.write_context.src);
+            pos = encode_uleb128(pos, (uint32_t) insn->u.write_context.offset);
+            break;
+        case IR_CMPXCHG_8: case IR_CMPXCHG_16: case IR_CMPXCHG_32: case IR_CMPXCHG_64:
+        case IR_XCHG_8: case IR_XCHG_16: case IR_XCHG_32: case IR_XCHG_64:
+        case IR_FETCH_ADD_8: case IR_FETCH_ADD_16: case IR_FETCH_ADD_32: case IR_FETCH_ADD_64:
+            pos = encode_reg(pos, insn->u.atomic.address);
+            pos = encode_reg(pos, insn->u.atomic.op1);
+            pos = encode_reg(pos, insn->u.atomic.op2);
+            break;
+        case IR_CALL_VOID: case IR_CALL_8: case IR_CALL_16: case IR_CALL_32: case IR_CALL_64:
+            pos = encode_reg(pos, insn->u.call.address);
+            for(i = 0; i < 4; i++)
+                pos = encode_reg(pos, insn->u.call.param[i]);
+            break;
+        case IR_BINOP:
+            pos = encode_uleb128(pos, insn->u.binop.type);
+            pos = encode_reg(pos, insn->u.binop.op1);
+            pos = encode_reg(pos, insn->u.binop.op2);
+            break;
+        case IR_CAST:
+            pos = encode_uleb128(pos, insn->u.cast.type);
+            pos = encode_reg(pos, insn->u.cast.op);
+            break;
+        case IR_EXIT:
+            pos = encode_reg(pos, insn->u.exit.value);
+            pos = encode_reg(pos, insn->u.exit.pred);
+            break;
+        case IR_INSN_MARKER:
+            pos = encode_uleb128(pos, insn->u.marker.value);
+            break;
+        default:
+            assert(0);
+    }
+    assert(pos - buffer <= SERIALIZED_INSN_MAX_SIZE);
+
+    return pos - buffer;
+}
+
+int serializeIr(jitContext handle, char *buffer, int bufferSize)
+{
+    struct jitter *jitter = (struct jitter *) handle;
+    int insnNb = jitter->instructionPoolAllocator.index / sizeof(struct irInstruction);
+    struct irInstruction *irArray = (struct irInstruction *) jitter->instructionPoolAllocator.buffer;
+    unsigned char insnBuffer[SERIALIZED_INSN_MAX_SIZE];
+    int res;
+    int i;
+
+    res = encode_uleb128(insnBuffer, insnNb) - insnBuffer;
+    if (buffer) {
+        assert(res <= bufferSize);
+        memcpy(buffer, insnBuffer, res);
+    }
+    for(i = 0; i < insnNb; i++) {
+        int insnSize = serializeInsn(&irArray[i], insnBuffer);
+
+        if (buffer) {
+            assert(res + insnSize <= bufferSize);
+            memcpy(buffer + res, insnBuffer, insnSize);
+        }
+        res += insnSize;
+    }
+
+    return res;
+}
+
+void deserializeIr(jitContext handle, char *buffer, int size)
+{
+    static const enum irRegisterType castToDstType[] = {
+        IR_REG_16, IR_REG_32, IR_REG_64,
+        IR_REG_16, IR_REG_32, IR_REG_64,
+        IR_REG_32, IR_REG_64,
+        IR_REG_32, IR_REG_64,
+        IR_REG_64,
+        IR_REG_64,
+        IR_REG_8, IR_REG_8, IR_REG_8,
+        IR_REG_16, IR_REG_16,
+        IR_REG_32};
+    struct jitter *jitter = (struct jitter *) handle;
+    struct irInstructionAllocator *ir = &jitter->irInstructionAllocator;
+    unsigned char *pos = (unsigned char *) buffer;
+    unsigned char *end = pos + size;
+    struct irRegister **regs;
+    struct irRegister *op[5];
+    int regNb = 0;
+    uint32_t insnNb;
+    uint32_t type;
+    uint32_t subType;
+    uint64_t value;
+    int i, j;
+
+    pos = decode_uleb128(pos, &insnNb);
+    /* each instruction defines at most one register */
+    regs = alloca(insnNb * sizeof(struct irRegister *));
+    for(i = 0; i < insnNb; i++) {
+        struct irRegister *dst = NULL;
+
+        assert(pos < end);
+        pos = decode_uleb128(pos, &type);
+        switch(type) {
+            case IR_MOV_CONST_8: case IR_MOV_CONST_16: case IR_MOV_CONST_32: case IR_MOV_CONST_64:
+                pos = decode_uleb128_64(pos, &value);
+                dst = add_mov_const(ir, value, type, IR_REG_8 + type - IR_MOV_CONST_8);
+                break;
+            case IR_LOAD_8: case IR_LOAD_16: case IR_LOAD_32: case IR_LOAD_64:
+                pos = decode_reg(pos, regs, regNb, &op[0]);
+                dst = add_load(ir, op[0], type, IR_REG_8 + type - IR_LOAD_8);
+                break;
+            case IR_STORE_8: case IR_STORE_16: case IR_STORE_32: case IR_STORE_64:
+                pos = decode_reg(pos, regs, regNb, &op[0]);
+                pos = decode_reg(pos, regs, regNb, &op[1]);
+                add_store(ir, op[0], op[1], type);
+                break;
+            case IR_ITE_8: case IR_ITE_16: case IR_ITE_32: case IR_ITE_64:
+                for(j = 0; j < 3; j++)
+                    pos = decode_reg(pos, regs, regNb, &op[j]);
+                dst = add_ite(ir, op[0], op[1], op[2], type);
+                break;
+            case IR_READ_8: case IR_READ_16: case IR_READ_32: case IR_READ_64:
+                pos = decode_uleb128(pos, &subType);
+                dst = add_read_context(ir, (int32_t) subType, type, IR_REG_8 + type - IR_READ_8);
+                break;
+            case IR_WRITE_8: case IR_WRITE_16: case IR_WRITE_32: case IR_WRITE_64:
+                pos = decode_reg(pos, regs, regNb, &op[0]);
+                pos = decode_uleb128(pos, &subType);
+                add_write_context(ir, op[0], (int32_t) subType, type);
+                break;
+            case IR_CMPXCHG_8: case IR_CMPXCHG_16: case IR_CMPXCHG_32: case IR_CMPXCHG_64:
+            case IR_XCHG_8: case IR_XCHG_16: case IR_XCHG_32: case IR_XCHG_64:
+            case IR_FETCH_ADD_8: case IR_FETCH_ADD_16: case IR_FETCH_ADD_32: case IR_FETCH_ADD_64:
+                for(j = 0; j < 3; j++)
+                    pos = decode_reg(pos, regs, regNb, &op[j]);
+                dst = add_atomic(ir, op[0], op[1], op[2], type, IR_REG_8 + (type - IR_CMPXCHG_8) % 4);
+                break;
+            case IR_CALL_VOID: case IR_CALL_8: case IR_CALL_16: case IR_CALL_32: case IR_CALL_64:
+                for(j = 0; j < 5; j++)
+                    pos = decode_reg(pos, regs, regNb, &op[j]);
+                dst = add_call(ir, "Unknown", op[0], &op[1], type);
+                break;
+            case IR_BINOP:
+                pos = decode_uleb128(pos, &subType);
+                pos = decode_reg(pos, regs, regNb, &op[0]);
+                pos = decode_reg(pos, regs, regNb, &op[1]);
+                assert(subType <= IR_BINOP_FCMPE_64);
+                dst = add_binop(ir, op[0], op[1], subType);
+                break;
+            case IR_CAST:
+                pos = decode_uleb128(pos, &subType);
+                pos = decode_reg(pos, regs, regNb, &op[0]);
+                assert(subType < sizeof(castToDstType) / sizeof(castToDstType[0]));
+                dst = add_cast(ir, op[0], subType, castToDstType[subType]);
+                break;
+            case IR_EXIT:
+                pos = decode_reg(pos, regs, regNb, &op[0]);
+                pos = decode_reg(pos, regs, regNb, &op[1]);
+                add_exit_cond(ir, op[0], op[1]);
+                break;
+            case IR_INSN_MARKER:
+                pos = decode_uleb128(pos, &subType);
+                add_insn_marker(ir, subType);
+                break;
+            default:
+                assert(0);
+        }
+        if (dst)
+            regs[regNb++] = dst;
+    }
+    assert(pos == end);
+}
+
+/* jit statistics */
+static uint64_t getTimeNs()
+{
+    struct timespec ts;
+
+    syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+uint64_t jitStatsStart(struct backend *backend)
+{
+    if (!backend->stats)
+        return 0;
+    memset(backend->stats, 0, sizeof(*backend->stats));
+
+    return getTimeNs();
+}
+
+void jitStatsPassEnd(struct backend *backend, enum jitPass pass, uint64_t *time)
+{
+    uint64_t now;
 
-    return jitter->backend->get_marker(jitter->backend, irArray, insnNb, buffer, bufferSize, offset);
+    if (!backend->stats)
+        return;
+    now = getTimeNs();
+    backend->stats->pass_time[pass] += now - *time;
+    *time = now;
 }
@@ -99,6 +99,17 @@ struct irInstructionAllocator {
     struct irRegister *(*add_cmpne_16)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
     struct irRegister *(*add_cmpne_32)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
     struct irRegister *(*add_cmpne_64)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
+    /* crc32c accumulate of op2 into 32 bits op1. Only use when host has sse4.2 */
+    struct irRegister *(*add_crc32c_8)(struct irInstructionAllocator *, struct irRegister *crc, struct irRegister *value);
+    struct irRegister *(*add_crc32c_16)(struct irInstructionAllocator *, struct irRegister *crc, struct irRegister *value);
+    struct irRegister *(*add_crc32c_32)(struct irInstructionAllocator *, struct irRegister *crc, struct irRegister *value);
+    struct irRegister *(*add_crc32c_64)(struct irInstructionAllocator *, struct irRegister *crc, struct irRegister *value);
+    /* floating point compare of op1 and op2 bit patterns. Result has arm nzcv flags in bits 31 to 28,
+       unordered being 0011. fcmpe also raises invalid for quiet NaN. Only use when host has sse2 */
+    struct irRegister *(*add_fcmp_32)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
+    struct irRegister *(*add_fcmp_64)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
+    struct irRegister *(*add_fcmpe_32)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
+    struct irRegister *(*add_fcmpe_64)(struct irInstructionAllocator *, struct irRegister *op1, struct irRegister *op2);
     struct irRegister *(*add_8U_to_16)(struct irInstructionAllocator *, struct irRegister *op);
     struct irRegister *(*add_8U_to_32)(struct irInstructionAllocator *, struct irRegister *op);
     struct irRegister *(*add_8U_to_64)(struct irInstructionAllocator *, struct irRegister *op);
@@ -128,6 +139,19 @@ struct irInstructionAllocator {
     void (*add_write_context_32)(struct irInstructionAllocator *, struct irRegister *src, int32_t offset);
     void (*add_write_context_64)(struct irInstructionAllocator *, struct irRegister *src, int32_t offset);
     void (*add_insn_marker)(struct irInstructionAllocator *, uint32_t value);
+    /* atomic operations. All of them return previous memory content */
+    struct irRegister *(*add_cmpxchg_8)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *expected, struct irRegister *value);
+    struct irRegister *(*add_cmpxchg_16)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *expected, struct irRegister *value);
+    struct irRegister *(*add_cmpxchg_32)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *expected, struct irRegister *value);
+    struct irRegister *(*add_cmpxchg_64)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *expected, struct irRegister *value);
+    struct irRegister *(*add_xchg_8)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_xchg_16)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_xchg_32)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_xchg_64)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_fetch_add_8)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_fetch_add_16)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_fetch_add_32)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
+    struct irRegister *(*add_fetch_add_64)(struct irInstructionAllocator *, struct irRegister *address, struct irRegister *value);
 };
 
 struct backend_execute_result {
@@ -135,13 +159,40 @@ struct backend_execute_result {
     void *link_patch_area;
 };
 
+struct insn_marker {
+    uint32_t host_offset;
+    uint32_t value;
+};
+
+/* jit passes timed in struct jit_stats */
+enum jitPass {
+    JIT_PASS_LOWER,         /* ir to backend instructions */
+    JIT_PASS_OPTIMIZE,      /* backend instructions rewriting */
+    JIT_PASS_REGALLOC,
+    JIT_PASS_CODEGEN,
+    JIT_PASS_NB
+};
+
+/* statistics of last jit call. Only filled when backend stats is set */
+struct jit_stats {
+    uint64_t pass_time[JIT_PASS_NB];    /* in nanoseconds */
+    int max_live;                       /* peak number of host registers or slots in use */
+    int spill_nb;                       /* number of values living in a spill slot */
+};
+
 struct backend {
-    int (*jit)(struct backend *backend, struct irInstruction *irArray, int irInsnNb, char *buffer, int bufferSize);
+    int (*jit)(struct backend *backend, struct irInstruction *irArray, int irInsnNb, struct irRegister *irRegArray, int irRegNb, char *buffer, int bufferSize);
     void (*reset)(struct backend *backend);
     struct backend_execute_result (*execute)(struct backend *backend, char *buffer, uint64_t context);
     void (*request_signal_alternate_exit)(struct backend *backend, void *ucp, uint64_t result);
-    uint32_t (*get_marker)(struct backend *backend, struct irInstruction *irArray, int irInsnNb, char *buffer, int bufferSize, int offset);
+    /* fill markers with insn markers of last jitted sequence and return their number */
+    int (*get_markers)(struct backend *backend, struct insn_marker *markers, int markerNb);
     void (*patch)(struct backend *backend, void *link_patch_area, void *cache_area);
+    /* return host address jitted code will resume at when ucp interrupted a helper called
+       from jitted code, NULL otherwise */
+    void *(*get_helper_return_address)(struct backend *backend, void *ucp);
+    /* NULL unless caller wants jit statistics */
+    struct jit_stats *stats;
 };
 
 /* jitter public api */
@@ -157,8 +208,15 @@ struct irInstructionAllocator *getIrInstructionAllocator(jitContext);
 void displayIr(jitContext handle);
 /* Translate ir instruction sequence into buffer area using backend */
 int jitCode(jitContext handle, char *buffer, int bufferSize);
-/* Find guest insn address offset that is associated with byte located at buffer + offset */
-int findInsn(jitContext handle, char *buffer, int bufferSize, int offset);
+/* Write compact map of insn markers host offset of last translated sequence. Return map size */
+int jitInsnMap(jitContext handle, char *buffer, int bufferSize);
+/* Find insn marker value that is associated with byte located at offset of code described by map */
+uint32_t lookupInsnMap(void *map, int offset);
+/* Write compact binary encoding of current instruction sequence. Return encoding size. When buffer
+   is NULL only compute size */
+int serializeIr(jitContext handle, char *buffer, int bufferSize);
+/* Append instruction sequence encoded by serializeIr to current one */
+void deserializeIr(jitContext handle, char *buffer, int size);
 
 #endif
 
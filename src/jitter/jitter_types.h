@@ -28,6 +28,10 @@ extern "C" {
 #ifndef __JITTER_TYPES__
 #define __JITTER_TYPES__ 1
 
+/* jitted code is executed from a JIT_CODE_ALIGN bytes aligned address. Backends rely on
+   it to align code that is patched at runtime. */
+#define JIT_CODE_ALIGN      16
+
 /* define register type and size */
 enum irRegisterType {
     IR_REG_8,
@@ -37,15 +41,18 @@ enum irRegisterType {
     IR_LAST_REG_TYPE,
 };
 
-/* virtual register structure */
+/* virtual register structure. Registers of a sequence are stored in a dense array and
+   instructions reference them by their index in it */
 struct irRegister {
     enum irRegisterType type;
     int index;
     int firstWriteIndex;
     int lastReadIndex;
-    void *backend;
 };
 
+/* register index used when an optional operand is not present */
+#define IR_NO_REG   (-1)
+
 /* cast type info for cast instruction */
 enum irCastType {
     IR_CAST_8U_TO_16, IR_CAST_8U_TO_32, IR_CAST_8U_TO_64,
@@ -72,6 +79,10 @@ enum irBinopType {
     IR_BINOP_ROR_8, IR_BINOP_ROR_16, IR_BINOP_ROR_32, IR_BINOP_ROR_64,
     IR_BINOP_CMPEQ_8, IR_BINOP_CMPEQ_16, IR_BINOP_CMPEQ_32, IR_BINOP_CMPEQ_64,
     IR_BINOP_CMPNE_8, IR_BINOP_CMPNE_16, IR_BINOP_CMPNE_32, IR_BINOP_CMPNE_64,
+    IR_BINOP_CRC32C_8, IR_BINOP_CRC32C_16, IR_BINOP_CRC32C_32, IR_BINOP_CRC32C_64,
+    /* float compares only exist on 32 and 64 bits */
+    IR_BINOP_FCMP_32, IR_BINOP_FCMP_64,
+    IR_BINOP_FCMPE_32, IR_BINOP_FCMPE_64,
 };
 
 /* list of supported instructions */
@@ -82,66 +93,77 @@ enum irInstructionType {
     IR_ITE_8, IR_ITE_16, IR_ITE_32, IR_ITE_64,
     IR_READ_8, IR_READ_16, IR_READ_32, IR_READ_64,
     IR_WRITE_8, IR_WRITE_16, IR_WRITE_32, IR_WRITE_64,
+    IR_CMPXCHG_8, IR_CMPXCHG_16, IR_CMPXCHG_32, IR_CMPXCHG_64,
+    IR_XCHG_8, IR_XCHG_16, IR_XCHG_32, IR_XCHG_64,
+    IR_FETCH_ADD_8, IR_FETCH_ADD_16, IR_FETCH_ADD_32, IR_FETCH_ADD_64,
     IR_CALL_VOID, IR_CALL_8, IR_CALL_16, IR_CALL_32, IR_CALL_64,
     IR_BINOP, IR_CAST, IR_EXIT, IR_INSN_MARKER,
     IR_LAST_INTRUCTION_TYPE,
 };
 
-/* hold an instruction description */
+/* hold an instruction description. Operands are register indexes so instructions stay small */
 struct irInstruction {
     enum irInstructionType type;
     union {
         struct {
-            struct irRegister *dst;
+            int32_t dst;
             uint64_t value;
         } mov;
         struct {
-            struct irRegister *dst;
-            struct irRegister *address;
+            int32_t dst;
+            int32_t address;
         } load;
         struct {
-            struct irRegister *src;
-            struct irRegister *address;
+            int32_t src;
+            int32_t address;
         } store;
         struct {
             enum irBinopType type;
-            struct irRegister *dst;
-            struct irRegister *op1;
-            struct irRegister *op2;
+            int32_t dst;
+            int32_t op1;
+            int32_t op2;
         } binop;
         struct {
-            struct irRegister *address;
-            char *name;
-            struct irRegister *param[4];
-            struct irRegister *result;
+            int32_t address;
+            int32_t param[4];
+            int32_t result;
         } call;
         struct {
-            struct irRegister *dst;
-            struct irRegister *pred;
-            struct irRegister *trueOp;
-            struct irRegister *falseOp;
+            int32_t dst;
+            int32_t pred;
+            int32_t trueOp;
+            int32_t falseOp;
         } ite;
         struct {
             enum irCastType type;
-            struct irRegister *dst;
-            struct irRegister *op;
+            int32_t dst;
+            int32_t op;
         } cast;
         /* if predicate is true then sequence of insn will return value */
         struct {
-            struct irRegister *value;
-            struct irRegister *pred;
+            int32_t value;
+            int32_t pred;
         } exit;
         struct {
-            struct irRegister *dst;
+            int32_t dst;
             int32_t offset;
         } read_context;
         struct {
-            struct irRegister *src;
+            int32_t src;
             int32_t offset;
         } write_context;
         struct {
             uint32_t value;
         } marker;
+        /* dst always receive previous memory content. For cmpxchg op1 is the
+           expected value and op2 the new one. For xchg and fetch_add op2 is
+           not used */
+        struct {
+            int32_t dst;
+            int32_t address;
+            int32_t op1;
+            int32_t op2;
+        } atomic;
     } u;
 };
 
@@ -34,13 +34,31 @@
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
     (type *)( (char *)__mptr - offsetof(type,member) );})
 
-#define REG_NUMBER  8
+#define REG_NUMBER          10
+#define SPILL_SLOT_NUMBER   256
+/* execute_be_x86_64 reserves JIT_FRAME_SIZE bytes above jit code return address so sp never
+   moves inside jit code. Spill slots come first, then caller saved registers slots. Last
+   8 bytes hold backend pointer. */
+#define JIT_FRAME_SIZE      2112
+#define SLOT_OFFSET(slot)   (8 + (slot) * 8)
+#define CALLER_SAVED_REG_NB 5
+/* patch site alignment is relative to code buffer start which ends up JIT_CODE_ALIGN aligned */
+#define PATCH_SITE_SIZE     8
+
+enum x86PhysicalRegister {
+    X86_RAX, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+    X86_R8, X86_R9, X86_R10, X86_R11, X86_R12, X86_R13, X86_R14, X86_R15
+};
 
 struct x86Register {
     int isConstant;
+    uint64_t value;
     int index;
+    int spillSlot;
     int firstWriteIndex;
     int lastReadIndex;
+    int readNb;
+    int immReadNb;
 };
 
 enum x86BinopType {
@@ -54,7 +72,10 @@ enum x86BinopType {
     X86_BINOP_ASR,
     X86_BINOP_ROR,
     X86_BINOP_CMPEQ,
-    X86_BINOP_CMPNE
+    X86_BINOP_CMPNE,
+    X86_BINOP_CRC32C,
+    X86_BINOP_FCMP,
+    X86_BINOP_FCMPE
 };
 
 enum x86InstructionType {
@@ -68,7 +89,11 @@ enum x86InstructionType {
     X86_CALL,
     X86_READ_8, X86_READ_16, X86_READ_32, X86_READ_64,
     X86_WRITE_8, X86_WRITE_16, X86_WRITE_32, X86_WRITE_64,
-    X86_INSN_MARKER
+    X86_CMPXCHG_8, X86_CMPXCHG_16, X86_CMPXCHG_32, X86_CMPXCHG_64,
+    X86_XCHG_8, X86_XCHG_16, X86_XCHG_32, X86_XCHG_64,
+    X86_FETCH_ADD_8, X86_FETCH_ADD_16, X86_FETCH_ADD_32, X86_FETCH_ADD_64,
+    X86_INSN_MARKER,
+    X86_NOP
 };
 
 struct x86Instruction {
@@ -81,15 +106,26 @@ struct x86Instruction {
         struct {
             struct x86Register *dst;
             struct x86Register *address;
+            int32_t disp;
         } load;
         struct {
             struct x86Register *src;
             struct x86Register *address;
+            int32_t disp;
         } store;
         struct {
             struct x86Register *value;
             struct x86Register *pred;
             int is_patchable;
+            /* fused compare when cmpOp1 is not NULL */
+            enum x86BinopType cmpType;
+            struct x86Register *cmpOp1;
+            struct x86Register *cmpOp2;
+            /* rel32 of jcc to out of line exit stub */
+            char *stub_patch;
+            int stub_value_index;
+            /* marker value of guest instruction owning the exit */
+            uint32_t stub_marker_value;
         } exit;
         struct {
             enum x86BinopType type;
@@ -112,6 +148,7 @@ struct x86Instruction {
             struct x86Register *address;
             struct x86Register *param[4];
             struct x86Register *result;
+            uint32_t liveRegsMask;
         } call;
         struct {
             struct x86Register *dst;
@@ -123,7 +160,18 @@ struct x86Instruction {
         } write_context;
         struct {
             uint32_t value;
+            uint32_t host_offset;
         } marker;
+        struct {
+            struct x86Register *op1;
+            struct x86Register *op2;
+        } nop;
+        struct {
+            struct x86Register *dst;
+            struct x86Register *address;
+            struct x86Register *op1;
+            struct x86Register *op2;
+        } atomic;
     } u;
 };
 
@@ -142,6 +190,10 @@ struct inter {
     struct memoryPool instructionPoolAllocator;
     int regIndex;
     int instructionIndex;
+    int callSaveSlot;
+    char *codeBuffer;
+    /* x86 register of each ir register of the sequence being jitted */
+    struct x86Register *irRegisters;
 };
 
 /* pool */
@@ -172,27 +224,83 @@ static void memoryPoolInit(struct memoryPool *pool, char *buffer, int size)
 }
 
 /* register allocation */
-static struct x86Register *allocateRegister(struct inter *inter, struct irRegister *irReg)
+static struct x86Register *allocateRegister(struct inter *inter, int32_t irRegIndex)
 {
     struct x86Register *res;
     struct memoryPool *pool = (struct memoryPool *) &inter->registerPoolAllocator;
 
-    if (irReg && irReg->backend) {
-        res = irReg->backend;
-    } else {
+    if (irRegIndex == IR_NO_REG)
         res = (struct x86Register *) pool->alloc(pool, sizeof(struct x86Register));
+    else
+        res = &inter->irRegisters[irRegIndex];
+    /* ir registers entries are created on first use */
+    if (irRegIndex == IR_NO_REG || res->firstWriteIndex == -1) {
         res->isConstant = 0;
         res->index = inter->regIndex++;
+        res->spillSlot = -1;
         res->firstWriteIndex = inter->instructionIndex;
         res->lastReadIndex = -1;
-        if (irReg)
-            irReg->backend = res;
+        res->readNb = 0;
+        res->immReadNb = 0;
     }
 
     return res;
 }
 
+/* instruction selection. Constants are encoded as immediates when operand allows it */
+static int isImm8(uint64_t value)
+{
+    return value == (uint64_t) (int64_t) (int8_t) value;
+}
+
+static int isImm32(uint64_t value)
+{
+    return value == (uint64_t) (int64_t) (int32_t) value;
+}
+
+static int isBinopImmediate(enum x86InstructionType type, enum x86BinopType subType, struct x86Register *op2)
+{
+    if (!op2->isConstant)
+        return 0;
+
+    switch(subType) {
+        case X86_BINOP_SHL: case X86_BINOP_SHR: case X86_BINOP_ASR: case X86_BINOP_ROR:
+            return 1;
+        case X86_BINOP_CMPEQ: case X86_BINOP_CMPNE:
+            /* comparison is done on 64 bits */
+            return isImm32(op2->value);
+        case X86_BINOP_CRC32C: case X86_BINOP_FCMP: case X86_BINOP_FCMPE:
+            return 0;
+        default:
+            /* only low bits of narrow results are kept */
+            return type != X86_BINOP_64 || isImm32(op2->value);
+    }
+}
+
+static int isStoreImmediate(int size, struct x86Register *src)
+{
+    return src->isConstant && (size != 64 || isImm32(src->value));
+}
+
+static int isAddressImmediate(struct x86Register *address)
+{
+    return address->isConstant && isImm32(address->value);
+}
+
 /* instructions allocation */
+static void markRead(struct inter *inter, struct x86Register *reg)
+{
+    reg->lastReadIndex = inter->instructionIndex;
+    reg->readNb++;
+}
+
+static void markReadImm(struct inter *inter, struct x86Register *reg, int isImm)
+{
+    markRead(inter, reg);
+    if (isImm)
+        reg->immReadNb++;
+}
+
 static void add_mov_const(struct inter *inter, struct x86Register *dst, uint64_t value)
 {
     struct memoryPool *pool = &inter->instructionPoolAllocator;
@@ -201,6 +309,7 @@ static void add_mov_const(struct inter *inter, struct x86Register *dst, uint64_t
     insn->type = X86_MOV_CONST;
     insn->u.mov.dst = dst;
     insn->u.mov.dst->isConstant = 1;
+    insn->u.mov.dst->value = value;
     insn->u.mov.value = value;
 
     inter->instructionIndex++;
@@ -211,11 +320,12 @@ static void add_load(struct inter *inter, enum x86InstructionType type, struct x
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    address->lastReadIndex = inter->instructionIndex;
+    markReadImm(inter, address, isAddressImmediate(address));
 
     insn->type = type;
     insn->u.load.dst = dst;
     insn->u.load.address = address;
+    insn->u.load.disp = 0;
 
     inter->instructionIndex++;
 }
@@ -225,12 +335,13 @@ static void add_store(struct inter *inter, enum x86InstructionType type, struct
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    address->lastReadIndex = inter->instructionIndex;
-    src->lastReadIndex = inter->instructionIndex;
+    markReadImm(inter, address, isAddressImmediate(address));
+    markReadImm(inter, src, isStoreImmediate(8 << (type - X86_STORE_8), src));
 
     insn->type = type;
     insn->u.store.src = src;
     insn->u.store.address = address;
+    insn->u.store.disp = 0;
 
     inter->instructionIndex++;
 }
@@ -240,14 +351,17 @@ static void add_exit(struct inter *inter, struct x86Register *value, struct x86R
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    value->lastReadIndex = inter->instructionIndex;
+    markReadImm(inter, value, value->isConstant);
     if (pred)
-        pred->lastReadIndex = inter->instructionIndex;
+        markRead(inter, pred);
 
     insn->type = X86_EXIT;
     insn->u.exit.value = value;
     insn->u.exit.pred = pred;
     insn->u.exit.is_patchable = value->isConstant;
+    insn->u.exit.cmpOp1 = NULL;
+    insn->u.exit.cmpOp2 = NULL;
+    insn->u.exit.stub_patch = NULL;
 
     inter->instructionIndex++;
 }
@@ -257,8 +371,8 @@ static void add_binop(struct inter *inter, enum x86InstructionType type, enum x8
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    op1->lastReadIndex = inter->instructionIndex;
-    op2->lastReadIndex = inter->instructionIndex;
+    markRead(inter, op1);
+    markReadImm(inter, op2, isBinopImmediate(type, subType, op2));
 
     insn->type = type;
     insn->u.binop.type = subType;
@@ -274,9 +388,9 @@ static void add_ite(struct inter *inter, struct x86Register *dst, struct x86Regi
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    pred->lastReadIndex = inter->instructionIndex;
-    trueOp->lastReadIndex = inter->instructionIndex;
-    falseOp->lastReadIndex = inter->instructionIndex;
+    markRead(inter, pred);
+    markRead(inter, trueOp);
+    markRead(inter, falseOp);
 
     insn->type = X86_ITE;
     insn->u.ite.dst = dst;
@@ -292,7 +406,7 @@ static void add_cast(struct inter *inter, enum irCastType type, struct x86Regist
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    op->lastReadIndex = inter->instructionIndex;
+    markRead(inter, op);
 
     insn->type = X86_CAST;
     insn->u.cast.type = type;
@@ -308,10 +422,10 @@ static void add_call(struct inter *inter, struct x86Register *address, struct x8
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
     int i;
 
-    address->lastReadIndex = inter->instructionIndex;
+    markReadImm(inter, address, 1);
     for(i = 0; i < 4; i++) {
         if (params[i])
-            params[i]->lastReadIndex = inter->instructionIndex;
+            markReadImm(inter, params[i], 1);
     }
 
     insn->type = X86_CALL;
@@ -340,7 +454,7 @@ static void add_write(struct inter *inter, enum x86InstructionType type, struct
     struct memoryPool *pool = &inter->instructionPoolAllocator;
     struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
 
-    src->lastReadIndex = inter->instructionIndex;
+    markReadImm(inter, src, isStoreImmediate(8 << (type - X86_WRITE_8), src));
     insn->type = type;
     insn->u.write_context.src = src;
     insn->u.write_context.offset = offset;
@@ -348,6 +462,25 @@ static void add_write(struct inter *inter, enum x86InstructionType type, struct
     inter->instructionIndex++;
 }
 
+static void add_atomic(struct inter *inter, enum x86InstructionType type, struct x86Register *dst, struct x86Register *address, struct x86Register *op1, struct x86Register *op2)
+{
+    struct memoryPool *pool = &inter->instructionPoolAllocator;
+    struct x86Instruction *insn = (struct x86Instruction *) pool->alloc(pool, sizeof(struct x86Instruction));
+
+    markRead(inter, address);
+    markRead(inter, op1);
+    if (op2)
+        markRead(inter, op2);
+
+    insn->type = type;
+    insn->u.atomic.dst = dst;
+    insn->u.atomic.address = address;
+    insn->u.atomic.op1 = op1;
+    insn->u.atomic.op2 = op2;
+
+    inter->instructionIndex++;
+}
+
 static void add_insn_start_marker(struct inter *inter, uint32_t value)
 {
     struct memoryPool *pool = &inter->instructionPoolAllocator;
@@ -359,7 +492,7 @@ static void add_insn_start_marker(struct inter *inter, uint32_t value)
     inter->instructionIndex++;
 }
 
-static void allocateInstructions(struct inter *inter, struct irInstruction *irArray, int irInsnNb)
+static void allocateInstructions(struct inter *inter, struct irInstruction *irArray, int irInsnNb, struct irRegister *irRegArray)
 {
     int i;
     int goto_p0 = 0;
@@ -424,11 +557,11 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                                 struct x86Register *shiftRightResult;
 
                                 if (goto_p0) {
-                                    shiftValue = allocateRegister(inter, NULL);
+                                    shiftValue = allocateRegister(inter, IR_NO_REG);
                                     add_mov_const(inter, shiftValue, goto_p0);
-                                    shiftLeftResult = allocateRegister(inter, NULL);
+                                    shiftLeftResult = allocateRegister(inter, IR_NO_REG);
                                     add_binop(inter, X86_BINOP_64, X86_BINOP_SHL, shiftLeftResult, op1, shiftValue);
-                                    shiftRightResult = allocateRegister(inter, NULL);
+                                    shiftRightResult = allocateRegister(inter, IR_NO_REG);
                                     add_binop(inter, X86_BINOP_64, X86_BINOP_ASR, shiftRightResult, shiftLeftResult, shiftValue);
                                 } else {
                                     shiftRightResult = allocateRegister(inter, insn->u.binop.op1);
@@ -445,6 +578,15 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                         case IR_BINOP_CMPNE_8: case IR_BINOP_CMPNE_16: case IR_BINOP_CMPNE_32: case IR_BINOP_CMPNE_64:
                             add_binop(inter, X86_BINOP_8 + insn->u.binop.type - IR_BINOP_CMPNE_8, X86_BINOP_CMPNE, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
                             break;
+                        case IR_BINOP_CRC32C_8: case IR_BINOP_CRC32C_16: case IR_BINOP_CRC32C_32: case IR_BINOP_CRC32C_64:
+                            add_binop(inter, X86_BINOP_8 + insn->u.binop.type - IR_BINOP_CRC32C_8, X86_BINOP_CRC32C, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
+                            break;
+                        case IR_BINOP_FCMP_32: case IR_BINOP_FCMP_64:
+                            add_binop(inter, X86_BINOP_32 + insn->u.binop.type - IR_BINOP_FCMP_32, X86_BINOP_FCMP, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
+                            break;
+                        case IR_BINOP_FCMPE_32: case IR_BINOP_FCMPE_64:
+                            add_binop(inter, X86_BINOP_32 + insn->u.binop.type - IR_BINOP_FCMPE_32, X86_BINOP_FCMPE, allocateRegister(inter, insn->u.binop.dst), allocateRegister(inter, insn->u.binop.op1), allocateRegister(inter, insn->u.binop.op2));
+                            break;
                         default:
                             assert(0);
                     }
@@ -457,7 +599,7 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                 add_cast(inter, insn->u.cast.type, allocateRegister(inter, insn->u.cast.dst), allocateRegister(inter, insn->u.cast.op));
                 break;
             case IR_EXIT:
-                if (insn->u.exit.pred)
+                if (insn->u.exit.pred != IR_NO_REG)
                     add_exit(inter, allocateRegister(inter, insn->u.exit.value), allocateRegister(inter, insn->u.exit.pred));
                 else
                     add_exit(inter, allocateRegister(inter, insn->u.exit.value), NULL);
@@ -469,12 +611,12 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                     int i;
 
                     for(i = 0; i < 4; i++) {
-                        if (insn->u.call.param[i])
+                        if (insn->u.call.param[i] != IR_NO_REG)
                             params[i] = allocateRegister(inter, insn->u.call.param[i]);
                         else
                             params[i] = NULL;
                     }
-                    if (insn->u.call.result)
+                    if (insn->u.call.result != IR_NO_REG)
                         result = allocateRegister(inter, insn->u.call.result);
                     else
                         result = NULL;
@@ -484,12 +626,24 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
                 break;
             case IR_READ_8: case IR_READ_16: case IR_READ_32: case IR_READ_64:
                 /* if register is never use then drop the read */
-                if (insn->u.read_context.dst->lastReadIndex != -1)
+                if (irRegArray[insn->u.read_context.dst].lastReadIndex != -1)
                     add_read(inter, X86_READ_8 + insn->type - IR_READ_8, allocateRegister(inter, insn->u.read_context.dst), insn->u.read_context.offset);
                 break;
             case IR_WRITE_8: case IR_WRITE_16: case IR_WRITE_32: case IR_WRITE_64:
                 add_write(inter, X86_WRITE_8 + insn->type - IR_WRITE_8, allocateRegister(inter, insn->u.write_context.src), insn->u.write_context.offset);
                 break;
+            case IR_CMPXCHG_8: case IR_CMPXCHG_16: case IR_CMPXCHG_32: case IR_CMPXCHG_64:
+                add_atomic(inter, X86_CMPXCHG_8 + insn->type - IR_CMPXCHG_8, allocateRegister(inter, insn->u.atomic.dst), allocateRegister(inter, insn->u.atomic.address),
+                           allocateRegister(inter, insn->u.atomic.op1), allocateRegister(inter, insn->u.atomic.op2));
+                break;
+            case IR_XCHG_8: case IR_XCHG_16: case IR_XCHG_32: case IR_XCHG_64:
+                add_atomic(inter, X86_XCHG_8 + insn->type - IR_XCHG_8, allocateRegister(inter, insn->u.atomic.dst), allocateRegister(inter, insn->u.atomic.address),
+                           allocateRegister(inter, insn->u.atomic.op1), NULL);
+                break;
+            case IR_FETCH_ADD_8: case IR_FETCH_ADD_16: case IR_FETCH_ADD_32: case IR_FETCH_ADD_64:
+                add_atomic(inter, X86_FETCH_ADD_8 + insn->type - IR_FETCH_ADD_8, allocateRegister(inter, insn->u.atomic.dst), allocateRegister(inter, insn->u.atomic.address),
+                           allocateRegister(inter, insn->u.atomic.op1), NULL);
+                break;
             case IR_INSN_MARKER:
                 add_insn_start_marker(inter, insn->u.marker.value);
                 break;
@@ -499,13 +653,127 @@ static void allocateInstructions(struct inter *inter, struct irInstruction *irAr
     }
 }
 
+/* instructions fusion. Fused instructions are turned into nops */
+static struct x86Instruction *getSingleUseDefinition(struct x86Instruction *insns, struct x86Register *reg)
+{
+    struct x86Instruction *def;
+
+    if (reg->isConstant || reg->readNb != 1)
+        return NULL;
+    def = &insns[reg->firstWriteIndex];
+    if (def->type >= X86_BINOP_8 && def->type <= X86_BINOP_64 && def->u.binop.dst == reg)
+        return def;
+    if (def->type == X86_CAST && def->u.cast.dst == reg)
+        return def;
+
+    return NULL;
+}
+
+static void extendLiveness(struct x86Register *reg, int insnIndex)
+{
+    if (reg->lastReadIndex < insnIndex)
+        reg->lastReadIndex = insnIndex;
+}
+
+/* nop still releases operands for which it was last reader */
+static void removeInstruction(struct x86Instruction *insn, struct x86Register *op1, struct x86Register *op2)
+{
+    insn->type = X86_NOP;
+    insn->u.nop.op1 = op1;
+    insn->u.nop.op2 = op2;
+}
+
+/* fold address computation of form base + constant into load / store displacement */
+static void foldAddressDisplacement(struct inter *inter)
+{
+    struct x86Instruction *insns = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
+    int i;
+
+    for (i = 0; i < inter->instructionIndex; ++i) {
+        struct x86Instruction *insn = &insns[i];
+        struct x86Instruction *def;
+        struct x86Register **address;
+        int32_t *disp;
+
+        if (insn->type >= X86_LOAD_8 && insn->type <= X86_LOAD_64) {
+            address = &insn->u.load.address;
+            disp = &insn->u.load.disp;
+        } else if (insn->type >= X86_STORE_8 && insn->type <= X86_STORE_64) {
+            address = &insn->u.store.address;
+            disp = &insn->u.store.disp;
+        } else
+            continue;
+        def = getSingleUseDefinition(insns, *address);
+        if (!def || def->type != X86_BINOP_64 || def->u.binop.type != X86_BINOP_ADD ||
+            def->u.binop.op1->isConstant || !isBinopImmediate(def->type, def->u.binop.type, def->u.binop.op2))
+            continue;
+        *address = def->u.binop.op1;
+        *disp = def->u.binop.op2->value;
+        extendLiveness(*address, i);
+        removeInstruction(def, NULL, def->u.binop.op2);
+    }
+}
+
+/* fuse cmpeq / cmpne with the conditional exit that consumes it. Casts between them don't
+   change pred zero-ness since compare result is either all ones or zero */
+static void fuseExitCompare(struct inter *inter)
+{
+    struct x86Instruction *insns = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
+    int i;
+
+    for (i = 0; i < inter->instructionIndex; ++i) {
+        struct x86Instruction *insn = &insns[i];
+        struct x86Instruction *def;
+        struct x86Register *reg;
+
+        if (insn->type != X86_EXIT || !insn->u.exit.pred)
+            continue;
+        reg = insn->u.exit.pred;
+        while ((def = getSingleUseDefinition(insns, reg)) && def->type == X86_CAST)
+            reg = def->u.cast.op;
+        if (!def || (def->u.binop.type != X86_BINOP_CMPEQ && def->u.binop.type != X86_BINOP_CMPNE))
+            continue;
+        insn->u.exit.cmpType = def->u.binop.type;
+        insn->u.exit.cmpOp1 = def->u.binop.op1;
+        insn->u.exit.cmpOp2 = def->u.binop.op2;
+        extendLiveness(insn->u.exit.cmpOp1, i);
+        extendLiveness(insn->u.exit.cmpOp2, i);
+        removeInstruction(def, NULL, NULL);
+        /* remove casts chain */
+        reg = insn->u.exit.pred;
+        while ((def = getSingleUseDefinition(insns, reg)) && def->type == X86_CAST) {
+            reg = def->u.cast.op;
+            removeInstruction(def, NULL, NULL);
+        }
+        insn->u.exit.pred = NULL;
+    }
+}
+
 /* register allocation */
-static int getFreeRegRaw(int *freeRegList)
+/* linear scan allocation. Each register interval is either allocated to a physical
+   register or to a spill slot of the block frame for its whole life. */
+static const int allocatableRegs[REG_NUMBER] = {X86_R8, X86_R9, X86_R10, X86_R11,
+                                                X86_R12, X86_R13, X86_R14, X86_R15,
+                                                X86_RBX, X86_RBP};
+/* rdi holds context pointer */
+static const int callerSavedRegs[CALLER_SAVED_REG_NB] = {X86_RDI, X86_R8, X86_R9, X86_R10, X86_R11};
+
+struct regAllocator {
+    struct x86Register *active[REG_NUMBER];
+    int freeSlotList[SPILL_SLOT_NUMBER];
+    int slotNb;
+    int spillNb;
+};
+
+static int getFreeSlot(struct regAllocator *allocator)
 {
     int i;
-    for(i = 0; i < REG_NUMBER; i++) {
-        if (freeRegList[i]) {
-            freeRegList[i] = 0;
+
+    for(i = 0; i < SPILL_SLOT_NUMBER; i++) {
+        if (allocator->freeSlotList[i]) {
+            allocator->freeSlotList[i] = 0;
+            if (i >= allocator->slotNb)
+                allocator->slotNb = i + 1;
             return i;
         }
     }
@@ -513,28 +781,96 @@ static int getFreeRegRaw(int *freeRegList)
     assert(0);
 }
 
-static void getFreeReg(int *freeRegList, struct x86Register *reg)
+/* constant only use as immediates is never loaded into a register */
+static int isImmediateOnlyConstant(struct x86Register *reg)
+{
+    return reg->isConstant && reg->readNb == reg->immReadNb;
+}
+
+static void releaseReg(struct regAllocator *allocator, struct x86Register *reg)
+{
+    int i;
+
+    if (reg->spillSlot >= 0) {
+        allocator->freeSlotList[reg->spillSlot] = 1;
+    } else {
+        for(i = 0; i < REG_NUMBER; i++)
+            if (allocator->active[i] == reg)
+                allocator->active[i] = NULL;
+    }
+}
+
+static void releaseRegIfLastRead(struct regAllocator *allocator, struct x86Register *reg, int insnIndex)
+{
+    if (reg && reg->lastReadIndex == insnIndex)
+        releaseReg(allocator, reg);
+}
+
+static void getFreeReg(struct regAllocator *allocator, struct x86Register *reg)
 {
-    reg->index = getFreeRegRaw(freeRegList);
+    int victim = 0;
+    int i;
+
+    for(i = 0; i < REG_NUMBER; i++) {
+        if (allocator->active[i] == NULL)
+            break;
+        if (allocator->active[i]->lastReadIndex > allocator->active[victim]->lastReadIndex)
+            victim = i;
+    }
+    if (i < REG_NUMBER) {
+        allocator->active[i] = reg;
+        reg->index = allocatableRegs[i];
+    } else if (allocator->active[victim]->lastReadIndex > reg->lastReadIndex) {
+        /* victim interval end later, so it's the one that goes to memory */
+        allocator->active[victim]->spillSlot = getFreeSlot(allocator);
+        allocator->active[victim] = reg;
+        reg->index = allocatableRegs[victim];
+        allocator->spillNb++;
+    } else {
+        reg->spillSlot = getFreeSlot(allocator);
+        allocator->spillNb++;
+    }
     if (reg->lastReadIndex == -1)
-        freeRegList[reg->index] = 1;
+        releaseReg(allocator, reg);
 }
 
 #ifdef DEBUG_REG_ALLOC
 static void displayReg(struct x86Register *reg)
 {
-    if (reg)
-        printf("R%d[%d->%d[", reg->index + 8, reg->firstWriteIndex, reg->lastReadIndex);
+    if (reg && reg->spillSlot >= 0)
+        printf("S%d[%d->%d[", reg->spillSlot, reg->firstWriteIndex, reg->lastReadIndex);
+    else if (reg)
+        printf("R%d[%d->%d[", reg->index, reg->firstWriteIndex, reg->lastReadIndex);
     else
         printf("NULL");
 }
 #endif
 
+static void updateMaxLive(struct jit_stats *stats, struct regAllocator *allocator)
+{
+    int liveNb = 0;
+    int i;
+
+    for(i = 0; i < REG_NUMBER; i++)
+        liveNb += allocator->active[i] != NULL;
+    for(i = 0; i < allocator->slotNb; i++)
+        liveNb += !allocator->freeSlotList[i];
+    if (liveNb > stats->max_live)
+        stats->max_live = liveNb;
+}
+
 static void allocateRegisters(struct inter *inter)
 {
     int i;
     struct x86Instruction *insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
-    int freeRegList[REG_NUMBER] = {1, 1, 1, 1, 1, 1, 1, 1};
+    struct regAllocator allocator;
+
+    for(i = 0; i < REG_NUMBER; i++)
+        allocator.active[i] = NULL;
+    for(i = 0; i < SPILL_SLOT_NUMBER; i++)
+        allocator.freeSlotList[i] = 1;
+    allocator.slotNb = 0;
+    allocator.spillNb = 0;
 
     for (i = 0; i < inter->instructionIndex; ++i, insn++)
     {
@@ -543,7 +879,8 @@ static void allocateRegisters(struct inter *inter)
 #endif
         switch(insn->type) {
             case X86_MOV_CONST:
-                getFreeReg(freeRegList, insn->u.mov.dst);
+                if (!isImmediateOnlyConstant(insn->u.mov.dst))
+                    getFreeReg(&allocator, insn->u.mov.dst);
 #ifdef DEBUG_REG_ALLOC
                 printf("mov_const ");
                 displayReg(insn->u.mov.dst);
@@ -554,30 +891,27 @@ static void allocateRegisters(struct inter *inter)
             case X86_LOAD_16:
             case X86_LOAD_32:
             case X86_LOAD_64:
-                getFreeReg(freeRegList, insn->u.load.dst);
-                if (insn->u.load.address->lastReadIndex == i)
-                    freeRegList[insn->u.load.address->index] = 1;
+                getFreeReg(&allocator, insn->u.load.dst);
+                releaseRegIfLastRead(&allocator, insn->u.load.address, i);
 #ifdef DEBUG_REG_ALLOC
                 printf("load ");
                 displayReg(insn->u.load.dst);
                 printf(", [");
                 displayReg(insn->u.load.address);
-                printf("]");
+                printf(" + %d]", insn->u.load.disp);
 #endif
                 break;
             case X86_STORE_8:
             case X86_STORE_16:
             case X86_STORE_32:
             case X86_STORE_64:
-                if (insn->u.store.address->lastReadIndex == i)
-                    freeRegList[insn->u.store.address->index] = 1;
-                if (insn->u.store.src->lastReadIndex == i)
-                    freeRegList[insn->u.store.src->index] = 1;
+                releaseRegIfLastRead(&allocator, insn->u.store.address, i);
+                releaseRegIfLastRead(&allocator, insn->u.store.src, i);
 #ifdef DEBUG_REG_ALLOC
-                printf("store_%d ", 1 << (insn->type - IR_STORE_8 + 3));
+                printf("store_%d ", 1 << (insn->type - X86_STORE_8 + 3));
                 printf("[");
                 displayReg(insn->u.store.address);
-                printf("], ");
+                printf(" + %d], ", insn->u.store.disp);
                 displayReg(insn->u.store.src);
 #endif
                 break;
@@ -585,11 +919,9 @@ static void allocateRegisters(struct inter *inter)
             case X86_BINOP_16:
             case X86_BINOP_32:
             case X86_BINOP_64:
-                getFreeReg(freeRegList, insn->u.binop.dst);
-                if (insn->u.binop.op1->lastReadIndex == i)
-                    freeRegList[insn->u.binop.op1->index] = 1;
-                if (insn->u.binop.op2->lastReadIndex == i)
-                    freeRegList[insn->u.binop.op2->index] = 1;
+                getFreeReg(&allocator, insn->u.binop.dst);
+                releaseRegIfLastRead(&allocator, insn->u.binop.op1, i);
+                releaseRegIfLastRead(&allocator, insn->u.binop.op2, i);
 #ifdef DEBUG_REG_ALLOC
                 printf("binop ");
                 displayReg(insn->u.binop.dst);
@@ -600,25 +932,27 @@ static void allocateRegisters(struct inter *inter)
 #endif
                 break;
             case X86_EXIT:
-                if (insn->u.exit.value->lastReadIndex == i)
-                    freeRegList[insn->u.exit.value->index] = 1;
-                if (insn->u.exit.pred && insn->u.exit.pred->lastReadIndex == i)
-                    freeRegList[insn->u.exit.pred->index] = 1;
+                releaseRegIfLastRead(&allocator, insn->u.exit.value, i);
+                releaseRegIfLastRead(&allocator, insn->u.exit.pred, i);
+                releaseRegIfLastRead(&allocator, insn->u.exit.cmpOp1, i);
+                releaseRegIfLastRead(&allocator, insn->u.exit.cmpOp2, i);
 #ifdef DEBUG_REG_ALLOC
                 printf("exit ");
                 displayReg(insn->u.exit.value);
                 printf(" if ");
-                displayReg(insn->u.exit.pred);
+                if (insn->u.exit.cmpOp1) {
+                    displayReg(insn->u.exit.cmpOp1);
+                    printf(insn->u.exit.cmpType == X86_BINOP_CMPEQ?" == ":" != ");
+                    displayReg(insn->u.exit.cmpOp2);
+                } else
+                    displayReg(insn->u.exit.pred);
 #endif
                 break;
             case X86_ITE:
-                getFreeReg(freeRegList, insn->u.ite.dst);
-                if (insn->u.ite.pred->lastReadIndex == i)
-                    freeRegList[insn->u.ite.pred->index] = 1;
-                if (insn->u.ite.trueOp->lastReadIndex == i)
-                    freeRegList[insn->u.ite.trueOp->index] = 1;
-                if (insn->u.ite.falseOp->lastReadIndex == i)
-                    freeRegList[insn->u.ite.falseOp->index] = 1;
+                getFreeReg(&allocator, insn->u.ite.dst);
+                releaseRegIfLastRead(&allocator, insn->u.ite.pred, i);
+                releaseRegIfLastRead(&allocator, insn->u.ite.trueOp, i);
+                releaseRegIfLastRead(&allocator, insn->u.ite.falseOp, i);
 #ifdef DEBUG_REG_ALLOC
                 displayReg(insn->u.ite.dst);
                 printf(" = ");
@@ -630,9 +964,8 @@ static void allocateRegisters(struct inter *inter)
 #endif
                 break;
             case X86_CAST:
-                getFreeReg(freeRegList, insn->u.cast.dst);
-                if (insn->u.cast.op->lastReadIndex == i)
-                    freeRegList[insn->u.cast.op->index] = 1;
+                getFreeReg(&allocator, insn->u.cast.dst);
+                releaseRegIfLastRead(&allocator, insn->u.cast.op, i);
 #ifdef DEBUG_REG_ALLOC
                 {
                 const char *typeToString[] = {"(8u_to_16)", "(8u_to_32)", "(8u_to_64)",
@@ -653,12 +986,15 @@ static void allocateRegisters(struct inter *inter)
                     int j;
 
                     if (insn->u.call.result)
-                        getFreeReg(freeRegList, insn->u.call.result);
-                    if (insn->u.call.address->lastReadIndex == i)
-                        freeRegList[insn->u.call.address->index] = 1;
+                        getFreeReg(&allocator, insn->u.call.result);
+                    releaseRegIfLastRead(&allocator, insn->u.call.address, i);
                     for(j = 0; j < 4; j++)
-                        if (insn->u.call.param[j] && insn->u.call.param[j]->lastReadIndex == i)
-                            freeRegList[insn->u.call.param[j]->index] = 1;
+                        releaseRegIfLastRead(&allocator, insn->u.call.param[j], i);
+                    /* remaining active registers are live across call */
+                    insn->u.call.liveRegsMask = 1 << X86_RDI;
+                    for(j = 0; j < REG_NUMBER; j++)
+                        if (allocator.active[j] && allocator.active[j] != insn->u.call.result)
+                            insn->u.call.liveRegsMask |= 1 << allocator.active[j]->index;
 #ifdef DEBUG_REG_ALLOC
                     printf("call (");
                     displayReg(insn->u.call.address);
@@ -677,7 +1013,7 @@ static void allocateRegisters(struct inter *inter)
                 break;
             case X86_READ_8: case X86_READ_16: case X86_READ_32: case X86_READ_64:
                 {
-                    getFreeReg(freeRegList, insn->u.read_context.dst);
+                    getFreeReg(&allocator, insn->u.read_context.dst);
 #ifdef DEBUG_REG_ALLOC
                     printf("read_context ");
                     displayReg(insn->u.read_context.dst);
@@ -687,8 +1023,7 @@ static void allocateRegisters(struct inter *inter)
                 break;
             case X86_WRITE_8: case X86_WRITE_16: case X86_WRITE_32: case X86_WRITE_64:
                 {
-                    if (insn->u.write_context.src->lastReadIndex == i)
-                        freeRegList[insn->u.write_context.src->index] = 1;
+                    releaseRegIfLastRead(&allocator, insn->u.write_context.src, i);
 #ifdef DEBUG_REG_ALLOC
                     printf("write_context ");
                     printf("context[%d], ",insn->u.write_context.offset);
@@ -696,9 +1031,34 @@ static void allocateRegisters(struct inter *inter)
 #endif
                 }
                 break;
+            case X86_CMPXCHG_8: case X86_CMPXCHG_16: case X86_CMPXCHG_32: case X86_CMPXCHG_64:
+            case X86_XCHG_8: case X86_XCHG_16: case X86_XCHG_32: case X86_XCHG_64:
+            case X86_FETCH_ADD_8: case X86_FETCH_ADD_16: case X86_FETCH_ADD_32: case X86_FETCH_ADD_64:
+                getFreeReg(&allocator, insn->u.atomic.dst);
+                releaseRegIfLastRead(&allocator, insn->u.atomic.address, i);
+                releaseRegIfLastRead(&allocator, insn->u.atomic.op1, i);
+                releaseRegIfLastRead(&allocator, insn->u.atomic.op2, i);
+#ifdef DEBUG_REG_ALLOC
+                printf("atomic ");
+                displayReg(insn->u.atomic.dst);
+                printf(", [");
+                displayReg(insn->u.atomic.address);
+                printf("], ");
+                displayReg(insn->u.atomic.op1);
+                printf(", ");
+                displayReg(insn->u.atomic.op2);
+#endif
+                break;
             case X86_INSN_MARKER:
 #ifdef DEBUG_REG_ALLOC
                 printf("start_of_new_instruction\n");
+#endif
+                break;
+            case X86_NOP:
+                releaseRegIfLastRead(&allocator, insn->u.nop.op1, i);
+                releaseRegIfLastRead(&allocator, insn->u.nop.op2, i);
+#ifdef DEBUG_REG_ALLOC
+                printf("nop");
 #endif
                 break;
             default:
@@ -709,12 +1069,18 @@ static void allocateRegisters(struct inter *inter)
     {
         int j;
         printf("    ");
-        for(j=0;j<8;j++)
-            printf("%d", freeRegList[j]);
+        for(j=0;j<REG_NUMBER;j++)
+            printf("%d", allocator.active[j] == NULL);
         printf("\n");
     }
 #endif
+        if (inter->backend.stats)
+            updateMaxLive(inter->backend.stats, &allocator);
     }
+    /* caller saved registers are saved after spill slots */
+    inter->callSaveSlot = allocator.slotNb;
+    if (inter->backend.stats)
+        inter->backend.stats->spill_nb = allocator.spillNb;
 }
 
 /* code generation */
@@ -739,368 +1105,545 @@ static void allocateRegisters(struct inter *inter)
 #define SIB_INDEX_SHIFT     3
 #define SIB_BASE_SHIFT      0
 
-static char *gen_mov_const_hlp(char *pos, struct x86Register *dst, uint64_t value)
+/* emit operand size prefix, rex prefix and opcode. rex prefix is always generated for byte
+   operands so byte registers 4 to 7 are spl, bpl, sil and dil. */
+static char *gen_opcode(char *pos, int size, int opcode, int reg, int rm)
 {
-    if (value) {
-        *pos++ = REX_OPCODE | REX_W | REX_B;
-        *pos++ = 0xb8 + dst->index;
-        *pos++ = (value >> 0) & 0xff;
-        *pos++ = (value >> 8) & 0xff;
-        *pos++ = (value >> 16) & 0xff;
-        *pos++ = (value >> 24) & 0xff;
-        *pos++ = (value >> 32) & 0xff;
-        *pos++ = (value >> 40) & 0xff;
-        *pos++ = (value >> 48) & 0xff;
-        *pos++ = (value >> 56) & 0xff;
-    } else {
-        *pos++ = REX_OPCODE | REX_R | REX_B;
-        *pos++ = 0x31;
-        *pos++ = 0xc0 | (dst->index << 3) | dst->index;
-    }
+    int rex = REX_OPCODE | (size == 64?REX_W:0) | ((reg & 8)?REX_R:0) | ((rm & 8)?REX_B:0);
+
+    if (size == 16)
+        *pos++ = 0x66;
+    if (rex != REX_OPCODE || size == 8 || opcode == 0x0fb6 || opcode == 0x0fbe)
+        *pos++ = rex;
+    if (opcode > 0xff)
+        *pos++ = opcode >> 8;
+    *pos++ = opcode & 0xff;
 
     return pos;
 }
 
-static char *gen_mov_const(char *pos, struct x86Instruction *insn)
+static char *gen_imm16(char *pos, uint16_t value)
 {
-    return gen_mov_const_hlp(pos, insn->u.mov.dst, insn->u.mov.value);
+    *pos++ = (value >> 0) & 0xff;
+    *pos++ = (value >> 8) & 0xff;
+
+    return pos;
 }
 
-static char *gen_load_8(char *pos, struct x86Instruction *insn)
+static char *gen_imm32(char *pos, uint32_t value)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B;
-    *pos++ = 0x8a;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    *pos++ = (value >> 0) & 0xff;
+    *pos++ = (value >> 8) & 0xff;
+    *pos++ = (value >> 16) & 0xff;
+    *pos++ = (value >> 24) & 0xff;
 
     return pos;
 }
 
-static char *gen_load_16(char *pos, struct x86Instruction *insn)
+/* opcode reg, rm */
+static char *gen_rr(char *pos, int size, int opcode, int reg, int rm)
 {
-    *pos++ = 0x66;
-    *pos++ = REX_OPCODE | REX_R | REX_B;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    pos = gen_opcode(pos, size, opcode, reg, rm);
+    *pos++ = MODRM_MODE_3 | ((reg & 7) << MODRM_REG_SHIFT) | (rm & 7);
 
     return pos;
 }
 
-static char *gen_load_32(char *pos, struct x86Instruction *insn)
+/* modrm and sib for [base + index + disp]. index is -1 when there is none. Shortest
+   displacement encoding is used. rbp and r13 base always need a displacement. */
+static char *gen_modrm_mem(char *pos, int reg, int base, int index, int32_t disp)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    int mode;
+
+    if (disp == 0 && (base & 7) != X86_RBP)
+        mode = MODRM_MODE_0;
+    else if (isImm8(disp))
+        mode = MODRM_MODE_1;
+    else
+        mode = MODRM_MODE_2;
+    if (index >= 0 || (base & 7) == X86_RSP) {
+        *pos++ = mode | ((reg & 7) << MODRM_REG_SHIFT) | 4; //address is sib
+        *pos++ = (0 << SIB_SCALE_SHIFT) | (((index >= 0)?(index & 7):4) <<  SIB_INDEX_SHIFT) | (base & 7);
+    } else
+        *pos++ = mode | ((reg & 7) << MODRM_REG_SHIFT) | (base & 7);
+    if (mode == MODRM_MODE_1)
+        *pos++ = disp;
+    else if (mode == MODRM_MODE_2)
+        pos = gen_imm32(pos, disp);
 
     return pos;
 }
 
-static char *gen_load_64(char *pos, struct x86Instruction *insn)
+/* opcode reg, [base + disp] */
+static char *gen_rm(char *pos, int size, int opcode, int reg, int base, int32_t disp)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    pos = gen_opcode(pos, size, opcode, reg, base);
 
-    return pos;
+    return gen_modrm_mem(pos, reg, base, -1, disp);
 }
 
-static char *gen_store_8(char *pos, struct x86Instruction *insn)
+/* opcode reg, [disp32] */
+static char *gen_rm_abs(char *pos, int size, int opcode, int reg, int32_t disp)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B;
-    *pos++ = 0x88;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    pos = gen_opcode(pos, size, opcode, reg, 0);
+    *pos++ = MODRM_MODE_0 | ((reg & 7) << MODRM_REG_SHIFT) | 4; //address is sib without base
+    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | X86_RBP;
 
-    return pos;
+    return gen_imm32(pos, disp);
 }
 
-static char *gen_store_16(char *pos, struct x86Instruction *insn)
+/* opcode reg, [address + disp]. Constant address is encoded as an absolute address */
+static char *gen_rm_address(char *pos, int size, int opcode, int reg, struct x86Register *address, int32_t disp)
 {
-    *pos++ = 0x66;
-    *pos++ = REX_OPCODE | REX_R | REX_B;
-    *pos++ = 0x89;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    if (isAddressImmediate(address))
+        return gen_rm_abs(pos, size, opcode, reg, address->value);
+
+    return gen_rm(pos, size, opcode, reg, address->index, disp);
+}
+
+/* lea dst, [base + index] */
+static char *gen_lea_index(char *pos, int size, int dst, int base, int index)
+{
+    int rex = REX_OPCODE | (size == 64?REX_W:0) | ((dst & 8)?REX_R:0) | ((index & 8)?REX_X:0) | ((base & 8)?REX_B:0);
+
+    if (rex != REX_OPCODE)
+        *pos++ = rex;
+    *pos++ = 0x8d;
+
+    return gen_modrm_mem(pos, dst, base, index, 0);
+}
+
+/* opcode rm, imm. Use sign extended imm8 form when possible. */
+static char *gen_ri(char *pos, int size, int subcode, int rm, uint64_t value)
+{
+    int32_t imm = value;
+
+    if (size == 8) {
+        pos = gen_rr(pos, 8, 0x80, subcode, rm);
+        *pos++ = imm;
+    } else if (imm == (int8_t) imm) {
+        pos = gen_rr(pos, size, 0x83, subcode, rm);
+        *pos++ = imm;
+    } else {
+        pos = gen_rr(pos, size, 0x81, subcode, rm);
+        pos = size == 16?gen_imm16(pos, imm):gen_imm32(pos, imm);
+    }
 
     return pos;
 }
 
-static char *gen_store_32(char *pos, struct x86Instruction *insn)
+/* append store immediate value after mov [mem], imm modrm */
+static char *gen_store_imm(char *pos, int size, uint64_t value)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B;
-    *pos++ = 0x89;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    if (size == 8)
+        *pos++ = value;
+    else if (size == 16)
+        pos = gen_imm16(pos, value);
+    else
+        pos = gen_imm32(pos, value);
 
     return pos;
 }
 
-static char *gen_store_64(char *pos, struct x86Instruction *insn)
+/* spill slots are located in frame reserved by execute_be_x86_64, just above return address */
+static char *gen_load_slot(char *pos, int reg, int slot)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-    *pos++ = 0x89;
-    *pos++ = MODRM_MODE_2 | (insn->u.load.dst->index << MODRM_REG_SHIFT) | 4; //address is sib+disp32
-    *pos++ = (0 << SIB_SCALE_SHIFT) | (4 <<  SIB_INDEX_SHIFT) | (insn->u.load.address->index);
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    return gen_rm(pos, 64, 0x8b, reg, X86_RSP, SLOT_OFFSET(slot));
+}
+
+static char *gen_store_slot(char *pos, int reg, int slot)
+{
+    return gen_rm(pos, 64, 0x89, reg, X86_RSP, SLOT_OFFSET(slot));
+}
+
+/* use shortest form. mov r32, imm32 zero extends and mov r64, imm32 sign extends */
+static char *gen_mov_const_hlp(char *pos, int dst, uint64_t value)
+{
+    if (value == 0) {
+        pos = gen_rr(pos, 32, 0x31, dst, dst);
+    } else if (value <= 0xffffffff) {
+        if (dst & 8)
+            *pos++ = REX_OPCODE | REX_B;
+        *pos++ = 0xb8 + (dst & 7);
+        pos = gen_imm32(pos, value);
+    } else if (isImm32(value)) {
+        pos = gen_rr(pos, 64, 0xc7, 0/*subcode*/, dst);
+        pos = gen_imm32(pos, value);
+    } else {
+        *pos++ = REX_OPCODE | REX_W | ((dst & 8)?REX_B:0);
+        *pos++ = 0xb8 + (dst & 7);
+        *pos++ = (value >> 0) & 0xff;
+        *pos++ = (value >> 8) & 0xff;
+        *pos++ = (value >> 16) & 0xff;
+        *pos++ = (value >> 24) & 0xff;
+        *pos++ = (value >> 32) & 0xff;
+        *pos++ = (value >> 40) & 0xff;
+        *pos++ = (value >> 48) & 0xff;
+        *pos++ = (value >> 56) & 0xff;
+    }
 
     return pos;
 }
 
-static char *gen_move_reg_low(char *pos, int low_index, struct x86Register *src)
+static char *gen_mov_const(char *pos, struct x86Instruction *insn)
+{
+    return gen_mov_const_hlp(pos, insn->u.mov.dst->index, insn->u.mov.value);
+}
+
+/* 8 and 16 bits values are zero extended with movzx */
+static int loadOpcode(int size)
+{
+    return size == 8?0x0fb6:(size == 16?0x0fb7:0x8b);
+}
+
+static char *gen_load(char *pos, struct x86Instruction *insn, int size)
+{
+    return gen_rm_address(pos, size == 64?64:32, loadOpcode(size), insn->u.load.dst->index, insn->u.load.address, insn->u.load.disp);
+}
+
+static char *gen_store(char *pos, struct x86Instruction *insn, int size)
+{
+    if (isStoreImmediate(size, insn->u.store.src)) {
+        pos = gen_rm_address(pos, size, size == 8?0xc6:0xc7, 0/*subcode*/, insn->u.store.address, insn->u.store.disp);
+        return gen_store_imm(pos, size, insn->u.store.src->value);
+    }
+
+    return gen_rm_address(pos, size, size == 8?0x88:0x89, insn->u.store.src->index, insn->u.store.address, insn->u.store.disp);
+}
+
+static char *gen_move_reg(char *pos, int dst, int src)
 {
-    /* mov low_index, src */
-    *pos++ = REX_OPCODE | REX_B | REX_W;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_3 | (low_index << MODRM_REG_SHIFT) | src->index;
+    return gen_rr(pos, 64, 0x8b, dst, src);
+}
+
+/* cmp op1, op2. Comparison with zero is done with test */
+static char *gen_cmp_hlp(char *pos, struct x86Register *op1, struct x86Register *op2, int isImm)
+{
+    if (isImm && op2->value == 0)
+        pos = gen_rr(pos, 64, 0x85, op1->index, op1->index);
+    else if (isImm)
+        pos = gen_ri(pos, 64, 7/*subcode*/, op1->index, op2->value);
+    else
+        pos = gen_rr(pos, 64, 0x3b, op2->index, op1->index);
 
     return pos;
 }
 
-static char *gen_move_reg_from_low(char *pos, int low_index, struct x86Register *dst)
+/* multi bytes nop of up to 7 bytes */
+static char *gen_nop(char *pos, int size)
 {
-    /* mov dst, low_index */
-    *pos++ = REX_OPCODE | REX_R | REX_W;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_3 | (dst->index << MODRM_REG_SHIFT) | low_index;
+    static const unsigned char nops[8][7] = {
+        {0},
+        {0x90},
+        {0x66, 0x90},
+        {0x0f, 0x1f, 0x00},
+        {0x0f, 0x1f, 0x40, 0x00},
+        {0x0f, 0x1f, 0x44, 0x00, 0x00},
+        {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+        {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00}
+    };
+    int i;
+
+    assert(size < 8);
+    for(i = 0; i < size; i++)
+        *pos++ = nops[size][i];
 
     return pos;
 }
 
-static char *gen_exit(char *pos, struct x86Instruction *insn)
-{
-    char *pos_start_offset = 0;
-    char *pos_patch = NULL;
-
-    if (insn->u.exit.pred) {
-        //cmp pred with zero
-        *pos++ = REX_OPCODE | REX_B | REX_W;
-        *pos++ = 0x81;
-        *pos++ = MODRM_MODE_3 | (7/*subcode*/ << MODRM_REG_SHIFT) | insn->u.exit.pred->index;
-        *pos++ = 0;
-        *pos++ = 0;
-        *pos++ = 0;
-        *pos++ = 0;
-        //je after exit sequence
-        *pos++ = 0x74;
-        pos_patch = pos;
-        *pos++ = 0;
-        pos_start_offset = pos;
-    }
+/* return value into rax, patch area address into rdx and ret to execute_be_x86_64.
+   Patch area starts with an 8 bytes aligned patch site holding the ret, so patch() can
+   replace it with a jmp using a single atomic store. An absolute jump trampoline follows
+   for targets out of rel32 range. */
+static char *gen_exit_sequence(struct inter *inter, char *pos, struct x86Register *value, int is_patchable)
+{
     /* mov rax, value */
-    pos = gen_move_reg_low(pos, 0/*rax*/, insn->u.exit.value);
+    if (value->isConstant)
+        pos = gen_mov_const_hlp(pos, X86_RAX, value->value);
+    else
+        pos = gen_move_reg(pos, X86_RAX, value->index);
     /* generate rdx */
-    if (insn->u.exit.is_patchable) {
-        /* return rip, lea rdx, [rip] */
+    if (is_patchable) {
+        int padding = -(pos + 7 - inter->codeBuffer) & (PATCH_SITE_SIZE - 1);
+
+        /* lea rdx, [rip + padding] */
         *pos++ = 0x48;
         *pos++ = 0x8d;
         *pos++ = 0x15;
-        *pos++ = 0;
-        *pos++ = 0;
-        *pos++ = 0;
-        *pos++ = 0;
-    } else {
-        *pos++ = REX_OPCODE;
-        *pos++ = 0x31;
-        *pos++ = 0xc0 | (2 << 3) | 2;
-    }
-    /*retq */
-    *pos++ = 0xc3;
-    /* setup patch area */
-    if (insn->u.exit.is_patchable) {
-        /* mov rax, imm64 */
+        pos = gen_imm32(pos, padding);
+        pos = gen_nop(pos, padding);
+        /* patch site. retq followed by int3 */
+        *pos++ = 0xc3;
+        memset(pos, 0xcc, PATCH_SITE_SIZE - 1);
+        pos += PATCH_SITE_SIZE - 1;
+        /* trampoline. mov rax, imm64 and jmp rax */
         *pos++ = 0x48;
         *pos++ = 0xb8;
-        pos+=8;
-        /* jmp rax */
+        pos = gen_imm32(pos, 0);
+        pos = gen_imm32(pos, 0);
         *pos++ = 0xff;
         *pos++ = 0xe0;
-        /* return rip, lea rdx, [rip] */
-        *pos++ = 0x48;
-        *pos++ = 0x8d;
-        *pos++ = 0x15;
-        *pos++ = 0;
-        *pos++ = 0;
-        *pos++ = 0;
-        *pos++ = 0;
-    }
-    /* fixup jump target to go after retq */
-    if (insn->u.exit.pred) {
-        *pos_patch = (pos - pos_start_offset);
+    } else {
+        *pos++ = REX_OPCODE;
+        *pos++ = 0x31;
+        *pos++ = 0xc0 | (2 << 3) | 2;
+        /*retq */
+        *pos++ = 0xc3;
     }
 
     return pos;
 }
 
-static char *gen_move_reg(char *pos, struct x86Register *dst, struct x86Register *src)
+/* conditional exits only emit a jcc to an exit stub. Stubs are generated out of line after
+   block code so fall through path stays dense. */
+static char *gen_exit(struct inter *inter, char *pos, struct x86Instruction *insn, struct x86Instruction *orig)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_3 | (dst->index << MODRM_REG_SHIFT) | src->index;
+    unsigned char jcc;
+
+    if (insn->u.exit.cmpOp1) {
+        //cmp op1, op2
+        pos = gen_cmp_hlp(pos, insn->u.exit.cmpOp1, insn->u.exit.cmpOp2,
+                          isBinopImmediate(X86_BINOP_64, insn->u.exit.cmpType, insn->u.exit.cmpOp2));
+        jcc = (insn->u.exit.cmpType == X86_BINOP_CMPEQ)?0x84/*je*/:0x85/*jne*/;
+    } else if (insn->u.exit.pred) {
+        //test pred, pred
+        pos = gen_rr(pos, 64, 0x85, insn->u.exit.pred->index, insn->u.exit.pred->index);
+        jcc = 0x85/*jne*/;
+    } else
+        return gen_exit_sequence(inter, pos, insn->u.exit.value, insn->u.exit.is_patchable);
+
+    //jcc rel32 to stub
+    *pos++ = 0x0f;
+    *pos++ = jcc;
+    orig->u.exit.stub_patch = pos;
+    orig->u.exit.stub_value_index = insn->u.exit.value->index;
+    pos = gen_imm32(pos, 0);
 
     return pos;
 }
 
-static char *gen_cmp(char *pos, int isEq, struct x86Register *dst, struct x86Register *op1, struct x86Register *op2)
+static char *gen_exit_stub(struct inter *inter, char *pos, struct x86Instruction *insn)
+{
+    struct x86Register value = *insn->u.exit.value;
+    char *pos_next = insn->u.exit.stub_patch + 4;
+
+    /* value register may have been reloaded into a scratch register */
+    value.index = insn->u.exit.stub_value_index;
+    gen_imm32(insn->u.exit.stub_patch, pos - pos_next);
+
+    return gen_exit_sequence(inter, pos, &value, insn->u.exit.is_patchable);
+}
+
+static char *gen_cmp(char *pos, int isEq, struct x86Register *dst, struct x86Register *op1, struct x86Register *op2, int isImm)
 {
     char *pos_patch;
     char *pos_ori;
 
-    pos = gen_mov_const_hlp(pos, dst, ~0);
+    pos = gen_mov_const_hlp(pos, dst->index, ~0);
     //cmp op1 op2
-    *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-    *pos++ = 0x3b;
-    *pos++ = MODRM_MODE_3 | (op2->index << MODRM_REG_SHIFT) | op1->index;
+    pos = gen_cmp_hlp(pos, op1, op2, isImm);
     //je after next move
     *pos++ = (isEq)?0x74:0x75;
     pos_patch = pos;
     *pos++ = 0;
     // set false value
     pos_ori = pos;
-    pos = gen_mov_const_hlp(pos, dst, 0);
+    pos = gen_mov_const_hlp(pos, dst->index, 0);
     *pos_patch = pos - pos_ori;
 
     return pos;
 }
 
+/* zero extend low bits of op into dst */
+static char *gen_zero_extend(char *pos, int dst, int op, uint64_t mask)
+{
+    switch(mask) {
+        case 0xff:
+            return gen_rr(pos, 32, 0x0fb6, dst, op);
+        case 0xffff:
+            return gen_rr(pos, 32, 0x0fb7, dst, op);
+        default:
+            return gen_rr(pos, 32, 0x8b, dst, op);
+    }
+}
+
+/* crc32 dst, op. Mandatory f2 prefix must come before rex so gen_opcode can't be used */
+static char *gen_crc32c(char *pos, int size, int dst, int op)
+{
+    int rex = REX_OPCODE | (size == 64?REX_W:0) | ((dst & 8)?REX_R:0) | ((op & 8)?REX_B:0);
+
+    if (size == 16)
+        *pos++ = 0x66;
+    *pos++ = 0xf2;
+    if (rex != REX_OPCODE || size == 8)
+        *pos++ = rex;
+    *pos++ = 0x0f;
+    *pos++ = 0x38;
+    *pos++ = (size == 8)?0xf0:0xf1;
+    *pos++ = MODRM_MODE_3 | ((dst & 7) << MODRM_REG_SHIFT) | (op & 7);
+
+    return pos;
+}
+
+/* movd / movq xmm, reg */
+static char *gen_mov_to_xmm(char *pos, int size, int xmm, int reg)
+{
+    int rex = REX_OPCODE | (size == 64?REX_W:0) | ((reg & 8)?REX_B:0);
+
+    *pos++ = 0x66;
+    if (rex != REX_OPCODE)
+        *pos++ = rex;
+    *pos++ = 0x0f;
+    *pos++ = 0x6e;
+    *pos++ = MODRM_MODE_3 | ((xmm & 7) << MODRM_REG_SHIFT) | (reg & 7);
+
+    return pos;
+}
+
+/* ucomis / comis of op1 and op2 then turn zf, pf and cf into arm nzcv. Moves don't change
+   flags. Unordered sets all three flags so it's tested last */
+static char *gen_fcmp(char *pos, int size, int isSignaling, int dst, int op1, int op2)
+{
+    pos = gen_mov_to_xmm(pos, size, 0, op1);
+    pos = gen_mov_to_xmm(pos, size, 1, op2);
+    if (size == 64)
+        *pos++ = 0x66;
+    *pos++ = 0x0f;
+    *pos++ = isSignaling?0x2f:0x2e;
+    *pos++ = MODRM_MODE_3 | (0 << MODRM_REG_SHIFT) | 1;
+    //greater
+    pos = gen_mov_const_hlp(pos, dst, 0x20000000);
+    //less
+    pos = gen_mov_const_hlp(pos, X86_RCX, 0x80000000);
+    pos = gen_rr(pos, 32, 0x0f42/*cmovb*/, dst, X86_RCX);
+    //equal
+    pos = gen_mov_const_hlp(pos, X86_RCX, 0x60000000);
+    pos = gen_rr(pos, 32, 0x0f44/*cmove*/, dst, X86_RCX);
+    //unordered
+    pos = gen_mov_const_hlp(pos, X86_RCX, 0x30000000);
+    pos = gen_rr(pos, 32, 0x0f4a/*cmovp*/, dst, X86_RCX);
+
+    return pos;
+}
+
 static char *gen_binop(char *pos, struct x86Instruction *insn, uint64_t mask)
 {
     static const char binopToOpcode[] = {0x01/*add*/, 0x29/*sub*/, 0x31/*xor*/, 0x21/*and*/,
                                          0x09/*or*/, 0xd3/*shl*/, 0xd3/*shr*/, 0xd3/*sar*/, 0xd3/*ror*/,
                                          0xff/*cmpeq*/, 0xff/*cmpne*/};
+    static const char binopToSubcode[] = {0/*add*/, 5/*sub*/, 6/*xor*/, 4/*and*/, 1/*or*/};
+    struct x86Register *op2 = insn->u.binop.op2;
+    int isImm = isBinopImmediate(insn->type, insn->u.binop.type, op2);
+    int dst = insn->u.binop.dst->index;
+    int op1 = insn->u.binop.op1->index;
+    int size = 64;
+    int rorSize;
     char subtype = 0;
 
     switch(insn->u.binop.type) {
         case X86_BINOP_CMPEQ:
-            pos = gen_cmp(pos, 1, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
+            pos = gen_cmp(pos, 1, insn->u.binop.dst, insn->u.binop.op1, op2, isImm);
             break;
         case X86_BINOP_CMPNE:
-            pos = gen_cmp(pos, 0, insn->u.binop.dst, insn->u.binop.op1, insn->u.binop.op2);
+            pos = gen_cmp(pos, 0, insn->u.binop.dst, insn->u.binop.op1, op2, isImm);
             break;
         case X86_BINOP_SHL: subtype = 4; goto unop;
         case X86_BINOP_SHR: subtype = 5; goto unop;
         case X86_BINOP_ASR: subtype = 7; goto unop;
             unop: {
-                pos = gen_move_reg_low(pos, 1/*cl*/, insn->u.binop.op2);
-                pos = gen_move_reg(pos, insn->u.binop.dst, insn->u.binop.op1);
-                *pos++ = REX_OPCODE | REX_B | REX_W;
-                *pos++ = 0xd3;
-                *pos++ = MODRM_MODE_3 | (subtype/*subcode*/ << MODRM_REG_SHIFT) | insn->u.binop.dst->index;
+                if (isImm) {
+                    pos = gen_move_reg(pos, dst, op1);
+                    pos = gen_rr(pos, 64, 0xc1, subtype/*subcode*/, dst);
+                    *pos++ = op2->value & 63;
+                } else {
+                    pos = gen_move_reg(pos, X86_RCX, op2->index);
+                    pos = gen_move_reg(pos, dst, op1);
+                    pos = gen_rr(pos, 64, 0xd3, subtype/*subcode*/, dst);
+                }
             }
             break;
         case X86_BINOP_ROR:
-            pos = gen_move_reg_low(pos, 1/*cl*/, insn->u.binop.op2);
-            pos = gen_move_reg(pos, insn->u.binop.dst, insn->u.binop.op1);
-            if (insn->type == X86_BINOP_16)
-                *pos++ = 0x66;
-            *pos++ = REX_OPCODE | REX_B | (insn->type == X86_BINOP_64?REX_W:0);
-            *pos++ = insn->type == X86_BINOP_8?0xd2:0xd3;
-            *pos++ = MODRM_MODE_3 | (1/*subcode*/ << MODRM_REG_SHIFT) | insn->u.binop.dst->index;
+            rorSize = 8 << (insn->type - X86_BINOP_8);
+            if (!isImm)
+                pos = gen_move_reg(pos, X86_RCX, op2->index);
+            pos = gen_move_reg(pos, dst, op1);
+            if (isImm) {
+                pos = gen_rr(pos, rorSize, rorSize == 8?0xc0:0xc1, 1/*subcode*/, dst);
+                *pos++ = op2->value;
+            } else
+                pos = gen_rr(pos, rorSize, rorSize == 8?0xd2:0xd3, 1/*subcode*/, dst);
+            break;
+        case X86_BINOP_CRC32C:
+            /* op1 and result are 32 bits whatever value size is */
+            pos = gen_rr(pos, 32, 0x8b, dst, op1);
+            pos = gen_crc32c(pos, 8 << (insn->type - X86_BINOP_8), dst, op2->index);
+            mask = 0;
+            break;
+        case X86_BINOP_FCMP:
+        case X86_BINOP_FCMPE:
+            pos = gen_fcmp(pos, 8 << (insn->type - X86_BINOP_8), insn->u.binop.type == X86_BINOP_FCMPE,
+                           dst, op1, op2->index);
+            mask = 0;
+            break;
+        case X86_BINOP_ADD:
+            /* 32 bits operations clear upper bits so there is no need to mask result */
+            if (insn->type == X86_BINOP_32) {
+                size = 32;
+                mask = 0;
+            }
+            /* lea avoid moving op1 into dst first */
+            if (isImm)
+                pos = gen_rm(pos, size, 0x8d, dst, op1, op2->value);
+            else
+                pos = gen_lea_index(pos, size, dst, op1, op2->index);
             break;
         default:
-            pos = gen_move_reg(pos, insn->u.binop.dst, insn->u.binop.op1);
-            *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-            *pos++ = binopToOpcode[insn->u.binop.type];
-            *pos++ = MODRM_MODE_3 | (insn->u.binop.op2->index << MODRM_REG_SHIFT) | insn->u.binop.dst->index;
+            if (insn->type == X86_BINOP_32) {
+                size = 32;
+                mask = 0;
+            }
+            pos = gen_rr(pos, size, 0x8b, dst, op1);
+            if (isImm)
+                pos = gen_ri(pos, size, binopToSubcode[insn->u.binop.type], dst, op2->value);
+            else
+                pos = gen_rr(pos, size, binopToOpcode[insn->u.binop.type], op2->index, dst);
     }
     //mask result
-    if (mask) {
-        /* moc cl, mask */
-        *pos++ = REX_OPCODE | REX_W;
-        *pos++ = 0xb8 + 1/*cl*/;
-        *pos++ = (mask >> 0) & 0xff;
-        *pos++ = (mask >> 8) & 0xff;
-        *pos++ = (mask >> 16) & 0xff;
-        *pos++ = (mask >> 24) & 0xff;
-        *pos++ = (mask >> 32) & 0xff;
-        *pos++ = (mask >> 40) & 0xff;
-        *pos++ = (mask >> 48) & 0xff;
-        *pos++ = (mask >> 56) & 0xff;
-        /* and dst, dst, cl */
-        *pos++ = REX_OPCODE | REX_B | REX_W;
-        *pos++ = 0x21;
-        *pos++ = MODRM_MODE_3 | (1/*cl*/ << MODRM_REG_SHIFT) | insn->u.binop.dst->index;
-    }
+    if (mask)
+        pos = gen_zero_extend(pos, dst, dst, mask);
 
     return pos;
 }
 
 static char *gen_ite(char *pos, struct x86Instruction *insn)
 {
-    pos = gen_move_reg(pos, insn->u.ite.dst, insn->u.ite.falseOp);
-    //cmp pred with zero
-    *pos++ = REX_OPCODE | REX_B | REX_W;
-    *pos++ = 0x81;
-    *pos++ = MODRM_MODE_3 | (7/*subcode*/ << MODRM_REG_SHIFT) | insn->u.ite.pred->index;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
-    *pos++ = 0;
+    pos = gen_move_reg(pos, insn->u.ite.dst->index, insn->u.ite.falseOp->index);
+    //test pred, pred
+    pos = gen_rr(pos, 64, 0x85, insn->u.ite.pred->index, insn->u.ite.pred->index);
     //cmovnz dst <= trueOp
-    *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-    *pos++ = 0x0f;
-    *pos++ = 0x45;
-    *pos++ = MODRM_MODE_3 | (insn->u.ite.dst->index << MODRM_REG_SHIFT) | insn->u.ite.trueOp->index;
+    pos = gen_rr(pos, 64, 0x0f45, insn->u.ite.dst->index, insn->u.ite.trueOp->index);
 
     return pos;
 }
 
 static char *gen_upper_unsigned_cast_hlp(char *pos, struct x86Register *dst, struct x86Register *op, uint64_t mask)
 {
-    pos = gen_mov_const_hlp(pos, dst, mask);
-    *pos++ = REX_OPCODE | REX_R | REX_B | REX_W;
-    *pos++ = 0x21; /* and */
-    *pos++ = MODRM_MODE_3 | (op->index << MODRM_REG_SHIFT) | dst->index;
-
-    return pos;
+    return gen_zero_extend(pos, dst->index, op->index, mask);
 }
 
 static char *gen_upper_signed_cast_hlp(char *pos, struct x86Register *dst, struct x86Register *op, char shift_value)
 {
-    pos = gen_move_reg(pos, dst, op);
-    *pos++ = REX_OPCODE | REX_B | REX_W;
-    *pos++ = 0xc1;
-    *pos++ = MODRM_MODE_3 | (4/*subcode*/ << MODRM_REG_SHIFT) | dst->index; //shl dst, imm8
-    *pos++ = shift_value;
-    *pos++ = REX_OPCODE | REX_B | REX_W;
-    *pos++ = 0xc1;
-    *pos++ = MODRM_MODE_3 | (7/*subcode*/ << MODRM_REG_SHIFT) | dst->index; //sar dst, imm8
-    *pos++ = shift_value;
-
-    return pos;
+    switch(shift_value) {
+        case 56:
+            /* movsx dst, op8 */
+            return gen_rr(pos, 64, 0x0fbe, dst->index, op->index);
+        case 48:
+            /* movsx dst, op16 */
+            return gen_rr(pos, 64, 0x0fbf, dst->index, op->index);
+        default:
+            /* movsxd dst, op32 */
+            return gen_rr(pos, 64, 0x63, dst->index, op->index);
+    }
 }
 
 static char *gen_cast(char *pos, struct x86Instruction *insn)
@@ -1140,180 +1683,274 @@ static char *gen_cast(char *pos, struct x86Instruction *insn)
     return pos;
 }
 
-static char *gen_push_hlp(char *pos, int index)
+/* move call parameter into its abi register */
+static char *gen_call_param(char *pos, int dst, struct x86Register *param)
 {
-    if (index >= 8)
-        *pos++ = REX_OPCODE | REX_B | REX_W;
-    else
-        *pos++ = REX_OPCODE | REX_W;
-    *pos++ = 0x50 + (index & 7);
+    if (param->isConstant)
+        pos = gen_mov_const_hlp(pos, dst, param->value);
+    else if (param->spillSlot >= 0)
+        pos = gen_load_slot(pos, dst, param->spillSlot);
+    else if (param->index != dst)
+        pos = gen_move_reg(pos, dst, param->index);
 
     return pos;
 }
 
-static char *gen_pop_hlp(char *pos, int index)
+static char *gen_call(struct inter *inter, char *pos, struct x86Instruction *insn)
 {
-    if (index >= 8)
-        *pos++ = REX_OPCODE | REX_B | REX_W;
-    else
-        *pos++ = REX_OPCODE | REX_W;
-    *pos++ = 0x58 + (index & 7);
-
-    return pos;
-}
+    int i;
 
-static char *gen_call(char *pos, struct x86Instruction *insn)
-{
-    /* save caller regs we use */
-    pos = gen_push_hlp(pos, 7/*rdi*/);
-    pos = gen_push_hlp(pos, 8/*r8*/);
-    pos = gen_push_hlp(pos, 9/*r9*/);
-    pos = gen_push_hlp(pos, 10/*r10*/);
-    pos = gen_push_hlp(pos, 11/*r11*/);
-    pos = gen_push_hlp(pos, 12/*r12*/);/* only use to keep sp align on 16 bytes */
+    /* save caller saved registers that are live across call */
+    for(i = 0; i < CALLER_SAVED_REG_NB; i++)
+        if (insn->u.call.liveRegsMask & (1 << callerSavedRegs[i]))
+            pos = gen_store_slot(pos, callerSavedRegs[i], inter->callSaveSlot + i);
 
     /* mov address into rax */
-    pos = gen_move_reg_low(pos, 0/*rax*/, insn->u.call.address);
+    pos = gen_call_param(pos, X86_RAX, insn->u.call.address);
 
     /* rdi already has context value */
     if (insn->u.call.param[2]) {
-        pos = gen_move_reg_low(pos, 1/*rcx*/, insn->u.call.param[2]);
+        pos = gen_call_param(pos, X86_RCX, insn->u.call.param[2]);
     }
     if (insn->u.call.param[1]) {
-        pos = gen_move_reg_low(pos, 2/*rdx*/, insn->u.call.param[1]);
+        pos = gen_call_param(pos, X86_RDX, insn->u.call.param[1]);
     }
     if (insn->u.call.param[0]) {
-        pos = gen_move_reg_low(pos, 6/*rsi*/, insn->u.call.param[0]);
+        pos = gen_call_param(pos, X86_RSI, insn->u.call.param[0]);
     }
     /* do r8 last in case it's use into others param */
     if (insn->u.call.param[3]) {
-        struct x86Register dst;
-        dst.index = 0;
-        pos = gen_move_reg(pos, &dst/*r8*/, insn->u.call.param[3]);
+        pos = gen_call_param(pos, X86_R8, insn->u.call.param[3]);
     }
 
     /* call function by address */
-    *pos++ = REX_OPCODE | REX_W;
-    *pos++ = 0xff;
-    *pos++ = MODRM_MODE_3 | (2/*subcode*/ << MODRM_REG_SHIFT) | 0/*rax*/;
-    /* restore caller save regs */
-    pos = gen_pop_hlp(pos, 12/*r12*/);/* only use to keep sp align on 16 bytes */
-    pos = gen_pop_hlp(pos, 11/*r11*/);
-    pos = gen_pop_hlp(pos, 10/*r10*/);
-    pos = gen_pop_hlp(pos, 9/*r9*/);
-    pos = gen_pop_hlp(pos, 8/*r8*/);
-    pos = gen_pop_hlp(pos, 7/*rdi*/);
+    pos = gen_rr(pos, 64, 0xff, 2/*subcode*/, X86_RAX);
+    /* restore caller saved regs */
+    for(i = 0; i < CALLER_SAVED_REG_NB; i++)
+        if (insn->u.call.liveRegsMask & (1 << callerSavedRegs[i]))
+            pos = gen_load_slot(pos, callerSavedRegs[i], inter->callSaveSlot + i);
 
     /* move result if need */
     if (insn->u.call.result) {
-        pos = gen_move_reg_from_low(pos, 0/*rax*/, insn->u.call.result);
+        if (insn->u.call.result->spillSlot >= 0)
+            pos = gen_store_slot(pos, X86_RAX, insn->u.call.result->spillSlot);
+        else
+            pos = gen_move_reg(pos, insn->u.call.result->index, X86_RAX);
     }
 
     return pos;
 }
 
-static char *gen_read_8(char *pos, struct x86Instruction *insn)
+/* context is pointed by rdi */
+static char *gen_read(char *pos, struct x86Instruction *insn, int size)
 {
-    *pos++ = REX_OPCODE | REX_R;
-    *pos++ = 0x8a;
-    *pos++ = MODRM_MODE_2 | (insn->u.read_context.dst->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.read_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 24) & 0xff;
+    return gen_rm(pos, size == 64?64:32, loadOpcode(size), insn->u.read_context.dst->index, X86_RDI, insn->u.read_context.offset);
+}
 
-    return pos;
+static char *gen_write(char *pos, struct x86Instruction *insn, int size)
+{
+    if (isStoreImmediate(size, insn->u.write_context.src)) {
+        pos = gen_rm(pos, size, size == 8?0xc6:0xc7, 0/*subcode*/, X86_RDI, insn->u.write_context.offset);
+        return gen_store_imm(pos, size, insn->u.write_context.src->value);
+    }
+
+    return gen_rm(pos, size, size == 8?0x88:0x89, insn->u.write_context.src->index, X86_RDI, insn->u.write_context.offset);
 }
 
-static char *gen_read_16(char *pos, struct x86Instruction *insn)
+/* rax hold result of atomic instruction, zero extend it into dst */
+static char *gen_atomic_result(char *pos, int size, struct x86Register *dst)
 {
-    *pos++ = 0x66;
-    *pos++ = REX_OPCODE | REX_R;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_2 | (insn->u.read_context.dst->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.read_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 24) & 0xff;
+    switch(size) {
+        case 0:
+            /* movzx dst, al */
+            pos = gen_rr(pos, 64, 0x0fb6, dst->index, X86_RAX);
+            break;
+        case 1:
+            /* movzx dst, ax */
+            pos = gen_rr(pos, 64, 0x0fb7, dst->index, X86_RAX);
+            break;
+        case 2:
+            /* mov dst32, eax */
+            pos = gen_rr(pos, 32, 0x8b, dst->index, X86_RAX);
+            break;
+        default:
+            pos = gen_move_reg(pos, dst->index, X86_RAX);
+    }
 
     return pos;
 }
 
-static char *gen_read_32(char *pos, struct x86Instruction *insn)
+/* generate [lock] opcode [address], reg with correct operand size prefixes */
+static char *gen_atomic_hlp(char *pos, int size, int isLock, int opcode, int reg, struct x86Register *address)
 {
-    *pos++ = REX_OPCODE | REX_R;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_2 | (insn->u.read_context.dst->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.read_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 24) & 0xff;
+    if (isLock)
+        *pos++ = 0xf0;
 
-    return pos;
+    return gen_rm(pos, 8 << size, opcode, reg, address->index, 0);
 }
 
-static char *gen_read_64(char *pos, struct x86Instruction *insn)
+static char *gen_cmpxchg(char *pos, struct x86Instruction *insn)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_W;
-    *pos++ = 0x8b;
-    *pos++ = MODRM_MODE_2 | (insn->u.read_context.dst->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.read_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.read_context.offset >> 24) & 0xff;
+    int size = insn->type - X86_CMPXCHG_8;
+
+    /* mov rax, expected */
+    pos = gen_move_reg(pos, X86_RAX, insn->u.atomic.op1->index);
+    /* lock cmpxchg [address], op2 */
+    pos = gen_atomic_hlp(pos, size, 1, size?0x0fb1:0x0fb0, insn->u.atomic.op2->index, insn->u.atomic.address);
+    pos = gen_atomic_result(pos, size, insn->u.atomic.dst);
 
     return pos;
 }
 
-static char *gen_write_8(char *pos, struct x86Instruction *insn)
+static char *gen_xchg(char *pos, struct x86Instruction *insn)
 {
-    *pos++ = REX_OPCODE | REX_R;
-    *pos++ = 0x88;
-    *pos++ = MODRM_MODE_2 | (insn->u.write_context.src->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.write_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 24) & 0xff;
+    int size = insn->type - X86_XCHG_8;
+
+    /* mov rax, value */
+    pos = gen_move_reg(pos, X86_RAX, insn->u.atomic.op1->index);
+    /* xchg [address], rax. lock is implicit */
+    pos = gen_atomic_hlp(pos, size, 0, size?0x87:0x86, X86_RAX, insn->u.atomic.address);
+    pos = gen_atomic_result(pos, size, insn->u.atomic.dst);
 
     return pos;
 }
 
-static char *gen_write_16(char *pos, struct x86Instruction *insn)
+static char *gen_fetch_add(char *pos, struct x86Instruction *insn)
 {
-    *pos++ = 0x66;
-    *pos++ = REX_OPCODE | REX_R;
-    *pos++ = 0x89;
-    *pos++ = MODRM_MODE_2 | (insn->u.write_context.src->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.write_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 24) & 0xff;
+    int size = insn->type - X86_FETCH_ADD_8;
+
+    /* mov rax, value */
+    pos = gen_move_reg(pos, X86_RAX, insn->u.atomic.op1->index);
+    /* lock xadd [address], rax */
+    pos = gen_atomic_hlp(pos, size, 1, size?0x0fc1:0x0fc0, X86_RAX, insn->u.atomic.address);
+    pos = gen_atomic_result(pos, size, insn->u.atomic.dst);
 
     return pos;
 }
 
-static char *gen_write_32(char *pos, struct x86Instruction *insn)
+/* spilled operands are reloaded into scratch registers. Scratch registers are choosen so
+   they don't collide with fixed registers used by instruction code sequence. */
+static char *gen_reload(char *pos, struct x86Register **reg, struct x86Register *scratch, int index)
 {
-    *pos++ = REX_OPCODE | REX_R;
-    *pos++ = 0x89;
-    *pos++ = MODRM_MODE_2 | (insn->u.write_context.src->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.write_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 24) & 0xff;
+    if (*reg && (*reg)->spillSlot >= 0) {
+        *scratch = **reg;
+        scratch->index = index;
+        scratch->spillSlot = -1;
+        pos = gen_load_slot(pos, index, (*reg)->spillSlot);
+        *reg = scratch;
+    }
 
     return pos;
 }
 
-static char *gen_write_64(char *pos, struct x86Instruction *insn)
+/* spilled destination is computed into a scratch register. Return original register so
+   result can be stored into its spill slot */
+static struct x86Register *use_scratch(struct x86Register **reg, struct x86Register *scratch, int index)
+{
+    struct x86Register *res = NULL;
+
+    if (*reg && (*reg)->spillSlot >= 0) {
+        res = *reg;
+        *scratch = **reg;
+        scratch->index = index;
+        scratch->spillSlot = -1;
+        *reg = scratch;
+    }
+
+    return res;
+}
+
+static char *gen_insn(struct inter *inter, char *pos, struct x86Instruction *insn)
 {
-    *pos++ = REX_OPCODE | REX_R | REX_W;;
-    *pos++ = 0x89;
-    *pos++ = MODRM_MODE_2 | (insn->u.write_context.src->index << MODRM_REG_SHIFT) | 7; //address is rdi+disp32
-    *pos++ = (insn->u.write_context.offset >> 0) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 8) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 16) & 0xff;
-    *pos++ = (insn->u.write_context.offset >> 24) & 0xff;
+    struct x86Instruction tmp = *insn;
+    struct x86Register scratch[4];
+    struct x86Register *dst = NULL;
+    int dst_index = X86_RAX;
+    uint64_t mask;
+
+    switch(insn->type) {
+        case X86_MOV_CONST:
+            if (isImmediateOnlyConstant(insn->u.mov.dst))
+                break;
+            dst = use_scratch(&tmp.u.mov.dst, &scratch[0], dst_index = X86_RAX);
+            pos = gen_mov_const(pos, &tmp);
+            break;
+        case X86_LOAD_8: case X86_LOAD_16: case X86_LOAD_32: case X86_LOAD_64:
+            pos = gen_reload(pos, &tmp.u.load.address, &scratch[0], X86_RCX);
+            dst = use_scratch(&tmp.u.load.dst, &scratch[1], dst_index = X86_RAX);
+            pos = gen_load(pos, &tmp, 8 << (insn->type - X86_LOAD_8));
+            break;
+        case X86_STORE_8: case X86_STORE_16: case X86_STORE_32: case X86_STORE_64:
+            pos = gen_reload(pos, &tmp.u.store.address, &scratch[0], X86_RCX);
+            pos = gen_reload(pos, &tmp.u.store.src, &scratch[1], X86_RAX);
+            pos = gen_store(pos, &tmp, 8 << (insn->type - X86_STORE_8));
+            break;
+        case X86_BINOP_8: mask = 0xff; goto binop;
+        case X86_BINOP_16: mask = 0xffff; goto binop;
+        case X86_BINOP_32: mask = 0xffffffff; goto binop;
+        case X86_BINOP_64: mask = 0; goto binop;
+            binop:
+                /* rcx is used by binop code sequence */
+                pos = gen_reload(pos, &tmp.u.binop.op1, &scratch[0], X86_RAX);
+                pos = gen_reload(pos, &tmp.u.binop.op2, &scratch[1], X86_RDX);
+                dst = use_scratch(&tmp.u.binop.dst, &scratch[2], dst_index = X86_RSI);
+                pos = gen_binop(pos, &tmp, mask);
+            break;
+        case X86_EXIT:
+            /* rax and rdx are used by exit code sequence */
+            pos = gen_reload(pos, &tmp.u.exit.value, &scratch[0], X86_RSI);
+            pos = gen_reload(pos, &tmp.u.exit.pred, &scratch[1], X86_RCX);
+            pos = gen_reload(pos, &tmp.u.exit.cmpOp1, &scratch[2], X86_RCX);
+            pos = gen_reload(pos, &tmp.u.exit.cmpOp2, &scratch[3], X86_RDX);
+            pos = gen_exit(inter, pos, &tmp, insn);
+            break;
+        case X86_ITE:
+            pos = gen_reload(pos, &tmp.u.ite.pred, &scratch[0], X86_RCX);
+            pos = gen_reload(pos, &tmp.u.ite.trueOp, &scratch[1], X86_RDX);
+            pos = gen_reload(pos, &tmp.u.ite.falseOp, &scratch[2], X86_RSI);
+            dst = use_scratch(&tmp.u.ite.dst, &scratch[3], dst_index = X86_RAX);
+            pos = gen_ite(pos, &tmp);
+            break;
+        case X86_CAST:
+            pos = gen_reload(pos, &tmp.u.cast.op, &scratch[0], X86_RCX);
+            dst = use_scratch(&tmp.u.cast.dst, &scratch[1], dst_index = X86_RAX);
+            pos = gen_cast(pos, &tmp);
+            break;
+        case X86_CALL:
+            /* gen_call handles spilled registers itself */
+            pos = gen_call(inter, pos, &tmp);
+            break;
+        case X86_READ_8: case X86_READ_16: case X86_READ_32: case X86_READ_64:
+            dst = use_scratch(&tmp.u.read_context.dst, &scratch[0], dst_index = X86_RAX);
+            pos = gen_read(pos, &tmp, 8 << (insn->type - X86_READ_8));
+            break;
+        case X86_WRITE_8: case X86_WRITE_16: case X86_WRITE_32: case X86_WRITE_64:
+            pos = gen_reload(pos, &tmp.u.write_context.src, &scratch[0], X86_RAX);
+            pos = gen_write(pos, &tmp, 8 << (insn->type - X86_WRITE_8));
+            break;
+        case X86_CMPXCHG_8: case X86_CMPXCHG_16: case X86_CMPXCHG_32: case X86_CMPXCHG_64:
+        case X86_XCHG_8: case X86_XCHG_16: case X86_XCHG_32: case X86_XCHG_64:
+        case X86_FETCH_ADD_8: case X86_FETCH_ADD_16: case X86_FETCH_ADD_32: case X86_FETCH_ADD_64:
+            /* rax is used by atomic code sequence */
+            pos = gen_reload(pos, &tmp.u.atomic.address, &scratch[0], X86_RCX);
+            pos = gen_reload(pos, &tmp.u.atomic.op1, &scratch[1], X86_RSI);
+            pos = gen_reload(pos, &tmp.u.atomic.op2, &scratch[2], X86_RDX);
+            dst = use_scratch(&tmp.u.atomic.dst, &scratch[3], dst_index = X86_RDX);
+            if (insn->type >= X86_FETCH_ADD_8)
+                pos = gen_fetch_add(pos, &tmp);
+            else if (insn->type >= X86_XCHG_8)
+                pos = gen_xchg(pos, &tmp);
+            else
+                pos = gen_cmpxchg(pos, &tmp);
+            break;
+        case X86_INSN_MARKER:
+        case X86_NOP:
+            break;
+        default:
+            assert(0);
+    }
+    if (dst)
+        pos = gen_store_slot(pos, dst_index, dst->spillSlot);
 
     return pos;
 }
@@ -1323,178 +1960,54 @@ static int generateCode(struct inter *inter, char *buffer)
     int i;
     struct x86Instruction *insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
     char *pos = buffer;
-    uint64_t mask;
-
-    for (i = 0; i < inter->instructionIndex; ++i, insn++)
-    {
-        switch(insn->type) {
-            case X86_MOV_CONST:
-                pos = gen_mov_const(pos, insn);
-                break;
-            case X86_LOAD_8:
-                pos = gen_load_8(pos, insn);
-                break;
-            case X86_LOAD_16:
-                pos = gen_load_16(pos, insn);
-                break;
-            case X86_LOAD_32:
-                pos = gen_load_32(pos, insn);
-                break;
-            case X86_LOAD_64:
-                pos = gen_load_64(pos, insn);
-                break;
-            case X86_STORE_8:
-                pos = gen_store_8(pos, insn);
-                break;
-            case X86_STORE_16:
-                pos = gen_store_16(pos, insn);
-                break;
-            case X86_STORE_32:
-                pos = gen_store_32(pos, insn);
-                break;
-            case X86_STORE_64:
-                pos = gen_store_64(pos, insn);
-                break;
-            case X86_BINOP_8: mask = 0xff; goto binop;
-            case X86_BINOP_16: mask = 0xffff; goto binop;
-            case X86_BINOP_32: mask = 0xffffffff; goto binop;
-            case X86_BINOP_64: mask = 0; goto binop;
-                binop:
-                    pos = gen_binop(pos, insn, mask);
-                break;
-            case X86_EXIT:
-                pos = gen_exit(pos, insn);
-                break;
-            case X86_ITE:
-                pos = gen_ite(pos, insn);
-                break;
-            case X86_CAST:
-                pos = gen_cast(pos, insn);
-                break;
-            case X86_CALL:
-                pos = gen_call(pos, insn);
-                break;
-            case X86_READ_8:
-                pos = gen_read_8(pos, insn);
-                break;
-            case X86_READ_16:
-                pos = gen_read_16(pos, insn);
-                break;
-            case X86_READ_32:
-                pos = gen_read_32(pos, insn);
-                break;
-            case X86_READ_64:
-                pos = gen_read_64(pos, insn);
-                break;
-            case X86_WRITE_8:
-                pos = gen_write_8(pos, insn);
-                break;
-            case X86_WRITE_16:
-                pos = gen_write_16(pos, insn);
-                break;
-            case X86_WRITE_32:
-                pos = gen_write_32(pos, insn);
-                break;
-            case X86_WRITE_64:
-                pos = gen_write_64(pos, insn);
-                break;
-            default:
-                assert(0);
-        }
+    uint32_t marker_value = 0;
+
+    inter->codeBuffer = buffer;
+    for (i = 0; i < inter->instructionIndex; ++i, insn++) {
+        if (insn->type == X86_INSN_MARKER) {
+            insn->u.marker.host_offset = pos - buffer;
+            marker_value = insn->u.marker.value;
+        } else if (insn->type == X86_EXIT)
+            insn->u.exit.stub_marker_value = marker_value;
+        pos = gen_insn(inter, pos, insn);
+    }
+    /* cold exit stubs */
+    insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
+    for (i = 0; i < inter->instructionIndex; ++i, insn++) {
+        if (insn->type == X86_EXIT && insn->u.exit.stub_patch)
+            pos = gen_exit_stub(inter, pos, insn);
     }
 
     return pos - buffer;
 }
 
-static uint32_t findInsnInCode(struct inter *inter, char *buffer, int offset)
+static int get_markers(struct backend *backend, struct insn_marker *markers, int markerNb)
 {
-    int i;
+    struct inter *inter = container_of(backend, struct inter, backend);
     struct x86Instruction *insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
-    char *pos = buffer;
-    uint64_t mask;
-    uint32_t res = ~0;
+    int res = 0;
+    int i;
 
-    for (i = 0; i < inter->instructionIndex; ++i, insn++)
-    {
-        switch(insn->type) {
-            case X86_INSN_MARKER:
-                res = insn->u.marker.value;
-                break;
-            case X86_MOV_CONST:
-                pos = gen_mov_const(pos, insn);
-                break;
-            case X86_LOAD_8:
-                pos = gen_load_8(pos, insn);
-                break;
-            case X86_LOAD_16:
-                pos = gen_load_16(pos, insn);
-                break;
-            case X86_LOAD_32:
-                pos = gen_load_32(pos, insn);
-                break;
-            case X86_LOAD_64:
-                pos = gen_load_64(pos, insn);
-                break;
-            case X86_STORE_8:
-                pos = gen_store_8(pos, insn);
-                break;
-            case X86_STORE_16:
-                pos = gen_store_16(pos, insn);
-                break;
-            case X86_STORE_32:
-                pos = gen_store_32(pos, insn);
-                break;
-            case X86_STORE_64:
-                pos = gen_store_64(pos, insn);
-                break;
-            case X86_BINOP_8: mask = 0xff; goto binop;
-            case X86_BINOP_16: mask = 0xffff; goto binop;
-            case X86_BINOP_32: mask = 0xffffffff; goto binop;
-            case X86_BINOP_64: mask = 0; goto binop;
-                binop:
-                    pos = gen_binop(pos, insn, mask);
-                break;
-            case X86_EXIT:
-                pos = gen_exit(pos, insn);
-                break;
-            case X86_ITE:
-                pos = gen_ite(pos, insn);
-                break;
-            case X86_CAST:
-                pos = gen_cast(pos, insn);
-                break;
-            case X86_CALL:
-                pos = gen_call(pos, insn);
-                break;
-            case X86_READ_8:
-                pos = gen_read_8(pos, insn);
-                break;
-            case X86_READ_16:
-                pos = gen_read_16(pos, insn);
-                break;
-            case X86_READ_32:
-                pos = gen_read_32(pos, insn);
-                break;
-            case X86_READ_64:
-                pos = gen_read_64(pos, insn);
-                break;
-            case X86_WRITE_8:
-                pos = gen_write_8(pos, insn);
-                break;
-            case X86_WRITE_16:
-                pos = gen_write_16(pos, insn);
-                break;
-            case X86_WRITE_32:
-                pos = gen_write_32(pos, insn);
-                break;
-            case X86_WRITE_64:
-                pos = gen_write_64(pos, insn);
-                break;
-            default:
-                assert(0);
+    for (i = 0; i < inter->instructionIndex; ++i, insn++) {
+        if (insn->type == X86_INSN_MARKER) {
+            assert(res < markerNb);
+            markers[res].host_offset = insn->u.marker.host_offset;
+            markers[res].value = insn->u.marker.value;
+            res++;
+        }
+    }
+    /* exit stubs are attributed to the guest instruction owning their exit. Stub location
+       is found back from its jcc rel32 */
+    insn = (struct x86Instruction *) inter->instructionPoolAllocator.buffer;
+    for (i = 0; i < inter->instructionIndex; ++i, insn++) {
+        if (insn->type == X86_EXIT && insn->u.exit.stub_patch) {
+            char *stub = insn->u.exit.stub_patch + 4 + *(int32_t *) insn->u.exit.stub_patch;
+
+            assert(res < markerNb);
+            markers[res].host_offset = stub - inter->codeBuffer;
+            markers[res].value = insn->u.exit.stub_marker_value;
+            res++;
         }
-        if (pos >= buffer + offset)
-            break;
     }
 
     return res;
@@ -1510,56 +2023,80 @@ static void request_signal_alternate_exit(struct backend *backend, void *_ucp, u
     ucp->uc_mcontext.gregs[REG_RSI] = result;
 }
 
+/* patch site is replaced by a jmp rel32 to cache_area, or by a jmp rel8 to the trampoline
+   for far targets. Trampoline is filled before patch site is atomically updated so
+   concurrent executions see either a ret or a complete jump. */
 static void patch(struct backend *backend, void *link_patch_area, void *cache_area)
 {
-    unsigned char *pos = link_patch_area;
-    uint64_t target = (uint64_t) cache_area;
+    uint64_t *site = (uint64_t *) link_patch_area;
+    int64_t rel = (int64_t) cache_area - ((int64_t) site + 5);
+    uint64_t insn = *site;
+
+    assert(((uint64_t) site & (PATCH_SITE_SIZE - 1)) == 0);
+    assert((insn & 0xff) == 0xc3);
+    if (isImm32(rel)) {
+        /* jmp rel32 */
+        insn = (insn & ~0xffffffffffUL) | 0xe9 | (((uint64_t) (uint32_t) rel) << 8);
+    } else {
+        unsigned char *pos = (unsigned char *) (site + 1) + 2;
+        uint64_t target = (uint64_t) cache_area;
+        int i;
+
+        for(i = 0; i < 8; i++)
+            *pos++ = (target >> (i * 8)) & 0xff;
+        /* jmp rel8 to trampoline */
+        insn = (insn & ~0xffffUL) | 0xeb | ((PATCH_SITE_SIZE - 2) << 8);
+    }
+    __atomic_store_n(site, insn, __ATOMIC_RELEASE);
+}
 
-    assert(*pos == 0xc3);
-    *pos++=0x90;
-    pos+=2;
-    *pos++ = (target >> 0) & 0xff;
-    *pos++ = (target >> 8) & 0xff;
-    *pos++ = (target >> 16) & 0xff;
-    *pos++ = (target >> 24) & 0xff;
-    *pos++ = (target >> 32) & 0xff;
-    *pos++ = (target >> 40) & 0xff;
-    *pos++ = (target >> 48) & 0xff;
-    *pos++ = (target >> 56) & 0xff;
+static void *get_helper_return_address(struct backend *backend, void *_ucp)
+{
+    struct inter *inter = container_of(backend, struct inter, backend);
+    ucontext_t *ucp = (ucontext_t *) _ucp;
+    uint64_t jit_sp;
+
+    /* jit code is not running */
+    if (!inter->restore_sp)
+        return NULL;
+    /* sp is constant inside jit code. So being below it means we are inside a helper and
+       its return address is just below jit sp */
+    jit_sp = inter->restore_sp - JIT_FRAME_SIZE - 8;
+    if (ucp->uc_mcontext.gregs[REG_RSP] >= jit_sp)
+        return NULL;
+
+    return *(void **) (jit_sp - 8);
 }
 
 /* backend api */
-static int jit(struct backend *backend, struct irInstruction *irArray, int irInsnNb, char *buffer, int bufferSize)
+static int jit(struct backend *backend, struct irInstruction *irArray, int irInsnNb, struct irRegister *irRegArray, int irRegNb, char *buffer, int bufferSize)
 {
     struct inter *inter = container_of(backend, struct inter, backend);
+    struct memoryPool *pool = &inter->registerPoolAllocator;
+    uint64_t time = jitStatsStart(backend);
     int res;
+    int i;
 
     // allocate x86 instructions
-    allocateInstructions(inter, irArray, irInsnNb);
+    inter->irRegisters = (struct x86Register *) pool->alloc(pool, irRegNb * sizeof(struct x86Register));
+    for(i = 0; i < irRegNb; i++)
+        inter->irRegisters[i].firstWriteIndex = -1;
+    allocateInstructions(inter, irArray, irInsnNb, irRegArray);
+    jitStatsPassEnd(backend, JIT_PASS_LOWER, &time);
+
+    // select addressing modes
+    foldAddressDisplacement(inter);
+    fuseExitCompare(inter);
+    jitStatsPassEnd(backend, JIT_PASS_OPTIMIZE, &time);
 
     // allocate registers
     allocateRegisters(inter);
+    jitStatsPassEnd(backend, JIT_PASS_REGALLOC, &time);
 
     // generate code
     res = generateCode(inter, buffer);
     assert(res <= bufferSize);
-
-    return res;
-}
-
-static uint32_t get_marker(struct backend *backend, struct irInstruction *irArray, int irInsnNb, char *buffer, int bufferSize, int offset)
-{
-    struct inter *inter = container_of(backend, struct inter, backend);
-    int res;
-
-    // allocate x86 instructions
-    allocateInstructions(inter, irArray, irInsnNb);
-
-    // allocate registers
-    allocateRegisters(inter);
-
-    // find insn
-    res = findInsnInCode(inter, buffer, offset);
+    jitStatsPassEnd(backend, JIT_PASS_CODEGEN, &time);
 
     return res;
 }
@@ -1572,6 +2109,7 @@ static void reset(struct backend *backend)
     inter->instructionPoolAllocator.reset(&inter->instructionPoolAllocator);
     inter->regIndex = 0;
     inter->instructionIndex = 0;
+    inter->callSaveSlot = 0;
 }
 
 /* api */
@@ -1580,6 +2118,7 @@ struct backend *createBackend(void *memory, int size)
     struct inter *inter;
 
     assert(BE_MIN_CONTEXT_SIZE >= sizeof(*inter));
+    assert(SLOT_OFFSET(SPILL_SLOT_NUMBER + CALLER_SAVED_REG_NB) <= JIT_FRAME_SIZE - 8);
     inter = (struct inter *) memory;
     if (inter) {
         int pool_mem_size;
@@ -1589,8 +2128,10 @@ struct backend *createBackend(void *memory, int size)
         inter->backend.jit = jit;
         inter->backend.execute = execute_be_x86_64;
         inter->backend.request_signal_alternate_exit = request_signal_alternate_exit;
-        inter->backend.get_marker = get_marker;
+        inter->backend.get_markers = get_markers;
         inter->backend.patch = patch;
+        inter->backend.get_helper_return_address = get_helper_return_address;
+        inter->backend.stats = NULL;
         inter->backend.reset = reset;
         inter->registerPoolAllocator.alloc = memoryPoolAlloc;
         inter->instructionPoolAllocator.alloc = memoryPoolAlloc;
@@ -31,11 +31,14 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <fcntl.h>
+#include <alloca.h>
 
 #include "cache.h"
 #include "jitter.h"
 #include "target.h"
 #include "be.h"
+#include "host_features.h"
 #include "runtime.h"
 #include "umeq.h"
 #include "version.h"
@@ -44,7 +47,10 @@ char *exe_filename;
 int is_under_proot = 0;
 int maybe_ptraced = 0;
 int is_umeq_call_in_execve = 0;
+int is_host_baseline = 0;
 char *umeq_filename;
+/* when >= 0 ir of each translated block is appended to this file */
+static int ir_capture_fd = -1;
 
 struct memory_config {
     int max_insn;
@@ -57,12 +63,36 @@ enum memory_profile memory_profile = MEM_PROFILE_2M;
 
 const struct memory_config nocache_memory_config = {5, 32 * KB, 32 * KB, 0};
 const struct memory_config cache_memory_config[MEM_PROFILE_NB] = {
-    {10, 64 * KB, 64 * KB, 1 * MB},
-    {10, 64 * KB, 64 * KB, 3 * MB},
-    {20, 128 * KB, 128 * KB, 6 * MB},
-    {40, 256 * KB, 256 * KB, 14 * MB},
+    {10, 32 * KB, 64 * KB, 1 * MB},
+    {10, 32 * KB, 64 * KB, 3 * MB},
+    {20, 48 * KB, 128 * KB, 6 * MB},
+    {40, 96 * KB, 256 * KB, 14 * MB},
 };
 
+/* capture record is a 32 bits size followed by serialized ir of the block */
+static void capture_ir(jitContext handle)
+{
+    uint32_t size = serializeIr(handle, NULL, 0);
+    char *record = alloca(sizeof(size) + size);
+    size_t remaining = sizeof(size) + size;
+    ssize_t res;
+
+    memcpy(record, &size, sizeof(size));
+    serializeIr(handle, record + sizeof(size), size);
+    /* one write per record so records of several threads don't interleave. Loop
+       only to resume after a signal or a short write on a nearly full disk */
+    while(remaining) {
+        res = write(ir_capture_fd, record, remaining);
+        /* runtime write returns -errno */
+        if (res == -EINTR)
+            continue;
+        if (res <= 0)
+            fatal("Unable to write ir capture file (%d)\n", (int) res);
+        record += res;
+        remaining -= res;
+    }
+}
+
 static void loop_common(struct target *target, struct backend *backend, struct cache *cache, uint64_t entry,
                         void *target_runtime, jitContext handle, int max_insn)
 {
@@ -70,7 +100,8 @@ static void loop_common(struct target *target, struct backend *backend, struct c
     uint64_t prevCurrentPc = ~0;
     struct backend_execute_result result = {0, 0};
     struct irInstructionAllocator *ir = getIrInstructionAllocator(handle);
-    char jitBuffer[16 * 1024];
+    /* cacheNone executes code from jitBuffer */
+    char jitBuffer[16 * 1024] __attribute__ ((aligned (JIT_CODE_ALIGN)));
 
     while(target->isLooping(target)) {
         void *cache_area;
@@ -83,13 +114,18 @@ static void loop_common(struct target *target, struct backend *backend, struct c
             currentPc = result.result;
         } else {
             int jitSize;
+            int mapSize;
 
             resetJitter(handle);
             target->disassemble(target, ir, currentPc, max_insn);
             //displayIr(handle);
+            if (ir_capture_fd >= 0)
+                capture_ir(handle);
             jitSize = jitCode(handle, jitBuffer, sizeof(jitBuffer));
             if (jitSize > 0) {
-                cache_area = cache->append(cache, currentPc, jitBuffer, jitSize, &is_cache_was_cleaned);
+                /* insn map is used to find precise guest pc on signal */
+                mapSize = jitInsnMap(handle, jitBuffer + jitSize, sizeof(jitBuffer) - jitSize);
+                cache_area = cache->append(cache, currentPc, jitBuffer, jitSize, jitBuffer + jitSize, mapSize, &is_cache_was_cleaned);
                 /* only link forward to avoid loop */
                 if (prevCurrentPc < currentPc && result.link_patch_area && is_cache_was_cleaned == 0) {
                     backend->patch(backend, result.link_patch_area, cache_area);
@@ -234,6 +270,18 @@ int main(int argc, char **argv)
             is_umeq_call_in_execve = 1;
             umeq_filename = argv[0];
             target_argv0_index ++;
+        } else if (strcmp("-baseline", argv[target_argv0_index]) == 0) {
+            /* don't use optional host instruction set extensions */
+            is_host_baseline = 1;
+            target_argv0_index++;
+        } else if (strcmp("-capture-ir", argv[target_argv0_index]) == 0) {
+            /* record ir of translated blocks for offline backend benchmarking */
+            if (target_argv0_index + 1 >= argc)
+                fatal("-capture-ir requires a file name\n");
+            ir_capture_fd = open(argv[target_argv0_index + 1], O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if (ir_capture_fd < 0)
+                fatal("Unable to open ir capture file %s\n", argv[target_argv0_index + 1]);
+            target_argv0_index += 2;
         } else if (strcmp("-version", argv[target_argv0_index]) == 0) {
             target_argv0_index++;
             display_version_and_exit();
@@ -242,6 +290,7 @@ int main(int argc, char **argv)
     }
     assert(additionnal_env_index < 16);
     assert(unset_env_index < 16);
+    initHostFeatures(is_host_baseline);
     /* clear is_under_proot flag if -execve option is in use */
     if (is_umeq_call_in_execve) {
         /* this option require -0 usage */
@@ -359,6 +359,8 @@ static int execve_neutral(uint32_t filename_p,uint32_t argv_p,uint32_t envp_p)
         /* insert umeq */
         ptr[index++] = umeq_filename;
         ptr[index++] = "-execve";
+        if (is_host_baseline)
+            ptr[index++] = "-baseline";
         ptr[index++] = "-0";
         if (i_name) {
             ptr[index++] = i_name;
@@ -75,6 +75,8 @@ static long execve_neutral(uint64_t filename_p, uint64_t argv_p, uint64_t envp_p
         /* insert umeq */
         ptr[index++] = umeq_filename;
         ptr[index++] = "-execve";
+        if (is_host_baseline)
+            ptr[index++] = "-baseline";
         ptr[index++] = "-0";
         if (i_name) {
             ptr[index++] = i_name;
@@ -36,7 +36,6 @@
 #include "arm_signal_types.h"
 #include "jitter.h"
 #include "target.h"
-#include "be.h"
 
 #define ARM_CONTEXT_SIZE     (4096)
 
@@ -123,28 +122,24 @@ static void setup_siginfo(uint32_t signum, siginfo_t *siginfo, struct siginfo_ar
     }
 }
 
-static uint32_t find_insn_offset(uint32_t guest_pc, int offset)
+static uint32_t find_guest_pc(void *host_pc)
 {
-    struct backend *backend;
-    jitContext handle;
-    struct irInstructionAllocator *ir;
-    struct arm_target context;
-    char jitBuffer[16 * KB];
-    char *beMemory = alloca(256 * KB);
-    char *jitterMemory = alloca(256 * KB);
-
-    memset(&context, 0, sizeof(context));
-
-    backend = createBackend(beMemory, 256 * KB);
-    handle = createJitter(jitterMemory, backend, 256 * KB);
-    ir = getIrInstructionAllocator(handle);
-
-    if (guest_pc & 1)
-        disassemble_thumb_with_marker(&context, ir, guest_pc, 40);
-    else
-        disassemble_arm_with_marker(&context, ir, guest_pc, 40);
-
-    return findInsn(handle, jitBuffer, sizeof(jitBuffer), offset);
+    struct tls_context *current_tls_context;
+    struct cache *cache;
+    void *jit_host_start_pc;
+    void *insn_map;
+    uint32_t jit_guest_start_pc;
+    uint32_t insn_offset;
+
+    current_tls_context = get_tls_context();
+    cache = current_tls_context->cache;
+
+    jit_guest_start_pc = cache->lookup_pc(cache, host_pc, &jit_host_start_pc, &insn_map);
+    assert(jit_guest_start_pc != 0);
+    insn_offset = lookupInsnMap(insn_map, host_pc - jit_host_start_pc);
+    assert(insn_offset != ~0);
+
+    return jit_guest_start_pc + insn_offset;
 }
 
 static uint32_t restore_precise_pc(struct arm_target *prev_context, ucontext_t *ucp, int *in_signal_location)
@@ -153,36 +148,27 @@ static uint32_t restore_precise_pc(struct arm_target *prev_context, ucontext_t *
 
     if (ucp) {
         void *host_pc_signal = get_host_pc_from_user_context(ucp);
+        void *helper_return_address;
 
         /* we can be in three distinct area :
         - in jitting area
         - in umeq helper function
         - in umeq code, in that case we are not currently emulating guest instruction */
-        if (prev_context->regs.helper_pc) {
-            /* we are inside an helper */
-            *in_signal_location = SIGNAL_LOCATION_JITTER_EXEC;
-            res = prev_context->regs.helper_pc;
-        } else if (host_pc_signal >= (void *)&__executable_start &&
-               host_pc_signal < (void *)&__etext) {
-            /* we are somewhere in umeq code */
-            *in_signal_location = SIGNAL_LOCATION_UMEQ_CODE;
-            res = prev_context->regs.r[15];
+        if (host_pc_signal >= (void *)&__executable_start &&
+            host_pc_signal < (void *)&__etext) {
+            helper_return_address = prev_context->backend->get_helper_return_address(prev_context->backend, ucp);
+            if (helper_return_address) {
+                /* we are inside an helper. Use call instruction to find guest instruction */
+                *in_signal_location = SIGNAL_LOCATION_JITTER_EXEC;
+                res = find_guest_pc(helper_return_address - 1);
+            } else {
+                /* we are somewhere in umeq code */
+                *in_signal_location = SIGNAL_LOCATION_UMEQ_CODE;
+                res = prev_context->regs.r[15];
+            }
         } else {
-            struct tls_context *current_tls_context;
-            struct cache *cache;
-            void *jit_host_start_pc;
-            uint32_t jit_guest_start_pc;
-            uint32_t insn_offset;
-
-            current_tls_context = get_tls_context();
-            cache = current_tls_context->cache;
-
-            jit_guest_start_pc = cache->lookup_pc(cache, host_pc_signal, &jit_host_start_pc);
-            assert(jit_guest_start_pc != 0);
-            insn_offset = find_insn_offset(jit_guest_start_pc, host_pc_signal - jit_host_start_pc);
-            assert(insn_offset != ~0);
-
-            res = prev_context->regs.r[15] + insn_offset;
+            *in_signal_location = SIGNAL_LOCATION_JITTER_EXEC;
+            res = find_guest_pc(host_pc_signal);
         }
     }
 
@@ -90,7 +90,7 @@ struct arm_registers {
     } e;
     float_status fp_status;
     float_status fp_status_simd;
-    uint32_t helper_pc;
+    uint64_t exclusive_value;
 };
 
 struct arm_target {
@@ -100,8 +100,9 @@ struct arm_target {
     uint64_t sp_init;
     uint32_t isLooping;
     uint32_t exitStatus;
-    uint64_t exclusive_value;
     uint32_t disa_itstate;
+    /* set when flags computed by current instruction are never observed */
+    uint32_t disa_is_flags_dead;
     uint32_t is_in_signal;
     int32_t in_signal_location;
     struct backend *backend;
@@ -124,8 +125,6 @@ extern void ptrace_exec_event(struct arm_target *context);
 extern void ptrace_syscall_enter(struct arm_target *context);
 extern void ptrace_syscall_exit(struct arm_target *context);
 extern void arm_load_image(int argc, char **argv, void **additionnal_env, void **unset_env, void *target_argv0, uint64_t *entry, uint64_t *stack);
-extern void disassemble_arm_with_marker(struct arm_target *context, struct irInstructionAllocator *irAlloc, uint64_t pc, int maxInsn);
-extern void disassemble_thumb_with_marker(struct arm_target *context, struct irInstructionAllocator *irAlloc, uint64_t pc, int maxInsn);
 extern int on_sig_stack(struct arm_target *context, uint32_t sp);
 extern int is_out_of_signal_stack(struct arm_target *context);
 extern uint32_t sigsp(struct arm_target *prev_context, uint32_t signum);
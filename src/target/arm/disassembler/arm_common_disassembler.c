@@ -113,6 +113,49 @@ static void write_fpscr(struct arm_target *context, struct irInstructionAllocato
                         params);
 }
 
+/* flags liveness */
+#define FLAG_N      0x80000000
+#define FLAG_Z      0x40000000
+#define FLAG_C      0x20000000
+#define FLAG_V      0x10000000
+#define FLAGS_NZCV  (FLAG_N | FLAG_Z | FLAG_C | FLAG_V)
+
+/* size_access encoding follow arm ldrex / strex one : 4 => 32 bits, 6 => 8 bits, 7 => 16 bits */
+static struct irRegister *mk_ldrexx(struct arm_target *context, struct irInstructionAllocator *ir, struct irRegister *address, int size_access)
+{
+    struct irRegister *res;
+
+    if (size_access == 4)
+        res = ir->add_load_32(ir, mk_address(ir, address));
+    else if (size_access == 7)
+        res = ir->add_16U_to_32(ir, ir->add_load_16(ir, mk_address(ir, address)));
+    else
+        res = ir->add_8U_to_32(ir, ir->add_load_8(ir, mk_address(ir, address)));
+    /* keep value so strex can check memory has not been modified */
+    ir->add_write_context_32(ir, res, offsetof(struct arm_registers, exclusive_value));
+
+    return res;
+}
+
+/* FIXME: like previous helper version this is subject to the ABA problem */
+static struct irRegister *mk_strexx(struct arm_target *context, struct irInstructionAllocator *ir, struct irRegister *address, int size_access, struct irRegister *value)
+{
+    struct irRegister *expected = ir->add_read_context_32(ir, offsetof(struct arm_registers, exclusive_value));
+    struct irRegister *status;
+
+    if (size_access == 4) {
+        status = ir->add_cmpne_32(ir, ir->add_cmpxchg_32(ir, mk_address(ir, address), expected, value), expected);
+    } else if (size_access == 7) {
+        expected = ir->add_32_to_16(ir, expected);
+        status = ir->add_16U_to_32(ir, ir->add_cmpne_16(ir, ir->add_cmpxchg_16(ir, mk_address(ir, address), expected, ir->add_32_to_16(ir, value)), expected));
+    } else {
+        expected = ir->add_32_to_8(ir, expected);
+        status = ir->add_8U_to_32(ir, ir->add_cmpne_8(ir, ir->add_cmpxchg_8(ir, mk_address(ir, address), expected, ir->add_32_to_8(ir, value)), expected));
+    }
+
+    return ir->add_and_32(ir, status, ir->add_mov_const_32(ir, 1));
+}
+
 /* ir generation */
 static int dis_common_vldm(struct arm_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
@@ -27,6 +27,7 @@
 #include "runtime.h"
 #include "cache.h"
 #include "umeq.h"
+#include "flags_liveness.h"
 
 //#define DUMP_STATE  1
 #define INSN(msb, lsb) ((insn >> (lsb)) & ((1 << ((msb) - (lsb) + 1))-1))
@@ -53,31 +54,17 @@ static struct irRegister *mk_64(struct irInstructionAllocator *ir, uint64_t valu
 
 static void mk_call_void(struct arm_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    ir->add_write_context_32(ir, mk_32(ir, context->pc), offsetof(struct arm_registers, helper_pc));
     ir->add_call_void(ir, name, address, params);
-    ir->add_write_context_32(ir, mk_32(ir, 0), offsetof(struct arm_registers, helper_pc));
 }
 
 static struct irRegister *mk_call_32(struct arm_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    struct irRegister *res;
-
-    ir->add_write_context_32(ir, mk_32(ir, context->pc), offsetof(struct arm_registers, helper_pc));
-    res = ir->add_call_32(ir, name, address, params);
-    ir->add_write_context_32(ir, mk_32(ir, 0), offsetof(struct arm_registers, helper_pc));
-
-    return res;
+    return ir->add_call_32(ir, name, address, params);
 }
 
 static struct irRegister *mk_call_64(struct arm_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    struct irRegister *res;
-
-    ir->add_write_context_32(ir, mk_32(ir, context->pc), offsetof(struct arm_registers, helper_pc));
-    res = ir->add_call_64(ir, name, address, params);
-    ir->add_write_context_32(ir, mk_32(ir, 0), offsetof(struct arm_registers, helper_pc));
-
-    return res;
+    return ir->add_call_64(ir, name, address, params);
 }
 
 static void dump_state(struct arm_target *context, struct irInstructionAllocator *ir)
@@ -207,6 +194,7 @@ static int mk_data_processing(struct arm_target *context, struct irInstructionAl
     int isExit = (rd == 15)?1:0;
     struct irRegister *result = NULL;
 
+    s = s && !context->disa_is_flags_dead;
     if (s) {
         struct irRegister *params[4];
 
@@ -550,7 +538,7 @@ static int dis_data_processing_immediate(struct arm_target *context, uint32_t in
     }
     op = mk_32(ir, imm32);
 
-    if (s) {
+    if (s && !context->disa_is_flags_dead) {
         if (rotate) {
             write_sco(context, ir, mk_32(ir, (imm32 >> 2) & 0x20000000));
         } else {
@@ -754,7 +742,7 @@ static int dis_data_processing_register_insn(struct arm_target *context, uint32_
 
     rm_reg = read_reg(context, ir, rm);
 
-    if (s) {
+    if (s && !context->disa_is_flags_dead) {
         write_sco(context, ir, mk_sco(context, ir,
                                       mk_32(ir, insn),
                                       rm_reg,
@@ -1264,22 +1252,11 @@ static int dis_ldrexx(struct arm_target *context, uint32_t insn, struct irInstru
 {
     int rn = INSN(19, 16);
     int rt = INSN(15, 12);
-    struct irRegister *params[4];
-    struct irRegister *result;
 
     assert_illegal_opcode(rn != 15);
     assert_illegal_opcode(rt != 15);
 
-    params[0] = read_reg(context, ir, rn);
-    params[1] = mk_32(ir, INSN(23, 21));
-    params[2] = NULL;
-    params[3] = NULL;
-
-    result = mk_call_32(context, ir, "arm_hlp_ldrexx",
-                             mk_64(ir, ptr_2_int(arm_hlp_ldrexx)),
-                             params);
-
-    write_reg(context, ir, rt, result);
+    write_reg(context, ir, rt, mk_ldrexx(context, ir, read_reg(context, ir, rn), INSN(23, 21)));
 
     return 0;
 }
@@ -1315,23 +1292,12 @@ static int dis_strexx(struct arm_target *context, uint32_t insn, struct irInstru
     int rn = INSN(19, 16);
     int rd = INSN(15, 12);
     int rt = INSN(3, 0);
-    struct irRegister *params[4];
-    struct irRegister *result;
 
     assert_illegal_opcode(rn != 15);
     assert_illegal_opcode(rd != 15);
     assert_illegal_opcode(rt != 15);
 
-    params[0] = read_reg(context, ir, rn);
-    params[1] = mk_32(ir, INSN(23, 21));
-    params[2] = read_reg(context, ir, rt);
-    params[3] = NULL;
-
-    result = mk_call_32(context, ir, "arm_hlp_strexx",
-                             mk_64(ir, ptr_2_int(arm_hlp_strexx)),
-                             params);
-
-    write_reg(context, ir, rd, result);
+    write_reg(context, ir, rd, mk_strexx(context, ir, read_reg(context, ir, rn), INSN(23, 21), read_reg(context, ir, rt)));
 
     return 0;
 }
@@ -2411,7 +2377,7 @@ static int dis_data_processing_register_shifted_insn(struct arm_target *context,
     rm_reg = read_reg(context, ir, rm);
     rs_reg = read_reg(context, ir, rs);
 
-    if (s) {
+    if (s && !context->disa_is_flags_dead) {
         write_sco(context, ir, mk_sco(context, ir,
                                       mk_32(ir, insn),
                                       rm_reg,
@@ -2786,49 +2752,108 @@ static int vdso_get_tls(struct arm_target *context, struct irInstructionAllocato
 
     return 1;
 }
-/* api */
-void disassemble_arm(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
+/* flags liveness. Return 0 for instructions we don't handle or that may exit block.
+   For these ones all flags must be considered as observed. */
+static int get_flags_usage(uint32_t insn, struct flags_usage *usage)
 {
-    struct arm_target *context = container_of(target, struct arm_target, target);
-    int i;
-    int isExit = 0; //unconditionnal exit
-    uint32_t *pc_ptr = (uint32_t *) g_2_h(pc);
+    int op1 = INSN(27, 25);
+    int opcode = INSN(24, 21);
+    int s = INSN(20, 20);
+    int rd = INSN(15, 12);
 
-    assert((pc & 3) == 0);
-    for(i = 0; i < maxInsn; i++) {
-        context->pc = h_2_g(pc_ptr);
-        if (context->pc == 0xffff0f60) {
-            isExit = vdso_cmpxchg64(context, ir);
-        } else if (context->pc == 0xffff0fc0) {
-            isExit = vdso_cmpxchg(context, ir);
-        } else if (context->pc == 0xffff0fa0) {
-            isExit = vdso_memory_barrier(context, ir);
-        } else if (context->pc == 0xffff0fe0) {
-            isExit = vdso_get_tls(context, ir);
-        } else {
-            isExit = disassemble_insn(context, *pc_ptr, ir);
-            pc_ptr++;
-        }
-        dump_state(context, ir);
-        if (isExit)
+    usage->read = 0;
+    usage->write = 0;
+    usage->may_write = 0;
+    if (INSN(31, 28) != 14)
+        return 0;
+    switch(op1) {
+        case 0:
+            /* multiply, extra load/store and misc instructions are not handled */
+            if ((INSN(7, 7) && INSN(4, 4)) || (!s && (opcode & 0xc) == 0x8))
+                return 0;
+            /* rrx */
+            if (!INSN(4, 4) && INSN(6, 5) == 3 && INSN(11, 7) == 0)
+                usage->read |= FLAG_C;
+            break;
+        case 1:
+            if (!s && (opcode & 0xc) == 0x8) {
+                /* movw / movt */
+                if ((opcode == 8 || opcode == 10) && rd != 15)
+                    return 1;
+                return 0;
+            }
             break;
+        case 2: case 3:
+            /* media */
+            if (op1 == 3 && INSN(4, 4))
+                return 0;
+            /* ldr pc */
+            if (INSN(20, 20) && rd == 15)
+                return 0;
+            /* rrx */
+            if (op1 == 3 && INSN(6, 5) == 3 && INSN(11, 7) == 0)
+                usage->read |= FLAG_C;
+            return 1;
+        case 4:
+            /* ldm with pc and user registers variants */
+            if (INSN(22, 22) || (INSN(20, 20) && INSN(15, 15)))
+                return 0;
+            return 1;
+        default:
+            return 0;
     }
-    if (!isExit) {
-        write_reg(context, ir, 15, ir->add_mov_const_32(ir, context->pc + 4));
-        ir->add_exit(ir, ir->add_mov_const_64(ir, context->pc + 4));
+
+    /* data processing */
+    if (rd == 15)
+        return 0;
+    /* adc / sbc / rsc */
+    if (opcode >= 5 && opcode <= 7)
+        usage->read |= FLAG_C;
+    if (s) {
+        switch(opcode) {
+            case 2 ... 7: case 10: case 11:
+                usage->write = FLAGS_NZCV;
+                usage->may_write = FLAGS_NZCV;
+                break;
+            default:
+                usage->write = FLAG_N | FLAG_Z;
+                usage->may_write = FLAG_N | FLAG_Z | FLAG_C;
+        }
+    }
+
+    return 1;
+}
+
+static uint64_t mk_dead_flags(uint32_t *pc_ptr, int maxInsn)
+{
+    struct flags_usage usage[64];
+    int nb;
+
+    for(nb = 0; nb < maxInsn && nb < 64; nb++, pc_ptr++) {
+        /* vdso entry points */
+        if (h_2_g(pc_ptr) >= 0xffff0f60)
+            break;
+        if (!get_flags_usage(*pc_ptr, &usage[nb]))
+            break;
     }
+
+    return compute_dead_flags(usage, nb);
 }
 
-void disassemble_arm_with_marker(struct arm_target *context, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
+/* api */
+void disassemble_arm(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
 {
+    struct arm_target *context = container_of(target, struct arm_target, target);
     int i;
     int isExit = 0; //unconditionnal exit
     uint32_t *pc_ptr = (uint32_t *) g_2_h(pc);
     uint32_t pc_offset = 0;
+    uint64_t dead_flags = mk_dead_flags(pc_ptr, maxInsn);
 
     assert((pc & 3) == 0);
     for(i = 0; i < maxInsn; i++) {
         context->pc = h_2_g(pc_ptr);
+        context->disa_is_flags_dead = (dead_flags >> i) & 1;
         ir->add_insn_marker(ir, pc_offset);
         pc_offset += 4;
         if (context->pc == 0xffff0f60) {
@@ -36,6 +36,7 @@
 #include "arm_private.h"
 #include "arm_helpers.h"
 #include "runtime.h"
+#include "host_features.h"
 #include "softfloat.h"
 #include "arm_softfloat.h"
 #include "umeq.h"
@@ -2317,6 +2318,10 @@ uint32_t arm_hlp_clz(uint64_t context, uint32_t rm)
     uint32_t res = 0;
     int i;
 
+    if (hasHostFeature(HOST_FEATURE_LZCNT)) {
+        asm("lzcnt %1, %0" : "=r" (res) : "r" (rm));
+        return res;
+    }
     for(i = 31; i >= 0; i--) {
         if ((rm >> i) & 1)
             break;
@@ -2346,74 +2351,22 @@ uint32_t arm_hlp_multiply_flag_update(uint64_t context, uint32_t res, uint32_t o
 /* FIXME: ldrex / strex implementation below is not sematically correct. It's subject
           to the ABBA problem which is not the case of ldrex/strex hardware implementation
  */
-uint32_t arm_hlp_ldrexx(uint64_t regs, uint32_t address, uint32_t size_access)
-{
-    struct arm_target *context = container_of(int_2_ptr(regs), struct arm_target, regs);
-
-    switch(size_access) {
-        case 6://8 bits
-            context->exclusive_value = (uint64_t) *((uint8_t *)g_2_h(address));
-            break;
-        case 7://16 bits
-            context->exclusive_value = (uint64_t) *((uint16_t *)g_2_h(address));
-            break;
-        case 4://32 bits
-            context->exclusive_value = (uint64_t) *((uint32_t *)g_2_h(address));
-            break;
-        default:
-            fatal_illegal_opcode("size_access %d unsupported\n", size_access);
-    }
-
-    return (uint32_t) context->exclusive_value;
-}
-
-uint64_t arm_hlp_ldrexd(uint64_t regs, uint32_t address)
-{
-    struct arm_target *context = container_of(int_2_ptr(regs), struct arm_target, regs);
-
-    context->exclusive_value = (uint64_t) *((uint64_t *)g_2_h(address));
-
-    return context->exclusive_value;
-}
-
-uint32_t arm_hlp_strexx(uint64_t regs, uint32_t address, uint32_t size_access, uint32_t value)
+uint64_t arm_hlp_ldrexd(uint64_t _regs, uint32_t address)
 {
-    struct arm_target *context = container_of(int_2_ptr(regs), struct arm_target, regs);
-    uint32_t res = 0;
+    struct arm_registers *regs = (struct arm_registers *) int_2_ptr(_regs);
 
-    switch(size_access) {
-        case 6://8 bits
-            if (__sync_bool_compare_and_swap((uint8_t *) g_2_h(address), (uint8_t)context->exclusive_value, value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        case 7://16 bits
-            if (__sync_bool_compare_and_swap((uint16_t *) g_2_h(address), (uint16_t)context->exclusive_value, value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        case 4://32 bits
-            if (__sync_bool_compare_and_swap((uint32_t *) g_2_h(address), (uint32_t)context->exclusive_value, value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        default:
-            fatal_illegal_opcode("size_access %d unsupported\n", size_access);
-    }
+    regs->exclusive_value = (uint64_t) *((uint64_t *)g_2_h(address));
 
-    return res;
+    return regs->exclusive_value;
 }
 
-uint32_t arm_hlp_strexd(uint64_t regs, uint32_t address, uint32_t lsb, uint32_t msb)
+uint32_t arm_hlp_strexd(uint64_t _regs, uint32_t address, uint32_t lsb, uint32_t msb)
 {
-    struct arm_target *context = container_of(int_2_ptr(regs), struct arm_target, regs);
+    struct arm_registers *regs = (struct arm_registers *) int_2_ptr(_regs);
     uint32_t res = 0;
     uint64_t value = ((uint64_t)msb << 32) | lsb;
 
-    if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), context->exclusive_value, value))
+    if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), regs->exclusive_value, value))
         res = 0;
     else
         res = 1;
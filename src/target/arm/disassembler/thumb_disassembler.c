@@ -27,6 +27,7 @@
 #include "runtime.h"
 #include "cache.h"
 #include "umeq.h"
+#include "flags_liveness.h"
 
 //#define DUMP_STATE  1
 #define INSN(msb, lsb) ((insn >> (lsb)) & ((1 << ((msb) - (lsb) + 1))-1))
@@ -41,6 +42,12 @@ static int inItBlock(struct arm_target *context)
     return (context->disa_itstate & 0xf) != 0;
 }
 
+/* 16 bits instructions only update flags outside it block */
+static int isSetFlags(struct arm_target *context)
+{
+    return !inItBlock(context) && !context->disa_is_flags_dead;
+}
+
 /*static int lastInItBlock(struct arm_target *context)
 {
     return (context->disa_itstate & 0xf) == 0x8;
@@ -109,31 +116,17 @@ static struct irRegister *mk_64(struct irInstructionAllocator *ir, uint64_t valu
 
 static void mk_call_void(struct arm_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    ir->add_write_context_32(ir, mk_32(ir, context->pc), offsetof(struct arm_registers, helper_pc));
     ir->add_call_void(ir, name, address, params);
-    ir->add_write_context_32(ir, mk_32(ir, 0), offsetof(struct arm_registers, helper_pc));
 }
 
 static struct irRegister *mk_call_32(struct arm_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    struct irRegister *res;
-
-    ir->add_write_context_32(ir, mk_32(ir, context->pc), offsetof(struct arm_registers, helper_pc));
-    res = ir->add_call_32(ir, name, address, params);
-    ir->add_write_context_32(ir, mk_32(ir, 0), offsetof(struct arm_registers, helper_pc));
-
-    return res;
+    return ir->add_call_32(ir, name, address, params);
 }
 
 static struct irRegister *mk_call_64(struct arm_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    struct irRegister *res;
-
-    ir->add_write_context_32(ir, mk_32(ir, context->pc), offsetof(struct arm_registers, helper_pc));
-    res = ir->add_call_64(ir, name, address, params);
-    ir->add_write_context_32(ir, mk_32(ir, 0), offsetof(struct arm_registers, helper_pc));
-
-    return res;
+    return ir->add_call_64(ir, name, address, params);
 }
 
 static void dump_state(struct arm_target *context, struct irInstructionAllocator *ir)
@@ -282,6 +275,7 @@ static int mk_data_processing_modified(struct arm_target *context, struct irInst
     int rd = INSN2(11, 8);
     int rn = INSN1(3, 0);
     int s = INSN1(4, 4);
+    int is_flags_update = s && !context->disa_is_flags_dead;
     int isExit = (rd == 15)?1:0;
     struct irRegister *op1;
     struct irRegister *result = NULL;
@@ -299,7 +293,7 @@ static int mk_data_processing_modified(struct arm_target *context, struct irInst
     else
         op1 = read_reg(context, ir, rn);
 
-    if (s) {
+    if (is_flags_update) {
         struct irRegister *params[4];
 
         params[0] = ir->add_or_32(ir,
@@ -391,7 +385,7 @@ static int mk_data_processing_modified(struct arm_target *context, struct irInst
     assert_illegal_opcode(isExit == 0);
     if (result)
         write_reg(context, ir, rd, result);
-    if (s)
+    if (is_flags_update)
         write_cpsr(context, ir, nextCpsr);
 
     return isExit;
@@ -474,7 +468,7 @@ static int mk_load_store_word_immediate(struct arm_target *context, uint32_t ins
 static int mk_t1_add_sub_immediate(struct arm_target *context, uint32_t insn, struct irInstructionAllocator *ir,
                                    int isAdd, int rd, int rn, uint32_t imm32)
 {
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
 
@@ -771,16 +765,19 @@ static int dis_t1_mov_immediate(struct arm_target *context, uint32_t insn, struc
 {
     int rd = INSN(10, 8);
     uint32_t imm32 = INSN(7, 0);
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
 
     if (s) {
         struct irRegister *params[4];
 
+        /* carry is unchanged */
         params[0] = ir->add_or_32(ir,
                                   ir->add_mov_const_32(ir, opcode),
-                                  read_sco(context, ir));
+                                  ir->add_and_32(ir,
+                                                 read_cpsr(context, ir),
+                                                 mk_32(ir, 0x20000000)));
         params[1] = mk_32(ir, 0);
         params[2] = mk_32(ir, imm32);
         params[3] = read_cpsr(context, ir);
@@ -801,7 +798,7 @@ static int dis_t1_cmp_immediate(struct arm_target *context, uint32_t insn, struc
 {
     int rn = INSN(10, 8);
     uint32_t imm32 = INSN(7, 0);
-    int s = 1;
+    int s = !context->disa_is_flags_dead;
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
 
@@ -865,7 +862,7 @@ static int dis_t1_lsl_immediate(struct arm_target *context, uint32_t insn, struc
     int rm = INSN(5, 3);
     int rd = INSN(2, 0);
     int imm5 = INSN(10, 6);
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *rm_reg = read_reg(context, ir, rm);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
@@ -907,7 +904,7 @@ static int dis_t1_lsr_immediate(struct arm_target *context, uint32_t insn, struc
     int rm = INSN(5, 3);
     int rd = INSN(2, 0);
     int imm5 = INSN(10, 6);
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *rm_reg = read_reg(context, ir, rm);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
@@ -951,7 +948,7 @@ static int dis_t1_asr_immediate(struct arm_target *context, uint32_t insn, struc
     int rm = INSN(5, 3);
     int rd = INSN(2, 0);
     int imm5 = INSN(10, 6);
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *rm_reg = read_reg(context, ir, rm);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
@@ -995,7 +992,7 @@ static int dis_t1_add_register(struct arm_target *context, uint32_t insn, struct
     int rd = INSN(2, 0);
     int rn = INSN(5, 3);
     int rm = INSN(8, 6);
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
 
@@ -1030,7 +1027,7 @@ static int dis_t1_sub_register(struct arm_target *context, uint32_t insn, struct
     int rd = INSN(2, 0);
     int rn = INSN(5, 3);
     int rm = INSN(8, 6);
-    int s = !inItBlock(context);
+    int s = isSetFlags(context);
     struct irRegister *nextCpsr;
     int opcode = INSN(13, 9);
 
@@ -1121,6 +1118,9 @@ static int dis_t1_cmp_register_t2(struct arm_target *context, uint32_t insn, str
     struct irRegister *params[4];
     struct irRegister *nextCpsr;
 
+    if (context->disa_is_flags_dead)
+        return 0;
+
     params[0] = mk_32(ir, 10);
     params[1] = read_reg(context, ir, rn);
     params[2] = read_reg(context, ir, rm);
@@ -2353,7 +2353,7 @@ static int dis_t1_data_processing(struct arm_target *context, uint32_t insn, str
     int rdn = INSN(2, 0);
     int rm = INSN(5, 3);
     int opcode = INSN(9, 6);
-    int s = !inItBlock(context) || opcode == 8 || opcode == 10 || opcode == 11;
+    int s = (!inItBlock(context) || opcode == 8 || opcode == 10 || opcode == 11) && !context->disa_is_flags_dead;
     struct irRegister *pred;
     struct irRegister *op_true;
     struct irRegister *op_false;
@@ -2735,25 +2735,17 @@ static int dis_t2_ldrexx(struct arm_target *context, uint32_t insn, struct irIns
 {
     int rn = INSN1(3, 0);
     int rt = INSN2(15, 12);
-    struct irRegister *params[4];
-    struct irRegister *result;
+    struct irRegister *address;
 
     assert_illegal_opcode(rn != 15);
     assert_illegal_opcode(rt != 15);
 
     if (imm32)
-        params[0] = ir->add_add_32(ir, read_reg(context, ir, rn), mk_32(ir, imm32));
+        address = ir->add_add_32(ir, read_reg(context, ir, rn), mk_32(ir, imm32));
     else
-        params[0] = read_reg(context, ir, rn);
-    params[1] = mk_32(ir, type);
-    params[2] = NULL;
-    params[3] = NULL;
-
-    result = mk_call_32(context, ir, "arm_hlp_ldrexx",
-                             mk_64(ir, ptr_2_int(arm_hlp_ldrexx)),
-                             params);
+        address = read_reg(context, ir, rn);
 
-    write_reg(context, ir, rt, result);
+    write_reg(context, ir, rt, mk_ldrexx(context, ir, address, type));
 
     return 0;
 }
@@ -2804,26 +2796,18 @@ static int dis_t2_strexx(struct arm_target *context, uint32_t insn, struct irIns
 {
     int rn = INSN1(3, 0);
     int rt = INSN2(15, 12);
-    struct irRegister *params[4];
-    struct irRegister *result;
+    struct irRegister *address;
 
     assert_illegal_opcode(rn != 15);
     assert_illegal_opcode(rd != 15);
     assert_illegal_opcode(rt != 15);
 
     if (imm32)
-        params[0] = ir->add_add_32(ir, read_reg(context, ir, rn), mk_32(ir, imm32));
+        address = ir->add_add_32(ir, read_reg(context, ir, rn), mk_32(ir, imm32));
     else
-        params[0] = read_reg(context, ir, rn);
-    params[1] = mk_32(ir, type);
-    params[2] = read_reg(context, ir, rt);
-    params[3] = NULL;
+        address = read_reg(context, ir, rn);
 
-    result = mk_call_32(context, ir, "arm_hlp_strexx",
-                             mk_64(ir, ptr_2_int(arm_hlp_strexx)),
-                             params);
-
-    write_reg(context, ir, rd, result);
+    write_reg(context, ir, rd, mk_strexx(context, ir, address, type, read_reg(context, ir, rt)));
 
     return 0;
 }
@@ -3690,7 +3674,7 @@ static int dis_t2_data_processing_modified_immediate(struct arm_target *context,
     struct irRegister *op;
 
     op = mk_32(ir, imm32);
-    if (s) {
+    if (s && !context->disa_is_flags_dead) {
         if (imm12 >> 10) {
              write_sco(context, ir, mk_32(ir, (imm32 >> 2) & 0x20000000));
         } else {
@@ -3714,7 +3698,7 @@ static int dis_t2_data_processing_shifted_register(struct arm_target *context, u
 
     rm_reg = read_reg(context, ir, rm);
 
-    if (s) {
+    if (s && !context->disa_is_flags_dead) {
         write_sco(context, ir, mk_sco_t2(context, ir,
                                          mk_32(ir, insn),
                                          rm_reg,
@@ -4345,54 +4329,180 @@ static int disassemble_thumb2_insn(struct arm_target *context, uint32_t insn, st
     return isExit;
 }
 
-/* api */
-void disassemble_thumb(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
+/* flags liveness. Return 0 for instructions we don't handle or that may exit block.
+   For these ones all flags must be considered as observed. Analysis is only done outside
+   it block so 16 bits instructions always update flags. */
+static void get_flags_usage_data_processing(int opcode, int s, int is_rrx, struct flags_usage *usage)
 {
-    struct arm_target *context = container_of(target, struct arm_target, target);
-    int i;
-    int isExit = 0; //unconditionnal exit
-    uint16_t *pc_ptr = (uint16_t *) g_2_h(pc & ~1);
+    /* adc / sbc */
+    if (opcode == 10 || opcode == 11)
+        usage->read |= FLAG_C;
+    if (is_rrx)
+        usage->read |= FLAG_C;
+    if (s) {
+        switch(opcode) {
+            case 8: case 10: case 11: case 13: case 14:
+                usage->write = FLAGS_NZCV;
+                usage->may_write = FLAGS_NZCV;
+                break;
+            default:
+                usage->write = FLAG_N | FLAG_Z;
+                usage->may_write = FLAG_N | FLAG_Z | FLAG_C;
+        }
+    }
+}
 
-    assert((pc & 1) == 1);
-    context->disa_itstate = context->regs.reg_itstate;
-    for(i = 0; i < maxInsn; i++) {
-        int inIt = inItBlock(context);
+static int get_flags_usage_thumb1(uint32_t insn, struct flags_usage *usage)
+{
+    uint32_t opcode = INSN(15, 10);
 
-        context->pc = h_2_g(pc_ptr) + 1;
+    switch(opcode) {
+        case 0 ... 15:
+            switch(INSN(13, 11)) {
+                case 0 ... 2://shift immediate
+                    usage->write = FLAG_N | FLAG_Z;
+                    usage->may_write = FLAG_N | FLAG_Z | FLAG_C;
+                    break;
+                case 4://mov immediate
+                    usage->write = FLAG_N | FLAG_Z;
+                    usage->may_write = FLAG_N | FLAG_Z;
+                    break;
+                default:
+                    usage->write = FLAGS_NZCV;
+                    usage->may_write = FLAGS_NZCV;
+            }
+            return 1;
+        case 16:
+            switch(INSN(9, 6)) {
+                case 5: case 6://adc / sbc
+                    usage->read = FLAG_C;
+                    /* fallthrough */
+                case 9 ... 11://rsb / cmp / cmn
+                    usage->write = FLAGS_NZCV;
+                    usage->may_write = FLAGS_NZCV;
+                    break;
+                default:
+                    usage->write = FLAG_N | FLAG_Z;
+                    usage->may_write = FLAG_N | FLAG_Z | FLAG_C;
+            }
+            return 1;
+        case 17:
+            switch(INSN(9, 6)) {
+                case 0 ... 3://add
+                case 8 ... 11://mov
+                    return ((INSN(7, 7) << 3) | INSN(2, 0)) != 15;
+                case 5 ... 7://cmp
+                    usage->write = FLAGS_NZCV;
+                    usage->may_write = FLAGS_NZCV;
+                    return 1;
+                default:
+                    return 0;
+            }
+        case 18 ... 43:
+        case 48 ... 51:
+            return 1;
+        case 44 ... 47:
+            switch(INSN(11, 5)) {
+                case 0 ... 7://add / sub sp
+                case 16 ... 23://extend
+                case 32 ... 47://push
+                case 80 ... 83:
+                case 86 ... 87://rev
+                    return 1;
+                case 96 ... 111://pop
+                    return INSN(8, 8) == 0;
+                default:
+                    return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+static int get_flags_usage_thumb2(uint32_t insn, struct flags_usage *usage)
+{
+    int op1 = INSN1(12, 11);
+    int op2 = INSN1(10, 4);
+    int s = INSN1(4, 4);
+    int rd = INSN2(11, 8);
+
+    if (op1 == 2 && INSN2(15, 15) == 0) {
+        if (INSN1(9, 9))
+            return rd != 15;
+        /* modified immediate */
+        if (rd == 15 && !s)
+            return 0;
+        get_flags_usage_data_processing(INSN1(8, 5), s, 0, usage);
+        return 1;
+    } else if (op1 == 1 && (op2 & 0x60) == 0x20) {
+        /* shifted register */
+        if (rd == 15 && !s)
+            return 0;
+        get_flags_usage_data_processing(INSN1(8, 5), s,
+                                        INSN2(5, 4) == 3 && INSN2(14, 12) == 0 && INSN2(7, 6) == 0,
+                                        usage);
+        return 1;
+    } else if (op1 == 3 && ((op2 & 0x67) == 0x01 || (op2 & 0x67) == 0x03 || (op2 & 0x67) == 0x05)) {
+        /* loads */
+        return INSN2(15, 12) != 15;
+    } else if (op1 == 3 && (op2 & 0x71) == 0x00) {
+        /* stores */
+        return 1;
+    } else if (INSN1(15, 0) == 0xe92d) {
+        /* push.w */
+        return 1;
+    } else if (INSN1(15, 0) == 0xe8bd) {
+        /* pop.w */
+        return INSN2(15, 15) == 0;
+    }
+
+    return 0;
+}
+
+static uint64_t mk_dead_flags(struct arm_target *context, uint16_t *pc_ptr, int maxInsn)
+{
+    struct flags_usage usage[64];
+    int nb;
+
+    /* don't bother with it block */
+    if (context->disa_itstate)
+        return 0;
+    for(nb = 0; nb < maxInsn && nb < 64; nb++) {
+        usage[nb].read = 0;
+        usage[nb].write = 0;
+        usage[nb].may_write = 0;
         if ((*pc_ptr >> 11) == 0x1d || (*pc_ptr >> 11) == 0x1e || (*pc_ptr >> 11) == 0x1f) {
-            //fprintf(stderr, "0x%lx => insn = 0x%04x%04x\n", pc, *pc_ptr, *(pc_ptr+1));
-            isExit = disassemble_thumb2_insn(context, (*pc_ptr << 16) | (*(pc_ptr+1)), ir);
+            if (!get_flags_usage_thumb2((*pc_ptr << 16) | (*(pc_ptr+1)), &usage[nb]))
+                break;
             pc_ptr += 2;
         } else {
-            //fprintf(stderr, "0x%lx => insn = 0x%04x\n", pc, *pc_ptr);
-            isExit = disassemble_thumb1_insn(context, *pc_ptr++, ir);
+            if (!get_flags_usage_thumb1(*pc_ptr, &usage[nb]))
+                break;
+            pc_ptr++;
         }
-        dump_state(context, ir);
-        if (inIt)
-            itAdvance(context);
-        if (isExit)
-            break;
-    }
-    if (!isExit) {
-        context->pc = h_2_g(pc_ptr) + 1;
-        write_reg(context, ir, 15, ir->add_mov_const_32(ir, context->pc));
-        ir->add_exit(ir, ir->add_mov_const_64(ir, context->pc));
     }
+
+    return compute_dead_flags(usage, nb);
 }
 
-void disassemble_thumb_with_marker(struct arm_target *context, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
+/* api */
+void disassemble_thumb(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
 {
+    struct arm_target *context = container_of(target, struct arm_target, target);
     int i;
     int isExit = 0; //unconditionnal exit
     uint16_t *pc_ptr = (uint16_t *) g_2_h(pc & ~1);
+    uint64_t dead_flags;
     uint32_t pc_offset = 0;
 
     assert((pc & 1) == 1);
     context->disa_itstate = context->regs.reg_itstate;
+    dead_flags = mk_dead_flags(context, pc_ptr, maxInsn);
     for(i = 0; i < maxInsn; i++) {
         int inIt = inItBlock(context);
 
         context->pc = h_2_g(pc_ptr) + 1;
+        context->disa_is_flags_dead = (dead_flags >> i) & 1;
         ir->add_insn_marker(ir, pc_offset);
         if ((*pc_ptr >> 11) == 0x1d || (*pc_ptr >> 11) == 0x1e || (*pc_ptr >> 11) == 0x1f) {
             //fprintf(stderr, "0x%lx => insn = 0x%04x%04x\n", pc, *pc_ptr, *(pc_ptr+1));
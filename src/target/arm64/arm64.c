@@ -36,7 +36,6 @@
 #include "arm64_signal_types.h"
 #include "jitter.h"
 #include "target.h"
-#include "be.h"
 
 #define ARM64_CONTEXT_SIZE     (4096)
 
@@ -123,67 +122,65 @@ static void setup_siginfo(uint32_t signum, siginfo_t *siginfo, struct siginfo_ar
     }
 }
 
-static uint32_t find_insn_offset(uint64_t guest_pc, int offset)
+static uint64_t find_guest_pc(void *host_pc)
 {
-    struct backend *backend;
-    jitContext handle;
-    struct irInstructionAllocator *ir;
-    struct arm64_target context;
-    char jitBuffer[16 * KB];
-    char *beMemory = alloca(256 * KB);
-    char *jitterMemory = alloca(256 * KB);
-
-    memset(&context, 0, sizeof(context));
-
-    backend = createBackend(beMemory, 256 * KB);
-    handle = createJitter(jitterMemory, backend, 256 * KB);
-    ir = getIrInstructionAllocator(handle);
-
-    disassemble_arm64_with_marker(&context, ir, guest_pc, 40);
-
-    return findInsn(handle, jitBuffer, sizeof(jitBuffer), offset);
+    struct tls_context *current_tls_context;
+    struct cache *cache;
+    void *jit_host_start_pc;
+    void *insn_map;
+    uint64_t jit_guest_start_pc;
+    uint32_t insn_offset;
+
+    syscall(SYS_arch_prctl, ARCH_GET_FS, &current_tls_context);
+    cache = current_tls_context->cache;
+
+    jit_guest_start_pc = cache->lookup_pc(cache, host_pc, &jit_host_start_pc, &insn_map);
+    assert(jit_guest_start_pc != 0);
+    insn_offset = lookupInsnMap(insn_map, host_pc - jit_host_start_pc);
+    assert(insn_offset != ~0);
+
+    return jit_guest_start_pc + insn_offset;
 }
 
 static uint64_t restore_precise_pc(struct arm64_target *prev_context, ucontext_t *ucp, int *in_signal_location)
 {
     uint64_t res;
     void *host_pc_signal = (void *)ucp->uc_mcontext.gregs[REG_RIP];
+    void *helper_return_address;
 
     /* we can be in three distinct area :
         - in jitting area
         - in umeq helper function
         - in umeq code, in that case we are not currently emulating guest instruction */
-    if (prev_context->regs.helper_pc) {
-        /* we are inside an helper */
-        *in_signal_location = SIGNAL_LOCATION_JITTER_EXEC;
-        res = prev_context->regs.helper_pc;
-    } else if (host_pc_signal >= (void *)&__executable_start &&
-               host_pc_signal < (void *)&__etext) {
-        /* we are somewhere in umeq code */
-        *in_signal_location = SIGNAL_LOCATION_UMEQ_CODE;
-        res = prev_context->regs.pc;
+    if (host_pc_signal >= (void *)&__executable_start &&
+        host_pc_signal < (void *)&__etext) {
+        helper_return_address = prev_context->backend->get_helper_return_address(prev_context->backend, ucp);
+        if (helper_return_address) {
+            /* we are inside an helper. Use call instruction to find guest instruction */
+            *in_signal_location = SIGNAL_LOCATION_JITTER_EXEC;
+            res = find_guest_pc(helper_return_address - 1);
+        } else {
+            /* we are somewhere in umeq code */
+            *in_signal_location = SIGNAL_LOCATION_UMEQ_CODE;
+            res = prev_context->regs.pc;
+        }
     } else {
-        struct tls_context *current_tls_context;
-        struct cache *cache;
-        void *jit_host_start_pc;
-        uint64_t jit_guest_start_pc;
-        uint32_t insn_offset;
-
         *in_signal_location = SIGNAL_LOCATION_JITTER_EXEC;
-        syscall(SYS_arch_prctl, ARCH_GET_FS, &current_tls_context);
-        cache = current_tls_context->cache;
-
-        jit_guest_start_pc = cache->lookup_pc(cache, host_pc_signal, &jit_host_start_pc);
-        assert(jit_guest_start_pc != 0);
-        insn_offset = find_insn_offset(jit_guest_start_pc, host_pc_signal - jit_host_start_pc);
-        assert(insn_offset != ~0);
-
-        res = prev_context->regs.pc + insn_offset;
+        res = find_guest_pc(host_pc_signal);
     }
 
     return res;
 }
 
+/* return nzcv of an interrupted context. Resolution is done on a copy so lazy state the
+   interrupted block relies on at translation time is left untouched */
+static uint32_t get_interrupted_nzcv(struct arm64_target *context)
+{
+    struct arm64_registers regs = context->regs;
+
+    return arm64_hlp_resolve_nzcv((uint64_t) &regs);
+}
+
 static void setup_sigframe(struct rt_sigframe_arm64 *frame, struct arm64_target *prev_context,
                            struct host_signal_info *signal_info, int *in_signal_location)
 {
@@ -198,7 +195,7 @@ static void setup_sigframe(struct rt_sigframe_arm64 *frame, struct arm64_target
     /* Update prev_context pc so we are sure to detect pc modifications on signal exit */
     prev_context->regs.pc = restore_precise_pc(prev_context, signal_info->context, in_signal_location);
     frame->uc.uc_mcontext.pc = prev_context->regs.pc;
-    frame->uc.uc_mcontext.pstate = prev_context->regs.nzcv;
+    frame->uc.uc_mcontext.pstate = get_interrupted_nzcv(prev_context);
     frame->uc.uc_mcontext.fault_address = 0;
       /* FIXME: need to save simd */
     end = (struct _aarch64_ctx *) frame->uc.uc_mcontext.__reserved;
@@ -209,13 +206,19 @@ static void setup_sigframe(struct rt_sigframe_arm64 *frame, struct arm64_target
 static int restore_sigframe(struct rt_sigframe_arm64 *frame, struct arm64_target *prev_context)
 {
     int is_pc_change = (prev_context->regs.pc != frame->uc.uc_mcontext.pc);
+    int is_nzcv_change = (get_interrupted_nzcv(prev_context) != frame->uc.uc_mcontext.pstate);
     int i;
 
     for(i = 0; i < 31; i++)
         prev_context->regs.r[i] = frame->uc.uc_mcontext.regs[i];
     prev_context->regs.r[31] = frame->uc.uc_mcontext.sp;
     prev_context->regs.pc = frame->uc.uc_mcontext.pc;
-    prev_context->regs.nzcv = frame->uc.uc_mcontext.pstate;
+    /* only drop lazy state when handler has modified flags so interrupted block resumes with
+       the lazy state it has been translated with */
+    if (is_nzcv_change) {
+        prev_context->regs.nzcv = frame->uc.uc_mcontext.pstate;
+        prev_context->regs.lazy_nzcv_ops = LAZY_NZCV_NONE;
+    }
 
     return is_pc_change;
 }
@@ -283,7 +286,8 @@ static void init(struct target *target, struct target *prev_target, uint64_t ent
             context->regs.r[i] = 0;
             context->regs.v[i].v128 = 0;
         }
-        context->regs.nzcv = prev_context->regs.nzcv;
+        context->regs.nzcv = get_interrupted_nzcv(prev_context);
+        context->regs.lazy_nzcv_ops = LAZY_NZCV_NONE;
         context->regs.tpidr_el0 = prev_context->regs.tpidr_el0;
         context->regs.fp_status = prev_context->regs.fp_status;
         context->regs.fpcr_others = prev_context->regs.fpcr_others;
@@ -317,7 +321,8 @@ static void init(struct target *target, struct target *prev_target, uint64_t ent
             context->regs.r[i] = parent_context->regs.r[i];
             context->regs.v[i].v128 = parent_context->regs.v[i].v128;
         }
-        context->regs.nzcv = parent_context->regs.nzcv;
+        context->regs.nzcv = arm64_hlp_resolve_nzcv((uint64_t) &parent_context->regs);
+        context->regs.lazy_nzcv_ops = LAZY_NZCV_NONE;
         context->regs.fp_status = parent_context->regs.fp_status;
         context->regs.fpcr_others = parent_context->regs.fpcr_others;
         context->regs.qc = parent_context->regs.qc;
@@ -343,6 +348,7 @@ static void init(struct target *target, struct target *prev_target, uint64_t ent
        	context->regs.pc = entry;
         context->regs.tpidr_el0 = 0;
         context->regs.nzcv = 0;
+        context->regs.lazy_nzcv_ops = LAZY_NZCV_NONE;
         set_float_detect_tininess(float_tininess_before_rounding, &context->regs.fp_status);
         set_float_rounding_mode(float_round_nearest_even, &context->regs.fp_status);
         set_float_exception_flags(0, &context->regs.fp_status);
@@ -29,6 +29,15 @@
 void *auxv_start = NULL;
 void *auxv_end = NULL;
 
+/* arm64 HWCAP bits. crypto ones are always set since helpers have portable fallbacks */
+#define ARM64_HWCAP_FP      (1 << 0)
+#define ARM64_HWCAP_ASIMD   (1 << 1)
+#define ARM64_HWCAP_AES     (1 << 3)
+#define ARM64_HWCAP_PMULL   (1 << 4)
+#define ARM64_HWCAP_SHA1    (1 << 5)
+#define ARM64_HWCAP_SHA2    (1 << 6)
+#define ARM64_HWCAP_CRC32   (1 << 7)
+
 static int strcmp_env(char *s1, char *s2)
 {
     while ( (*s1++ == *s2++) && (*s1 != '=') );
@@ -120,6 +129,8 @@ static void compute_emulated_stack_space(int argc, char **argv, struct load_auxv
     *pointer_area_size += sizeof(*auxv);
     *pointer_area_size += sizeof(*auxv);
     *pointer_area_size += sizeof(*auxv);
+    // AT_HWCAP
+    *pointer_area_size += sizeof(*auxv);
     // end of auxv
     *pointer_area_size += sizeof(*auxv);
 
@@ -217,6 +228,11 @@ static guest_ptr populate_emulated_stack(guest_ptr stack, int argc, char **argv,
     auxv_target->a_type = AT_ENTRY;
     auxv_target->a_un.a_val = auxv_info->load_AT_ENTRY;
     auxv_target++;
+    // AT_HW_CAP
+    auxv_target->a_type = AT_HWCAP;
+    auxv_target->a_un.a_val = ARM64_HWCAP_FP | ARM64_HWCAP_ASIMD | ARM64_HWCAP_AES | ARM64_HWCAP_PMULL |
+                              ARM64_HWCAP_SHA1 | ARM64_HWCAP_SHA2 | ARM64_HWCAP_CRC32;
+    auxv_target++;
     // end of auxv
     auxv_target->a_type = AT_NULL;
     auxv_target++;
@@ -52,6 +52,18 @@ union simd_register {
     float sf[4];
 };
 
+/* nzcv flags can be lazily computed. When lazy_nzcv_ops is not LAZY_NZCV_NONE, NZCV
+   flags are the ones of the lazy_nzcv_ops operation applied on lazy_nzcv_op1 and
+   lazy_nzcv_op2. 32 bits operations store their operands shifted in msb part so the
+   same 64 bits computation gives the correct flags. */
+enum lazy_nzcv {
+    LAZY_NZCV_NONE = 0,
+    LAZY_NZCV_ADD,
+    LAZY_NZCV_SUB,
+    LAZY_NZCV_LOGICAL,
+    LAZY_NZCV_UNKNOWN /* translation time only */
+};
+
 struct arm64_registers {
     uint64_t r[32];
     uint64_t pc;
@@ -64,8 +76,11 @@ struct arm64_registers {
     uint32_t is_in_syscall;
     uint32_t is_stepin;
     uint64_t is_syscall_entry_show;
-    uint64_t helper_pc;
     uint32_t fast_math_is_allow;
+    __uint128_t exclusive_value;
+    uint32_t lazy_nzcv_ops;
+    uint64_t lazy_nzcv_op1;
+    uint64_t lazy_nzcv_op2;
 };
 
 struct arm64_target {
@@ -77,7 +92,6 @@ struct arm64_target {
     uint32_t exitStatus;
     uint32_t is_in_signal;
     int32_t in_signal_location;
-    __uint128_t exclusive_value;
     struct backend *backend;
     /* stuff need to support guest context change during signal handler */
     struct rt_sigframe_arm64 *frame;
@@ -86,6 +100,15 @@ struct arm64_target {
     uint64_t sas_ss_sp;
     uint64_t sas_ss_size;
     int start_on_sig_stack;
+    /* translation time knowledge of regs.lazy_nzcv_ops */
+    enum lazy_nzcv lazy_nzcv_ops;
+    /* translation time copy of regs.nzcv when lazy_nzcv_ops is LAZY_NZCV_NONE, NULL if unknown */
+    struct irRegister *nzcv_value;
+    /* translation time copy of regs.lazy_nzcv_op1 / op2 when written by current block, else NULL */
+    struct irRegister *lazy_nzcv_op1;
+    struct irRegister *lazy_nzcv_op2;
+    /* set when flags computed by current instruction are never observed */
+    int is_flags_dead;
 };
 
 /* globals */
@@ -93,8 +116,8 @@ extern guest_ptr *arm64_env_startup_pointer;
 /* functions */
 extern void arm64_load_image(int argc, char **argv, void **additionnal_env, void **unset_env, void *target_argv0, uint64_t *entry, uint64_t *stack);
 extern void disassemble_arm64(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn);
-extern void disassemble_arm64_with_marker(struct arm64_target *context, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn);
 extern void arm64_hlp_syscall(uint64_t regs);
+extern uint32_t arm64_hlp_resolve_nzcv(uint64_t regs);
 extern void arm64_setup_brk(void);
 extern void ptrace_exec_event(struct arm64_target *context);
 extern void ptrace_syscall_enter(struct arm64_target *context);
@@ -26,6 +26,9 @@
 #include "arm64_helpers.h"
 #include "arm64_helpers_simd.h"
 #include "arm64_helpers_fpu.h"
+#include "arm64_helpers_crypto.h"
+#include "host_features.h"
+#include "flags_liveness.h"
 
 #define ZERO_REG    1
 #define SP_REG      0
@@ -53,31 +56,17 @@ static struct irRegister *mk_64(struct irInstructionAllocator *ir, uint64_t valu
 
 static void mk_call_void(struct arm64_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    ir->add_write_context_64(ir, mk_64(ir, context->pc), offsetof(struct arm64_registers, helper_pc));
     ir->add_call_void(ir, name, address, params);
-    ir->add_write_context_64(ir, mk_64(ir, 0), offsetof(struct arm64_registers, helper_pc));
 }
 
 static struct irRegister *mk_call_32(struct arm64_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    struct irRegister *res;
-
-    ir->add_write_context_64(ir, mk_64(ir, context->pc), offsetof(struct arm64_registers, helper_pc));
-    res = ir->add_call_32(ir, name, address, params);
-    ir->add_write_context_64(ir, mk_64(ir, 0), offsetof(struct arm64_registers, helper_pc));
-
-    return res;
+    return ir->add_call_32(ir, name, address, params);
 }
 
 static struct irRegister *mk_call_64(struct arm64_target *context, struct irInstructionAllocator *ir, char *name, struct irRegister *address, struct irRegister **params)
 {
-    struct irRegister *res;
-
-    ir->add_write_context_64(ir, mk_64(ir, context->pc), offsetof(struct arm64_registers, helper_pc));
-    res = ir->add_call_64(ir, name, address, params);
-    ir->add_write_context_64(ir, mk_64(ir, 0), offsetof(struct arm64_registers, helper_pc));
-
-    return res;
+    return ir->add_call_64(ir, name, address, params);
 }
 
 static void dump_state(struct arm64_target *context, struct irInstructionAllocator *ir)
@@ -234,14 +223,208 @@ static void write_pc(struct irInstructionAllocator *ir,struct irRegister *value)
     ir->add_write_context_64(ir, value, offsetof(struct arm64_registers, pc));
 }
 
-static struct irRegister *read_nzcv(struct irInstructionAllocator *ir)
+/* return up to date nzcv value */
+static struct irRegister *read_nzcv(struct arm64_target *context, struct irInstructionAllocator *ir)
 {
-    return ir->add_read_context_32(ir, offsetof(struct arm64_registers, nzcv));
+    if (context->lazy_nzcv_ops != LAZY_NZCV_NONE) {
+        struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+
+        context->lazy_nzcv_ops = LAZY_NZCV_NONE;
+        context->nzcv_value = mk_call_32(context, ir, "arm64_hlp_resolve_nzcv",
+                                         ir->add_mov_const_64(ir, (uint64_t) arm64_hlp_resolve_nzcv),
+                                         params);
+    } else if (!context->nzcv_value)
+        context->nzcv_value = ir->add_read_context_32(ir, offsetof(struct arm64_registers, nzcv));
+
+    return context->nzcv_value;
 }
 
-static void write_nzcv(struct irInstructionAllocator *ir, struct irRegister *value)
+static void write_nzcv(struct arm64_target *context, struct irInstructionAllocator *ir, struct irRegister *value)
 {
     ir->add_write_context_32(ir, value, offsetof(struct arm64_registers, nzcv));
+    context->nzcv_value = value;
+    if (context->lazy_nzcv_ops != LAZY_NZCV_NONE) {
+        ir->add_write_context_32(ir, mk_32(ir, LAZY_NZCV_NONE), offsetof(struct arm64_registers, lazy_nzcv_ops));
+        context->lazy_nzcv_ops = LAZY_NZCV_NONE;
+    }
+}
+
+static void write_lazy_nzcv_operands(struct irInstructionAllocator *ir, struct irRegister *op1, struct irRegister *op2)
+{
+    ir->add_write_context_64(ir, op1, offsetof(struct arm64_registers, lazy_nzcv_op1));
+    if (op2)
+        ir->add_write_context_64(ir, op2, offsetof(struct arm64_registers, lazy_nzcv_op2));
+}
+
+/* record flags setting operation. nzcv will be computed only when needed. ops is always
+   written, and written after operands, since a signal handler may have resolved lazy state
+   behind our translation time knowledge of it */
+static void mk_lazy_nzcv_64(struct arm64_target *context, struct irInstructionAllocator *ir, enum lazy_nzcv ops, struct irRegister *op1, struct irRegister *op2)
+{
+    if (context->is_flags_dead)
+        return ;
+    write_lazy_nzcv_operands(ir, op1, op2);
+    ir->add_write_context_32(ir, mk_32(ir, ops), offsetof(struct arm64_registers, lazy_nzcv_ops));
+    context->lazy_nzcv_ops = ops;
+    context->nzcv_value = NULL;
+    context->lazy_nzcv_op1 = op1;
+    context->lazy_nzcv_op2 = op2;
+}
+
+/* return lazy operand, reusing value computed by current block when available */
+static struct irRegister *read_lazy_nzcv_operand(struct irInstructionAllocator *ir, struct irRegister *value, int32_t offset)
+{
+    return value?value:ir->add_read_context_64(ir, offset);
+}
+
+static void mk_lazy_nzcv_32(struct arm64_target *context, struct irInstructionAllocator *ir, enum lazy_nzcv ops, struct irRegister *op1, struct irRegister *op2)
+{
+    if (context->is_flags_dead)
+        return ;
+    op1 = ir->add_shl_64(ir, ir->add_32U_to_64(ir, op1), mk_8(ir, 32));
+    if (op2)
+        op2 = ir->add_shl_64(ir, ir->add_32U_to_64(ir, op2), mk_8(ir, 32));
+
+    mk_lazy_nzcv_64(context, ir, ops, op1, op2);
+}
+
+enum nzcv_flag {
+    FLAG_V = 28,
+    FLAG_C,
+    FLAG_Z,
+    FLAG_N
+};
+
+/* return flag as a 0/1 64 bits value. nzcv is only use when no operation is pending */
+static struct irRegister *mk_flag(struct irInstructionAllocator *ir, enum lazy_nzcv ops, enum nzcv_flag flag,
+                                  struct irRegister *nzcv, struct irRegister *op1, struct irRegister *op2, struct irRegister *res)
+{
+    struct irRegister *msb = NULL;
+
+    if (ops == LAZY_NZCV_NONE)
+        return ir->add_and_64(ir, ir->add_shr_64(ir, nzcv, mk_8(ir, flag)), mk_64(ir, 1));
+
+    switch(flag) {
+        case FLAG_N:
+            msb = res;
+            break;
+        case FLAG_Z:
+            return ir->add_and_64(ir, ir->add_cmpeq_64(ir, res, mk_64(ir, 0)), mk_64(ir, 1));
+        case FLAG_C:
+            if (ops == LAZY_NZCV_ADD) {
+                /* carry out */
+                msb = ir->add_or_64(ir, ir->add_and_64(ir, op1, op2),
+                                        ir->add_and_64(ir, ir->add_or_64(ir, op1, op2),
+                                                           ir->add_xor_64(ir, res, mk_64(ir, ~0UL))));
+            } else if (ops == LAZY_NZCV_SUB) {
+                /* not borrow */
+                msb = ir->add_or_64(ir, ir->add_and_64(ir, ir->add_xor_64(ir, op1, mk_64(ir, ~0UL)), op2),
+                                        ir->add_and_64(ir, ir->add_xor_64(ir, ir->add_xor_64(ir, op1, op2), mk_64(ir, ~0UL)),
+                                                           res));
+                msb = ir->add_xor_64(ir, msb, mk_64(ir, ~0UL));
+            } else
+                return mk_64(ir, 0);
+            break;
+        case FLAG_V:
+            if (ops == LAZY_NZCV_ADD)
+                msb = ir->add_and_64(ir, ir->add_xor_64(ir, res, op1), ir->add_xor_64(ir, res, op2));
+            else if (ops == LAZY_NZCV_SUB)
+                msb = ir->add_and_64(ir, ir->add_xor_64(ir, op1, op2), ir->add_xor_64(ir, op1, res));
+            else
+                return mk_64(ir, 0);
+            break;
+    }
+
+    return ir->add_shr_64(ir, msb, mk_8(ir, 63));
+}
+
+/* return non zero if cond code is true else 0. Only needed flags are computed inline */
+static struct irRegister *mk_pred(struct arm64_target *context, struct irInstructionAllocator *ir, int cond)
+{
+    struct irRegister *nzcv = NULL;
+    struct irRegister *op1 = NULL;
+    struct irRegister *op2 = NULL;
+    struct irRegister *res = NULL;
+    struct irRegister *pred;
+    enum lazy_nzcv ops;
+
+    if (cond >= 14)
+        return mk_32(ir, 1);
+
+    /* we don't know pending operation at translation time */
+    if (context->lazy_nzcv_ops == LAZY_NZCV_UNKNOWN)
+        nzcv = ir->add_32U_to_64(ir, read_nzcv(context, ir));
+    ops = context->lazy_nzcv_ops;
+    switch(ops) {
+        case LAZY_NZCV_NONE:
+            if (!nzcv)
+                nzcv = ir->add_32U_to_64(ir, read_nzcv(context, ir));
+            break;
+        case LAZY_NZCV_ADD:
+            op1 = read_lazy_nzcv_operand(ir, context->lazy_nzcv_op1, offsetof(struct arm64_registers, lazy_nzcv_op1));
+            op2 = read_lazy_nzcv_operand(ir, context->lazy_nzcv_op2, offsetof(struct arm64_registers, lazy_nzcv_op2));
+            res = ir->add_add_64(ir, op1, op2);
+            break;
+        case LAZY_NZCV_SUB:
+            op1 = read_lazy_nzcv_operand(ir, context->lazy_nzcv_op1, offsetof(struct arm64_registers, lazy_nzcv_op1));
+            op2 = read_lazy_nzcv_operand(ir, context->lazy_nzcv_op2, offsetof(struct arm64_registers, lazy_nzcv_op2));
+            /* eq / ne compare operands directly */
+            res = ((cond >> 1) == 0)?NULL:ir->add_sub_64(ir, op1, op2);
+            break;
+        case LAZY_NZCV_LOGICAL:
+            op1 = read_lazy_nzcv_operand(ir, context->lazy_nzcv_op1, offsetof(struct arm64_registers, lazy_nzcv_op1));
+            res = op1;
+            break;
+        default:
+            assert(0);
+    }
+
+    /* eq / ne are a bare compare so backend can fuse it with a conditional exit */
+    if ((cond >> 1) == 0 && ops != LAZY_NZCV_NONE) {
+        if (ops == LAZY_NZCV_SUB)
+            pred = (cond & 1)?ir->add_cmpne_64(ir, op1, op2):ir->add_cmpeq_64(ir, op1, op2);
+        else
+            pred = (cond & 1)?ir->add_cmpne_64(ir, res, mk_64(ir, 0)):ir->add_cmpeq_64(ir, res, mk_64(ir, 0));
+
+        return ir->add_64_to_32(ir, pred);
+    }
+
+    switch(cond >> 1) {
+        case 0://EQ + NE
+            pred = mk_flag(ir, ops, FLAG_Z, nzcv, op1, op2, res);
+            break;
+        case 1://HS + LO
+            pred = mk_flag(ir, ops, FLAG_C, nzcv, op1, op2, res);
+            break;
+        case 2://MI + PL
+            pred = mk_flag(ir, ops, FLAG_N, nzcv, op1, op2, res);
+            break;
+        case 3://VS + VC
+            pred = mk_flag(ir, ops, FLAG_V, nzcv, op1, op2, res);
+            break;
+        case 4://HI + LS
+            pred = ir->add_and_64(ir, mk_flag(ir, ops, FLAG_C, nzcv, op1, op2, res),
+                                      ir->add_xor_64(ir, mk_flag(ir, ops, FLAG_Z, nzcv, op1, op2, res), mk_64(ir, 1)));
+            break;
+        case 5://GE + LT
+            pred = ir->add_xor_64(ir, ir->add_xor_64(ir, mk_flag(ir, ops, FLAG_N, nzcv, op1, op2, res),
+                                                         mk_flag(ir, ops, FLAG_V, nzcv, op1, op2, res)),
+                                      mk_64(ir, 1));
+            break;
+        case 6://GT + LE
+            pred = ir->add_xor_64(ir, ir->add_or_64(ir, mk_flag(ir, ops, FLAG_Z, nzcv, op1, op2, res),
+                                                        ir->add_xor_64(ir, mk_flag(ir, ops, FLAG_N, nzcv, op1, op2, res),
+                                                                           mk_flag(ir, ops, FLAG_V, nzcv, op1, op2, res))),
+                                      mk_64(ir, 1));
+            break;
+        default:
+            assert(0);
+    }
+    //invert cond
+    if (cond & 1)
+        pred = ir->add_xor_64(ir, pred, mk_64(ir, 1));
+
+    return ir->add_64_to_32(ir, pred);
 }
 
 static struct irRegister *mk_ror_imm_64(struct irInstructionAllocator *ir, struct irRegister *op, int rotation)
@@ -262,7 +445,7 @@ static struct irRegister *mk_next_nzcv_64(struct arm64_target *context, struct i
         params[0] = mk_32(ir, ops);
         params[1] = op1;
         params[2] = op2;
-        params[3] = read_nzcv(ir);
+        params[3] = read_nzcv(context, ir);
 
         nextCpsr = mk_call_32(context, ir, "arm64_hlp_compute_next_nzcv_64",
                                    ir->add_mov_const_64(ir, (uint64_t) arm64_hlp_compute_next_nzcv_64),
@@ -279,7 +462,7 @@ static struct irRegister *mk_next_nzcv_32(struct arm64_target *context, struct i
         params[0] = mk_32(ir, ops);
         params[1] = op1;
         params[2] = op2;
-        params[3] = read_nzcv(ir);
+        params[3] = read_nzcv(context, ir);
 
         nextCpsr = mk_call_32(context, ir, "arm64_hlp_compute_next_nzcv_32",
                                    ir->add_mov_const_64(ir, (uint64_t) arm64_hlp_compute_next_nzcv_32),
@@ -823,9 +1006,9 @@ static int dis_add_sub(struct arm64_target *context, uint32_t insn, struct irIns
     /* update flags */
     if (S) {
         if (is_64)
-            write_nzcv(ir, mk_next_nzcv_64(context, ir, is_sub?OPS_SUB:OPS_ADD, op1, op2));
+            mk_lazy_nzcv_64(context, ir, is_sub?LAZY_NZCV_SUB:LAZY_NZCV_ADD, op1, op2);
         else
-            write_nzcv(ir, mk_next_nzcv_32(context, ir, is_sub?OPS_SUB:OPS_ADD, op1, op2));
+            mk_lazy_nzcv_32(context, ir, is_sub?LAZY_NZCV_SUB:LAZY_NZCV_ADD, op1, op2);
     }
 
     /* write reg */
@@ -1088,9 +1271,9 @@ static int dis_logical_shifted_register(struct arm64_target *context, uint32_t i
     /* update nzcv if needed */
     if (is_setflags) {
         if (is_64)
-            write_nzcv(ir, mk_next_nzcv_64(context, ir, OPS_LOGICAL, res, mk_64(ir, 0)));
+            mk_lazy_nzcv_64(context, ir, LAZY_NZCV_LOGICAL, res, NULL);
         else
-            write_nzcv(ir, mk_next_nzcv_32(context, ir, OPS_LOGICAL, ir->add_64_to_32(ir, res), mk_32(ir, 0)));
+            mk_lazy_nzcv_32(context, ir, LAZY_NZCV_LOGICAL, ir->add_64_to_32(ir, res), NULL);
     }
 
     /* write res */
@@ -1190,20 +1373,12 @@ static int dis_conditionnal_branch_immediate_insn(struct arm64_target *context,
 {
     int cond = INSN(3,0);
     int64_t imm19 = INSN(23, 5) << 2;
-    struct irRegister *params[4];
     struct irRegister *pred;
 
     imm19 = (imm19 << 43) >> 43;
 
 
-    params[0] = mk_32(ir, cond);
-    params[1] = read_nzcv(ir);
-    params[2] = NULL;
-    params[3] = NULL;
-
-    pred = mk_call_32(context, ir, "arm64_hlp_compute_flags_pred",
-                           mk_64(ir, (uint64_t) arm64_hlp_compute_flags_pred),
-                           params);
+    pred = mk_pred(context, ir, cond);
     dump_state(context, ir);
 
     /* if cond is true then do the branch else jump to next insn */
@@ -1300,49 +1475,25 @@ static int dis_ccmp_A_ccmn(struct arm64_target *context, uint32_t insn, struct i
     int cond = INSN(15,12);
     int rn = INSN(9,5);
     int nzcv = INSN(4,0);
-    struct irRegister *params[4];
     struct irRegister *pred;
-    struct irRegister *res_true;
-    struct irRegister *res_false;
-    struct irRegister *res;
+    struct irRegister *op1;
 
     /* compute pred */
-    params[0] = mk_32(ir, cond);
-    params[1] = read_nzcv(ir);
-    params[2] = NULL;
-    params[3] = NULL;
-    pred = mk_call_32(context, ir, "arm64_hlp_compute_flags_pred",
-                           mk_64(ir, (uint64_t) arm64_hlp_compute_flags_pred),
-                           params);
+    pred = mk_pred(context, ir, cond);
 
-    /* compute true value */
-    if (is_64) {
-        params[0] = mk_32(ir, op?OPS_SUB:OPS_ADD);
-        params[1] = read_x(ir, rn, ZERO_REG);
-        params[2] = op2;
-        params[3] = read_nzcv(ir);
-        res_true = mk_call_32(context, ir, "arm64_hlp_compute_next_nzcv_64",
-                               mk_64(ir, (uint64_t) arm64_hlp_compute_next_nzcv_64),
-                               params);
-    } else {
-        params[0] = mk_32(ir, op?OPS_SUB:OPS_ADD);
-        params[1] = read_w(ir, rn, ZERO_REG);
-        params[2] = op2;
-        params[3] = read_nzcv(ir);
-        res_true = mk_call_32(context, ir, "arm64_hlp_compute_next_nzcv_32",
-                               mk_64(ir, (uint64_t) arm64_hlp_compute_next_nzcv_32),
-                               params);
+    /* when pred is true flags are the ones of the comparison else we use nzcv immediate */
+    if (is_64)
+        op1 = read_x(ir, rn, ZERO_REG);
+    else {
+        op1 = ir->add_shl_64(ir, ir->add_32U_to_64(ir, read_w(ir, rn, ZERO_REG)), mk_8(ir, 32));
+        op2 = ir->add_shl_64(ir, ir->add_32U_to_64(ir, op2), mk_8(ir, 32));
     }
-    /* compute false value */
-    res_false = mk_32(ir, nzcv << 28);
-
-    /* compute 32 bits result */
-    res = ir->add_ite_32(ir, pred,
-                             res_true,
-                             res_false);
-
-    /* write reg */
-    write_nzcv(ir, res);
+    write_lazy_nzcv_operands(ir, op1, op2);
+    ir->add_write_context_32(ir, mk_32(ir, nzcv << 28), offsetof(struct arm64_registers, nzcv));
+    ir->add_write_context_32(ir, ir->add_ite_32(ir, pred, mk_32(ir, op?LAZY_NZCV_SUB:LAZY_NZCV_ADD), mk_32(ir, LAZY_NZCV_NONE)),
+                             offsetof(struct arm64_registers, lazy_nzcv_ops));
+    context->lazy_nzcv_ops = LAZY_NZCV_UNKNOWN;
+    context->nzcv_value = NULL;
 
     return 0;
 }
@@ -1375,17 +1526,10 @@ static int dis_cond_select(struct arm64_target *context, uint32_t insn, struct i
     int rd = INSN(4,0);
     int rn = INSN(9,5);
     int cond = INSN(15,12);
-    struct irRegister *params[4];
     struct irRegister *pred;
     struct irRegister *res;
 
-    params[0] = mk_32(ir, cond);
-    params[1] = read_nzcv(ir);
-    params[2] = NULL;
-    params[3] = NULL;
-    pred = mk_call_32(context, ir, "arm64_hlp_compute_flags_pred",
-                           mk_64(ir, (uint64_t) arm64_hlp_compute_flags_pred),
-                           params);
+    pred = mk_pred(context, ir, cond);
 
     /* compute 64 bits result */
     res = ir->add_ite_64(ir, ir->add_32U_to_64(ir, pred), //is jitter assertion on pred type is util ?
@@ -1898,9 +2042,9 @@ static int dis_logical_immediate(struct arm64_target *context, uint32_t insn, st
 
     if (is_setflags) {
         if (is_64)
-            write_nzcv(ir, mk_next_nzcv_64(context, ir, OPS_LOGICAL, res, mk_64(ir, 0)));
+            mk_lazy_nzcv_64(context, ir, LAZY_NZCV_LOGICAL, res, NULL);
         else
-            write_nzcv(ir, mk_next_nzcv_32(context, ir, OPS_LOGICAL, ir->add_64_to_32(ir, res), mk_32(ir, 0)));
+            mk_lazy_nzcv_32(context, ir, LAZY_NZCV_LOGICAL, ir->add_64_to_32(ir, res), NULL);
     }
 
     if (is_64)
@@ -2143,6 +2287,34 @@ static int dis_rorv(struct arm64_target *context, uint32_t insn, struct irInstru
 static int dis_crc32(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    int sz = INSN(11,10);
+    int rd = INSN(4, 0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    int is_crc32c = INSN(12,12);
+
+    /* sse4.2 crc32 instruction use crc32c polynomial */
+    if (is_crc32c && hasHostFeature(HOST_FEATURE_SSE4_2)) {
+        struct irRegister *acc = read_w(ir, rn, ZERO_REG);
+        struct irRegister *res;
+
+        switch(sz) {
+            case 0:
+                res = ir->add_crc32c_8(ir, acc, ir->add_32_to_8(ir, read_w(ir, rm, ZERO_REG)));
+                break;
+            case 1:
+                res = ir->add_crc32c_16(ir, acc, ir->add_32_to_16(ir, read_w(ir, rm, ZERO_REG)));
+                break;
+            case 2:
+                res = ir->add_crc32c_32(ir, acc, read_w(ir, rm, ZERO_REG));
+                break;
+            default:
+                res = ir->add_crc32c_64(ir, acc, read_x(ir, rm, ZERO_REG));
+        }
+        write_w(ir, rd, res, ZERO_REG);
+
+        return 0;
+    }
 
     params[0] = mk_32(ir, insn);
 
@@ -2352,7 +2524,8 @@ static int dis_msr_register(struct arm64_target *context, uint32_t insn, struct
     if (op0 == 3 && op1 == 3 && crn == 0xd && crm == 0 && op2 == 2) {
         ir->add_write_context_64(ir, read_x(ir, rt, ZERO_REG), offsetof(struct arm64_registers, tpidr_el0));
     } else if (op0 == 3 && op1 == 3 && crn == 0x4 && crm == 2 && op2 == 0) {
-        write_nzcv(ir, read_w(ir, rt, ZERO_REG));
+        /* nzcv bits 27 to 0 are RES0 */
+        write_nzcv(context, ir, ir->add_and_32(ir, read_w(ir, rt, ZERO_REG), mk_32(ir, 0xf0000000)));
     } else if (op0 == 3 && op1 == 3 && crn == 0x4 && crm == 4 && op2 == 0) {
         //fpcr
         write_fpcr(context, ir, read_w(ir, rt, ZERO_REG));
@@ -2381,7 +2554,7 @@ static int dis_mrs_register(struct arm64_target *context, uint32_t insn, struct
         //dczid_el0. We declare instruction is prohibited
         write_x(ir, rt, mk_64(ir, (1 << 4) | 7 ), ZERO_REG);
     } else if (op0 == 3 && op1 == 3 && crn == 0x4 && crm == 2 && op2 == 0) {
-        write_x(ir, rt, ir->add_32U_to_64(ir, read_nzcv(ir)), ZERO_REG);
+        write_x(ir, rt, ir->add_32U_to_64(ir, read_nzcv(context, ir)), ZERO_REG);
     } else if (op0 == 3 && op1 == 3 && crn == 0x4 && crm == 4 && op2 == 0) {
         //fpcr
         write_x(ir, rt, read_fpcr(context, ir), ZERO_REG);
@@ -2408,43 +2581,29 @@ static int dis_load_exclusive(struct arm64_target *context, uint32_t insn, struc
     int size = INSN(31,30);
     int rt = INSN(4,0);
     int rn = INSN(9,5);
-    struct irRegister *params[4];
-    struct irRegister *result;
-
-    params[0] = read_x(ir, rn, SP_REG);
-    params[1] = mk_32(ir, size);
-    params[2] = NULL;
-    params[3] = NULL;
+    struct irRegister *address = read_x(ir, rn, SP_REG);
+    struct irRegister *value;
 
-    result = mk_call_64(context, ir, "arm64_hlp_ldxr",
-                             mk_64(ir, (uint64_t) arm64_hlp_ldxr),
-                             params);
+    if (size == 3)
+        value = ir->add_load_64(ir, address);
+    else if (size == 2)
+        value = ir->add_32U_to_64(ir, ir->add_load_32(ir, address));
+    else if (size == 1)
+        value = ir->add_16U_to_64(ir, ir->add_load_16(ir, address));
+    else
+        value = ir->add_8U_to_64(ir, ir->add_load_8(ir, address));
+    /* keep value so store exclusive can check memory has not been modified */
+    ir->add_write_context_64(ir, value, offsetof(struct arm64_registers, exclusive_value));
 
-    write_x(ir, rt, result, ZERO_REG);
+    write_x(ir, rt, value, ZERO_REG);
 
     return 0;
 }
 
 static int dis_load_aquire_exclusive(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
-    int size = INSN(31,30);
-    int rt = INSN(4,0);
-    int rn = INSN(9,5);
-    struct irRegister *params[4];
-    struct irRegister *result;
-
-    params[0] = read_x(ir, rn, SP_REG);
-    params[1] = mk_32(ir, size);
-    params[2] = NULL;
-    params[3] = NULL;
-
-    result = mk_call_64(context, ir, "arm64_hlp_ldaxr",
-                             mk_64(ir, (uint64_t) arm64_hlp_ldaxr),
-                             params);
-
-    write_x(ir, rt, result, ZERO_REG);
-
-    return 0;
+    /* x86 loads already have acquire semantic */
+    return dis_load_exclusive(context, insn, ir);
 }
 
 static int dis_load_aquire_exclusive_pair(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
@@ -2527,19 +2686,26 @@ static int dis_store_exclusive(struct arm64_target *context, uint32_t insn, stru
     int rs = INSN(20,16);
     int rt = INSN(4,0);
     int rn = INSN(9,5);
-    struct irRegister *params[4];
-    struct irRegister *result;
-
-    params[0] = read_x(ir, rn, SP_REG);
-    params[1] = mk_32(ir, size);
-    params[2] = read_x(ir, rt, ZERO_REG);
-    params[3] = NULL;
+    struct irRegister *address = read_x(ir, rn, SP_REG);
+    struct irRegister *expected;
+    struct irRegister *status;
 
-    result = mk_call_32(context, ir, "arm64_hlp_stxr",
-                             mk_64(ir, (uint64_t) arm64_hlp_stxr),
-                             params);
+    /* FIXME: like previous helper version this is subject to the ABA problem */
+    if (size == 3) {
+        expected = ir->add_read_context_64(ir, offsetof(struct arm64_registers, exclusive_value));
+        status = ir->add_64_to_32(ir, ir->add_cmpne_64(ir, ir->add_cmpxchg_64(ir, address, expected, read_x(ir, rt, ZERO_REG)), expected));
+    } else if (size == 2) {
+        expected = ir->add_read_context_32(ir, offsetof(struct arm64_registers, exclusive_value));
+        status = ir->add_cmpne_32(ir, ir->add_cmpxchg_32(ir, address, expected, read_w(ir, rt, ZERO_REG)), expected);
+    } else if (size == 1) {
+        expected = ir->add_64_to_16(ir, ir->add_read_context_64(ir, offsetof(struct arm64_registers, exclusive_value)));
+        status = ir->add_16U_to_32(ir, ir->add_cmpne_16(ir, ir->add_cmpxchg_16(ir, address, expected, ir->add_64_to_16(ir, read_x(ir, rt, ZERO_REG))), expected));
+    } else {
+        expected = ir->add_64_to_8(ir, ir->add_read_context_64(ir, offsetof(struct arm64_registers, exclusive_value)));
+        status = ir->add_8U_to_32(ir, ir->add_cmpne_8(ir, ir->add_cmpxchg_8(ir, address, expected, ir->add_64_to_8(ir, read_x(ir, rt, ZERO_REG))), expected));
+    }
 
-    write_w(ir, rs, result, ZERO_REG);
+    write_w(ir, rs, ir->add_and_32(ir, status, mk_32(ir, 1)), ZERO_REG);
 
     return 0;
 }
@@ -2578,25 +2744,8 @@ static int dis_store_release_exclusive_pair(struct arm64_target *context, uint32
 
 static int dis_store_release_exclusive(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
-    int size = INSN(31,30);
-    int rs = INSN(20,16);
-    int rt = INSN(4,0);
-    int rn = INSN(9,5);
-    struct irRegister *params[4];
-    struct irRegister *result;
-
-    params[0] = read_x(ir, rn, SP_REG);
-    params[1] = mk_32(ir, size);
-    params[2] = read_x(ir, rt, ZERO_REG);
-    params[3] = NULL;
-
-    result = mk_call_32(context, ir, "arm64_hlp_stlxr",
-                             mk_64(ir, (uint64_t) arm64_hlp_stlxr),
-                             params);
-
-    write_w(ir, rs, result, ZERO_REG);
-
-    return 0;
+    /* lock cmpxchg is a full barrier so release semantic is already there */
+    return dis_store_exclusive(context, insn, ir);
 }
 
 static int dis_rbit_64(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
@@ -3031,13 +3180,30 @@ static int dis_insn_element(struct arm64_target *context, uint32_t insn, struct
 
 static int dis_dup_element(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
+    static void (*const helpers[4])(uint64_t, uint32_t, uint32_t, uint32_t, uint32_t) = {
+        arm64_hlp_simd_dup_element_8, arm64_hlp_simd_dup_element_16,
+        arm64_hlp_simd_dup_element_32, arm64_hlp_simd_dup_element_64};
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
-
-    params[0] = mk_32(ir, insn);
-
-    mk_call_void(context, ir, "arm64_hlp_dirty_simd_dup_element",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_simd_dup_element),
-                           params);
+    int q = INSN(30,30);
+    int imm5 = INSN(20,16);
+    int size = __builtin_ctz(imm5 | 0x10);
+
+    /* element size is known here so call a specialized helper, reserved encodings are left
+       to the generic helper */
+    if (size < 3 || (size == 3 && q)) {
+        params[0] = mk_32(ir, INSN(4,0));
+        params[1] = mk_32(ir, INSN(9,5));
+        params[2] = mk_32(ir, imm5 >> (size + 1));
+        params[3] = mk_32(ir, q);
+        mk_call_void(context, ir, "arm64_hlp_simd_dup_element",
+                               mk_64(ir, (uint64_t) helpers[size]),
+                               params);
+    } else {
+        params[0] = mk_32(ir, insn);
+        mk_call_void(context, ir, "arm64_hlp_dirty_simd_dup_element",
+                               mk_64(ir, (uint64_t) arm64_hlp_dirty_simd_dup_element),
+                               params);
+    }
 
     return 0;
 }
@@ -3080,7 +3246,7 @@ static int dis_load_store_multiple_structure(struct arm64_target *context, uint3
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_simd),
+                           mk_64(ir, (uint64_t) arm64_hlp_resolve_advanced_simd_load_store_multiple_structure_simd(insn)),
                            params);
 
     return 0;
@@ -3093,7 +3259,7 @@ static int dis_load_store_multiple_structure_post_index(struct arm64_target *con
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_post_index_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_post_index_simd),
+                           mk_64(ir, (uint64_t) arm64_hlp_resolve_advanced_simd_load_store_multiple_structure_simd(insn)),
                            params);
 
     return 0;
@@ -3141,7 +3307,7 @@ static int dis_add_substract_with_carry(struct arm64_target *context, uint32_t i
 
     /* got carry */
     carry = ir->add_and_32(ir,
-                           ir->add_shr_32(ir, read_nzcv(ir), mk_8(ir, 29)),
+                           ir->add_shr_32(ir, read_nzcv(context, ir), mk_8(ir, 29)),
                            mk_32(ir, 1));
 
     /* compute res */
@@ -3170,9 +3336,9 @@ static int dis_add_substract_with_carry(struct arm64_target *context, uint32_t i
     /* set flags */
     if (S) {
         if (is_64)
-            write_nzcv(ir, mk_next_nzcv_64(context, ir, OPS_ADC, op1, op2_inverted));
+            write_nzcv(context, ir, mk_next_nzcv_64(context, ir, OPS_ADC, op1, op2_inverted));
         else
-            write_nzcv(ir, mk_next_nzcv_32(context, ir, OPS_ADC, op1, op2_inverted));
+            write_nzcv(context, ir, mk_next_nzcv_32(context, ir, OPS_ADC, op1, op2_inverted));
     }
 
     /* write res */
@@ -3346,15 +3512,101 @@ static int dis_floating_point_immediate(struct arm64_target *context, uint32_t i
     return 0;
 }
 
+/* return op or its signed zero when op is denormal and fpcr.fz is set. fz being a runtime
+   state, squash is done inline. is_squash is set to a non zero value when op has been flushed */
+static struct irRegister *mk_fp_squash_input_denormal_32(struct irInstructionAllocator *ir, struct irRegister *op, struct irRegister *fz,
+                                                          struct irRegister **is_squash)
+{
+    struct irRegister *is_denormal;
+
+    is_denormal = ir->add_and_32(ir, ir->add_cmpeq_32(ir, ir->add_and_32(ir, op, mk_32(ir, 0x7f800000)), mk_32(ir, 0)),
+                                     ir->add_cmpne_32(ir, ir->add_and_32(ir, op, mk_32(ir, 0x7fffffff)), mk_32(ir, 0)));
+    *is_squash = ir->add_and_32(ir, is_denormal, ir->add_8U_to_32(ir, fz));
+
+    return ir->add_ite_32(ir, *is_squash, ir->add_and_32(ir, op, mk_32(ir, 0x80000000)), op);
+}
+
+static struct irRegister *mk_fp_squash_input_denormal_64(struct irInstructionAllocator *ir, struct irRegister *op, struct irRegister *fz,
+                                                          struct irRegister **is_squash)
+{
+    struct irRegister *is_denormal;
+
+    is_denormal = ir->add_and_64(ir, ir->add_cmpeq_64(ir, ir->add_and_64(ir, op, mk_64(ir, 0x7ff0000000000000UL)), mk_64(ir, 0)),
+                                     ir->add_cmpne_64(ir, ir->add_and_64(ir, op, mk_64(ir, 0x7fffffffffffffffUL)), mk_64(ir, 0)));
+    *is_squash = ir->add_64_to_32(ir, ir->add_and_64(ir, is_denormal, ir->add_8U_to_64(ir, fz)));
+
+    return ir->add_ite_64(ir, ir->add_32U_to_64(ir, *is_squash), ir->add_and_64(ir, op, mk_64(ir, 0x8000000000000000UL)), op);
+}
+
+/* compare vn with vm (or zero) using host sse2 and return nzcv in bits 31 to 28. When pred is
+   given and is false, zero is compared with zero so no exception flag can be raised */
+static struct irRegister *mk_fcmp(struct irInstructionAllocator *ir, int is_double, int is_quiet,
+                                  int rn, int rm, int is_compare_zero, struct irRegister *pred)
+{
+    struct irRegister *fz = ir->add_read_context_8(ir, offsetof(struct arm64_registers, fp_status.flush_inputs_to_zero));
+    struct irRegister *is_squash_n;
+    struct irRegister *is_squash_m = NULL;
+    struct irRegister *is_squash;
+    struct irRegister *op1;
+    struct irRegister *op2;
+    struct irRegister *flags;
+    struct irRegister *res;
+
+    if (is_double) {
+        op1 = mk_fp_squash_input_denormal_64(ir, ir->add_read_context_64(ir, offsetof(struct arm64_registers, v[rn].d[0])), fz, &is_squash_n);
+        op2 = is_compare_zero?mk_64(ir, 0):
+                              mk_fp_squash_input_denormal_64(ir, ir->add_read_context_64(ir, offsetof(struct arm64_registers, v[rm].d[0])), fz, &is_squash_m);
+        if (pred) {
+            op1 = ir->add_ite_64(ir, ir->add_32U_to_64(ir, pred), op1, mk_64(ir, 0));
+            op2 = ir->add_ite_64(ir, ir->add_32U_to_64(ir, pred), op2, mk_64(ir, 0));
+        }
+        res = ir->add_64_to_32(ir, is_quiet?ir->add_fcmp_64(ir, op1, op2):ir->add_fcmpe_64(ir, op1, op2));
+    } else {
+        op1 = mk_fp_squash_input_denormal_32(ir, ir->add_read_context_32(ir, offsetof(struct arm64_registers, v[rn].s[0])), fz, &is_squash_n);
+        op2 = is_compare_zero?mk_32(ir, 0):
+                              mk_fp_squash_input_denormal_32(ir, ir->add_read_context_32(ir, offsetof(struct arm64_registers, v[rm].s[0])), fz, &is_squash_m);
+        if (pred) {
+            op1 = ir->add_ite_32(ir, pred, op1, mk_32(ir, 0));
+            op2 = ir->add_ite_32(ir, pred, op2, mk_32(ir, 0));
+        }
+        res = is_quiet?ir->add_fcmp_32(ir, op1, op2):ir->add_fcmpe_32(ir, op1, op2);
+    }
+
+    /* update idc like softfloat does */
+    is_squash = is_squash_m?ir->add_or_32(ir, is_squash_n, is_squash_m):is_squash_n;
+    if (pred)
+        is_squash = ir->add_and_32(ir, is_squash, pred);
+    flags = ir->add_8U_to_32(ir, ir->add_read_context_8(ir, offsetof(struct arm64_registers, fp_status.float_exception_flags)));
+    flags = ir->add_or_32(ir, flags, ir->add_ite_32(ir, is_squash, mk_32(ir, float_flag_input_denormal), mk_32(ir, 0)));
+    ir->add_write_context_8(ir, ir->add_32_to_8(ir, flags), offsetof(struct arm64_registers, fp_status.float_exception_flags));
+
+    return res;
+}
+
 static int dis_floating_point_compare(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    int type = INSN(23,22);
+    int is_compare_zero = INSN(3,3);
+    int is_quiet = (INSN(4,4) == 0);
+    int rm = INSN(20,16);
+    int rn = INSN(9,5);
+
+    /* single and double compare are done inline when host has sse2 */
+    if (type < 2 && hasHostFeature(HOST_FEATURE_SSE2)) {
+        write_nzcv(context, ir, mk_fcmp(ir, type, is_quiet, rn, rm, is_compare_zero, NULL));
+
+        return 0;
+    }
 
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_floating_point_compare_simd",
                            mk_64(ir, (uint64_t) arm64_hlp_dirty_floating_point_compare_simd),
                            params);
+    /* helper has written nzcv */
+    context->lazy_nzcv_ops = LAZY_NZCV_NONE;
+    context->nzcv_value = NULL;
 
     return 0;
 }
@@ -3381,6 +3633,9 @@ static int dis_floating_point_conditional_select(struct arm64_target *context, u
     mk_call_void(context, ir, "arm64_hlp_dirty_floating_point_conditional_select_simd",
                            mk_64(ir, (uint64_t) arm64_hlp_dirty_floating_point_conditional_select_simd),
                            params);
+    /* helper has resolved nzcv */
+    context->lazy_nzcv_ops = LAZY_NZCV_NONE;
+    context->nzcv_value = NULL;
 
     return 0;
 }
@@ -3437,6 +3692,21 @@ static int dis_advanced_simd_scalar_pair_wise(struct arm64_target *context, uint
     return 0;
 }
 
+static int dis_crypto(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
+{
+    struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    arm64_simd_helper helper = arm64_hlp_resolve_crypto_simd(insn);
+
+    assert_illegal_opcode(helper != NULL);
+    params[0] = mk_32(ir, insn);
+
+    mk_call_void(context, ir, "arm64_hlp_crypto_simd",
+                           mk_64(ir, (uint64_t) helper),
+                           params);
+
+    return 0;
+}
+
 static int dis_advanced_simd_table_lookup(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
@@ -3444,7 +3714,7 @@ static int dis_advanced_simd_table_lookup(struct arm64_target *context, uint32_t
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_table_lookup_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_table_lookup_simd),
+                           mk_64(ir, (uint64_t) arm64_hlp_resolve_advanced_simd_table_lookup_simd(insn)),
                            params);
 
     return 0;
@@ -3453,11 +3723,12 @@ static int dis_advanced_simd_table_lookup(struct arm64_target *context, uint32_t
 static int dis_advanced_simd_permute(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    arm64_simd_helper helper = arm64_hlp_resolve_advanced_simd_permute_simd(insn);
 
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_permute_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_permute_simd),
+                           mk_64(ir, (uint64_t) (helper?helper:arm64_hlp_dirty_advanced_simd_permute_simd)),
                            params);
 
     return 0;
@@ -3479,11 +3750,13 @@ static int dis_advanced_simd_ext(struct arm64_target *context, uint32_t insn, st
 static int dis_advanced_simd_three_different(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    arm64_simd_helper helper = arm64_hlp_resolve_advanced_simd_three_different_simd(insn);
 
     params[0] = mk_32(ir, insn);
 
+    /* decode is done now, generic helper is only called for illegal encodings */
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_simd_three_different_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_simd_three_different_simd),
+                           mk_64(ir, (uint64_t) (helper?helper:arm64_hlp_dirty_advanced_simd_simd_three_different_simd)),
                            params);
 
     return 0;
@@ -3492,11 +3765,12 @@ static int dis_advanced_simd_three_different(struct arm64_target *context, uint3
 static int dis_advanced_simd_two_reg_misc(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    arm64_simd_helper helper = arm64_hlp_resolve_advanced_simd_two_reg_misc_simd(insn);
 
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_two_reg_misc_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_two_reg_misc_simd),
+                           mk_64(ir, (uint64_t) (helper?helper:arm64_hlp_dirty_advanced_simd_two_reg_misc_simd)),
                            params);
 
     return 0;
@@ -3560,14 +3834,66 @@ static int dis_advanced_simd_scalar_three_same(struct arm64_target *context, uin
     return 0;
 }
 
+static void dis_advanced_simd_three_same_logic(struct irInstructionAllocator *ir, uint32_t insn)
+{
+    int U = INSN(29,29);
+    int q = INSN(30,30);
+    int size = INSN(23,22);
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    struct irRegister *res[2];
+    int i;
+
+    for(i = 0; i < (q?2:1); i++) {
+        struct irRegister *op1 = i?read_v_msb(ir, rn):read_v_lsb(ir, rn);
+        struct irRegister *op2 = i?read_v_msb(ir, rm):read_v_lsb(ir, rm);
+
+        if (U)
+            res[i] = ir->add_xor_64(ir, op1, op2);
+        else if (size & 1)
+            res[i] = (size & 2 ? ir->add_or_64 : ir->add_and_64)(ir, op1, ir->add_xor_64(ir, op2, mk_64(ir, ~0UL)));
+        else
+            res[i] = (size & 2 ? ir->add_or_64 : ir->add_and_64)(ir, op1, op2);
+    }
+    write_v_lsb(ir, rd, res[0]);
+    write_v_msb(ir, rd, q?res[1]:mk_64(ir, 0));
+}
+
 static int dis_advanced_simd_three_same(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
+    static void (*const add_sub_helpers[2][4])(uint64_t, uint32_t, uint32_t, uint32_t, uint32_t) = {
+        {arm64_hlp_simd_add_8, arm64_hlp_simd_add_16, arm64_hlp_simd_add_32, arm64_hlp_simd_add_64},
+        {arm64_hlp_simd_sub_8, arm64_hlp_simd_sub_16, arm64_hlp_simd_sub_32, arm64_hlp_simd_sub_64}};
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    int U = INSN(29,29);
+    int opcode = INSN(15,11);
+    int size = INSN(23,22);
+    arm64_simd_helper helper;
+
+    /* and, bic, orr, orn and eor are done inline */
+    if (opcode == 3 && (!U || size == 0)) {
+        dis_advanced_simd_three_same_logic(ir, insn);
+        return 0;
+    }
+    /* add and sub use a helper specialized on element size. Reserved .1D arrangement goes
+       through generic helper which reports illegal opcode */
+    if (opcode == 16 && !(size == 3 && !INSN(30,30))) {
+        params[0] = mk_32(ir, INSN(4,0));
+        params[1] = mk_32(ir, INSN(9,5));
+        params[2] = mk_32(ir, INSN(20,16));
+        params[3] = mk_32(ir, INSN(30,30));
+        mk_call_void(context, ir, "arm64_hlp_simd_add_sub",
+                               mk_64(ir, (uint64_t) add_sub_helpers[U][size]),
+                               params);
+        return 0;
+    }
 
+    /* other opcodes are decoded now, generic helper is only called for illegal encodings */
+    helper = arm64_hlp_resolve_advanced_simd_three_same_simd(insn);
     params[0] = mk_32(ir, insn);
-
     mk_call_void(context, ir, "arm64_hlp_dirty_advanced_simd_three_same_simd",
-                           mk_64(ir, (uint64_t) arm64_hlp_dirty_advanced_simd_three_same_simd),
+                           mk_64(ir, (uint64_t) (helper?helper:arm64_hlp_dirty_advanced_simd_three_same_simd)),
                            params);
 
     return 0;
@@ -3615,12 +3941,30 @@ static int dis_advanced_simd_scalar_shift_by_immediate(struct arm64_target *cont
 static int dis_floating_point_conditional_compare(struct arm64_target *context, uint32_t insn, struct irInstructionAllocator *ir)
 {
     struct irRegister *params[4] = {NULL, NULL, NULL, NULL};
+    int type = INSN(23,22);
+    int is_quiet = (INSN(4,4) == 0);
+    int cond = INSN(15,12);
+    int nzcv = INSN(3,0);
+    int rm = INSN(20,16);
+    int rn = INSN(9,5);
+
+    /* when pred is true flags are the ones of the comparison else we use nzcv immediate */
+    if (type < 2 && hasHostFeature(HOST_FEATURE_SSE2)) {
+        struct irRegister *pred = mk_pred(context, ir, cond);
+
+        write_nzcv(context, ir, ir->add_ite_32(ir, pred, mk_fcmp(ir, type, is_quiet, rn, rm, 0, pred), mk_32(ir, nzcv << 28)));
+
+        return 0;
+    }
 
     params[0] = mk_32(ir, insn);
 
     mk_call_void(context, ir, "arm64_hlp_dirty_floating_point_conditional_compare",
                            mk_64(ir, (uint64_t) arm64_hlp_dirty_floating_point_conditional_compare),
                            params);
+    /* helper has resolved nzcv */
+    context->lazy_nzcv_ops = LAZY_NZCV_NONE;
+    context->nzcv_value = NULL;
 
     return 0;
 }
@@ -4280,7 +4624,9 @@ static int dis_advanced_simd(struct arm64_target *context, uint32_t insn, struct
                         assert_illegal_opcode((insn & 0x9f200c00) == 0x0e200000);
                         isExit = dis_advanced_simd_three_different(context, insn, ir);
                     } else { //INSN(11, 11) == 1
-                        if (INSN(20, 20) == 0) {
+                        if ((insn & 0xff3e0c00) == 0x4e280800) {
+                            isExit = dis_crypto(context, insn, ir);
+                        } else if (INSN(20, 20) == 0) {
                             assert_illegal_opcode((insn & 0x9f3e0c00) == 0x0e200800);
                             isExit = dis_advanced_simd_two_reg_misc(context, insn, ir);
                         } else { //INSN(20, 20) == 1
@@ -4316,10 +4662,16 @@ static int dis_advanced_simd(struct arm64_target *context, uint32_t insn, struct
         if (INSN(24, 24) == 0) {
             if (INSN(10, 10) == 0) {
                 if (INSN(11, 11) == 0) {
-                    assert_illegal_opcode((insn & 0xdf200c00) == 0x5e200000);
-                    isExit = dis_advanced_simd_scalar_three_different(context, insn, ir);
+                    if (INSN(21, 21) == 0) {
+                        isExit = dis_crypto(context, insn, ir);
+                    } else {
+                        assert_illegal_opcode((insn & 0xdf200c00) == 0x5e200000);
+                        isExit = dis_advanced_simd_scalar_three_different(context, insn, ir);
+                    }
                 } else { //INSN(11, 11) == 1
-                    if (INSN(20, 20) == 0) {
+                    if ((insn & 0xff3e0c00) == 0x5e280800) {
+                        isExit = dis_crypto(context, insn, ir);
+                    } else if (INSN(20, 20) == 0) {
                         assert_illegal_opcode((insn & 0xdf3e0c00) == 0x5e200800);
                         isExit = dis_advanced_simd_scalar_two_reg_misc(context, insn, ir);
                     } else { //INSN(20, 20) == 1
@@ -4425,39 +4777,87 @@ static int disassemble_insn(struct arm64_target *context, uint32_t insn, struct
     return isExit;
 }
 
-/* api */
-void disassemble_arm64(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
+/* flags liveness. Return 0 for instructions we don't handle or that may exit block.
+   For these ones all flags must be considered as observed. */
+#define NZCV_MASK   ((1 << FLAG_N) | (1 << FLAG_Z) | (1 << FLAG_C) | (1 << FLAG_V))
+static int get_flags_usage(uint32_t insn, struct flags_usage *usage)
 {
-    struct arm64_target *context = container_of(target, struct arm64_target, target);
-    int i;
-    int isExit; //unconditionnal exit
-    uint32_t *pc_ptr = (uint32_t *) g_2_h(pc);
+    usage->read = 0;
+    usage->write = 0;
+    usage->may_write = 0;
+    if (INSN(28, 26) == 4) {
+        switch(INSN(25, 23)) {
+            case 2 ... 3://add / sub
+                if (INSN(29, 29))
+                    usage->write = NZCV_MASK;
+                break;
+            case 4://logical
+                if (INSN(30, 29) == 3)
+                    usage->write = NZCV_MASK;
+                break;
+        }
+    } else if (INSN(27,27) == 1 && INSN(25, 25) == 0) {
+        ;
+    } else if (INSN(27, 25) == 5) {
+        if (INSN(28, 28) == 0) {
+            /* logical and add / sub */
+            if (INSN(24, 24) ? INSN(29, 29) : INSN(30, 29) == 3)
+                usage->write = NZCV_MASK;
+        } else {
+            switch(INSN(24, 21)) {
+                case 0://adc / sbc
+                    usage->read = 1 << FLAG_C;
+                    if (INSN(29, 29))
+                        usage->write = NZCV_MASK;
+                    break;
+                case 6://data processing 1 and 2 sources
+                case 8 ... 15://data processing 3 sources
+                    break;
+                default:
+                    return 0;
+            }
+        }
+    } else
+        return 0;
+    /* arm64 flags setting instructions always write all nzcv flags */
+    usage->may_write = usage->write;
 
-    assert((pc & 3) == 0);
-    for(i = 0; i < (context->regs.is_stepin?1:maxInsn); i++) {
-        context->pc = h_2_g(pc_ptr);
-        isExit = disassemble_insn(context, *pc_ptr, ir);
-        pc_ptr++;
-        if (!isExit)
-            dump_state(context, ir);
-        if (isExit)
+    return 1;
+}
+
+/* bit n of result is set when flags written by instruction n are dead */
+static uint64_t mk_dead_flags(uint32_t *pc_ptr, int maxInsn)
+{
+    struct flags_usage usage[64];
+    int nb;
+
+    for(nb = 0; nb < maxInsn && nb < 64; nb++, pc_ptr++) {
+        if (!get_flags_usage(*pc_ptr, &usage[nb]))
             break;
     }
-    if (!isExit) {
-        mk_exit(context, ir, mk_64(ir, context->pc + 4));
-    }
+
+    return compute_dead_flags(usage, nb);
 }
 
-void disassemble_arm64_with_marker(struct arm64_target *context, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
+/* api */
+void disassemble_arm64(struct target *target, struct irInstructionAllocator *ir, uint64_t pc, int maxInsn)
 {
+    struct arm64_target *context = container_of(target, struct arm64_target, target);
     int i;
     int isExit; //unconditionnal exit
     uint32_t *pc_ptr = (uint32_t *) g_2_h(pc);
+    uint64_t dead_flags;
     uint32_t pc_offset = 0;
 
     assert((pc & 3) == 0);
+    context->lazy_nzcv_ops = LAZY_NZCV_UNKNOWN;
+    context->nzcv_value = NULL;
+    context->lazy_nzcv_op1 = NULL;
+    context->lazy_nzcv_op2 = NULL;
+    dead_flags = mk_dead_flags(pc_ptr, context->regs.is_stepin?1:maxInsn);
     for(i = 0; i < (context->regs.is_stepin?1:maxInsn); i++) {
         context->pc = h_2_g(pc_ptr);
+        context->is_flags_dead = (dead_flags >> i) & 1;
         ir->add_insn_marker(ir, pc_offset);
         pc_offset += 4;
         isExit = disassemble_insn(context, *pc_ptr, ir);
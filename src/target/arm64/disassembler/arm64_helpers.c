@@ -26,6 +26,7 @@
 #include "arm64_helpers.h"
 #include "runtime.h"
 #include "cache.h"
+#include "host_features.h"
 
 //#define DUMP_STACK 1
 #define INSN(msb, lsb) ((insn >> (lsb)) & ((1 << ((msb) - (lsb) + 1))-1))
@@ -41,7 +42,7 @@ void arm64_hlp_dump(uint64_t regs)
         if (i % 4 == 3)
             printf("\n");
     }
-    printf("nzcv  = 0x%08x\n", context->regs.nzcv);
+    printf("nzcv  = 0x%08x\n", arm64_hlp_resolve_nzcv(regs));
     printf("pc    = 0x%016lx\n", context->regs.pc);
 #ifdef DUMP_STACK
     for(i = 0 ;i < 16; i++) {
@@ -181,6 +182,31 @@ uint32_t arm64_hlp_compute_next_nzcv_64(uint64_t context, uint32_t opcode, uint6
     return n|z|c|v|(oldnzcv&0x0fffffff);
 }
 
+/* compute nzcv from lazy state, write it back and return it */
+uint32_t arm64_hlp_resolve_nzcv(uint64_t _regs)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+
+    switch(regs->lazy_nzcv_ops) {
+        case LAZY_NZCV_NONE:
+            break;
+        case LAZY_NZCV_ADD:
+            regs->nzcv = arm64_hlp_compute_next_nzcv_64(_regs, OPS_ADD, regs->lazy_nzcv_op1, regs->lazy_nzcv_op2, regs->nzcv);
+            break;
+        case LAZY_NZCV_SUB:
+            regs->nzcv = arm64_hlp_compute_next_nzcv_64(_regs, OPS_SUB, regs->lazy_nzcv_op1, regs->lazy_nzcv_op2, regs->nzcv);
+            break;
+        case LAZY_NZCV_LOGICAL:
+            regs->nzcv = arm64_hlp_compute_next_nzcv_64(_regs, OPS_LOGICAL, regs->lazy_nzcv_op1, regs->lazy_nzcv_op2, regs->nzcv);
+            break;
+        default:
+            fatal("lazy_nzcv_ops = %d\n", regs->lazy_nzcv_ops);
+    }
+    regs->lazy_nzcv_ops = LAZY_NZCV_NONE;
+
+    return regs->nzcv;
+}
+
 /* return 1 if cond code is true */
 /* note that this is the invert of arm code which return 0 when cond code is true ... */
 uint32_t arm64_hlp_compute_flags_pred(uint64_t context, uint32_t cond, uint32_t nzcv)
@@ -356,43 +382,8 @@ int64_t arm64_hlp_smul_lsb_64(uint64_t context, int64_t op1, int64_t op2)
 /* FIXME: ldrex / strex implementation below is not sematically correct. It's subject
           to the ABBA problem which is not the case of ldrex/strex hardware implementation
  */
-uint64_t arm64_hlp_ldxr(uint64_t regs, uint64_t address, uint32_t size_access)
-{
-    struct arm64_target *context = container_of((void *) regs, struct arm64_target, regs);
-
-    switch(size_access) {
-        case 3://64 bits
-            context->exclusive_value = (uint64_t) *((uint64_t *)g_2_h(address));
-            break;
-        case 2://32 bits
-            context->exclusive_value = (uint32_t) *((uint32_t *)g_2_h(address));
-            break;
-        case 1://16 bits
-            context->exclusive_value = (uint16_t) *((uint16_t *)g_2_h(address));
-            break;
-        case 0://8 bits
-            context->exclusive_value = (uint8_t) *((uint8_t *)g_2_h(address));
-            break;
-        default:
-            fatal_illegal_opcode("size_access %d unsupported\n", size_access);
-    }
-
-    return context->exclusive_value;
-}
-
-uint64_t arm64_hlp_ldaxr(uint64_t regs, uint64_t address, uint32_t size_access)
-{
-    uint64_t res;
-
-    res = arm64_hlp_ldxr(regs, address, size_access);
-    __sync_synchronize();
-
-    return res;
-}
-
 void arm64_hlp_ldxp_dirty(uint64_t _regs, uint32_t insn)
 {
-    struct arm64_target *context = container_of((void *) _regs, struct arm64_target, regs);
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
 
     int size = INSN(31, 30);
@@ -402,17 +393,17 @@ void arm64_hlp_ldxp_dirty(uint64_t _regs, uint32_t insn)
     uint64_t address = regs->r[rn];
 
     if (size == 3) {
-        context->exclusive_value = (__uint128_t) *((__uint128_t *) g_2_h(address));
+        regs->exclusive_value = (__uint128_t) *((__uint128_t *) g_2_h(address));
         if (rt != 31)
-            regs->r[rt] = (uint64_t) context->exclusive_value;
+            regs->r[rt] = (uint64_t) regs->exclusive_value;
         if (rt2 != 31)
-            regs->r[rt2] = (uint64_t) (context->exclusive_value >> 64);
+            regs->r[rt2] = (uint64_t) (regs->exclusive_value >> 64);
     } else if (size == 2) {
-        context->exclusive_value = (uint64_t) *((uint64_t *) g_2_h(address));
+        regs->exclusive_value = (uint64_t) *((uint64_t *) g_2_h(address));
         if (rt != 31)
-            regs->r[rt] = (uint32_t) context->exclusive_value;
+            regs->r[rt] = (uint32_t) regs->exclusive_value;
         if (rt2 != 31)
-            regs->r[rt2] = (uint32_t) (context->exclusive_value >> 32);
+            regs->r[rt2] = (uint32_t) (regs->exclusive_value >> 32);
     } else
         assert_illegal_opcode(0);
 }
@@ -425,7 +416,6 @@ void arm64_hlp_ldaxp_dirty(uint64_t _regs, uint32_t insn)
 
 void arm64_hlp_stxp_dirty(uint64_t _regs, uint32_t insn)
 {
-    struct arm64_target *context = container_of((void *) _regs, struct arm64_target, regs);
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
 
     int size_access = INSN(31, 30);
@@ -444,19 +434,19 @@ void arm64_hlp_stxp_dirty(uint64_t _regs, uint32_t insn)
 #if 0
                 //FIXME: need to implement __sync_bool_compare_and_swap_16
                 __uint128_t value = ((__uint128_t)regs->r[rt2] << 64) | regs->r[rt];
-                if (__sync_bool_compare_and_swap((__uint128_t *) g_2_h(address), (__uint128_t)context->exclusive_value, (__uint128_t)value))
+                if (__sync_bool_compare_and_swap((__uint128_t *) g_2_h(address), (__uint128_t)regs->exclusive_value, (__uint128_t)value))
                     res = 0;
                 else
                     res = 1;
 #else
                 /* FIXME: not atomic ..... */
-                if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), (uint64_t)context->exclusive_value, regs->r[rt])) {
-                    if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address + 8), (uint64_t)(context->exclusive_value >> 64), regs->r[rt2])) {
+                if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), (uint64_t)regs->exclusive_value, regs->r[rt])) {
+                    if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address + 8), (uint64_t)(regs->exclusive_value >> 64), regs->r[rt2])) {
                         res = 0;
                     } else {
                         /* restore lsb ... */
                         res = 1;
-                        context->exclusive_value = ((context->exclusive_value >> 64) << 64) | regs->r[rt];
+                        regs->exclusive_value = ((regs->exclusive_value >> 64) << 64) | regs->r[rt];
                     }
                 } else
                     res = 1;
@@ -467,7 +457,7 @@ void arm64_hlp_stxp_dirty(uint64_t _regs, uint32_t insn)
             {
                 uint64_t value = (regs->r[rt2] << 32) | (regs->r[rt] & 0xffffffff);
 
-                if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), (uint64_t)context->exclusive_value, (uint64_t)value))
+                if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), (uint64_t)regs->exclusive_value, (uint64_t)value))
                     res = 0;
                 else
                     res = 1;
@@ -485,55 +475,12 @@ void arm64_hlp_stlxp_dirty(uint64_t _regs, uint32_t insn)
     arm64_hlp_stxp_dirty(_regs, insn);
 }
 
-uint32_t arm64_hlp_stxr(uint64_t regs, uint64_t address, uint32_t size_access, uint64_t value)
-{
-    struct arm64_target *context = container_of((void *) regs, struct arm64_target, regs);
-    uint32_t res = 0;
-
-    switch(size_access) {
-        case 3:
-            if (__sync_bool_compare_and_swap((uint64_t *) g_2_h(address), (uint64_t)context->exclusive_value, (uint64_t)value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        case 2:
-            if (__sync_bool_compare_and_swap((uint32_t *) g_2_h(address), (uint32_t)context->exclusive_value, (uint32_t)value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        case 1:
-            if (__sync_bool_compare_and_swap((uint16_t *) g_2_h(address), (uint16_t)context->exclusive_value, (uint16_t)value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        case 0:
-            if (__sync_bool_compare_and_swap((uint8_t *) g_2_h(address), (uint8_t)context->exclusive_value, (uint8_t)value))
-                res = 0;
-            else
-                res = 1;
-            break;
-        default:
-            fatal_illegal_opcode("size_access %d unsupported\n", size_access);
-    }
-
-    return res;
-}
-
-uint32_t arm64_hlp_stlxr(uint64_t regs, uint64_t address, uint32_t size_access, uint64_t value)
-{
-    __sync_synchronize();
-    return arm64_hlp_stxr(regs, address, size_access, value);
-}
-
 /* FIXME: not correct => should use compare_and_swap to swap atomically value */
-void arm64_hlp_clrex(uint64_t regs)
+void arm64_hlp_clrex(uint64_t _regs)
 {
-    struct arm64_target *context = container_of((void *) regs, struct arm64_target, regs);
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
 
-    context->exclusive_value = ~~context->exclusive_value;
+    regs->exclusive_value = ~~regs->exclusive_value;
 }
 
 uint64_t arm64_hlp_clz(uint64_t context, uint64_t rn, uint32_t start_index)
@@ -541,6 +488,17 @@ uint64_t arm64_hlp_clz(uint64_t context, uint64_t rn, uint32_t start_index)
     uint64_t res = 0;
     int i;
 
+    if (hasHostFeature(HOST_FEATURE_LZCNT)) {
+        if (start_index == 63) {
+            asm("lzcnt %1, %0" : "=r" (res) : "r" (rn));
+            return res;
+        } else if (start_index == 31) {
+            uint32_t res32;
+
+            asm("lzcnt %1, %0" : "=r" (res32) : "r" ((uint32_t) rn));
+            return res32;
+        }
+    }
     for(i = start_index; i >= 0; i--) {
         if ((rn >> i) & 1)
             break;
@@ -572,20 +530,30 @@ void arm64_hlp_memory_barrier(uint64_t regs)
 
 #include <arm64_crc32_tables.c>
 
-static uint64_t crc32(uint64_t crc, uint8_t *buf, unsigned int len)
+/* slice-by-8 : consume the whole 1, 2, 4 or 8 bytes value in one step */
+static uint32_t crc32_slice(const uint32_t table[8][256], uint32_t crc, uint64_t val, int len)
 {
-    while(len--)
-        crc = crc32_table[((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
+    uint32_t x = crc ^ (uint32_t) val;
+    uint32_t hi = val >> 32;
 
-    return crc;
-}
-
-static uint64_t crc32c(uint64_t crc, uint8_t *buf, unsigned int len)
-{
-    while(len--)
-        crc = crc32c_table[((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
+    switch(len) {
+        case 1:
+            return (crc >> 8) ^ table[0][x & 0xff];
+        case 2:
+            return (crc >> 16) ^ table[1][x & 0xff] ^ table[0][(x >> 8) & 0xff];
+        case 4:
+            return table[3][x & 0xff] ^ table[2][(x >> 8) & 0xff] ^
+                   table[1][(x >> 16) & 0xff] ^ table[0][x >> 24];
+        case 8:
+            return table[7][x & 0xff] ^ table[6][(x >> 8) & 0xff] ^
+                   table[5][(x >> 16) & 0xff] ^ table[4][x >> 24] ^
+                   table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+                   table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        default:
+            assert(0);
+    }
 
-    return crc;
+    return 0;
 }
 
 void arm64_hlp_dirty_crc32(uint64_t _regs, uint32_t insn)
@@ -601,7 +569,7 @@ void arm64_hlp_dirty_crc32(uint64_t _regs, uint32_t insn)
     uint64_t val= regs->r[rm] & mask[sz];
 
     if (is_crc32c)
-        regs->r[rd] = crc32c(acc, (uint8_t *) &val, 1 << sz);
+        regs->r[rd] = crc32_slice(crc32c_table, acc, val, 1 << sz);
     else
-        regs->r[rd] = crc32(acc, (uint8_t *) &val, 1 << sz);
+        regs->r[rd] = crc32_slice(crc32_table, acc, val, 1 << sz);
 }
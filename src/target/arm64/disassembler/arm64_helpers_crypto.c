@@ -0,0 +1,429 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2016 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#include <immintrin.h>
+
+#include "arm64_private.h"
+#include "arm64_helpers_crypto.h"
+#include "host_features.h"
+
+#define INSN(msb, lsb) ((insn >> (lsb)) & ((1 << ((msb) - (lsb) + 1))-1))
+
+#define AESNI   __attribute__((target("aes")))
+#define SHANI   __attribute__((target("sha,ssse3")))
+
+#include "arm64_aes_tables.c"
+
+static inline __m128i vload(struct arm64_registers *regs, int index)
+{
+    return _mm_loadu_si128((__m128i *) &regs->v[index]);
+}
+static inline void vstore(struct arm64_registers *regs, int index, __m128i value)
+{
+    _mm_storeu_si128((__m128i *) &regs->v[index], value);
+}
+
+static inline uint32_t rol32(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+static inline uint32_t ror32(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+/* portable aes. State bytes are column major, byte i is row i % 4 of column i / 4 */
+static inline uint8_t xtime(uint8_t x)
+{
+    return (x << 1) ^ ((x & 0x80)?0x1b:0);
+}
+
+static uint8_t gmul(uint8_t a, uint8_t b)
+{
+    uint8_t res = 0;
+
+    while(b) {
+        if (b & 1)
+            res ^= a;
+        a = xtime(a);
+        b >>= 1;
+    }
+
+    return res;
+}
+
+static void aes_sub_shift_rows(union simd_register *state, const uint8_t *sbox, int is_inverse)
+{
+    union simd_register res;
+    int i;
+
+    /* ShiftRows moves byte of row r from column (c + r) to column c */
+    for(i = 0; i < 16; i++) {
+        int r = i % 4;
+        int c = i / 4;
+
+        if (is_inverse)
+            res.b[r + 4 * ((c + r) % 4)] = sbox[state->b[i]];
+        else
+            res.b[i] = sbox[state->b[r + 4 * ((c + r) % 4)]];
+    }
+    *state = res;
+}
+
+static void aes_mix_columns(union simd_register *state, const uint8_t coef[4])
+{
+    union simd_register res;
+    int c, r;
+
+    for(c = 0; c < 4; c++) {
+        for(r = 0; r < 4; r++) {
+            res.b[4 * c + r] = gmul(state->b[4 * c + r], coef[0]) ^
+                               gmul(state->b[4 * c + (r + 1) % 4], coef[1]) ^
+                               gmul(state->b[4 * c + (r + 2) % 4], coef[2]) ^
+                               gmul(state->b[4 * c + (r + 3) % 4], coef[3]);
+        }
+    }
+    *state = res;
+}
+
+static void dis_aese_aesd(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int is_decrypt = INSN(12,12);
+    union simd_register state;
+
+    state.v.lsb = regs->v[rd].v.lsb ^ regs->v[rn].v.lsb;
+    state.v.msb = regs->v[rd].v.msb ^ regs->v[rn].v.msb;
+    aes_sub_shift_rows(&state, is_decrypt?aes_inv_sbox:aes_sbox, is_decrypt);
+
+    regs->v[rd] = state;
+}
+
+static void dis_aesmc_aesimc(uint64_t _regs, uint32_t insn)
+{
+    static const uint8_t mix[4] = {2, 3, 1, 1};
+    static const uint8_t inv_mix[4] = {14, 11, 13, 9};
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int is_inverse = INSN(12,12);
+    union simd_register state = regs->v[rn];
+
+    aes_mix_columns(&state, is_inverse?inv_mix:mix);
+
+    regs->v[rd] = state;
+}
+
+/* aes-ni last rounds have no MixColumns, so with a zero key they give arm aese/aesd.
+   aesmc is rebuilt from aesenc by undoing its SubBytes and ShiftRows first */
+static AESNI void simd_aese(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i state = _mm_xor_si128(vload(regs, INSN(4,0)), vload(regs, INSN(9,5)));
+
+    vstore(regs, INSN(4,0), _mm_aesenclast_si128(state, _mm_setzero_si128()));
+}
+
+static AESNI void simd_aesd(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i state = _mm_xor_si128(vload(regs, INSN(4,0)), vload(regs, INSN(9,5)));
+
+    vstore(regs, INSN(4,0), _mm_aesdeclast_si128(state, _mm_setzero_si128()));
+}
+
+static AESNI void simd_aesmc(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i state = _mm_aesdeclast_si128(vload(regs, INSN(9,5)), _mm_setzero_si128());
+
+    vstore(regs, INSN(4,0), _mm_aesenc_si128(state, _mm_setzero_si128()));
+}
+
+static AESNI void simd_aesimc(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+
+    vstore(regs, INSN(4,0), _mm_aesimc_si128(vload(regs, INSN(9,5))));
+}
+
+/* portable sha1 and sha256 follow arm pseudo code */
+static inline uint32_t sha_choose(uint32_t x, uint32_t y, uint32_t z)
+{
+    return ((y ^ z) & x) ^ z;
+}
+static inline uint32_t sha_parity(uint32_t x, uint32_t y, uint32_t z)
+{
+    return x ^ y ^ z;
+}
+static inline uint32_t sha_majority(uint32_t x, uint32_t y, uint32_t z)
+{
+    return (x & y) | ((x | y) & z);
+}
+
+static void dis_sha1c_sha1p_sha1m(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int opcode = INSN(14,12);
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    union simd_register x = regs->v[rd];
+    uint32_t y = regs->v[rn].s[0];
+    int e;
+
+    for(e = 0; e < 4; e++) {
+        uint32_t t;
+
+        if (opcode == 0)
+            t = sha_choose(x.s[1], x.s[2], x.s[3]);
+        else if (opcode == 1)
+            t = sha_parity(x.s[1], x.s[2], x.s[3]);
+        else
+            t = sha_majority(x.s[1], x.s[2], x.s[3]);
+        y = y + rol32(x.s[0], 5) + t + regs->v[rm].s[e];
+        x.s[1] = rol32(x.s[1], 30);
+        /* <y:x> = ROL(<y:x>, 32) */
+        t = x.s[3];
+        x.s[3] = x.s[2];
+        x.s[2] = x.s[1];
+        x.s[1] = x.s[0];
+        x.s[0] = y;
+        y = t;
+    }
+
+    regs->v[rd] = x;
+}
+
+static void dis_sha1su0(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    union simd_register res;
+
+    res.v.lsb = regs->v[rd].v.msb ^ regs->v[rd].v.lsb ^ regs->v[rm].v.lsb;
+    res.v.msb = regs->v[rn].v.lsb ^ regs->v[rd].v.msb ^ regs->v[rm].v.msb;
+
+    regs->v[rd] = res;
+}
+
+static void dis_sha1su1(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    union simd_register t;
+    union simd_register res;
+    int i;
+
+    for(i = 0; i < 4; i++)
+        t.s[i] = regs->v[rd].s[i] ^ (i < 3?regs->v[rn].s[i + 1]:0);
+    for(i = 0; i < 4; i++)
+        res.s[i] = rol32(t.s[i], 1);
+    res.s[3] ^= rol32(t.s[0], 2);
+
+    regs->v[rd] = res;
+}
+
+static void dis_sha1h(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    union simd_register res = {0};
+
+    res.s[0] = rol32(regs->v[rn].s[0], 30);
+
+    regs->v[rd] = res;
+}
+
+/* 4 rounds on abcd/efgh, sha256h keeps abcd and sha256h2 keeps efgh */
+static void sha256_hash(union simd_register *x, union simd_register *y, union simd_register *w)
+{
+    int e;
+
+    for(e = 0; e < 4; e++) {
+        uint32_t chs = sha_choose(y->s[0], y->s[1], y->s[2]);
+        uint32_t maj = sha_majority(x->s[0], x->s[1], x->s[2]);
+        uint32_t t = y->s[3] + (ror32(y->s[0], 6) ^ ror32(y->s[0], 11) ^ ror32(y->s[0], 25)) + chs + w->s[e];
+        uint32_t top;
+
+        x->s[3] = t + x->s[3];
+        y->s[3] = t + (ror32(x->s[0], 2) ^ ror32(x->s[0], 13) ^ ror32(x->s[0], 22)) + maj;
+        /* <y:x> = ROL(<y:x>, 32) */
+        top = y->s[3];
+        y->s[3] = y->s[2];
+        y->s[2] = y->s[1];
+        y->s[1] = y->s[0];
+        y->s[0] = x->s[3];
+        x->s[3] = x->s[2];
+        x->s[2] = x->s[1];
+        x->s[1] = x->s[0];
+        x->s[0] = top;
+    }
+}
+
+static void dis_sha256h_sha256h2(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int is_h2 = INSN(12,12);
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    union simd_register x = regs->v[is_h2?rn:rd];
+    union simd_register y = regs->v[is_h2?rd:rn];
+    union simd_register w = regs->v[rm];
+
+    sha256_hash(&x, &y, &w);
+
+    regs->v[rd] = is_h2?y:x;
+}
+
+static void dis_sha256su0(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    union simd_register res;
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        uint32_t elt = i < 3?regs->v[rd].s[i + 1]:regs->v[rn].s[0];
+
+        res.s[i] = regs->v[rd].s[i] + (ror32(elt, 7) ^ ror32(elt, 18) ^ (elt >> 3));
+    }
+
+    regs->v[rd] = res;
+}
+
+static void dis_sha256su1(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    union simd_register res;
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        uint32_t t0 = i < 3?regs->v[rn].s[i + 1]:regs->v[rm].s[0];
+        uint32_t t1 = i < 2?regs->v[rm].s[i + 2]:res.s[i - 2];
+
+        res.s[i] = regs->v[rd].s[i] + t0 + (ror32(t1, 17) ^ ror32(t1, 19) ^ (t1 >> 10));
+    }
+
+    regs->v[rd] = res;
+}
+
+/* sha-ni keeps a in the upper lane and adds round constants itself, while arm has a in
+   lane 0 and software already added them to w. So lanes are reversed and constants are
+   removed from w before use. Arm e is folded in first w as sha1nexte would do */
+#define SHA1_KERNEL(name, _func_, _k_) \
+static SHANI void simd_##name(uint64_t _regs, uint32_t insn) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+    __m128i abcd = _mm_shuffle_epi32(vload(regs, INSN(4,0)), 0x1b); \
+    __m128i w = _mm_shuffle_epi32(_mm_sub_epi32(vload(regs, INSN(20,16)), _mm_set1_epi32(_k_)), 0x1b); \
+\
+    w = _mm_add_epi32(w, _mm_set_epi32(regs->v[INSN(9,5)].s[0], 0, 0, 0)); \
+    vstore(regs, INSN(4,0), _mm_shuffle_epi32(_mm_sha1rnds4_epu32(abcd, w, _func_), 0x1b)); \
+}
+
+SHA1_KERNEL(sha1c, 0, 0x5a827999)
+SHA1_KERNEL(sha1p, 1, 0x6ed9eba1)
+SHA1_KERNEL(sha1m, 2, 0x8f1bbcdc)
+
+/* sha256rnds2 works on abef and cdgh halves, two rounds at a time */
+static SHANI void simd_sha256h_sha256h2(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int is_h2 = INSN(12,12);
+    __m128i abcd = _mm_shuffle_epi32(vload(regs, is_h2?INSN(9,5):INSN(4,0)), 0x1b);
+    __m128i efgh = _mm_shuffle_epi32(vload(regs, is_h2?INSN(4,0):INSN(9,5)), 0x1b);
+    __m128i w = vload(regs, INSN(20,16));
+    __m128i abef = _mm_unpackhi_epi64(efgh, abcd);
+    __m128i cdgh = _mm_unpacklo_epi64(efgh, abcd);
+
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, w);
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_srli_si128(w, 8));
+    if (is_h2)
+        vstore(regs, INSN(4,0), _mm_shuffle_epi32(_mm_unpacklo_epi64(cdgh, abef), 0x1b));
+    else
+        vstore(regs, INSN(4,0), _mm_shuffle_epi32(_mm_unpackhi_epi64(cdgh, abef), 0x1b));
+}
+
+static SHANI void simd_sha256su0(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+
+    vstore(regs, INSN(4,0), _mm_sha256msg1_epu32(vload(regs, INSN(4,0)), vload(regs, INSN(9,5))));
+}
+
+static SHANI void simd_sha256su1(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i m = vload(regs, INSN(20,16));
+    __m128i t0 = _mm_alignr_epi8(m, vload(regs, INSN(9,5)), 4);
+
+    vstore(regs, INSN(4,0), _mm_sha256msg2_epu32(_mm_add_epi32(vload(regs, INSN(4,0)), t0), m));
+}
+
+/* return leaf helper of a crypto instruction or NULL if encoding is illegal */
+arm64_simd_helper arm64_hlp_resolve_crypto_simd(uint32_t insn)
+{
+    int has_aes = hasHostFeature(HOST_FEATURE_AES);
+    int has_sha = hasHostFeature(HOST_FEATURE_SHA);
+
+    if ((insn & 0xff3e0c00) == 0x4e280800) {
+        //aes
+        switch(INSN(16,12)) {
+            case 4: return has_aes?simd_aese:dis_aese_aesd;
+            case 5: return has_aes?simd_aesd:dis_aese_aesd;
+            case 6: return has_aes?simd_aesmc:dis_aesmc_aesimc;
+            case 7: return has_aes?simd_aesimc:dis_aesmc_aesimc;
+        }
+    } else if ((insn & 0xff208c00) == 0x5e000000) {
+        //three registers sha
+        switch(INSN(14,12)) {
+            case 0: return has_sha?simd_sha1c:dis_sha1c_sha1p_sha1m;
+            case 1: return has_sha?simd_sha1p:dis_sha1c_sha1p_sha1m;
+            case 2: return has_sha?simd_sha1m:dis_sha1c_sha1p_sha1m;
+            case 3: return dis_sha1su0;
+            case 4: case 5: return has_sha?simd_sha256h_sha256h2:dis_sha256h_sha256h2;
+            case 6: return has_sha?simd_sha256su1:dis_sha256su1;
+        }
+    } else if ((insn & 0xff3e0c00) == 0x5e280800) {
+        //two registers sha
+        switch(INSN(16,12)) {
+            case 0: return dis_sha1h;
+            case 1: return dis_sha1su1;
+            case 2: return has_sha?simd_sha256su0:dis_sha256su0;
+        }
+    }
+
+    return NULL;
+}
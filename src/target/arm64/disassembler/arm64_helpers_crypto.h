@@ -0,0 +1,42 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2016 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef __ARM64_HELPERS_CRYPTO__
+#define __ARM64_HELPERS_CRYPTO__ 1
+
+#include "target64.h"
+#include "arm64_helpers_simd.h"
+
+extern arm64_simd_helper arm64_hlp_resolve_crypto_simd(uint32_t insn);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
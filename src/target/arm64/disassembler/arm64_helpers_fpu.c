@@ -26,6 +26,7 @@
 #include "arm64_private.h"
 #include "arm64_helpers.h"
 #include "runtime.h"
+#include "host_features.h"
 #include "softfloat.h"
 #include "arm64_softfloat.h"
 
@@ -58,6 +59,7 @@ static void dis_fcvt(uint64_t _regs, uint32_t insn)
     int rd = INSN(4,0);
     int rn = INSN(9,5);
     union simd_register res = {0};
+    int is_f16c = FAST_MATH_ALLOW && regs->fast_math_is_allow && IEEE_H16 && hasHostFeature(HOST_FEATURE_F16C);
 
     if (type == 1 && opc == 0) {
         //fcvt Sd, Dn
@@ -67,9 +69,13 @@ static void dis_fcvt(uint64_t _regs, uint32_t insn)
         res.d[0] = float64_maybe_silence_nan(float32_to_float64(regs->v[rn].s[0], &regs->fp_status));
     } else if (type == 0 && opc ==3) {
         //fcvt Hd, Sn
-        res.h[0] = float32_to_float16(regs->v[rn].s[0], IEEE_H16, &regs->fp_status);
-        if (IEEE_H16)
-            res.h[0] = float16_maybe_silence_nan(res.h[0]);
+        if (is_f16c && is_not_nan_or_infinite_32(regs->v[rn].s[0]) && is_not_tiny_for_16_32(regs->v[rn].s[0])) {
+            res.h[0] = f16c_s_to_h(regs->v[rn].s[0]);
+        } else {
+            res.h[0] = float32_to_float16(regs->v[rn].s[0], IEEE_H16, &regs->fp_status);
+            if (IEEE_H16)
+                res.h[0] = float16_maybe_silence_nan(res.h[0]);
+        }
     } else if (type == 1 && opc ==3) {
         //fcvt Hd, Dn
         res.h[0] = float64_to_float16(regs->v[rn].d[0], IEEE_H16, &regs->fp_status);
@@ -77,14 +83,23 @@ static void dis_fcvt(uint64_t _regs, uint32_t insn)
             res.h[0] = float16_maybe_silence_nan(res.h[0]);
     } else if (type == 3 && opc == 0) {
         //fcvt Sd, Hn
-        res.s[0] = float16_to_float32(regs->v[rn].h[0], IEEE_H16, &regs->fp_status);
-        if (IEEE_H16)
-            res.s[0] = float32_maybe_silence_nan(res.s[0]);
+        if (is_f16c && is_not_nan_or_infinite_16(regs->v[rn].h[0])) {
+            res.s[0] = f16c_h_to_s(regs->v[rn].h[0]);
+        } else {
+            res.s[0] = float16_to_float32(regs->v[rn].h[0], IEEE_H16, &regs->fp_status);
+            if (IEEE_H16)
+                res.s[0] = float32_maybe_silence_nan(res.s[0]);
+        }
     }else if (type == 3 && opc == 1) {
         //fcvt Dd, Hn
-        res.d[0] = float16_to_float64(regs->v[rn].h[0], IEEE_H16, &regs->fp_status);
-        if (IEEE_H16)
-            res.d[0] = float64_maybe_silence_nan(res.d[0]);
+        if (is_f16c && is_not_nan_or_infinite_16(regs->v[rn].h[0])) {
+            /* single to double is exact */
+            res.d[0] = make_uint64_t(make_float(f16c_h_to_s(regs->v[rn].h[0])));
+        } else {
+            res.d[0] = float16_to_float64(regs->v[rn].h[0], IEEE_H16, &regs->fp_status);
+            if (IEEE_H16)
+                res.d[0] = float64_maybe_silence_nan(res.d[0]);
+        }
     } else
         fatal_illegal_opcode("type=%d / opc=%d\n", type, opc);
     regs->v[rd] = res;
@@ -181,7 +196,7 @@ static void dis_fccmp_fccmpe(uint64_t _regs, uint32_t insn)
     int nzcv = INSN(3,0);
     int is_quiet = (INSN(4, 4) == 0);
 
-    if (arm64_hlp_compute_flags_pred(_regs, cond, regs->nzcv)) {
+    if (arm64_hlp_compute_flags_pred(_regs, cond, arm64_hlp_resolve_nzcv(_regs))) {
         if (is_double)
             nzcv = fcmp64(regs, regs->v[rn].d[0], regs->v[rm].d[0], is_quiet);
         else
@@ -254,6 +269,7 @@ void arm64_hlp_dirty_floating_point_compare_simd(uint64_t _regs, uint32_t insn)
         regs->nzcv = fcmp64(regs, regs->v[rn].d[0], is_compare_zero?0:regs->v[rm].d[0], is_quiet) << 28;
     else
         regs->nzcv = fcmp32(regs, regs->v[rn].s[0], is_compare_zero?0:regs->v[rm].s[0], is_quiet) << 28;
+    regs->lazy_nzcv_ops = LAZY_NZCV_NONE;
 }
 
 void arm64_hlp_dirty_floating_point_data_processing_2_source_simd(uint64_t _regs, uint32_t insn)
@@ -377,7 +393,7 @@ void arm64_hlp_dirty_floating_point_conditional_select_simd(uint64_t _regs, uint
     int rn = INSN(9,5);
     int rd = INSN(4,0);
 
-    if (arm64_hlp_compute_flags_pred(_regs, cond, regs->nzcv)) {
+    if (arm64_hlp_compute_flags_pred(_regs, cond, arm64_hlp_resolve_nzcv(_regs))) {
         //d <= n
         regs->v[rd].d[1] = 0;
         if (is_double)
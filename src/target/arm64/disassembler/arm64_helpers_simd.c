@@ -22,10 +22,17 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
 
 #include "arm64_private.h"
 #include "arm64_helpers.h"
+#include "arm64_helpers_simd.h"
 #include "runtime.h"
+#include "host_features.h"
 #include "softfloat.h"
 #include "arm64_softfloat.h"
 
@@ -169,6 +176,20 @@ static inline void set_qc(struct arm64_registers *regs)
     regs->qc = 1 << 27;
 }
 
+/* access simd registers as host vectors. Upper half is cleared when q is not set */
+static inline __m128i vload(struct arm64_registers *regs, int index)
+{
+    return _mm_loadu_si128((__m128i *) &regs->v[index]);
+}
+static inline void vstore(struct arm64_registers *regs, int index, __m128i value, int q)
+{
+    _mm_storeu_si128((__m128i *) &regs->v[index], q?value:_mm_move_epi64(value));
+}
+static inline __m128i vnot(__m128i value)
+{
+    return _mm_xor_si128(value, _mm_set1_epi32(-1));
+}
+
 #define DECLARE_USAT(size,max) \
 static inline uint##size##_t usat##size(struct arm64_registers *regs, int64_t op) \
 { \
@@ -305,6 +326,43 @@ void arm64_hlp_dirty_simd_dup_element(uint64_t _regs, uint32_t insn)
     regs->v[rd].v.msb = msb;
 }
 
+/* dup element specialized at translation time on element size */
+void arm64_hlp_simd_dup_element_8(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    uint64_t lsb = regs->v[rn].b[index] * 0x0101010101010101UL;
+
+    regs->v[rd].v.lsb = lsb;
+    regs->v[rd].v.msb = q?lsb:0;
+}
+
+void arm64_hlp_simd_dup_element_16(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    uint64_t lsb = regs->v[rn].h[index] * 0x0001000100010001UL;
+
+    regs->v[rd].v.lsb = lsb;
+    regs->v[rd].v.msb = q?lsb:0;
+}
+
+void arm64_hlp_simd_dup_element_32(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    uint64_t lsb = regs->v[rn].s[index] * 0x0000000100000001UL;
+
+    regs->v[rd].v.lsb = lsb;
+    regs->v[rd].v.msb = q?lsb:0;
+}
+
+void arm64_hlp_simd_dup_element_64(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    uint64_t lsb = regs->v[rn].d[index];
+
+    regs->v[rd].v.lsb = lsb;
+    regs->v[rd].v.msb = lsb;
+}
+
 void arm64_hlp_dirty_simd_dup_general(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
@@ -2235,6 +2293,24 @@ static void dis_add_sub(uint64_t _regs, uint32_t insn)
         regs->v[rd].v.msb = 0;
 }
 
+/* vector add/sub specialized at translation time. Registers and q are immediates */
+#define SIMD_ADD_SUB_HELPER(name, _op_) \
+void arm64_hlp_simd_##name(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+\
+    vstore(regs, rd, _op_(vload(regs, rn), vload(regs, rm)), q); \
+}
+
+SIMD_ADD_SUB_HELPER(add_8, _mm_add_epi8)
+SIMD_ADD_SUB_HELPER(add_16, _mm_add_epi16)
+SIMD_ADD_SUB_HELPER(add_32, _mm_add_epi32)
+SIMD_ADD_SUB_HELPER(add_64, _mm_add_epi64)
+SIMD_ADD_SUB_HELPER(sub_8, _mm_sub_epi8)
+SIMD_ADD_SUB_HELPER(sub_16, _mm_sub_epi16)
+SIMD_ADD_SUB_HELPER(sub_32, _mm_sub_epi32)
+SIMD_ADD_SUB_HELPER(sub_64, _mm_sub_epi64)
+
 static void dis_sqdmulh_sqrdmulh(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
@@ -3261,7 +3337,6 @@ static void dis_smull_umull(uint64_t _regs, uint32_t insn)
     regs->v[rd] = res;
 }
 
-/* FIXME: add 1Q arrangement for crypto extension */
 static void dis_pmull(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
@@ -3287,6 +3362,38 @@ static void dis_pmull(uint64_t _regs, uint32_t insn)
     regs->v[rd] = res;
 }
 
+/* 1Q arrangement of crypto extension */
+static void dis_pmull_64(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int q = INSN(30,30);
+    int rd = INSN(4,0);
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+    uint64_t op1 = regs->v[rn].d[q];
+    uint64_t op2 = regs->v[rm].d[q];
+    union simd_register res = {0};
+    int j;
+
+    for(j = 0; j < 64; j++) {
+        if ((op1 >> j) & 1) {
+            res.d[0] ^= op2 << j;
+            res.d[1] ^= j?op2 >> (64 - j):0;
+        }
+    }
+
+    regs->v[rd] = res;
+}
+
+static __attribute__((target("pclmul"))) void simd_pmull_64(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i n = vload(regs, INSN(9,5));
+    __m128i m = vload(regs, INSN(20,16));
+
+    vstore(regs, INSN(4,0), INSN(30,30)?_mm_clmulepi64_si128(n, m, 0x11):_mm_clmulepi64_si128(n, m, 0x00), 1);
+}
+
 static void dis_saddlv_uaddlv(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
@@ -4627,92 +4734,6 @@ static int dis_store_single_structure(uint64_t _regs, uint32_t insn, uint64_t ad
     return res;
 }
 
-static void dis_uzp1_uzp2(uint64_t _regs, uint32_t insn)
-{
-    struct arm64_registers *regs = (struct arm64_registers *) _regs;
-    int q = INSN(30,30);
-    int rd = INSN(4,0);
-    int rn = INSN(9,5);
-    int rm = INSN(20,16);
-    int size = INSN(23,22);
-    union simd_register res = {0};
-    int part = INSN(14,14);
-    int i;
-
-    switch(size) {
-        case 0:
-            for(i = 0; i < (q?8:4); i++) {
-                res.b[i] = regs->v[rn].b[2*i+part];
-                res.b[q?i+8:i+4] = regs->v[rm].b[2*i+part];
-            }
-            break;
-        case 1:
-            for(i = 0; i < (q?4:2); i++) {
-                res.h[i] = regs->v[rn].h[2*i+part];
-                res.h[q?i+4:i+2] = regs->v[rm].h[2*i+part];
-            }
-            break;
-        case 2:
-            for(i = 0; i < (q?2:1); i++) {
-                res.s[i] = regs->v[rn].s[2*i+part];
-                res.s[q?i+2:i+1] = regs->v[rm].s[2*i+part];
-            }
-            break;
-        case 3:
-            assert_illegal_opcode(q);
-            for(i = 0; i < 1; i++) {
-                res.d[i] = regs->v[rn].d[2*i+part];
-                res.d[i+1] = regs->v[rm].d[2*i+part];
-            }
-            break;
-    }
-    regs->v[rd] = res;    
-}
-
-static void dis_zip1_zip2(uint64_t _regs, uint32_t insn)
-{
-    struct arm64_registers *regs = (struct arm64_registers *) _regs;
-    int q = INSN(30,30);
-    int rd = INSN(4,0);
-    int rn = INSN(9,5);
-    int rm = INSN(20,16);
-    int size = INSN(23,22);
-    union simd_register res = {0};
-    int part = INSN(14,14);
-    int i;
-
-    switch(size) {
-        case 0:
-            for(i = 0; i < (q?8:4); i++) {
-                res.b[2*i+0] = regs->v[rn].b[(part?(q?8:4):0)+i];
-                res.b[2*i+1] = regs->v[rm].b[(part?(q?8:4):0)+i];
-            }
-            break;
-        case 1:
-            for(i = 0; i < (q?4:2); i++) {
-                res.h[2*i+0] = regs->v[rn].h[(part?(q?4:2):0)+i];
-                res.h[2*i+1] = regs->v[rm].h[(part?(q?4:2):0)+i];
-            }
-            break;
-        case 2:
-            for(i = 0; i < (q?2:1); i++) {
-                res.s[2*i+0] = regs->v[rn].s[(part?(q?2:1):0)+i];
-                res.s[2*i+1] = regs->v[rm].s[(part?(q?2:1):0)+i];
-            }
-            break;
-        case 3:
-            assert_illegal_opcode(q);
-            for(i = 0; i < 1; i++) {
-                res.d[2*i+0] = regs->v[rn].d[(part?1:0)+i];
-                res.d[2*i+1] = regs->v[rm].d[(part?1:0)+i];
-            }
-            break;
-        default:
-            assert_illegal_opcode(0);
-    }
-    regs->v[rd] = res; 
-}
-
 static void dis_trn1_trn2(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
@@ -5142,239 +5163,527 @@ void arm64_hlp_dirty_advanced_simd_scalar_three_same_simd(uint64_t _regs, uint32
     }
 }
 
-void arm64_hlp_dirty_advanced_simd_three_same_simd(uint64_t _regs, uint32_t insn)
+/* host simd kernels. They replace lane loops of some vector forms and are selected
+   when instruction is resolved. SSE2 is always there on 64 bits hosts, SSSE3 and SSE4.1
+   ones are only used when host supports it */
+#define SSSE3 __attribute__((target("ssse3")))
+#define SSE41 __attribute__((target("sse4.1")))
+
+#define SIMD_KERNEL_ATTR(name, _attr_, _expr_) \
+static _attr_ void simd_##name(uint64_t _regs, uint32_t insn) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+    __m128i n = vload(regs, INSN(9,5)); \
+    __m128i m = vload(regs, INSN(20,16)); \
+\
+    vstore(regs, INSN(4,0), _expr_, INSN(30,30)); \
+}
+#define SIMD_KERNEL(name, _expr_) SIMD_KERNEL_ATTR(name, , _expr_)
+#define SIMD_KERNEL_SSE41(name, _expr_) SIMD_KERNEL_ATTR(name, SSE41, _expr_)
+
+/* saturating ops set qc when result differs from the wrapping one on an active lane */
+#define SIMD_SAT_KERNEL(name, _sat_op_, _op_) \
+static void simd_##name(uint64_t _regs, uint32_t insn) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+    int q = INSN(30,30); \
+    __m128i n = vload(regs, INSN(9,5)); \
+    __m128i m = vload(regs, INSN(20,16)); \
+    __m128i res = _sat_op_(n, m); \
+    int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(res, _op_(n, m))) ^ 0xffff; \
+\
+    if (diff & (q?0xffff:0xff)) \
+        set_qc(regs); \
+    vstore(regs, INSN(4,0), res, q); \
+}
+
+SIMD_SAT_KERNEL(sqadd_8, _mm_adds_epi8, _mm_add_epi8)
+SIMD_SAT_KERNEL(uqadd_8, _mm_adds_epu8, _mm_add_epi8)
+SIMD_SAT_KERNEL(sqadd_16, _mm_adds_epi16, _mm_add_epi16)
+SIMD_SAT_KERNEL(uqadd_16, _mm_adds_epu16, _mm_add_epi16)
+SIMD_SAT_KERNEL(sqsub_8, _mm_subs_epi8, _mm_sub_epi8)
+SIMD_SAT_KERNEL(uqsub_8, _mm_subs_epu8, _mm_sub_epi8)
+SIMD_SAT_KERNEL(sqsub_16, _mm_subs_epi16, _mm_sub_epi16)
+SIMD_SAT_KERNEL(uqsub_16, _mm_subs_epu16, _mm_sub_epi16)
+
+/* unsigned compares flip sign bit to use signed ones */
+#define SIMD_CMP_KERNELS(size, _bias_) \
+SIMD_KERNEL(cmeq_##size, _mm_cmpeq_epi##size(n, m)) \
+SIMD_KERNEL(cmtst_##size, vnot(_mm_cmpeq_epi##size(_mm_and_si128(n, m), _mm_setzero_si128()))) \
+SIMD_KERNEL(cmgt_##size, _mm_cmpgt_epi##size(n, m)) \
+SIMD_KERNEL(cmge_##size, vnot(_mm_cmpgt_epi##size(m, n))) \
+SIMD_KERNEL(cmhi_##size, _mm_cmpgt_epi##size(_mm_xor_si128(n, _bias_), _mm_xor_si128(m, _bias_))) \
+SIMD_KERNEL(cmhs_##size, vnot(_mm_cmpgt_epi##size(_mm_xor_si128(m, _bias_), _mm_xor_si128(n, _bias_))))
+
+SIMD_CMP_KERNELS(8, _mm_set1_epi8(0x80))
+SIMD_CMP_KERNELS(16, _mm_set1_epi16(0x8000))
+SIMD_CMP_KERNELS(32, _mm_set1_epi32(0x80000000))
+
+SIMD_KERNEL(umax_8, _mm_max_epu8(n, m))
+SIMD_KERNEL(umin_8, _mm_min_epu8(n, m))
+SIMD_KERNEL(smax_16, _mm_max_epi16(n, m))
+SIMD_KERNEL(smin_16, _mm_min_epi16(n, m))
+SIMD_KERNEL_SSE41(smax_8, _mm_max_epi8(n, m))
+SIMD_KERNEL_SSE41(smin_8, _mm_min_epi8(n, m))
+SIMD_KERNEL_SSE41(umax_16, _mm_max_epu16(n, m))
+SIMD_KERNEL_SSE41(umin_16, _mm_min_epu16(n, m))
+SIMD_KERNEL_SSE41(smax_32, _mm_max_epi32(n, m))
+SIMD_KERNEL_SSE41(smin_32, _mm_min_epi32(n, m))
+SIMD_KERNEL_SSE41(umax_32, _mm_max_epu32(n, m))
+SIMD_KERNEL_SSE41(umin_32, _mm_min_epu32(n, m))
+
+/* for 64 bits forms low halves are merged first so the 128 bits shuffle gives the result
+   in the low half */
+#define SIMD_UZP_KERNEL(name, _expr_) \
+static void simd_##name(uint64_t _regs, uint32_t insn) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+    int q = INSN(30,30); \
+    __m128i n = vload(regs, INSN(9,5)); \
+    __m128i m = vload(regs, INSN(20,16)); \
+\
+    if (!q) { \
+        n = _mm_unpacklo_epi64(n, m); \
+        m = n; \
+    } \
+    vstore(regs, INSN(4,0), _expr_, q); \
+}
+
+SIMD_UZP_KERNEL(uzp1_8, _mm_packus_epi16(_mm_and_si128(n, _mm_set1_epi16(0xff)), _mm_and_si128(m, _mm_set1_epi16(0xff))))
+SIMD_UZP_KERNEL(uzp2_8, _mm_packus_epi16(_mm_srli_epi16(n, 8), _mm_srli_epi16(m, 8)))
+SIMD_UZP_KERNEL(uzp1_16, _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(n, 16), 16), _mm_srai_epi32(_mm_slli_epi32(m, 16), 16)))
+SIMD_UZP_KERNEL(uzp2_16, _mm_packs_epi32(_mm_srai_epi32(n, 16), _mm_srai_epi32(m, 16)))
+SIMD_UZP_KERNEL(uzp1_32, _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(n), _mm_castsi128_ps(m), _MM_SHUFFLE(2,0,2,0))))
+SIMD_UZP_KERNEL(uzp2_32, _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(n), _mm_castsi128_ps(m), _MM_SHUFFLE(3,1,3,1))))
+SIMD_KERNEL(zip1_64, _mm_unpacklo_epi64(n, m))
+SIMD_KERNEL(zip2_64, _mm_unpackhi_epi64(n, m))
+
+/* for 64 bits forms zip2 result is the upper half of interleaved low halves */
+#define SIMD_ZIP_KERNELS(size) \
+SIMD_KERNEL(zip1_##size, _mm_unpacklo_epi##size(n, m)) \
+SIMD_KERNEL(zip2_##size, INSN(30,30)?_mm_unpackhi_epi##size(n, m):_mm_srli_si128(_mm_unpacklo_epi##size(n, m), 8))
+
+SIMD_ZIP_KERNELS(8)
+SIMD_ZIP_KERNELS(16)
+SIMD_ZIP_KERNELS(32)
+
+/* packed fp kernels. Like scalar fast math they are only used when fpcr is the default one,
+   vectors with a NaN or an infinity in an active lane are done by lane helpers. Denormals
+   stay on the packed path since flush to zero is off */
+static inline __m128 vps(__m128i value)
+{
+    return _mm_castsi128_ps(value);
+}
+static inline __m128d vpd(__m128i value)
+{
+    return _mm_castsi128_pd(value);
+}
+static inline int has_special_32(__m128i n, __m128i m, int q)
+{
+    __m128i exp = _mm_set1_epi32(0x7f800000);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(n, exp), exp),
+                                   _mm_cmpeq_epi32(_mm_and_si128(m, exp), exp));
+
+    return _mm_movemask_epi8(special) & (q?0xffff:0xff);
+}
+/* low words always compare equal, only upper ones are checked */
+static inline int has_special_64(__m128i n, __m128i m, int q)
+{
+    __m128i exp = _mm_set1_epi64x(0x7ff0000000000000UL);
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(n, exp), exp),
+                                   _mm_cmpeq_epi32(_mm_and_si128(m, exp), exp));
+
+    return _mm_movemask_epi8(special) & 0xf0f0;
+}
+
+/* x86 default nan is negative, so divisions by zero are left to lane helpers */
+static inline int has_zero_32(__m128i m)
+{
+    return _mm_movemask_ps(_mm_cmpeq_ps(vps(m), _mm_setzero_ps()));
+}
+static inline int has_zero_64(__m128i m)
 {
+    return _mm_movemask_pd(_mm_cmpeq_pd(vpd(m), _mm_setzero_pd()));
+}
+
+#define SIMD_FP_KERNEL_GUARD(name, _size_, _fallback_, _guard_, _expr_) \
+static void simd_##name##_##_size_(uint64_t _regs, uint32_t insn) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+    int q = INSN(30,30); \
+    __m128i n = vload(regs, INSN(9,5)); \
+    __m128i m = vload(regs, INSN(20,16)); \
+\
+    /* upper lanes must not raise host exceptions */ \
+    if (!q) { \
+        n = _mm_unpacklo_epi64(n, n); \
+        m = _mm_unpacklo_epi64(m, m); \
+    } \
+    if (FAST_MATH_ALLOW && regs->fast_math_is_allow && !has_special_##_size_(n, m, q) && (_guard_)) \
+        vstore(regs, INSN(4,0), _expr_, q); \
+    else \
+        _fallback_(_regs, insn); \
+}
+#define SIMD_FP_KERNEL(name, _size_, _fallback_, _expr_) \
+    SIMD_FP_KERNEL_GUARD(name, _size_, _fallback_, 1, _expr_)
+
+/* x86 max/min return second operand when both are zero, arm wants +0 for max and -0 for min */
+#define SIMD_FP_KERNELS(_size_, _sfx_, _cast_, _abs_) \
+SIMD_FP_KERNEL(fadd, _size_, dis_fadd_fsub, _mm_cast##_sfx_##_si128(_mm_add_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL(fsub, _size_, dis_fadd_fsub, _mm_cast##_sfx_##_si128(_mm_sub_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL(fmul, _size_, dis_fmul, _mm_cast##_sfx_##_si128(_mm_mul_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL_GUARD(fdiv, _size_, dis_fdiv, !has_zero_##_size_(m), _mm_cast##_sfx_##_si128(_mm_div_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL(fabd, _size_, dis_fabd, _mm_and_si128(_mm_cast##_sfx_##_si128(_mm_sub_##_sfx_(_cast_(n), _cast_(m))), _abs_)) \
+SIMD_FP_KERNEL(fcmeq, _size_, dis_fcmeq, _mm_cast##_sfx_##_si128(_mm_cmpeq_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL(fcmge, _size_, dis_fcmge, _mm_cast##_sfx_##_si128(_mm_cmpge_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL(fcmgt, _size_, dis_fcmgt, _mm_cast##_sfx_##_si128(_mm_cmpgt_##_sfx_(_cast_(n), _cast_(m)))) \
+SIMD_FP_KERNEL(facge, _size_, dis_facge, _mm_cast##_sfx_##_si128(_mm_cmpge_##_sfx_(_cast_(_mm_and_si128(n, _abs_)), _cast_(_mm_and_si128(m, _abs_))))) \
+SIMD_FP_KERNEL(facgt, _size_, dis_facgt, _mm_cast##_sfx_##_si128(_mm_cmpgt_##_sfx_(_cast_(_mm_and_si128(n, _abs_)), _cast_(_mm_and_si128(m, _abs_))))) \
+SIMD_FP_KERNEL(fmax, _size_, dis_fmax_fmin, fp_zero_fix(_mm_cast##_sfx_##_si128(_mm_max_##_sfx_(_cast_(n), _cast_(m))), \
+                                                        _mm_cast##_sfx_##_si128(_mm_cmpeq_##_sfx_(_cast_(n), _cast_(m))), _mm_and_si128(n, m))) \
+SIMD_FP_KERNEL(fmin, _size_, dis_fmax_fmin, fp_zero_fix(_mm_cast##_sfx_##_si128(_mm_min_##_sfx_(_cast_(n), _cast_(m))), \
+                                                        _mm_cast##_sfx_##_si128(_mm_cmpeq_##_sfx_(_cast_(n), _cast_(m))), _mm_or_si128(n, m)))
+
+/* when operands are equal select bitwise merged value so +0/-0 pairs get arm result */
+static inline __m128i fp_zero_fix(__m128i res, __m128i eq, __m128i merged)
+{
+    return _mm_or_si128(_mm_andnot_si128(eq, res), _mm_and_si128(eq, merged));
+}
+
+SIMD_FP_KERNELS(32, ps, vps, _mm_set1_epi32(0x7fffffff))
+SIMD_FP_KERNELS(64, pd, vpd, _mm_set1_epi64x(0x7fffffffffffffffUL))
+
+static inline __m128i fp_faddp_32(__m128i n, __m128i m)
+{
+    __m128 even = _mm_shuffle_ps(vps(n), vps(m), _MM_SHUFFLE(2,0,2,0));
+    __m128 odd = _mm_shuffle_ps(vps(n), vps(m), _MM_SHUFFLE(3,1,3,1));
+
+    return _mm_castps_si128(_mm_add_ps(even, odd));
+}
+
+/* pairwise add of n then m lanes. 64 bits form merges low halves first */
+SIMD_FP_KERNEL(faddp, 32, dis_faddp, fp_faddp_32(q?n:_mm_unpacklo_epi64(n, m), q?m:_mm_unpacklo_epi64(n, m)))
+SIMD_FP_KERNEL(faddp, 64, dis_faddp, _mm_castpd_si128(_mm_add_pd(_mm_unpacklo_pd(vpd(n), vpd(m)), _mm_unpackhi_pd(vpd(n), vpd(m)))))
+
+/* fmla and fmls with fma3. Accumulator lanes are also checked for NaN and infinity */
+#define SIMD_FMA_KERNEL(name, _size_, _sfx_, _cast_, _op_) \
+static FMA void simd_##name##_##_size_(uint64_t _regs, uint32_t insn) \
+{ \
+    struct arm64_registers *regs = (struct arm64_registers *) _regs; \
+    int q = INSN(30,30); \
+    __m128i n = vload(regs, INSN(9,5)); \
+    __m128i m = vload(regs, INSN(20,16)); \
+    __m128i d = vload(regs, INSN(4,0)); \
+\
+    if (!q) { \
+        n = _mm_unpacklo_epi64(n, n); \
+        m = _mm_unpacklo_epi64(m, m); \
+        d = _mm_unpacklo_epi64(d, d); \
+    } \
+    if (FAST_MATH_ALLOW && regs->fast_math_is_allow && !has_special_##_size_(n, m, q) && !has_special_##_size_(d, d, q)) \
+        vstore(regs, INSN(4,0), _mm_cast##_sfx_##_si128(_op_(_cast_(n), _cast_(m), _cast_(d))), q); \
+    else \
+        dis_fmla_fmls(_regs, insn); \
+}
+
+SIMD_FMA_KERNEL(fmla, 32, ps, vps, _mm_fmadd_ps)
+SIMD_FMA_KERNEL(fmls, 32, ps, vps, _mm_fnmadd_ps)
+SIMD_FMA_KERNEL(fmla, 64, pd, vpd, _mm_fmadd_pd)
+SIMD_FMA_KERNEL(fmls, 64, pd, vpd, _mm_fnmadd_pd)
+
+static arm64_simd_helper resolve_three_same_kernel(uint32_t insn)
+{
+    static const arm64_simd_helper sat[2][2][2] = {
+        {{simd_sqadd_8, simd_sqadd_16}, {simd_uqadd_8, simd_uqadd_16}},
+        {{simd_sqsub_8, simd_sqsub_16}, {simd_uqsub_8, simd_uqsub_16}}};
+    static const arm64_simd_helper cmp[6][3] = {
+        {simd_cmgt_8, simd_cmgt_16, simd_cmgt_32}, {simd_cmhi_8, simd_cmhi_16, simd_cmhi_32},
+        {simd_cmge_8, simd_cmge_16, simd_cmge_32}, {simd_cmhs_8, simd_cmhs_16, simd_cmhs_32},
+        {simd_cmtst_8, simd_cmtst_16, simd_cmtst_32}, {simd_cmeq_8, simd_cmeq_16, simd_cmeq_32}};
+    static const arm64_simd_helper minmax[2][2][3] = {
+        {{simd_smax_8, simd_smax_16, simd_smax_32}, {simd_umax_8, simd_umax_16, simd_umax_32}},
+        {{simd_smin_8, simd_smin_16, simd_smin_32}, {simd_umin_8, simd_umin_16, simd_umin_32}}};
+    static const arm64_simd_helper fp[][2] = {
+        {simd_fadd_32, simd_fadd_64}, {simd_fsub_32, simd_fsub_64},
+        {simd_faddp_32, simd_faddp_64}, {simd_fabd_32, simd_fabd_64},
+        {simd_fmul_32, simd_fmul_64}, {simd_fcmeq_32, simd_fcmeq_64},
+        {simd_fcmge_32, simd_fcmge_64}, {simd_fcmgt_32, simd_fcmgt_64},
+        {simd_facge_32, simd_facge_64}, {simd_facgt_32, simd_facgt_64},
+        {simd_fmax_32, simd_fmax_64}, {simd_fmin_32, simd_fmin_64},
+        {simd_fdiv_32, simd_fdiv_64}};
+    static const arm64_simd_helper fma[2][2] = {
+        {simd_fmla_32, simd_fmla_64}, {simd_fmls_32, simd_fmls_64}};
     int U = INSN(29,29);
+    int q = INSN(30,30);
     int opcode = INSN(15,11);
     int size = INSN(23,22);
+    int is_double = size & 1;
+    int fp_op = -1;
 
     switch(opcode) {
-        case 0:
-            dis_shadd_srhadd_uhadd_urhadd(_regs, insn);
+        case 1: case 5:
+            return size < 2?sat[opcode == 5][U][size]:NULL;
+        case 6: case 7:
+            return size < 3?cmp[2 * (opcode - 6) + U][size]:NULL;
+        case 17:
+            return size < 3?cmp[4 + U][size]:NULL;
+        case 12: case 13:
+            if (size == 3)
+                return NULL;
+            /* pmaxub and pmaxsw families are sse2, others need sse4.1 */
+            if (!hasHostFeature(HOST_FEATURE_SSE4_1) && !(U && size == 0) && !(!U && size == 1))
+                return NULL;
+            return minmax[opcode - 12][U][size];
+        case 25:
+            if (U || (is_double && !q) || !hasHostFeature(HOST_FEATURE_FMA))
+                return NULL;
+            return fma[(size & 2) != 0][is_double];
+        case 26:
+            fp_op = U?((size & 2)?3:2):((size & 2)?1:0);
             break;
-        case 1:
-            dis_sqadd_uqadd(_regs, insn);
+        case 27:
+            fp_op = (U && !(size & 2))?4:-1;
             break;
-        case 2:
-            dis_shadd_srhadd_uhadd_urhadd(_regs, insn);
+        case 28:
+            fp_op = (size & 2)?(U?7:-1):(U?6:5);
+            break;
+        case 29:
+            fp_op = U?((size & 2)?9:8):-1;
+            break;
+        case 30:
+            fp_op = U?-1:((size & 2)?11:10);
+            break;
+        case 31:
+            fp_op = (U && !(size & 2))?12:-1;
             break;
+    }
+    /* double forms need q, reserved encoding is left to lane helper */
+    if (fp_op >= 0 && (q || !is_double))
+        return fp[fp_op][is_double];
+
+    return NULL;
+}
+
+/* return leaf helper of a three same instruction or NULL if encoding is illegal */
+arm64_simd_helper arm64_hlp_resolve_advanced_simd_three_same_simd(uint32_t insn)
+{
+    arm64_simd_helper kernel = resolve_three_same_kernel(insn);
+    int U = INSN(29,29);
+    int opcode = INSN(15,11);
+    int size = INSN(23,22);
+
+    if (kernel)
+        return kernel;
+
+    switch(opcode) {
+        case 0:
+            return dis_shadd_srhadd_uhadd_urhadd;
+        case 1:
+            return dis_sqadd_uqadd;
+        case 2:
+            return dis_shadd_srhadd_uhadd_urhadd;
         case 3:
             if (U) {
-                dis_bitop(_regs, insn);
+                return dis_bitop;
             } else {
                 if (size == 2)
-                    dis_orr_register(_regs, insn);
+                    return dis_orr_register;
                 else if (size == 0)
-                    dis_and(_regs, insn);
+                    return dis_and;
                 else if (size == 1)
-                    dis_bic_register(_regs, insn);
+                    return dis_bic_register;
                 else
-                    dis_orn(_regs, insn);
+                    return dis_orn;
             }
-            break;
         case 4:
-            dis_shsub_uhsub(_regs, insn);
-            break;
+            return dis_shsub_uhsub;
         case 5:
-            dis_sqsub_uqsub(_regs, insn);
-            break;
+            return dis_sqsub_uqsub;
         case 6:
             if (U)
-                dis_cmhi(_regs, insn);
+                return dis_cmhi;
             else
-                dis_cmgt(_regs, insn);
-            break;
+                return dis_cmgt;
         case 7:
             if (U)
-                dis_cmhs(_regs, insn);
+                return dis_cmhs;
             else
-                dis_cmge(_regs, insn);
-            break;
+                return dis_cmge;
         case 8:
-            dis_sshl_family(_regs, insn);
-            break;
+            return dis_sshl_family;
         case 9:
-            dis_sshl_family(_regs, insn);
-            break;
+            return dis_sshl_family;
         case 10:
-            dis_sshl_family(_regs, insn);
-            break;
+            return dis_sshl_family;
         case 11:
-            dis_sshl_family(_regs, insn);
-            break;
+            return dis_sshl_family;
         case 12:
-            dis_smax_smin_umax_umin(_regs, insn);
-            break;
+            return dis_smax_smin_umax_umin;
         case 13:
-            dis_smax_smin_umax_umin(_regs, insn);
-            break;
+            return dis_smax_smin_umax_umin;
         case 14:
-            dis_sabd_saba_uabd_uaba(_regs, insn);
-            break;
+            return dis_sabd_saba_uabd_uaba;
         case 15:
-            dis_sabd_saba_uabd_uaba(_regs, insn);
-            break;
+            return dis_sabd_saba_uabd_uaba;
         case 16:
-            dis_add_sub(_regs, insn);
-            break;
+            /* .1D arrangement is reserved */
+            if (size == 3 && !INSN(30,30))
+                return NULL;
+            return dis_add_sub;
         case 17:
             if (U)
-                dis_cmeq(_regs, insn);
+                return dis_cmeq;
             else
-                dis_cmtst(_regs, insn);
-            break;
+                return dis_cmtst;
         case 18:
-            dis_mal_mls(_regs, insn);
-            break;
+            return dis_mal_mls;
         case 19:
             if (U)
-                dis_pmul(_regs, insn);
+                return dis_pmul;
             else
-                dis_mul(_regs, insn);
-            break;
+                return dis_mul;
         case 20:
-            dis_smaxp_sminp_umaxp_uminp(_regs, insn);
-            break;
+            return dis_smaxp_sminp_umaxp_uminp;
         case 21:
-            dis_smaxp_sminp_umaxp_uminp(_regs, insn);
-            break;
+            return dis_smaxp_sminp_umaxp_uminp;
         case 22:
-            dis_sqdmulh_sqrdmulh(_regs, insn);
-            break;
+            return dis_sqdmulh_sqrdmulh;
         case 23:
             if (U)
-                assert_illegal_opcode(0);
+                return NULL;
             else
-                dis_addp(_regs, insn);
-            break;
+                return dis_addp;
         case 24:
-            U?dis_fmaxnmp_fminnmp(_regs, insn):dis_fmaxnm_fminnm(_regs, insn);
-            break;
+            return U?dis_fmaxnmp_fminnmp:dis_fmaxnm_fminnm;
         case 25:
             if (size&2)
                 if (U)
-                    assert_illegal_opcode(0);
+                    return NULL;
                 else
-                    dis_fmla_fmls(_regs, insn);
+                    return dis_fmla_fmls;
             else
                 if (U)
-                    assert_illegal_opcode(0);
+                    return NULL;
                 else
-                    dis_fmla_fmls(_regs, insn);
-            break;
+                    return dis_fmla_fmls;
         case 26:
             if (size&2)
-                U?dis_fabd(_regs, insn):dis_fadd_fsub(_regs, insn);
+                return U?dis_fabd:dis_fadd_fsub;
             else
-                U?dis_faddp(_regs, insn):dis_fadd_fsub(_regs, insn);
-            break;
+                return U?dis_faddp:dis_fadd_fsub;
         case 27:
             if (size&2)
-                assert_illegal_opcode(0);
+                return NULL;
             else
-                U?dis_fmul(_regs, insn):dis_fmulx(_regs, insn);
-            break;
+                return U?dis_fmul:dis_fmulx;
         case 28:
             if (size&2)
                 if (U)
-                    dis_fcmgt(_regs, insn);
+                    return dis_fcmgt;
                 else
-                    assert_illegal_opcode(0);
+                    return NULL;
             else
-                U?dis_fcmge(_regs, insn):dis_fcmeq(_regs, insn);
-            break;
+                return U?dis_fcmge:dis_fcmeq;
         case 29:
             if (size&2)
                 if (U) 
-                    dis_facgt(_regs, insn);
+                    return dis_facgt;
                 else
-                    assert_illegal_opcode(0);
+                    return NULL;
             else
                 if (U)
-                    dis_facge(_regs, insn);
+                    return dis_facge;
                 else
-                    assert_illegal_opcode(0);
-            break;
+                    return NULL;
         case 30:
-            U?dis_fmaxp_fminp(_regs, insn):dis_fmax_fmin(_regs, insn);
-            break;
+            return U?dis_fmaxp_fminp:dis_fmax_fmin;
         case 31:
             if (size&2)
                 if (U)
-                    assert_illegal_opcode(0);
+                    return NULL;
                 else
-                    dis_frsqrts(_regs, insn);
+                    return dis_frsqrts;
             else
-                U?dis_fdiv(_regs, insn):dis_frecps(_regs, insn);
-            break;
+                return U?dis_fdiv:dis_frecps;
         default:
-            fatal_illegal_opcode("opcode = %d(0x%x) / U=%d\n", opcode, opcode, U);
+            return NULL;
     }
 }
 
-void arm64_hlp_dirty_advanced_simd_simd_three_different_simd(uint64_t _regs, uint32_t insn)
+void arm64_hlp_dirty_advanced_simd_three_same_simd(uint64_t _regs, uint32_t insn)
+{
+    arm64_simd_helper helper = arm64_hlp_resolve_advanced_simd_three_same_simd(insn);
+
+    if (helper)
+        helper(_regs, insn);
+    else
+        fatal_illegal_opcode("opcode = %d(0x%x) / U=%d\n", INSN(15,11), INSN(15,11), INSN(29,29));
+}
+
+/* return leaf helper of a three different instruction or NULL if encoding is illegal */
+arm64_simd_helper arm64_hlp_resolve_advanced_simd_three_different_simd(uint32_t insn)
 {
     int U = INSN(29,29);
     int opcode = INSN(15,12);
+    int size = INSN(23,22);
 
     switch(opcode) {
         case 0:
-            dis_saddl_ssubl_uaddl_usubl(_regs, insn);
-            break;
+            return dis_saddl_ssubl_uaddl_usubl;
         case 1:
-            dis_saddw_ssubw_uaddw_usubw(_regs, insn);
-            break;
+            return dis_saddw_ssubw_uaddw_usubw;
         case 2:
-            dis_saddl_ssubl_uaddl_usubl(_regs, insn);
-            break;
+            return dis_saddl_ssubl_uaddl_usubl;
         case 3:
-            dis_saddw_ssubw_uaddw_usubw(_regs, insn);
-            break;
+            return dis_saddw_ssubw_uaddw_usubw;
         case 4: case 6:
-            dis_addhn_raddhn_subhn_rsubhn(_regs, insn);
-            break;
+            return dis_addhn_raddhn_subhn_rsubhn;
         case 5:
-            dis_sabdl_sabal_uabdl_uabal(_regs, insn);
-            break;
+            return dis_sabdl_sabal_uabdl_uabal;
         case 7:
-            dis_sabdl_sabal_uabdl_uabal(_regs, insn);
-            break;
+            return dis_sabdl_sabal_uabdl_uabal;
         case 8:
-            dis_smlal_smlsl_umlal_umlsl(_regs, insn);
-            break;
+            return dis_smlal_smlsl_umlal_umlsl;
         case 9:
             if (U)
-                assert_illegal_opcode(0);
+                return NULL;
             else
-                dis_sqdmlal_sqdmlsl(_regs, insn);
-            break;
+                return dis_sqdmlal_sqdmlsl;
         case 10:
-            dis_smlal_smlsl_umlal_umlsl(_regs, insn);
-            break;
+            return dis_smlal_smlsl_umlal_umlsl;
         case 11:
             if (U)
-                assert_illegal_opcode(0);
+                return NULL;
             else
-                dis_sqdmlal_sqdmlsl(_regs, insn);
-            break;
+                return dis_sqdmlal_sqdmlsl;
         case 12:
-            dis_smull_umull(_regs, insn);
-            break;
+            return dis_smull_umull;
         case 13:
             if (U)
-                assert_illegal_opcode(0);
+                return NULL;
             else
-                dis_sqdmull(_regs, insn);
-            break;
+                return dis_sqdmull;
         case 14:
-            assert_illegal_opcode(U==0);
-            dis_pmull(_regs, insn);
-            break;
+            if (U || size == 1 || size == 2)
+                return NULL;
+            if (size == 3)
+                return hasHostFeature(HOST_FEATURE_PCLMUL)?simd_pmull_64:dis_pmull_64;
+            return dis_pmull;
         default:
-            fatal_illegal_opcode("opcode = %d(0x%x) / U=%d\n", opcode, opcode, U);
+            return NULL;
     }
 }
 
+void arm64_hlp_dirty_advanced_simd_simd_three_different_simd(uint64_t _regs, uint32_t insn)
+{
+    arm64_simd_helper helper = arm64_hlp_resolve_advanced_simd_three_different_simd(insn);
+
+    if (helper)
+        helper(_regs, insn);
+    else
+        fatal_illegal_opcode("opcode = %d(0x%x) / U=%d\n", INSN(15,12), INSN(15,12), INSN(29,29));
+}
+
 void arm64_hlp_dirty_advanced_simd_scalar_pair_wise_simd(uint64_t _regs, uint32_t insn)
 {
     int U = INSN(29,29);
@@ -5645,6 +5954,161 @@ void arm64_hlp_dirty_advanced_simd_scalar_three_different_simd(uint64_t _regs, u
     }
 }
 
+/* ld2/ld3/ld4 and st2/st3/st4 (de)interleave whole registers with pshufb. Each destination
+   vector is the union of one shuffle per source vector. Masks are indexed by
+   [nb - 2][size][q][register][16 bytes memory chunk] and are built on first use. Several guest
+   threads may translate concurrently, so build is serialized and ready flag is published with
+   release semantic once tables are complete */
+static uint8_t structure_ld_masks[3][4][2][4][4][16];
+static uint8_t structure_st_masks[3][4][2][4][4][16];
+static int structure_masks_are_ready;
+static pthread_mutex_t structure_masks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void init_structure_masks(void)
+{
+    int nb, size, q, r, c, j;
+
+    pthread_mutex_lock(&structure_masks_mutex);
+    if (__atomic_load_n(&structure_masks_are_ready, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&structure_masks_mutex);
+        return ;
+    }
+    for(nb = 2; nb <= 4; nb++) {
+        for(size = 0; size < 4; size++) {
+            for(q = 0; q < 2; q++) {
+                int e = 1 << size;
+                int reg_bytes = q?16:8;
+
+                for(r = 0; r < nb; r++) {
+                    for(c = 0; c < 4; c++) {
+                        for(j = 0; j < 16; j++) {
+                            /* memory offset of byte j of register r */
+                            int offset = ((j / e) * nb + r) * e + j % e;
+                            /* element index of memory byte j of chunk c */
+                            int elem = (c * 16 + j) / e;
+
+                            structure_ld_masks[nb - 2][size][q][r][c][j] =
+                                (j < reg_bytes && offset / 16 == c)?offset % 16:0x80;
+                            structure_st_masks[nb - 2][size][q][r][c][j] =
+                                (c * 16 + j < nb * reg_bytes && elem % nb == r)?(elem / nb) * e + j % e:0x80;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    __atomic_store_n(&structure_masks_are_ready, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&structure_masks_mutex);
+}
+
+static inline void structure_writeback(struct arm64_registers *regs, uint32_t insn, int bytes)
+{
+    int rn = INSN(9,5);
+    int rm = INSN(20,16);
+
+    if (INSN(23,23))
+        regs->r[rn] += (rm == 31)?bytes:regs->r[rm];
+}
+
+static inline SSSE3 void structure_ld(struct arm64_registers *regs, uint32_t insn, int nb, int size, int q)
+{
+    uint8_t (*masks)[4][16] = structure_ld_masks[nb - 2][size][q];
+    uint64_t address = regs->r[INSN(9,5)];
+    int rt = INSN(4,0);
+    int bytes = nb * (q?16:8);
+    __m128i chunk[4];
+    int r, c;
+
+    for(c = 0; c < bytes / 16; c++)
+        chunk[c] = _mm_loadu_si128((__m128i *) (address + c * 16));
+    if (bytes % 16)
+        chunk[c] = _mm_loadl_epi64((__m128i *) (address + c * 16));
+    for(r = 0; r < nb; r++) {
+        __m128i res = _mm_setzero_si128();
+
+        for(c = 0; c < (bytes + 15) / 16; c++)
+            res = _mm_or_si128(res, _mm_shuffle_epi8(chunk[c], _mm_loadu_si128((__m128i *) masks[r][c])));
+        vstore(regs, (rt + r) % 32, res, q);
+    }
+    structure_writeback(regs, insn, bytes);
+}
+
+static inline SSSE3 void structure_st(struct arm64_registers *regs, uint32_t insn, int nb, int size, int q)
+{
+    uint8_t (*masks)[4][16] = structure_st_masks[nb - 2][size][q];
+    uint64_t address = regs->r[INSN(9,5)];
+    int rt = INSN(4,0);
+    int bytes = nb * (q?16:8);
+    __m128i reg[4];
+    int r, c;
+
+    for(r = 0; r < nb; r++)
+        reg[r] = vload(regs, (rt + r) % 32);
+    for(c = 0; c < (bytes + 15) / 16; c++) {
+        __m128i res = _mm_setzero_si128();
+
+        for(r = 0; r < nb; r++)
+            res = _mm_or_si128(res, _mm_shuffle_epi8(reg[r], _mm_loadu_si128((__m128i *) masks[r][c])));
+        if (c * 16 + 16 <= bytes)
+            _mm_storeu_si128((__m128i *) (address + c * 16), res);
+        else
+            _mm_storel_epi64((__m128i *) (address + c * 16), res);
+    }
+    structure_writeback(regs, insn, bytes);
+}
+
+#define STRUCTURE_KERNEL(name, nb, size, q) \
+static SSSE3 void simd_##name##nb##_##size##_##q(uint64_t _regs, uint32_t insn) \
+{ \
+    structure_##name((struct arm64_registers *) _regs, insn, nb, size, q); \
+}
+#define STRUCTURE_KERNELS(nb, size) \
+STRUCTURE_KERNEL(ld, nb, size, 0) \
+STRUCTURE_KERNEL(ld, nb, size, 1) \
+STRUCTURE_KERNEL(st, nb, size, 0) \
+STRUCTURE_KERNEL(st, nb, size, 1)
+#define STRUCTURE_KERNELS_ALL_SIZES(nb) \
+STRUCTURE_KERNELS(nb, 0) \
+STRUCTURE_KERNELS(nb, 1) \
+STRUCTURE_KERNELS(nb, 2) \
+STRUCTURE_KERNELS(nb, 3)
+
+STRUCTURE_KERNELS_ALL_SIZES(2)
+STRUCTURE_KERNELS_ALL_SIZES(3)
+STRUCTURE_KERNELS_ALL_SIZES(4)
+
+#define STRUCTURE_ENTRY(name, nb, size) {simd_##name##nb##_##size##_0, simd_##name##nb##_##size##_1}
+#define STRUCTURE_ENTRIES(name, nb) {STRUCTURE_ENTRY(name, nb, 0), STRUCTURE_ENTRY(name, nb, 1), \
+                                     STRUCTURE_ENTRY(name, nb, 2), STRUCTURE_ENTRY(name, nb, 3)}
+
+/* return leaf helper of a multiple structure instruction. Besides ld1/st1, reserved
+   encodings and hosts without ssse3 use generic helpers */
+arm64_simd_helper arm64_hlp_resolve_advanced_simd_load_store_multiple_structure_simd(uint32_t insn)
+{
+    static const arm64_simd_helper kernels[2][3][4][2] = {
+        {STRUCTURE_ENTRIES(st, 2), STRUCTURE_ENTRIES(st, 3), STRUCTURE_ENTRIES(st, 4)},
+        {STRUCTURE_ENTRIES(ld, 2), STRUCTURE_ENTRIES(ld, 3), STRUCTURE_ENTRIES(ld, 4)}};
+    int is_post_index = INSN(23,23);
+    int l = INSN(22,22);
+    int opcode = INSN(15,12);
+    int size = INSN(11,10);
+    int q = INSN(30,30);
+    int nb = 0;
+
+    switch(opcode) {
+        case 8: nb = 2; break;
+        case 4: nb = 3; break;
+        case 0: nb = 4; break;
+    }
+    if (!nb || (size == 3 && !q) || !hasHostFeature(HOST_FEATURE_SSSE3))
+        return is_post_index?arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_post_index_simd:
+                             arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_simd;
+    if (!__atomic_load_n(&structure_masks_are_ready, __ATOMIC_ACQUIRE))
+        init_structure_masks();
+
+    return kernels[l][nb - 2][size][q];
+}
+
 void arm64_hlp_dirty_advanced_simd_load_store_multiple_structure_simd(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
@@ -5725,7 +6189,7 @@ void arm64_hlp_dirty_advanced_simd_load_store_single_structure_post_index_simd(u
         regs->r[rn] += regs->r[rm];
 }
 
-void arm64_hlp_dirty_advanced_simd_table_lookup_simd(uint64_t _regs, uint32_t insn)
+static void dis_tbl_tbx(uint64_t _regs, uint32_t insn)
 {
     struct arm64_registers *regs = (struct arm64_registers *) _regs;
     int q = INSN(30,30);
@@ -5756,21 +6220,154 @@ void arm64_hlp_dirty_advanced_simd_table_lookup_simd(uint64_t _regs, uint32_t in
     regs->v[rd] = res;
 }
 
-void arm64_hlp_dirty_advanced_simd_permute_simd(uint64_t _regs, uint32_t insn)
+/* each table register is looked up with pshufb on indexes rebased to it. Saturated add of
+   0x70 sets bit 7 of every index outside [0, 15] so pshufb clears those lanes */
+static inline SSSE3 __m128i tbl_lookup(struct arm64_registers *regs, uint32_t insn, __m128i index)
+{
+    int len = INSN(14,13);
+    int rn = INSN(9,5);
+    __m128i res = _mm_setzero_si128();
+    int r;
+
+    for(r = 0; r <= len; r++) {
+        __m128i rebased = _mm_sub_epi8(index, _mm_set1_epi8(16 * r));
+        __m128i sel = _mm_adds_epu8(rebased, _mm_set1_epi8(0x70));
+
+        res = _mm_or_si128(res, _mm_shuffle_epi8(vload(regs, (rn + r) % 32), sel));
+    }
+
+    return res;
+}
+
+static SSSE3 void simd_tbl(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+
+    vstore(regs, INSN(4,0), tbl_lookup(regs, insn, vload(regs, INSN(20,16))), INSN(30,30));
+}
+
+/* tbx keeps destination lanes whose index is beyond table size */
+static SSSE3 void simd_tbx(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i index = vload(regs, INSN(20,16));
+    __m128i limit = _mm_set1_epi8(16 * (INSN(14,13) + 1));
+    __m128i outside = _mm_cmpeq_epi8(_mm_max_epu8(index, limit), index);
+    __m128i res = _mm_or_si128(tbl_lookup(regs, insn, index), _mm_and_si128(outside, vload(regs, INSN(4,0))));
+
+    vstore(regs, INSN(4,0), res, INSN(30,30));
+}
+
+/* return leaf helper of a table lookup instruction */
+arm64_simd_helper arm64_hlp_resolve_advanced_simd_table_lookup_simd(uint32_t insn)
+{
+    int is_tbx = INSN(12,12);
+
+    if (hasHostFeature(HOST_FEATURE_SSSE3))
+        return is_tbx?simd_tbx:simd_tbl;
+
+    return dis_tbl_tbx;
+}
+
+void arm64_hlp_dirty_advanced_simd_table_lookup_simd(uint64_t _regs, uint32_t insn)
+{
+    arm64_hlp_resolve_advanced_simd_table_lookup_simd(insn)(_regs, insn);
+}
+
+/* f16c half precision conversions. Lanes that need softfloat nan or underflow handling
+   make the whole instruction use the generic code */
+static F16C void simd_fcvtn_32(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    int q = INSN(30,30);
+    int rd = INSN(4,0);
+    __m128i n = vload(regs, INSN(9,5));
+    __m128i abs = _mm_and_si128(n, _mm_set1_epi32(0x7fffffff));
+    __m128i is_nan_or_inf = _mm_cmpgt_epi32(abs, _mm_set1_epi32(0x7f7fffff));
+    __m128i is_tiny = _mm_andnot_si128(_mm_cmpeq_epi32(abs, _mm_setzero_si128()),
+                                       _mm_cmplt_epi32(abs, _mm_set1_epi32(0x38800000)));
+    __m128i res;
+
+    if (FAST_MATH_ALLOW && regs->fast_math_is_allow && IEEE_H16 &&
+        !_mm_movemask_epi8(_mm_or_si128(is_nan_or_inf, is_tiny))) {
+        res = _mm_cvtps_ph(_mm_castsi128_ps(n), _MM_FROUND_TO_NEAREST_INT);
+        if (q)
+            res = _mm_unpacklo_epi64(vload(regs, rd), res);
+        vstore(regs, rd, res, q);
+    } else
+        dis_fcvtn(_regs, insn);
+}
+
+static F16C void simd_fcvtl_16(uint64_t _regs, uint32_t insn)
+{
+    struct arm64_registers *regs = (struct arm64_registers *) _regs;
+    __m128i n = vload(regs, INSN(9,5));
+    __m128i exp_mask = _mm_set1_epi16(0x7c00);
+
+    if (INSN(30,30))
+        n = _mm_unpackhi_epi64(n, n);
+    if (FAST_MATH_ALLOW && regs->fast_math_is_allow && IEEE_H16 &&
+        !(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(n, exp_mask), exp_mask)) & 0xff))
+        vstore(regs, INSN(4,0), _mm_castps_si128(_mm_cvtph_ps(n)), 1);
+    else
+        dis_fcvtl(_regs, insn);
+}
+
+/* return host kernel of a two register misc instruction or NULL if generic helper must be used */
+arm64_simd_helper arm64_hlp_resolve_advanced_simd_two_reg_misc_simd(uint32_t insn)
 {
+    int U = INSN(29,29);
+    int opcode = INSN(16,12);
+    int size = INSN(23,22);
+
+    if (U || size != 0 || !hasHostFeature(HOST_FEATURE_F16C))
+        return NULL;
+
+    switch(opcode) {
+        case 22:
+            return simd_fcvtn_32;
+        case 23:
+            return simd_fcvtl_16;
+        default:
+            return NULL;
+    }
+}
+
+/* return leaf helper of a permute instruction or NULL if encoding is illegal */
+arm64_simd_helper arm64_hlp_resolve_advanced_simd_permute_simd(uint32_t insn)
+{
+    static const arm64_simd_helper uzp[2][4] = {
+        {simd_uzp1_8, simd_uzp1_16, simd_uzp1_32, simd_zip1_64},
+        {simd_uzp2_8, simd_uzp2_16, simd_uzp2_32, simd_zip2_64}};
+    static const arm64_simd_helper zip[2][4] = {
+        {simd_zip1_8, simd_zip1_16, simd_zip1_32, simd_zip1_64},
+        {simd_zip2_8, simd_zip2_16, simd_zip2_32, simd_zip2_64}};
     int opcode = INSN(14,12);
+    int q = INSN(30,30);
+    int size = INSN(23,22);
 
     switch(opcode) {
         case 1: case 5:
-            dis_uzp1_uzp2(_regs, insn);
-            break;
+            if (size == 3 && !q)
+                return NULL;
+            return uzp[opcode == 5][size];
         case 3: case 7:
-            dis_zip1_zip2(_regs, insn);
-            break;
+            if (size == 3 && !q)
+                return NULL;
+            return zip[opcode == 7][size];
         case 2: case 6:
-            dis_trn1_trn2(_regs, insn);
-            break;
+            return dis_trn1_trn2;
         default:
-            fatal_illegal_opcode("opcode = %d(0x%x)\n", opcode, opcode);
+            return NULL;
     }
 }
+
+void arm64_hlp_dirty_advanced_simd_permute_simd(uint64_t _regs, uint32_t insn)
+{
+    arm64_simd_helper helper = arm64_hlp_resolve_advanced_simd_permute_simd(insn);
+
+    if (helper)
+        helper(_regs, insn);
+    else
+        fatal_illegal_opcode("opcode = %d(0x%x)\n", INSN(14,12), INSN(14,12));
+}
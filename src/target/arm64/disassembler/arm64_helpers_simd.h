@@ -32,6 +32,8 @@ extern "C" {
 
 #include "target64.h"
 
+typedef void (*arm64_simd_helper)(uint64_t _regs, uint32_t insn);
+
 extern void arm64_hlp_dirty_simd_dup_element(uint64_t _regs, uint32_t insn);
 extern void arm64_hlp_dirty_simd_dup_general(uint64_t _regs, uint32_t insn);
 extern void arm64_hlp_dirty_advanced_simd_shift_by_immediate_simd(uint64_t _regs, uint32_t insn);
@@ -53,6 +55,24 @@ extern void arm64_hlp_dirty_advanced_simd_load_store_single_structure_simd(uint6
 extern void arm64_hlp_dirty_advanced_simd_load_store_single_structure_post_index_simd(uint64_t _regs, uint32_t insn);
 extern void arm64_hlp_dirty_advanced_simd_table_lookup_simd(uint64_t _regs, uint32_t insn);
 extern void arm64_hlp_dirty_advanced_simd_permute_simd(uint64_t _regs, uint32_t insn);
+extern arm64_simd_helper arm64_hlp_resolve_advanced_simd_three_same_simd(uint32_t insn);
+extern arm64_simd_helper arm64_hlp_resolve_advanced_simd_three_different_simd(uint32_t insn);
+extern arm64_simd_helper arm64_hlp_resolve_advanced_simd_permute_simd(uint32_t insn);
+extern arm64_simd_helper arm64_hlp_resolve_advanced_simd_two_reg_misc_simd(uint32_t insn);
+extern arm64_simd_helper arm64_hlp_resolve_advanced_simd_table_lookup_simd(uint32_t insn);
+extern arm64_simd_helper arm64_hlp_resolve_advanced_simd_load_store_multiple_structure_simd(uint32_t insn);
+extern void arm64_hlp_simd_dup_element_8(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q);
+extern void arm64_hlp_simd_dup_element_16(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q);
+extern void arm64_hlp_simd_dup_element_32(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q);
+extern void arm64_hlp_simd_dup_element_64(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t index, uint32_t q);
+extern void arm64_hlp_simd_add_8(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_add_16(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_add_32(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_add_64(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_sub_8(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_sub_16(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_sub_32(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
+extern void arm64_hlp_simd_sub_64(uint64_t _regs, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t q);
 
 #endif
 
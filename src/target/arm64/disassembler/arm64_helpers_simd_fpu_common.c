@@ -19,6 +19,7 @@
  */
 
 #include <fenv.h>
+#include <immintrin.h>
 #include "umeq.h"
 
 #define float32_two make_float32(0x40000000)
@@ -53,6 +54,66 @@ static inline int is_not_nan_or_infinite_64(uint64_t a)
     return ((a&0x7ff0000000000000UL) == 0x7ff0000000000000UL)?0:1;
 }
 
+static inline int is_not_nan_or_infinite_16(uint16_t a)
+{
+    return ((a&0x7c00) == 0x7c00)?0:1;
+}
+
+/* x86 detects underflow after rounding where arm does it before, so single values that
+   are tiny for half precision are left to softfloat */
+static inline int is_not_tiny_for_16_32(uint32_t a)
+{
+    uint32_t abs = a & 0x7fffffff;
+
+    return abs == 0 || abs >= 0x38800000;
+}
+
+/* half precision conversions with f16c. Only for ieee half precision */
+#define F16C __attribute__((target("f16c")))
+
+static inline F16C uint32_t f16c_h_to_s(uint16_t a)
+{
+    return _mm_cvtsi128_si32(_mm_castps_si128(_mm_cvtph_ps(_mm_cvtsi32_si128(a))));
+}
+
+static inline F16C uint16_t f16c_s_to_h(uint32_t a)
+{
+    return _mm_cvtsi128_si32(_mm_cvtps_ph(_mm_castsi128_ps(_mm_cvtsi32_si128(a)), _MM_FROUND_TO_NEAREST_INT));
+}
+
+/* fma3 and softfloat muladd are both fused so results are bit exact */
+#define FMA __attribute__((target("fma")))
+
+static inline FMA uint32_t fma3_32(uint32_t a, uint32_t b, uint32_t acc)
+{
+    return _mm_cvtsi128_si32(_mm_castps_si128(_mm_fmadd_ss(_mm_castsi128_ps(_mm_cvtsi32_si128(a)),
+                                                           _mm_castsi128_ps(_mm_cvtsi32_si128(b)),
+                                                           _mm_castsi128_ps(_mm_cvtsi32_si128(acc)))));
+}
+
+static inline FMA uint64_t fma3_64(uint64_t a, uint64_t b, uint64_t acc)
+{
+    return _mm_cvtsi128_si64(_mm_castpd_si128(_mm_fmadd_sd(_mm_castsi128_pd(_mm_cvtsi64_si128(a)),
+                                                           _mm_castsi128_pd(_mm_cvtsi64_si128(b)),
+                                                           _mm_castsi128_pd(_mm_cvtsi64_si128(acc)))));
+}
+
+/* host fma support is resolved on first fmadd32/fmadd64 call, later calls only read
+   it. Concurrent first calls store the same value */
+static int fma_is_supported = -1;
+
+static inline int has_fma(void)
+{
+    int res = __atomic_load_n(&fma_is_supported, __ATOMIC_RELAXED);
+
+    if (res < 0) {
+        res = hasHostFeature(HOST_FEATURE_FMA);
+        __atomic_store_n(&fma_is_supported, res, __ATOMIC_RELAXED);
+    }
+
+    return res;
+}
+
 static inline float make_float(uint32_t i)
 {
     union float_uint32_t a = { .i = i };
@@ -347,12 +408,22 @@ static inline uint64_t fdiv64(struct arm64_registers *regs, uint64_t a, uint64_t
 
 static inline uint32_t fmadd32(struct arm64_registers *regs, uint32_t a, uint32_t b, uint32_t acc)
 {
-    return float32_val(float32_muladd(make_float32(a), make_float32(b), make_float32(acc), 0, &regs->fp_status));
+    if (FAST_MATH_ALLOW && regs->fast_math_is_allow &&
+        is_not_nan_or_infinite_32(a) && is_not_nan_or_infinite_32(b) && is_not_nan_or_infinite_32(acc) &&
+        has_fma())
+        return fma3_32(a, b, acc);
+    else
+        return float32_val(float32_muladd(make_float32(a), make_float32(b), make_float32(acc), 0, &regs->fp_status));
 }
 
 static inline uint64_t fmadd64(struct arm64_registers *regs, uint64_t a, uint64_t b, uint64_t acc)
 {
-    return float64_val(float64_muladd(make_float64(a), make_float64(b), make_float64(acc), 0, &regs->fp_status));
+    if (FAST_MATH_ALLOW && regs->fast_math_is_allow &&
+        is_not_nan_or_infinite_64(a) && is_not_nan_or_infinite_64(b) && is_not_nan_or_infinite_64(acc) &&
+        has_fma())
+        return fma3_64(a, b, acc);
+    else
+        return float64_val(float64_muladd(make_float64(a), make_float64(b), make_float64(acc), 0, &regs->fp_status));
 }
 
 static inline uint32_t fmax32(struct arm64_registers *regs, uint32_t a, uint32_t b)
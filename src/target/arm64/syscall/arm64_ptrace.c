@@ -255,6 +255,14 @@ static long write_gpr(int pid, struct user_pt_regs_arm64 *regs)
         goto write_gpr_error;
     data = (data & 0xffffffff00000000UL) | regs->pstate;
     res = syscall(SYS_ptrace, PTRACE_POKEDATA, pid, regs_base + offsetof(struct arm64_registers, nzcv), data);
+    if (res)
+        goto write_gpr_error;
+    /* and drop lazy flags state */
+    res = syscall(SYS_ptrace, PTRACE_PEEKDATA, pid, regs_base + offsetof(struct arm64_registers, lazy_nzcv_ops), &data);
+    if (res)
+        goto write_gpr_error;
+    data = (data & 0xffffffff00000000UL) | LAZY_NZCV_NONE;
+    res = syscall(SYS_ptrace, PTRACE_POKEDATA, pid, regs_base + offsetof(struct arm64_registers, lazy_nzcv_ops), data);
     if (res)
         goto write_gpr_error;
 
@@ -41,6 +41,8 @@ void arm64_hlp_syscall(uint64_t regs)
     Syshow how;
     long res = -ENOSYS;
 
+    /* flags must be up to date in case a tracer look at them */
+    arm64_hlp_resolve_nzcv(regs);
     /* syscall entry sequence */
     ptrace_syscall_enter(context);
     /* read syscall number in case x8 has been change on syscall entry by a tracer.
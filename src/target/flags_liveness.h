@@ -0,0 +1,53 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdint.h>
+
+#ifndef __FLAGS_LIVENESS__
+#define __FLAGS_LIVENESS__ 1
+
+/* nzcv flags liveness shared by arm and arm64 frontends. Both keep nzcv in bits 31 to 28 */
+#define FLAGS_LIVENESS_NZCV     0xf0000000
+
+struct flags_usage {
+    uint32_t read;      /* flags read by instruction */
+    uint32_t write;     /* flags always written by instruction */
+    uint32_t may_write; /* flags instruction may modify */
+};
+
+/* backward pass over the nb first instructions of a block. All flags are live after
+   the last one. Return a mask where bit i is set when flags computed by instruction i
+   are overwritten before being observed. */
+static inline uint64_t compute_dead_flags(struct flags_usage *usage, int nb)
+{
+    uint32_t live = FLAGS_LIVENESS_NZCV;
+    uint64_t res = 0;
+    int i;
+
+    for(i = nb - 1; i >= 0; i--) {
+        if (usage[i].may_write && (usage[i].may_write & live) == 0)
+            res |= 1UL << i;
+        live = (live & ~usage[i].write) | usage[i].read;
+    }
+
+    return res;
+}
+
+#endif
@@ -59,7 +59,7 @@ TEST(Cache, lookupSuccess) {
     }
     cache = createCache(memory, MIN_CACHE_SIZE, 0);
     
-    cache->append(cache, 0x8000, data, sizeof(data), &is_cache_was_cleaned);
+    cache->append(cache, 0x8000, data, sizeof(data), NULL, 0, &is_cache_was_cleaned);
     cache_hit = (char *) cache->lookup(cache, 0x8000, &is_cache_was_cleaned);
     EXPECT_TRUE(cache_hit != NULL);
     for(i = 0; i < sizeof(data); i++) {
@@ -69,6 +69,32 @@ TEST(Cache, lookupSuccess) {
     removeCache(cache);
 }
 
+TEST(Cache, lookupPc) {
+    char memory[MIN_CACHE_SIZE];
+    char data[16];
+    char map[4] = {1, 2, 3, 4};
+    struct cache *cache;
+    char *cache_hit;
+    void *host_pc_start;
+    char *cache_map;
+    int i;
+    int is_cache_was_cleaned;
+
+    for(i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    cache = createCache(memory, MIN_CACHE_SIZE, 0);
+
+    cache_hit = (char *) cache->append(cache, 0x8000, data, sizeof(data), map, sizeof(map), &is_cache_was_cleaned);
+    EXPECT_EQ(cache->lookup_pc(cache, cache_hit + 3, &host_pc_start, (void **) &cache_map), 0x8000);
+    EXPECT_TRUE(host_pc_start == cache_hit);
+    for(i = 0; i < sizeof(map); i++) {
+        EXPECT_EQ(cache_map[i], map[i]);
+    }
+
+    removeCache(cache);
+}
+
 TEST(Cache, multipleCache) {
     /* FIXME: keep like this of increase stacksize limit */
     static char memory[2][MIN_CACHE_SIZE];
@@ -84,8 +110,8 @@ TEST(Cache, multipleCache) {
     for(i = 0; i < 2; i++) {
         cache[i] = createCache(memory[i], MIN_CACHE_SIZE, 0);
     }
-    cache[0]->append(cache[0], 0x8000, data, sizeof(data), &is_cache_was_cleaned);
-    cache[1]->append(cache[1], 0x18000, data, sizeof(data), &is_cache_was_cleaned);
+    cache[0]->append(cache[0], 0x8000, data, sizeof(data), NULL, 0, &is_cache_was_cleaned);
+    cache[1]->append(cache[1], 0x18000, data, sizeof(data), NULL, 0, &is_cache_was_cleaned);
     /* be sure to have hit for cache[0] and miss for cache[1] for 0x8000 */
     cache_hit = (char *) cache[0]->lookup(cache[0], 0x8000, &is_cache_was_cleaned);
     EXPECT_TRUE(cache_hit != NULL);
@@ -121,7 +147,7 @@ TEST(Cache, cleanCache) {
     }
     cache = createCache(memory, MIN_CACHE_SIZE, 0);
     
-    cache->append(cache, 0x8000, data, sizeof(data), &is_cache_was_cleaned);
+    cache->append(cache, 0x8000, data, sizeof(data), NULL, 0, &is_cache_was_cleaned);
     cache_hit = (char *) cache->lookup(cache, 0x8000, &is_cache_was_cleaned);
     EXPECT_TRUE(cache_hit != NULL);
     for(i = 0; i < sizeof(data); i++) {
@@ -149,8 +175,8 @@ TEST(Cache, cleanCacheMultiple) {
     for(i = 0; i < 2; i++) {
         cache[i] = createCache(memory[i], MIN_CACHE_SIZE, 0);
     }
-    cache[0]->append(cache[0], 0x8000, data, sizeof(data), &is_cache_was_cleaned);
-    cache[1]->append(cache[1], 0x18000, data, sizeof(data), &is_cache_was_cleaned);
+    cache[0]->append(cache[0], 0x8000, data, sizeof(data), NULL, 0, &is_cache_was_cleaned);
+    cache[1]->append(cache[1], 0x18000, data, sizeof(data), NULL, 0, &is_cache_was_cleaned);
     /* be sure to have hit for cache[0] for 0x8000 and hit for cache[1] for 0x18000 */
     cache_hit = (char *) cache[0]->lookup(cache[0], 0x8000, &is_cache_was_cleaned);
     EXPECT_TRUE(cache_hit != NULL);
@@ -0,0 +1,358 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+
+#include "jitterFixture.h"
+
+class AtomicTest : public jitterFixture {
+};
+
+struct atomicThreadParam {
+    struct backend *backend;
+    char *code;
+    char *context;
+    pthread_barrier_t *barrier;
+    int loop;
+};
+
+static void *atomicThread(void *arg)
+{
+    struct atomicThreadParam *param = (struct atomicThreadParam *) arg;
+    int i;
+
+    pthread_barrier_wait(param->barrier);
+    for(i = 0; i < param->loop; i++)
+        param->backend->execute(param->backend, param->code, (uint64_t) param->context);
+
+    return NULL;
+}
+
+TEST_F(AtomicTest, cmpxchg8Success) {
+    uint8_t mem = 0x12;
+    uint8_t out = 0;
+
+    ir->add_store_8(ir,
+                    ir->add_cmpxchg_8(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                          ir->add_mov_const_8(ir, 0x12),
+                                          ir->add_mov_const_8(ir, 0x34)),
+                    ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x12, out);
+    EXPECT_EQ(0x34, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg8Failure) {
+    uint8_t mem = 0x56;
+    uint8_t out = 0;
+
+    ir->add_store_8(ir,
+                    ir->add_cmpxchg_8(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                          ir->add_mov_const_8(ir, 0x12),
+                                          ir->add_mov_const_8(ir, 0x34)),
+                    ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x56, out);
+    EXPECT_EQ(0x56, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg8ZeroExtend) {
+    uint8_t mem = 0xff;
+    uint64_t out = ~0UL;
+
+    ir->add_store_64(ir,
+                     ir->add_8U_to_64(ir, ir->add_cmpxchg_8(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                                                ir->add_mov_const_8(ir, 0x12),
+                                                                ir->add_mov_const_8(ir, 0x34))),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xffUL, out);
+    EXPECT_EQ(0xff, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg16Success) {
+    uint16_t mem = 0x1234;
+    uint16_t out = 0;
+
+    ir->add_store_16(ir,
+                     ir->add_cmpxchg_16(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                            ir->add_mov_const_16(ir, 0x1234),
+                                            ir->add_mov_const_16(ir, 0x5678)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x1234, out);
+    EXPECT_EQ(0x5678, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg32Success) {
+    uint32_t mem = 0xdeadbeef;
+    uint32_t out = 0;
+
+    ir->add_store_32(ir,
+                     ir->add_cmpxchg_32(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                            ir->add_mov_const_32(ir, 0xdeadbeef),
+                                            ir->add_mov_const_32(ir, 0xcafedeca)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xdeadbeef, out);
+    EXPECT_EQ(0xcafedeca, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg32Failure) {
+    uint32_t mem = 0x12345678;
+    uint32_t out = 0;
+
+    ir->add_store_32(ir,
+                     ir->add_cmpxchg_32(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                            ir->add_mov_const_32(ir, 0xdeadbeef),
+                                            ir->add_mov_const_32(ir, 0xcafedeca)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x12345678, out);
+    EXPECT_EQ(0x12345678, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg64Success) {
+    uint64_t mem = 0x12345678deadbeefUL;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                     ir->add_cmpxchg_64(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                            ir->add_mov_const_64(ir, 0x12345678deadbeefUL),
+                                            ir->add_mov_const_64(ir, 0xcafedeca87654321UL)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x12345678deadbeefUL, out);
+    EXPECT_EQ(0xcafedeca87654321UL, mem);
+}
+
+TEST_F(AtomicTest, cmpxchg64Failure) {
+    uint64_t mem = 0x12345678deadbeefUL;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                     ir->add_cmpxchg_64(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                            ir->add_mov_const_64(ir, 0x12345678UL),
+                                            ir->add_mov_const_64(ir, 0xcafedeca87654321UL)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x12345678deadbeefUL, out);
+    EXPECT_EQ(0x12345678deadbeefUL, mem);
+}
+
+TEST_F(AtomicTest, xchg8) {
+    uint8_t mem = 0x12;
+    uint8_t out = 0;
+
+    ir->add_store_8(ir,
+                    ir->add_xchg_8(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_8(ir, 0x34)),
+                    ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x12, out);
+    EXPECT_EQ(0x34, mem);
+}
+
+TEST_F(AtomicTest, xchg16) {
+    uint16_t mem = 0x1234;
+    uint16_t out = 0;
+
+    ir->add_store_16(ir,
+                     ir->add_xchg_16(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_16(ir, 0x5678)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x1234, out);
+    EXPECT_EQ(0x5678, mem);
+}
+
+TEST_F(AtomicTest, xchg32) {
+    uint32_t mem = 0xdeadbeef;
+    uint32_t out = 0;
+
+    ir->add_store_32(ir,
+                     ir->add_xchg_32(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_32(ir, 0xcafedeca)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xdeadbeef, out);
+    EXPECT_EQ(0xcafedeca, mem);
+}
+
+TEST_F(AtomicTest, xchg64) {
+    uint64_t mem = 0x12345678deadbeefUL;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                     ir->add_xchg_64(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_64(ir, 0xcafedeca87654321UL)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x12345678deadbeefUL, out);
+    EXPECT_EQ(0xcafedeca87654321UL, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd8) {
+    uint8_t mem = 0xff;
+    uint8_t out = 0;
+
+    ir->add_store_8(ir,
+                    ir->add_fetch_add_8(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_8(ir, 2)),
+                    ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xff, out);
+    EXPECT_EQ(1, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd16) {
+    uint16_t mem = 0x1234;
+    uint16_t out = 0;
+
+    ir->add_store_16(ir,
+                     ir->add_fetch_add_16(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_16(ir, 0x1111)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x1234, out);
+    EXPECT_EQ(0x2345, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd32) {
+    uint32_t mem = 0xdeadbeef;
+    uint32_t out = 0;
+
+    ir->add_store_32(ir,
+                     ir->add_fetch_add_32(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_32(ir, 1)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xdeadbeef, out);
+    EXPECT_EQ(0xdeadbef0, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd64) {
+    uint64_t mem = 0xffffffffUL;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                     ir->add_fetch_add_64(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_64(ir, 1)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xffffffffUL, out);
+    EXPECT_EQ(0x100000000UL, mem);
+}
+
+TEST_F(AtomicTest, xchg8ZeroExtend) {
+    uint8_t mem = 0xfe;
+    uint64_t out = ~0UL;
+
+    ir->add_store_64(ir,
+                     ir->add_8U_to_64(ir, ir->add_xchg_8(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_8(ir, 0x80))),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xfeUL, out);
+    EXPECT_EQ(0x80, mem);
+}
+
+TEST_F(AtomicTest, xchg16FromRegister) {
+    uint16_t mem = 0x1234;
+    uint16_t value = 0xfedc;
+    uint16_t out = 0;
+
+    ir->add_store_16(ir,
+                     ir->add_xchg_16(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                         ir->add_load_16(ir, ir->add_mov_const_64(ir, (uint64_t) &value))),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x1234, out);
+    EXPECT_EQ(0xfedc, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd16ZeroExtend) {
+    uint16_t mem = 0xffff;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                     ir->add_16U_to_64(ir, ir->add_fetch_add_16(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_16(ir, 0x8001))),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0xffffUL, out);
+    EXPECT_EQ(0x8000, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd64FromRegister) {
+    uint64_t mem = 0x00000001ffffffffUL;
+    uint64_t value = 0xffffffff00000001UL;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                     ir->add_fetch_add_64(ir, ir->add_mov_const_64(ir, (uint64_t) &mem),
+                                              ir->add_load_64(ir, ir->add_mov_const_64(ir, (uint64_t) &value))),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(0x00000001ffffffffUL, out);
+    EXPECT_EQ(0x0000000100000000UL, mem);
+}
+
+TEST_F(AtomicTest, fetchAdd32Concurrent) {
+    uint32_t mem = 0;
+    char jitBuffer[4096];
+    struct atomicThreadParam param;
+    pthread_barrier_t barrier;
+    pthread_t threads[4];
+    int i;
+
+    ir->add_fetch_add_32(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), ir->add_mov_const_32(ir, 1));
+    ir->add_exit(ir, ir->add_mov_const_64(ir, 0));
+    ASSERT_GT(jitCode(handle, jitBuffer, sizeof(jitBuffer)), 0);
+
+    param.backend = backend;
+    param.code = jitBuffer;
+    param.context = contextBuffer;
+    param.barrier = &barrier;
+    param.loop = 100000;
+    pthread_barrier_init(&barrier, NULL, 4);
+    for(i = 0; i < 4; i++)
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, atomicThread, &param));
+    for(i = 0; i < 4; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    EXPECT_EQ(400000U, mem);
+}
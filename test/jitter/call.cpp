@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <ucontext.h>
 #include "gtest/gtest.h"
 #include "jitter.h"
 
@@ -306,3 +307,35 @@ TEST_F(CallTest, call_64_p064_p164_p264_p364) {
     EXPECT_EQ(out, CALL_64_MARKER_P064_P164_P264_P364);
 }
 
+/* context holds backend pointer. Helper return address is written just after it */
+extern "C" void call_return_address_helper(uint64_t context)
+{
+    struct backend *backend = *(struct backend **) context;
+    unsigned char **res = (unsigned char **) (context + 8);
+    ucontext_t uc;
+
+    getcontext(&uc);
+    *res = (unsigned char *) backend->get_helper_return_address(backend, &uc);
+    /* return address must follow an indirect call instruction */
+    if (*res && ((*res)[-2] != 0xff || ((*res)[-1] & 0xf8) != 0xd0))
+        *res = NULL;
+}
+
+TEST_F(CallTest, call_return_address) {
+    struct irRegister *param[4] = {NULL, NULL, NULL, NULL};
+    unsigned char **res = (unsigned char **) &contextBuffer[8];
+    ucontext_t uc;
+
+    *(struct backend **) contextBuffer = backend;
+    *res = NULL;
+    ir->add_call_void(ir, (char *) "call_return_address",
+                      ir->add_mov_const_64(ir, (uint64_t) call_return_address_helper),
+                      param);
+
+    jitAndExcecute();
+
+    EXPECT_TRUE(*res != NULL);
+    /* jit code is no more running */
+    getcontext(&uc);
+    EXPECT_TRUE(backend->get_helper_return_address(backend, &uc) == NULL);
+}
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "gtest/gtest.h"
 #include "jitter.h"
 
@@ -77,3 +78,32 @@ TEST_F(ConstTest, const64) {
     EXPECT_EQ(in, out);
 }
 
+
+TEST_F(ConstTest, const64SignExtended) {
+    uint64_t in = 0xffffffff80000010UL;
+    uint64_t out = 0;
+
+    ir->add_store_64(ir,
+                    ir->add_mov_const_64(ir, in),
+                    ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(in, out);
+}
+
+TEST_F(ConstTest, const64InRegister) {
+    uint64_t in[] = {0, 0xfffffffe, 0xfffffffffffffff0UL, 0x1285ff123591UL};
+    uint64_t out[4] = {1, 1, 1, 1};
+    int i;
+
+    /* xor with zero register force constants into registers */
+    for(i = 0; i < 4; i++)
+        ir->add_store_64(ir,
+                         ir->add_xor_64(ir, ir->add_mov_const_64(ir, in[i]), ir->add_read_context_64(ir, 0)),
+                         ir->add_mov_const_64(ir, (uint64_t) &out[i]));
+    memset(contextBuffer, 0, 8);
+    jitAndExcecute();
+
+    for(i = 0; i < 4; i++)
+        EXPECT_EQ(in[i], out[i]);
+}
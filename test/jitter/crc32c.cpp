@@ -0,0 +1,110 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+#include "host_features.h"
+
+#include "jitterFixture.h"
+
+class Crc32cTest : public jitterFixture {
+    protected:
+    uint32_t crc32c(uint32_t crc, uint64_t value, int size) {
+        int i;
+
+        for(i = 0; i < size; i++) {
+            crc ^= (value >> i) & 1;
+            crc = (crc & 1)?(crc >> 1) ^ 0x82f63b78:crc >> 1;
+        }
+
+        return crc;
+    }
+};
+
+TEST_F(Crc32cTest, crc32c8) {
+    uint32_t crc = 0x12345678;
+    uint8_t value = 0xa5;
+    uint32_t out = 0;
+
+    if (!hasHostFeature(HOST_FEATURE_SSE4_2))
+        return ;
+    ir->add_store_32(ir,
+                     ir->add_crc32c_8(ir,
+                                      ir->add_mov_const_32(ir, crc),
+                                      ir->add_mov_const_8(ir, value)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(crc32c(crc, value, 8), out);
+}
+
+TEST_F(Crc32cTest, crc32c16) {
+    uint32_t crc = 0xffffffff;
+    uint16_t value = 0x8001;
+    uint32_t out = 0;
+
+    if (!hasHostFeature(HOST_FEATURE_SSE4_2))
+        return ;
+    ir->add_store_32(ir,
+                     ir->add_crc32c_16(ir,
+                                       ir->add_mov_const_32(ir, crc),
+                                       ir->add_mov_const_16(ir, value)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(crc32c(crc, value, 16), out);
+}
+
+TEST_F(Crc32cTest, crc32c32) {
+    uint32_t crc = 0;
+    uint32_t value = 0xdeadbeef;
+    uint32_t out = 0;
+
+    if (!hasHostFeature(HOST_FEATURE_SSE4_2))
+        return ;
+    ir->add_store_32(ir,
+                     ir->add_crc32c_32(ir,
+                                       ir->add_mov_const_32(ir, crc),
+                                       ir->add_mov_const_32(ir, value)),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(crc32c(crc, value, 32), out);
+}
+
+TEST_F(Crc32cTest, crc32c64) {
+    uint32_t crc = 0x89abcdef;
+    uint64_t value = 0x0123456789abcdefULL;
+    uint32_t out = 0;
+
+    if (!hasHostFeature(HOST_FEATURE_SSE4_2))
+        return ;
+    ir->add_store_32(ir,
+                     ir->add_crc32c_64(ir,
+                                       ir->add_mov_const_32(ir, crc),
+                                       ir->add_load_64(ir, ir->add_mov_const_64(ir, (uint64_t) &value))),
+                     ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(crc32c(crc, value, 64), out);
+}
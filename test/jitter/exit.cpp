@@ -21,6 +21,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "gtest/gtest.h"
 #include "jitter.h"
 
@@ -62,3 +64,95 @@ TEST_F(ExitTest, exitCondTrue) {
     EXPECT_EQ(res, 0x100000004UL);
 }
 
+
+TEST_F(ExitTest, exitCondCompare) {
+    uint64_t values[] = {0, 5, 0xffffffff, 0x100000000UL};
+    int i, j;
+
+    /* cmpeq / cmpne fused with exit, against register, immediate and zero */
+    for(i = 0; i < 4; i++) {
+        for(j = 0; j < 4; j++) {
+            int isEq;
+
+            for(isEq = 0; isEq < 2; isEq++) {
+                struct irRegister *op1;
+                struct irRegister *pred;
+                uint64_t res;
+
+                resetJitter(handle);
+                memcpy(&contextBuffer[0], &values[i], sizeof(values[i]));
+                memcpy(&contextBuffer[8], &values[j], sizeof(values[j]));
+                op1 = ir->add_read_context_64(ir, 0);
+                if (isEq)
+                    pred = ir->add_cmpeq_64(ir, op1, ir->add_read_context_64(ir, 8));
+                else
+                    pred = ir->add_cmpne_64(ir, op1, ir->add_mov_const_64(ir, values[j]));
+                ir->add_exit_cond(ir, ir->add_mov_const_64(ir, 0x100000004UL), ir->add_64_to_32(ir, pred));
+                ir->add_exit(ir, ir->add_mov_const_64(ir, 0x100000002UL));
+                res = jitAndExcecute();
+
+                EXPECT_EQ(res, ((values[i] == values[j]) == isEq)?0x100000004UL:0x100000002UL) << i << " " << j << " " << isEq;
+            }
+        }
+    }
+}
+
+TEST_F(ExitTest, exitCondStubs) {
+    uint64_t values[3] = {0x100000010UL, 0x100000020UL, 0x100000030UL};
+    uint64_t res;
+    int i;
+
+    /* only third conditional exit is taken. Exit values live in registers */
+    memcpy(contextBuffer, values, sizeof(values));
+    for(i = 0; i < 3; i++)
+        ir->add_exit_cond(ir,
+                          ir->add_read_context_64(ir, i * 8),
+                          ir->add_mov_const_32(ir, i == 2));
+    ir->add_exit(ir, ir->add_mov_const_64(ir, 0x100000002UL));
+    res = jitAndExcecute();
+
+    EXPECT_EQ(res, values[2]);
+}
+
+class ChainTest : public jitterFixture {
+    protected:
+    /* jit a block that exits with value into buffer */
+    void jitExitBlock(char *buffer, int size, uint64_t value) {
+        resetJitter(handle);
+        ir->add_exit(ir, ir->add_mov_const_64(ir, value));
+        ASSERT_GT(jitCode(handle, buffer, size), 0);
+    }
+
+    void chain(char *from, char *to) {
+        struct backend_execute_result result;
+
+        jitExitBlock(to, 256, 0x100000020UL);
+        jitExitBlock(from, 256, 0x100000010UL);
+        result = backend->execute(backend, from, (uint64_t) contextBuffer);
+        EXPECT_EQ(result.result, 0x100000010UL);
+        ASSERT_TRUE(result.link_patch_area != NULL);
+        backend->patch(backend, result.link_patch_area, to);
+        result = backend->execute(backend, from, (uint64_t) contextBuffer);
+        EXPECT_EQ(result.result, 0x100000020UL);
+    }
+};
+
+TEST_F(ChainTest, near) {
+    char buffer[512] __attribute__ ((aligned (JIT_CODE_ALIGN)));
+
+    chain(buffer, buffer + 256);
+}
+
+#if defined(__x86_64__)
+TEST_F(ChainTest, far) {
+    char buffer[256] __attribute__ ((aligned (JIT_CODE_ALIGN)));
+    /* far from stack so rel32 can't reach it */
+    char *far = (char *) mmap((void *) 0x100000000UL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    ASSERT_NE(far, MAP_FAILED);
+    ASSERT_GT((uint64_t) buffer - (uint64_t) far, 0x80000000UL);
+    chain(buffer, far);
+    munmap(far, 4096);
+}
+#endif
@@ -0,0 +1,131 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fenv.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+#include "host_features.h"
+
+#include "jitterFixture.h"
+
+class FcmpTest : public jitterFixture {
+    protected:
+    uint32_t f2u(float f) {
+        uint32_t res;
+
+        memcpy(&res, &f, sizeof(res));
+
+        return res;
+    }
+    uint64_t d2u(double d) {
+        uint64_t res;
+
+        memcpy(&res, &d, sizeof(res));
+
+        return res;
+    }
+    void fcmp32(int is_signaling, float a, float b, uint32_t *out) {
+        struct irRegister *op1 = ir->add_mov_const_32(ir, f2u(a));
+        struct irRegister *op2 = ir->add_mov_const_32(ir, f2u(b));
+
+        ir->add_store_32(ir,
+                         is_signaling?ir->add_fcmpe_32(ir, op1, op2):ir->add_fcmp_32(ir, op1, op2),
+                         ir->add_mov_const_64(ir, (uint64_t) out));
+    }
+    void fcmp64(int is_signaling, double a, double b, uint64_t *out) {
+        struct irRegister *op1 = ir->add_mov_const_64(ir, d2u(a));
+        struct irRegister *op2 = ir->add_mov_const_64(ir, d2u(b));
+
+        ir->add_store_64(ir,
+                         is_signaling?ir->add_fcmpe_64(ir, op1, op2):ir->add_fcmp_64(ir, op1, op2),
+                         ir->add_mov_const_64(ir, (uint64_t) out));
+    }
+};
+
+TEST_F(FcmpTest, fcmp32) {
+    uint32_t out[5];
+
+    if (!hasHostFeature(HOST_FEATURE_SSE2))
+        return ;
+    fcmp32(0, 1.0f, 2.0f, &out[0]);
+    fcmp32(0, 2.0f, 2.0f, &out[1]);
+    fcmp32(0, 3.0f, 2.0f, &out[2]);
+    fcmp32(0, NAN, 2.0f, &out[3]);
+    fcmp32(0, -0.0f, 0.0f, &out[4]);
+    jitAndExcecute();
+
+    EXPECT_EQ(0x80000000, out[0]);
+    EXPECT_EQ(0x60000000, out[1]);
+    EXPECT_EQ(0x20000000, out[2]);
+    EXPECT_EQ(0x30000000, out[3]);
+    EXPECT_EQ(0x60000000, out[4]);
+}
+
+TEST_F(FcmpTest, fcmp64) {
+    uint64_t out[5];
+
+    if (!hasHostFeature(HOST_FEATURE_SSE2))
+        return ;
+    fcmp64(0, -1.0, 2.0, &out[0]);
+    fcmp64(0, 2.0, 2.0, &out[1]);
+    fcmp64(0, INFINITY, 2.0, &out[2]);
+    fcmp64(0, 2.0, NAN, &out[3]);
+    fcmp64(0, 0.0, -0.0, &out[4]);
+    jitAndExcecute();
+
+    EXPECT_EQ(0x80000000UL, out[0]);
+    EXPECT_EQ(0x60000000UL, out[1]);
+    EXPECT_EQ(0x20000000UL, out[2]);
+    EXPECT_EQ(0x30000000UL, out[3]);
+    EXPECT_EQ(0x60000000UL, out[4]);
+}
+
+TEST_F(FcmpTest, fcmpQuietNan) {
+    uint32_t out;
+
+    if (!hasHostFeature(HOST_FEATURE_SSE2))
+        return ;
+    fcmp32(0, NAN, 1.0f, &out);
+    feclearexcept(FE_ALL_EXCEPT);
+    jitAndExcecute();
+
+    EXPECT_EQ(0x30000000, out);
+    EXPECT_EQ(0, fetestexcept(FE_INVALID));
+}
+
+TEST_F(FcmpTest, fcmpeQuietNan) {
+    uint64_t out;
+
+    if (!hasHostFeature(HOST_FEATURE_SSE2))
+        return ;
+    fcmp64(1, 1.0, NAN, &out);
+    feclearexcept(FE_ALL_EXCEPT);
+    jitAndExcecute();
+    EXPECT_NE(0, fetestexcept(FE_INVALID));
+    feclearexcept(FE_ALL_EXCEPT);
+
+    EXPECT_EQ(0x30000000UL, out);
+}
@@ -0,0 +1,51 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "gtest/gtest.h"
+#include "host_features.h"
+
+TEST(HostFeaturesTest, baseline) {
+    int i;
+
+    initHostFeatures(1);
+    for(i = 0; i < HOST_FEATURE_NB; i++) {
+#if defined(__x86_64__)
+        EXPECT_EQ(i == HOST_FEATURE_SSE2, hasHostFeature((enum hostFeature) i)) << getHostFeatureName((enum hostFeature) i);
+#else
+        EXPECT_EQ(0, hasHostFeature((enum hostFeature) i)) << getHostFeatureName((enum hostFeature) i);
+#endif
+    }
+    initHostFeatures(0);
+}
+
+TEST(HostFeaturesTest, probe) {
+    initHostFeatures(0);
+#if defined(__x86_64__)
+    EXPECT_TRUE(hasHostFeature(HOST_FEATURE_SSE2));
+#endif
+    /* avx encoded extensions require avx state */
+    if (hasHostFeature(HOST_FEATURE_AVX2) || hasHostFeature(HOST_FEATURE_FMA) || hasHostFeature(HOST_FEATURE_F16C))
+        EXPECT_TRUE(hasHostFeature(HOST_FEATURE_AVX));
+    if (hasHostFeature(HOST_FEATURE_SSE4_2))
+        EXPECT_TRUE(hasHostFeature(HOST_FEATURE_SSE4_1));
+}
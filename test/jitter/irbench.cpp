@@ -0,0 +1,184 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/* Replay ir captured with umeq -capture-ir <file> and report backend translation cost.
+   Usage: irbench [-v] [-n iterations] <file> */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+
+#include "jitterFixture.h"
+
+static const char *captureFilename;
+static int iterationNb = 10;
+static int isVerbose;
+
+static const char *passNames[JIT_PASS_NB] = {"lower", "optimize", "regalloc", "codegen"};
+
+class IrBench : public jitterFixture {
+    protected:
+    /* captured blocks may need more than minimal contexts */
+    virtual void SetUp() {
+        backend = createBackend(beMemory, sizeof(beMemory));
+        handle = createJitter(jitterMemory, backend, sizeof(jitterMemory));
+        ir = getIrInstructionAllocator(handle);
+    }
+};
+
+static uint64_t getTimeNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static char *readFile(const char *filename, long *size)
+{
+    FILE *f = fopen(filename, "r");
+    char *res;
+
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    res = (char *) malloc(*size);
+    if (fread(res, 1, *size, f) != (size_t) *size) {
+        free(res);
+        res = NULL;
+    }
+    fclose(f);
+
+    return res;
+}
+
+/* serialized ir starts with its instruction number */
+static uint32_t getInsnNb(unsigned char *pos)
+{
+    uint32_t res = 0;
+    int shift = 0;
+
+    do {
+        res |= (*pos & 0x7f) << shift;
+        shift += 7;
+    } while(*pos++ & 0x80);
+
+    return res;
+}
+
+TEST_F(IrBench, replay) {
+    static char jitBuffer[256 * 1024] __attribute__ ((aligned (JIT_CODE_ALIGN)));
+    struct jit_stats stats;
+    struct jit_stats best;
+    uint64_t passTotal[JIT_PASS_NB] = {0};
+    uint64_t timeTotal = 0;
+    uint64_t insnTotal = 0;
+    uint64_t codeTotal = 0;
+    uint64_t liveTotal = 0;
+    int liveMax = 0;
+    int spillTotal = 0;
+    int blockNb = 0;
+    char *capture;
+    long captureSize;
+    long offset = 0;
+    int i, j;
+
+    capture = readFile(captureFilename, &captureSize);
+    ASSERT_TRUE(capture != NULL) << "unable to read " << captureFilename;
+    backend->stats = &stats;
+    while(offset + (long) sizeof(uint32_t) <= captureSize) {
+        uint32_t size;
+        uint64_t bestTime = ~0UL;
+        int codeSize = 0;
+
+        memcpy(&size, capture + offset, sizeof(size));
+        offset += sizeof(size);
+        ASSERT_LE(offset + size, captureSize);
+        /* keep fastest run to filter noise */
+        for(i = 0; i < iterationNb; i++) {
+            uint64_t start;
+            uint64_t time;
+
+            resetJitter(handle);
+            deserializeIr(handle, capture + offset, size);
+            start = getTimeNs();
+            codeSize = jitCode(handle, jitBuffer, sizeof(jitBuffer));
+            time = getTimeNs() - start;
+            if (time < bestTime) {
+                bestTime = time;
+                best = stats;
+            }
+        }
+        if (isVerbose) {
+            printf("block %5d: %5u ir insns %6d bytes %8lu ns", blockNb, getInsnNb((unsigned char *) capture + offset), codeSize, bestTime);
+            for(j = 0; j < JIT_PASS_NB; j++)
+                printf(" %s %lu", passNames[j], best.pass_time[j]);
+            printf(" live %d spill %d\n", best.max_live, best.spill_nb);
+        }
+        timeTotal += bestTime;
+        for(j = 0; j < JIT_PASS_NB; j++)
+            passTotal[j] += best.pass_time[j];
+        insnTotal += getInsnNb((unsigned char *) capture + offset);
+        codeTotal += codeSize;
+        liveTotal += best.max_live;
+        if (best.max_live > liveMax)
+            liveMax = best.max_live;
+        spillTotal += best.spill_nb;
+        blockNb++;
+        offset += size;
+    }
+    backend->stats = NULL;
+    free(capture);
+
+    ASSERT_GT(blockNb, 0);
+    printf("%d blocks, %lu ir insns, %lu code bytes (%.1f per ir insn)\n", blockNb, insnTotal, codeTotal, (double) codeTotal / insnTotal);
+    printf("jit time %lu ns, %lu ns per block\n", timeTotal, timeTotal / blockNb);
+    for(j = 0; j < JIT_PASS_NB; j++)
+        printf("  %-9s %10lu ns (%.1f%%)\n", passNames[j], passTotal[j], 100.0 * passTotal[j] / timeTotal);
+    printf("live values %.1f per block, %d max, %d spills\n", (double) liveTotal / blockNb, liveMax, spillTotal);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    testing::InitGoogleTest(&argc, argv);
+    for(i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0)
+            isVerbose = 1;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            iterationNb = atoi(argv[++i]);
+        else
+            captureFilename = argv[i];
+    }
+    if (!captureFilename || iterationNb <= 0) {
+        fprintf(stderr, "usage: %s [-v] [-n iterations] <capture file>\n", argv[0]);
+        return 1;
+    }
+
+    return RUN_ALL_TESTS();
+}
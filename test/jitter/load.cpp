@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "gtest/gtest.h"
 #include "jitter.h"
 
@@ -77,3 +78,32 @@ TEST_F(LoadTest, load64) {
     EXPECT_EQ(in, out);
 }
 
+
+TEST_F(LoadTest, displacement) {
+    uint32_t in[4] = {0x11111111, 0x22222222, 0x33333333, 0x44444444};
+    uint32_t out[4] = {0, 0, 0, 0};
+    uint32_t *inBase = &in[2];
+    uint32_t *outBase = &out[1];
+    struct irRegister *inReg;
+    struct irRegister *outReg;
+
+    memcpy(&contextBuffer[0], &inBase, sizeof(inBase));
+    memcpy(&contextBuffer[8], &outBase, sizeof(outBase));
+    inReg = ir->add_read_context_64(ir, 0);
+    outReg = ir->add_read_context_64(ir, 8);
+    ir->add_store_32(ir,
+                     ir->add_load_32(ir, ir->add_add_64(ir, inReg, ir->add_mov_const_64(ir, 4))),
+                     ir->add_add_64(ir, outReg, ir->add_mov_const_64(ir, -4)));
+    ir->add_store_32(ir,
+                     ir->add_load_32(ir, ir->add_add_64(ir, inReg, ir->add_mov_const_64(ir, -8))),
+                     ir->add_add_64(ir, outReg, ir->add_mov_const_64(ir, 8)));
+    ir->add_store_16(ir,
+                     ir->add_mov_const_16(ir, 0xabcd),
+                     ir->add_add_64(ir, outReg, ir->add_mov_const_64(ir, 4)));
+    jitAndExcecute();
+
+    EXPECT_EQ(in[3], out[0]);
+    EXPECT_EQ(0, out[1]);
+    EXPECT_EQ(in[0], out[3]);
+    EXPECT_EQ(0xabcd, out[2]);
+}
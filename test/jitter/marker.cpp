@@ -0,0 +1,169 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+
+#include "jitterFixture.h"
+
+class MarkerTest : public jitterFixture {
+    protected:
+    char jitBuffer[16 * 1024];
+    char mapBuffer[1024];
+    int jitSize;
+
+    virtual void jitWithMap() {
+        ir->add_exit(ir, ir->add_mov_const_64(ir, 0));
+        jitSize = jitCode(handle, jitBuffer, sizeof(jitBuffer));
+        jitInsnMap(handle, mapBuffer, sizeof(mapBuffer));
+    }
+};
+
+#if defined(__x86_64__)
+static char *trapCode;
+static uint8_t trapSavedByte;
+static void *trapMap;
+static uint32_t trapValue;
+
+/* record guest offset of trapped host pc then restore original code and resume */
+static void trapHandler(int signum, siginfo_t *info, void *context)
+{
+    ucontext_t *ucp = (ucontext_t *) context;
+    char *host_pc = (char *) ucp->uc_mcontext.gregs[REG_RIP] - 1;
+
+    trapValue = lookupInsnMap(trapMap, host_pc - trapCode);
+    *host_pc = trapSavedByte;
+    ucp->uc_mcontext.gregs[REG_RIP] = (greg_t) host_pc;
+}
+#endif
+
+static void mk_code(struct irInstructionAllocator *ir, int nb)
+{
+    static uint64_t out;
+    int i;
+
+    for(i = 0; i < nb; i++)
+        ir->add_store_64(ir, ir->add_mov_const_64(ir, 0xDEADBEEF00000000ULL + i), ir->add_mov_const_64(ir, (uint64_t) &out));
+}
+
+TEST_F(MarkerTest, emptyInsn) {
+    ir->add_insn_marker(ir, 0);
+    mk_code(ir, 1);
+    /* this one generates no code */
+    ir->add_insn_marker(ir, 4);
+    ir->add_insn_marker(ir, 8);
+    mk_code(ir, 1);
+    jitWithMap();
+
+    EXPECT_EQ(lookupInsnMap(mapBuffer, 0), 0);
+    EXPECT_EQ(lookupInsnMap(mapBuffer, jitSize - 1), 8);
+}
+
+TEST_F(MarkerTest, largeBlock) {
+    uint32_t prev = 0;
+    uint32_t value;
+    int seen = 0;
+    int i;
+
+    /* some insns generate more than 127 bytes of code */
+    for(i = 0; i < 16; i++) {
+        ir->add_insn_marker(ir, i * 4);
+        mk_code(ir, i % 12);
+    }
+    jitWithMap();
+
+    for(i = 0; i < jitSize; i++) {
+        value = lookupInsnMap(mapBuffer, i);
+        EXPECT_GE(value, prev);
+        if (value != prev || i == 0)
+            seen++;
+        prev = value;
+    }
+    /* all markers except the ones without code (0 and 12) */
+    EXPECT_EQ(seen, 14);
+    EXPECT_EQ(prev, 15 * 4);
+}
+
+#if defined(__x86_64__)
+TEST_F(MarkerTest, exitStubSignal) {
+    char mapBuffer[1024];
+    char *code;
+    char *stub = NULL;
+    struct sigaction sa;
+    struct sigaction old;
+    uint64_t values[2] = {0x100000010UL, 0x100000020UL};
+    uint32_t preds[2] = {1, 0};
+    int i;
+
+    code = (char *) mmap(NULL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(code, MAP_FAILED);
+    /* two conditional exits not in last guest instruction. Only first one is taken */
+    memcpy(contextBuffer, values, sizeof(values));
+    memcpy(contextBuffer + sizeof(values), preds, sizeof(preds));
+    ir->add_insn_marker(ir, 0);
+    ir->add_exit_cond(ir, ir->add_read_context_64(ir, 0), ir->add_read_context_32(ir, 16));
+    ir->add_insn_marker(ir, 4);
+    ir->add_exit_cond(ir, ir->add_read_context_64(ir, 8), ir->add_read_context_32(ir, 20));
+    ir->add_insn_marker(ir, 8);
+    mk_code(ir, 1);
+    ir->add_exit(ir, ir->add_mov_const_64(ir, 0));
+    jitSize = jitCode(handle, code, 4096);
+    ASSERT_GT(jitSize, 0);
+    jitInsnMap(handle, mapBuffer, sizeof(mapBuffer));
+
+    /* first jne rel32 is the one of the first exit */
+    for(i = 0; i < jitSize - 6; i++) {
+        if ((uint8_t) code[i] == 0x0f && (uint8_t) code[i + 1] == 0x85) {
+            int32_t rel;
+
+            memcpy(&rel, &code[i + 2], sizeof(rel));
+            stub = &code[i + 6 + rel];
+            break;
+        }
+    }
+    ASSERT_TRUE(stub != NULL);
+    ASSERT_GE(stub - code, 0);
+    ASSERT_LT(stub - code, jitSize);
+    EXPECT_EQ(lookupInsnMap(mapBuffer, stub - code), 0);
+
+    /* now really take a signal inside stub */
+    trapCode = code;
+    trapMap = mapBuffer;
+    trapValue = ~0;
+    trapSavedByte = *stub;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = trapHandler;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGTRAP, &sa, &old);
+    *stub = (char) 0xcc;
+    EXPECT_EQ(backend->execute(backend, code, (uint64_t) contextBuffer).result, values[0]);
+    sigaction(SIGTRAP, &old, NULL);
+
+    EXPECT_EQ(trapValue, 0U);
+    munmap(code, 4096);
+}
+#endif
@@ -0,0 +1,166 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+
+#include "jitterFixture.h"
+
+class RegAllocTest : public jitterFixture {
+};
+
+/* more values than available host registers are kept live so some of them are spilled */
+#define LIVE_NB     24
+
+extern "C" uint64_t regalloc_sum_helper(uint64_t context, uint64_t p0, uint64_t p1, uint64_t p2, uint64_t p3)
+{
+    return p0 + p1 + p2 + p3;
+}
+
+static void setupContext(char *contextBuffer)
+{
+    uint64_t *values = (uint64_t *) contextBuffer;
+    int i;
+
+    for(i = 0; i < LIVE_NB; i++)
+        values[i] = 0x0101010101010101UL * (i + 1);
+}
+
+TEST_F(RegAllocTest, add64) {
+    struct irRegister *values[LIVE_NB];
+    struct irRegister *res;
+    uint64_t out = 0;
+    uint64_t expected = 0;
+    int i;
+
+    setupContext(contextBuffer);
+    for(i = 0; i < LIVE_NB; i++) {
+        values[i] = ir->add_read_context_64(ir, i * 8);
+        expected += 0x0101010101010101UL * (i + 1);
+    }
+    res = values[LIVE_NB - 1];
+    for(i = LIVE_NB - 2; i >= 0; i--)
+        res = ir->add_add_64(ir, res, values[i]);
+    ir->add_store_64(ir, res, ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(expected, out);
+}
+
+TEST_F(RegAllocTest, shl32) {
+    struct irRegister *values[LIVE_NB];
+    struct irRegister *res;
+    uint32_t out = 0;
+    uint32_t expected = 0;
+    int i;
+
+    setupContext(contextBuffer);
+    for(i = 0; i < LIVE_NB; i++)
+        values[i] = ir->add_read_context_32(ir, i * 8);
+    res = ir->add_mov_const_32(ir, 0);
+    for(i = LIVE_NB - 1; i >= 0; i--) {
+        res = ir->add_xor_32(ir, res, ir->add_shl_32(ir, values[i], ir->add_32_to_8(ir, values[LIVE_NB - 1 - i])));
+        expected ^= (0x01010101U * (i + 1)) << ((0x01010101U * (LIVE_NB - i)) & 0xff);
+    }
+    ir->add_store_32(ir, res, ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(expected, out);
+}
+
+TEST_F(RegAllocTest, ite64) {
+    struct irRegister *values[LIVE_NB];
+    struct irRegister *res;
+    uint64_t out = 0;
+    uint64_t expected = 0;
+    int i;
+
+    setupContext(contextBuffer);
+    for(i = 0; i < LIVE_NB; i++)
+        values[i] = ir->add_read_context_64(ir, i * 8);
+    res = ir->add_mov_const_64(ir, 0);
+    for(i = 0; i < LIVE_NB - 2; i++) {
+        struct irRegister *pred = ir->add_cmpeq_64(ir, values[i], values[i + 1]);
+
+        res = ir->add_add_64(ir, res, ir->add_ite_64(ir, pred, values[i], values[i + 2]));
+        expected += 0x0101010101010101UL * (i + 3);
+    }
+    ir->add_store_64(ir, res, ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(expected, out);
+}
+
+TEST_F(RegAllocTest, call) {
+    struct irRegister *values[LIVE_NB];
+    struct irRegister *param[4];
+    struct irRegister *res;
+    uint64_t out = 0;
+    uint64_t expected = 0;
+    int i;
+
+    setupContext(contextBuffer);
+    for(i = 0; i < LIVE_NB; i++) {
+        values[i] = ir->add_read_context_64(ir, i * 8);
+        expected += 0x0101010101010101UL * (i + 1);
+    }
+    res = ir->add_mov_const_64(ir, 0);
+    for(i = 0; i < LIVE_NB; i += 4) {
+        param[0] = values[i];
+        param[1] = values[i + 1];
+        param[2] = values[i + 2];
+        param[3] = values[i + 3];
+        res = ir->add_add_64(ir, res, ir->add_call_64(ir, (char *) "regalloc_sum_helper",
+                                                      ir->add_mov_const_64(ir, (uint64_t) regalloc_sum_helper),
+                                                      param));
+    }
+    ir->add_store_64(ir, res, ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(expected, out);
+}
+
+TEST_F(RegAllocTest, atomic32) {
+    struct irRegister *values[LIVE_NB];
+    struct irRegister *res;
+    uint32_t mem = 0;
+    uint32_t out = 0;
+    uint32_t expected = 0;
+    uint32_t expected_mem = 0;
+    int i;
+
+    setupContext(contextBuffer);
+    for(i = 0; i < LIVE_NB; i++)
+        values[i] = ir->add_read_context_32(ir, i * 8);
+    res = ir->add_mov_const_32(ir, 0);
+    for(i = LIVE_NB - 1; i >= 0; i--) {
+        res = ir->add_add_32(ir, res, ir->add_fetch_add_32(ir, ir->add_mov_const_64(ir, (uint64_t) &mem), values[i]));
+        expected += expected_mem;
+        expected_mem += 0x01010101U * (i + 1);
+    }
+    ir->add_store_32(ir, res, ir->add_mov_const_64(ir, (uint64_t) &out));
+    jitAndExcecute();
+
+    EXPECT_EQ(expected_mem, mem);
+    EXPECT_EQ(expected, out);
+}
@@ -0,0 +1,131 @@
+/* This file is part of Umeq, an equivalent of qemu user mode emulation with improved robustness.
+ *
+ * Copyright (C) 2015 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "gtest/gtest.h"
+#include "jitter.h"
+
+#include "jitterFixture.h"
+
+class ReplayTest : public jitterFixture {
+};
+
+#define LIVE_NB     24
+
+extern "C" uint32_t replay_helper(uint64_t context, uint32_t p0)
+{
+    return p0 + 1;
+}
+
+/* use most instruction kinds so encoding of each of them is exercised */
+static void buildBlock(struct irInstructionAllocator *ir, uint64_t *out)
+{
+    struct irRegister *param[4] = {NULL, NULL, NULL, NULL};
+    struct irRegister *v64 = ir->add_read_context_64(ir, 0);
+    struct irRegister *v32 = ir->add_read_context_32(ir, 8);
+    struct irRegister *address = ir->add_mov_const_64(ir, (uint64_t) out);
+    struct irRegister *pred;
+    struct irRegister *res;
+
+    ir->add_insn_marker(ir, 0x1000);
+    res = ir->add_add_64(ir, v64, ir->add_32U_to_64(ir, v32));
+    res = ir->add_shl_64(ir, res, ir->add_mov_const_8(ir, 4));
+    res = ir->add_xor_64(ir, res, ir->add_mov_const_64(ir, 0xffffffff00000000UL));
+    ir->add_insn_marker(ir, 0x1004);
+    pred = ir->add_cmpeq_32(ir, v32, ir->add_mov_const_32(ir, 7));
+    v32 = ir->add_ite_32(ir, pred, ir->add_mov_const_32(ir, 1), ir->add_mov_const_32(ir, -12));
+    param[0] = v32;
+    v32 = ir->add_call_32(ir, (char *) "replay_helper", ir->add_mov_const_64(ir, (uint64_t) replay_helper), param);
+    ir->add_write_context_32(ir, v32, 16);
+    ir->add_insn_marker(ir, 0x1008);
+    ir->add_store_64(ir, res, address);
+    ir->add_fetch_add_32(ir, ir->add_add_64(ir, address, ir->add_mov_const_64(ir, 8)), ir->add_load_32(ir, address));
+    ir->add_exit_cond(ir, ir->add_mov_const_64(ir, 0x2000), ir->add_cmpne_64(ir, res, v64));
+}
+
+TEST_F(ReplayTest, roundtrip) {
+    uint64_t out[2];
+    char *serialized;
+    char *reserialized;
+    char jitBuffer[4096];
+    char code[4096];
+    int codeSize;
+    int size;
+
+    buildBlock(ir, out);
+    ir->add_exit(ir, ir->add_mov_const_64(ir, 0));
+    size = serializeIr(handle, NULL, 0);
+    serialized = (char *) alloca(size);
+    reserialized = (char *) alloca(size);
+    ASSERT_EQ(size, serializeIr(handle, serialized, size));
+    codeSize = jitCode(handle, jitBuffer, sizeof(jitBuffer));
+    memcpy(code, jitBuffer, codeSize);
+
+    resetJitter(handle);
+    deserializeIr(handle, serialized, size);
+    ASSERT_EQ(size, serializeIr(handle, reserialized, size));
+    EXPECT_EQ(0, memcmp(serialized, reserialized, size));
+    ASSERT_EQ(codeSize, jitCode(handle, jitBuffer, sizeof(jitBuffer)));
+    EXPECT_EQ(0, memcmp(code, jitBuffer, codeSize));
+}
+
+TEST_F(ReplayTest, execute) {
+    uint64_t *context = (uint64_t *) contextBuffer;
+    uint64_t out[2] = {0, 3};
+    char buffer[1024];
+    int size;
+
+    context[0] = 0x10;
+    context[1] = 7;
+    buildBlock(ir, out);
+    size = serializeIr(handle, buffer, sizeof(buffer));
+    resetJitter(handle);
+    deserializeIr(handle, buffer, size);
+    EXPECT_EQ(0x2000UL, jitAndExcecute());
+
+    EXPECT_EQ(((0x17UL << 4) ^ 0xffffffff00000000UL), out[0]);
+    EXPECT_EQ(3 + (uint32_t) out[0], out[1]);
+    EXPECT_EQ(2U, *(uint32_t *) &contextBuffer[16]);
+}
+
+TEST_F(ReplayTest, stats) {
+    struct irRegister *values[LIVE_NB];
+    struct irRegister *res;
+    struct jit_stats stats;
+    char jitBuffer[4096];
+    int i;
+
+    backend->stats = &stats;
+    for(i = 0; i < LIVE_NB; i++)
+        values[i] = ir->add_read_context_64(ir, i * 8);
+    res = values[LIVE_NB - 1];
+    for(i = LIVE_NB - 2; i >= 0; i--)
+        res = ir->add_add_64(ir, res, values[i]);
+    ir->add_write_context_64(ir, res, 0);
+    ir->add_exit(ir, ir->add_mov_const_64(ir, 0));
+    EXPECT_GT(jitCode(handle, jitBuffer, sizeof(jitBuffer)), 0);
+    backend->stats = NULL;
+
+    EXPECT_GE(stats.max_live, LIVE_NB);
+    EXPECT_GT(stats.spill_nb, 0);
+}